@@ -0,0 +1,598 @@
+#include "audio_output.h"
+#include "synth_engine.h"
+#include "wav_file.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <alsa/asoundlib.h>
+
+#define ALSA_POLL_TIMEOUT_MS    1000    // これだけ待っても空かなければデバイスが止まっているとみなす
+
+size_t audio_sample_bytes(AudioSampleFormat format) {
+    switch (format) {
+    case AUDIO_FORMAT_S16_LE:
+        return 2;
+    case AUDIO_FORMAT_S24_3LE:
+        return 3;
+    case AUDIO_FORMAT_S32_LE:
+    case AUDIO_FORMAT_FLOAT_LE:
+        return 4;
+    }
+    return 0;
+}
+
+void audio_samples_to_float(AudioSampleFormat format, const void *src, float *dst, size_t n) {
+    const uint8_t *p = (const uint8_t *)src;
+    for (size_t i = 0; i < n; ++i) {
+        switch (format) {
+        case AUDIO_FORMAT_S16_LE:
+            dst[i] = (float)(int16_t)(p[2 * i] | (p[2 * i + 1] << 8)) / 32768.0f;
+            break;
+        case AUDIO_FORMAT_S24_3LE: {
+            int32_t v = (int32_t)((uint32_t)p[3 * i] << 8 | (uint32_t)p[3 * i + 1] << 16 | (uint32_t)p[3 * i + 2] << 24);
+            dst[i] = (float)(v >> 8) / 8388608.0f;
+            break;
+        }
+        case AUDIO_FORMAT_S32_LE: {
+            int32_t v = (int32_t)((uint32_t)p[4 * i] | (uint32_t)p[4 * i + 1] << 8 | (uint32_t)p[4 * i + 2] << 16 | (uint32_t)p[4 * i + 3] << 24);
+            dst[i] = (float)((double)v / 2147483648.0);
+            break;
+        }
+        case AUDIO_FORMAT_FLOAT_LE:
+            memcpy(&dst[i], p + 4 * i, 4);
+            break;
+        }
+    }
+}
+
+// -1.0 ~ 1.0 を scale 倍して整数にする (範囲外は飽和させる)
+static int32_t float_to_int(float v, double scale) {
+    double x = (double)v * scale;
+    if (x >= scale - 1.0) {
+        return (int32_t)(scale - 1.0);
+    }
+    if (x <= -scale) {
+        return (int32_t)-scale;
+    }
+    return (int32_t)lrint(x);
+}
+
+void audio_samples_from_float(AudioSampleFormat format, const float *src, void *dst, size_t n) {
+    uint8_t *p = (uint8_t *)dst;
+    for (size_t i = 0; i < n; ++i) {
+        switch (format) {
+        case AUDIO_FORMAT_S16_LE: {
+            int32_t v = float_to_int(src[i], 32768.0);
+            p[2 * i] = (uint8_t)v;
+            p[2 * i + 1] = (uint8_t)(v >> 8);
+            break;
+        }
+        case AUDIO_FORMAT_S24_3LE: {
+            int32_t v = float_to_int(src[i], 8388608.0);
+            p[3 * i] = (uint8_t)v;
+            p[3 * i + 1] = (uint8_t)(v >> 8);
+            p[3 * i + 2] = (uint8_t)(v >> 16);
+            break;
+        }
+        case AUDIO_FORMAT_S32_LE: {
+            int32_t v = float_to_int(src[i], 2147483648.0);
+            for (int b = 0; b < 4; ++b) {
+                p[4 * i + b] = (uint8_t)((uint32_t)v >> (8 * b));
+            }
+            break;
+        }
+        case AUDIO_FORMAT_FLOAT_LE:
+            memcpy(p + 4 * i, &src[i], 4);
+            break;
+        }
+    }
+}
+
+// 途中まで書けなかった場合も含めて全部書き込む
+static int write_all(int fd, const void *buf, size_t size) {
+    const uint8_t *p = (const uint8_t *)buf;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+// 出力ファイルを開く (NULL か "-" なら標準出力)
+// 標準出力に出すときは、printf のメッセージが波形に混ざらないように
+// 元の標準出力を波形専用にし、以降の標準出力は標準エラーへ回す
+static int open_output_file(AudioOutput *out, const char *path) {
+    if (!path || strcmp(path, "-") == 0) {
+        fflush(stdout);
+        out->fd = dup(STDOUT_FILENO);
+        if (out->fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            fprintf(stderr, "標準出力を波形の出力に使えません\n");
+            return -1;
+        }
+        out->seekable = 0;
+        return 0;
+    }
+    out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out->fd < 0) {
+        fprintf(stderr, "出力ファイルを開けません: %s\n", path);
+        return -1;
+    }
+    out->seekable = 1;
+    return 0;
+}
+
+static void close_output_file(AudioOutput *out) {
+    close(out->fd);
+}
+
+static void do_nothing(AudioOutput *out) {
+    (void)out;
+}
+
+// --- ALSA ---
+
+static snd_pcm_format_t alsa_format(AudioSampleFormat format) {
+    switch (format) {
+    case AUDIO_FORMAT_S24_3LE:
+        return SND_PCM_FORMAT_S24_3LE;
+    case AUDIO_FORMAT_S32_LE:
+        return SND_PCM_FORMAT_S32_LE;
+    case AUDIO_FORMAT_FLOAT_LE:
+        return SND_PCM_FORMAT_FLOAT_LE;
+    default:
+        return SND_PCM_FORMAT_S16_LE;
+    }
+}
+
+// PCMデバイスを再生用に非ブロッキングで開き、out->period_frames / buffer_frames に近いピリオドとバッファを設定する
+static int alsa_open(AudioOutput *out, const char *target) {
+    snd_pcm_t *handle;
+    snd_pcm_hw_params_t *params;
+    snd_pcm_sw_params_t *sw_params;
+    int err;
+
+    // "default" は標準の出力デバイスを意味する
+    if ((err = snd_pcm_open(&handle, target ? target : "default", SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK)) < 0) {
+        fprintf(stderr, "PCMデバイスを開けません: %s\n", snd_strerror(err));
+        return -1;
+    }
+
+    // ハードウェアパラメータ構造体を確保し、デバイスの現在のパラメータを取得
+    snd_pcm_hw_params_alloca(&params);
+    snd_pcm_hw_params_any(handle, params);
+
+    // パラメータを設定 (ミキサーはこの形式・チャンネル数で書くので、デバイスが対応していなければ開かない)
+    if ((err = snd_pcm_hw_params_set_access(handle, params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) { // アクセスタイプ: インターリーブ
+        fprintf(stderr, "インターリーブのアクセスを設定できません: %s\n", snd_strerror(err));
+        snd_pcm_close(handle);
+        return -1;
+    }
+    if ((err = snd_pcm_hw_params_set_format(handle, params, alsa_format(out->format))) < 0) { // サンプルの形式
+        fprintf(stderr, "サンプルの形式 (%s) を設定できません: %s\n",
+                snd_pcm_format_name(alsa_format(out->format)), snd_strerror(err));
+        snd_pcm_close(handle);
+        return -1;
+    }
+    if ((err = snd_pcm_hw_params_set_channels(handle, params, (unsigned int)out->channels)) < 0) { // チャンネル数
+        fprintf(stderr, "チャンネル数 (%d) を設定できません: %s\n", out->channels, snd_strerror(err));
+        snd_pcm_close(handle);
+        return -1;
+    }
+    // サンプリングレート (plugでの変換はせず、デバイスが対応している一番近いレートにする)
+    unsigned int rate = (unsigned int)out->sample_rate;
+    snd_pcm_hw_params_set_rate_resample(handle, params, 0);
+    snd_pcm_hw_params_set_rate_near(handle, params, &rate, 0);
+    // バッファサイズとピリオドサイズ (指定した遅延に近いものをデバイスに選んでもらう)
+    // (レートが変わった場合は、同じ時間になるフレーム数にする)
+    snd_pcm_uframes_t buffer_size = (snd_pcm_uframes_t)((uint64_t)out->buffer_frames * rate / (uint64_t)out->sample_rate);
+    snd_pcm_uframes_t period_size = (snd_pcm_uframes_t)((uint64_t)out->period_frames * rate / (uint64_t)out->sample_rate);
+    snd_pcm_hw_params_set_buffer_size_near(handle, params, &buffer_size);
+    snd_pcm_hw_params_set_period_size_near(handle, params, &period_size, 0);
+
+    // 設定したパラメータをデバイスに書き込む
+    if ((err = snd_pcm_hw_params(handle, params)) < 0) {
+        fprintf(stderr, "ハードウェアパラメータを設定できません: %s\n", snd_strerror(err));
+        snd_pcm_close(handle);
+        return -1;
+    }
+    snd_pcm_hw_params_get_buffer_size(params, &buffer_size);
+    snd_pcm_hw_params_get_period_size(params, &period_size, 0);
+    snd_pcm_hw_params_get_rate(params, &rate, 0);
+
+    // ピリオド単位でバッファが埋まったら鳴らし始め、1ピリオド空くごとに起こしてもらう
+    snd_pcm_sw_params_alloca(&sw_params);
+    snd_pcm_sw_params_current(handle, sw_params);
+    snd_pcm_sw_params_set_start_threshold(handle, sw_params, buffer_size / period_size * period_size);
+    snd_pcm_sw_params_set_avail_min(handle, sw_params, period_size);
+    if ((err = snd_pcm_sw_params(handle, sw_params)) < 0) {
+        fprintf(stderr, "ソフトウェアパラメータを設定できません: %s\n", snd_strerror(err));
+        snd_pcm_close(handle);
+        return -1;
+    }
+
+    // 空きを待つためのファイル記述子 (再生中にメモリを確保しないように、ここで用意する)
+    int count = snd_pcm_poll_descriptors_count(handle);
+    out->pollfds = count > 0 ? (struct pollfd *)calloc((size_t)count, sizeof(struct pollfd)) : NULL;
+    if (!out->pollfds || snd_pcm_poll_descriptors(handle, out->pollfds, (unsigned int)count) != count) {
+        fprintf(stderr, "PCMデバイスの待ち合わせを用意できません\n");
+        free(out->pollfds);
+        out->pollfds = NULL;
+        snd_pcm_close(handle);
+        return -1;
+    }
+    out->num_pollfds = count;
+    out->buffer_frames = buffer_size;
+    out->period_frames = period_size;
+    out->sample_rate = (int)rate;
+    out->pcm = handle;
+    return 0;
+}
+
+// アンダーラン (-EPIPE) やサスペンドから回復する
+static int alsa_recover(AudioOutput *out, int err) {
+    if (err == -EPIPE) {
+        out->underruns++;
+    }
+    if (snd_pcm_recover((snd_pcm_t *)out->pcm, err, 1) < 0) {
+        fprintf(stderr, "PCMデバイスへの書き込みに失敗しました: %s\n", snd_strerror(err));
+        return -1;
+    }
+    out->recoveries++;
+    return 0;
+}
+
+// 1ピリオド以上空くまでpollで待つ
+static long alsa_wait(AudioOutput *out) {
+    snd_pcm_t *handle = (snd_pcm_t *)out->pcm;
+    for (;;) {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(handle);
+        if (avail < 0) {
+            if (alsa_recover(out, (int)avail) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        if ((size_t)avail >= out->period_frames) {
+            return (long)(avail < (snd_pcm_sframes_t)out->buffer_frames ? avail : (snd_pcm_sframes_t)out->buffer_frames);
+        }
+        // 鳴らし始める前にバッファが埋まっていれば、待っていても空かないので始める
+        if (snd_pcm_state(handle) == SND_PCM_STATE_PREPARED) {
+            snd_pcm_start(handle);
+        }
+        int ready = poll(out->pollfds, (nfds_t)out->num_pollfds, ALSA_POLL_TIMEOUT_MS);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (ready == 0) {
+            fprintf(stderr, "PCMデバイスが応答しません\n");
+            return -1;
+        }
+        // 起きた理由がエラーなら、次の snd_pcm_avail_update が返すエラーで回復する
+        unsigned short revents = 0;
+        snd_pcm_poll_descriptors_revents(handle, out->pollfds, (unsigned int)out->num_pollfds, &revents);
+    }
+}
+
+// 途中までしか書けなかった場合は空くのを待って残りを書き直し、アンダーランは回復を試みる
+static int alsa_write(AudioOutput *out, const void *frames, size_t n) {
+    snd_pcm_t *handle = (snd_pcm_t *)out->pcm;
+    const uint8_t *p = (const uint8_t *)frames;
+    while (n > 0) {
+        snd_pcm_sframes_t written = snd_pcm_writei(handle, p, n);
+        if (written == -EAGAIN) {
+            if (alsa_wait(out) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (written < 0) {
+            if (alsa_recover(out, (int)written) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        p += (size_t)written * out->frame_bytes;
+        n -= (size_t)written;
+    }
+    return 0;
+}
+
+// 止めた後は、次の再生のためにデバイスを準備状態へ戻しておく
+static void alsa_drop(AudioOutput *out) {
+    snd_pcm_drop((snd_pcm_t *)out->pcm);
+    snd_pcm_prepare((snd_pcm_t *)out->pcm);
+}
+
+// 非ブロッキングのままでは snd_pcm_drain がすぐに戻ってしまうので、出し切る間だけブロッキングにする
+static void alsa_drain(AudioOutput *out) {
+    snd_pcm_t *handle = (snd_pcm_t *)out->pcm;
+    snd_pcm_nonblock(handle, 0);
+    snd_pcm_drain(handle);
+    snd_pcm_nonblock(handle, 1);
+    snd_pcm_prepare(handle);
+}
+
+static int alsa_status(AudioOutput *out, long *delay, long *avail) {
+    snd_pcm_sframes_t d, a;
+    if (snd_pcm_avail_delay((snd_pcm_t *)out->pcm, &a, &d) < 0) {
+        return -1;
+    }
+    *delay = (long)d;
+    *avail = (long)a;
+    return 0;
+}
+
+static void alsa_close(AudioOutput *out) {
+    snd_pcm_close((snd_pcm_t *)out->pcm);
+    free(out->pollfds);
+    out->pollfds = NULL;
+}
+
+// --- WAVファイル ---
+// 先に長さ0のヘッダを書いておき、閉じるときに実際の長さで書き直す
+
+static void wav_write_header(AudioOutput *out, uint32_t data_bytes) {
+    uint8_t header[WAV_HEADER_SIZE];
+    int tag = (out->format == AUDIO_FORMAT_FLOAT_LE) ? WAV_FORMAT_IEEE_FLOAT : WAV_FORMAT_PCM;
+    int bits = (int)audio_sample_bytes(out->format) * 8;
+    wav_build_header(header, tag, out->channels, out->sample_rate, bits, data_bytes);
+    if (write_all(out->fd, header, sizeof(header)) != 0) {
+        fprintf(stderr, "WAVヘッダを書き込めません\n");
+    }
+}
+
+static int wav_open(AudioOutput *out, const char *target) {
+    if (open_output_file(out, target) != 0) {
+        return -1;
+    }
+    // 標準出力 (パイプ) では後から長さを書き直せないので、最大の長さにしておく
+    wav_write_header(out, out->seekable ? 0 : WAV_MAX_DATA_BYTES);
+    return 0;
+}
+
+static int raw_write(AudioOutput *out, const void *frames, size_t n) {
+    return write_all(out->fd, frames, n * out->frame_bytes);
+}
+
+static void wav_close(AudioOutput *out) {
+    uint64_t data_bytes = out->frames_written * out->frame_bytes;
+    if (data_bytes > WAV_MAX_DATA_BYTES) {
+        data_bytes = WAV_MAX_DATA_BYTES;
+    }
+    if (out->seekable && lseek(out->fd, 0, SEEK_SET) == 0) {
+        wav_write_header(out, (uint32_t)data_bytes);
+    }
+    close_output_file(out);
+}
+
+// --- ヘッダなしのPCM ---
+
+static int raw_open(AudioOutput *out, const char *target) {
+    return open_output_file(out, target);
+}
+
+// --- nullシンク ---
+// 受け取ったフレームは捨てる。realtime なら、buffer_frames のリングバッファを持つデバイスと同じように、
+// サンプリングレートどおりの時刻にバッファが空くまで待ってから受け取る (書き込みが間に合わなければアンダーランとして数える)
+
+static double elapsed_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// 書き込みを始めてから frame フレーム目を鳴らし終わる時刻まで待つ
+static void null_wait_until(AudioOutput *out, uint64_t frame) {
+    struct timespec deadline = out->started;
+    deadline.tv_sec += (time_t)(frame / (uint64_t)out->sample_rate);
+    deadline.tv_nsec += (long)((frame % (uint64_t)out->sample_rate) * 1000000000ULL / (uint64_t)out->sample_rate);
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+    }
+}
+
+static int null_open(AudioOutput *out, const char *target) {
+    if (target && strcmp(target, "realtime") != 0) {
+        fprintf(stderr, "nullシンクの指定が不明です: %s\n", target);
+        return -1;
+    }
+    out->realtime = target != NULL;
+    return 0;
+}
+
+static int null_status(AudioOutput *out, long *delay, long *avail);
+
+// 書き込みを始めてから受け取ったフレーム数
+// 送ったフレームを鳴らし終わっていれば、デバイスならアンダーランになっている
+// 実際のデバイスを回復させたときと同じく、ここから数え直す
+static uint64_t null_queued(AudioOutput *out) {
+    uint64_t queued = out->frames_written - out->started_frame;
+    if (queued > 0 && elapsed_since(&out->started) * out->sample_rate > (double)queued) {
+        out->underruns++;
+        out->recoveries++;
+        clock_gettime(CLOCK_MONOTONIC, &out->started);
+        out->started_frame = out->frames_written;
+        queued = 0;
+    }
+    return queued;
+}
+
+static int null_write(AudioOutput *out, const void *frames, size_t n) {
+    (void)frames;
+    if (out->realtime) {
+        // 今回のフレームが入るだけリングバッファが空くまで待つ
+        uint64_t queued = null_queued(out);
+        if (queued + n > out->buffer_frames) {
+            null_wait_until(out, queued + n - out->buffer_frames);
+        }
+    }
+    return 0;
+}
+
+// realtime なら1ピリオド空くまで待つ (書き込みを始める前はバッファ全体が空いている)
+static long null_wait(AudioOutput *out) {
+    long delay, avail;
+    if (!out->realtime) {
+        return (long)out->period_frames;
+    }
+    if (!out->clock_running) {
+        return (long)out->buffer_frames;
+    }
+    uint64_t queued = null_queued(out);
+    if (queued + out->period_frames > out->buffer_frames) {
+        null_wait_until(out, queued + out->period_frames - out->buffer_frames);
+    }
+    null_status(out, &delay, &avail);
+    return avail;
+}
+
+static void null_drain(AudioOutput *out) {
+    if (out->realtime && out->clock_running) {
+        null_wait_until(out, out->frames_written - out->started_frame);
+    }
+}
+
+// realtime なら、受け取ったのにまだ鳴っていないフレーム数を時刻から計算する
+static int null_status(AudioOutput *out, long *delay, long *avail) {
+    if (!out->realtime) {
+        return -1;
+    }
+    double played = out->clock_running ? elapsed_since(&out->started) * out->sample_rate : 0.0;
+    double pending = (double)(out->frames_written - out->started_frame) - played;
+    long ring = (long)out->buffer_frames;
+    *delay = pending > 0 ? (long)pending : 0;
+    *avail = *delay < ring ? ring - *delay : 0;
+    return 0;
+}
+
+// 最後に書き込みを始めてからの分を報告する
+static void null_close(AudioOutput *out) {
+    uint64_t frames = out->frames_written - out->started_frame;
+    double seconds = frames > 0 ? elapsed_since(&out->started) : 0.0;
+    double audio_seconds = (double)frames / out->sample_rate;
+    fprintf(stderr, "nullシンク: %llu フレーム (%f 秒分) を %f 秒で受け取りました (実時間の %.1f 倍)\n",
+            (unsigned long long)frames, audio_seconds, seconds,
+            seconds > 0 ? audio_seconds / seconds : 0.0);
+}
+
+static const AudioOutputBackend backends[] = {
+    {"alsa", alsa_open, alsa_write, alsa_drop, alsa_drain, alsa_close, alsa_status, alsa_wait},
+    {"wav", wav_open, raw_write, do_nothing, do_nothing, wav_close, NULL, NULL},
+    {"raw", raw_open, raw_write, do_nothing, do_nothing, close_output_file, NULL, NULL},
+    {"null", null_open, null_write, do_nothing, null_drain, null_close, null_status, null_wait},
+};
+
+#define NUM_BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+size_t audio_output_backend_count(void) {
+    return NUM_BACKENDS;
+}
+
+const AudioOutputBackend *audio_output_backend(size_t i) {
+    return i < NUM_BACKENDS ? &backends[i] : NULL;
+}
+
+int audio_output_open(AudioOutput *out, const char *spec, AudioSampleFormat format, int channels, int sample_rate,
+                      unsigned int latency_us) {
+    memset(out, 0, sizeof(*out));
+    out->fd = -1;
+    out->format = format;
+    out->channels = channels;
+    out->sample_rate = sample_rate;
+    out->frame_bytes = audio_sample_bytes(format) * (size_t)channels;
+
+    // 遅延からバッファの大きさを決め、RING_PERIODS 個のピリオドに分ける (ALSAは開くときにデバイスと決め直す)
+    if (latency_us == 0) {
+        out->buffer_frames = PERIOD_FRAMES * RING_PERIODS;
+    } else {
+        if (latency_us < AUDIO_LATENCY_MIN_US) {
+            latency_us = AUDIO_LATENCY_MIN_US;
+        } else if (latency_us > AUDIO_LATENCY_MAX_US) {
+            latency_us = AUDIO_LATENCY_MAX_US;
+        }
+        out->buffer_frames = (size_t)((uint64_t)latency_us * (uint64_t)sample_rate / 1000000);
+    }
+    out->period_frames = out->buffer_frames / RING_PERIODS;
+    if (out->period_frames == 0) {
+        out->period_frames = 1;
+    }
+
+    // "種類:対象" に分ける
+    const char *colon = strchr(spec, ':');
+    size_t name_len = colon ? (size_t)(colon - spec) : strlen(spec);
+    const char *target = colon ? colon + 1 : NULL;
+    for (size_t i = 0; i < NUM_BACKENDS; ++i) {
+        if (strlen(backends[i].name) == name_len && strncmp(backends[i].name, spec, name_len) == 0) {
+            if (backends[i].open(out, target) != 0) {
+                return -1;
+            }
+            out->backend = &backends[i];
+            out->latency_us = (unsigned int)((uint64_t)out->buffer_frames * 1000000 / (uint64_t)out->sample_rate);
+            return 0;
+        }
+    }
+    fprintf(stderr, "出力先の種類が不明です: %s (alsa / wav / raw / null)\n", spec);
+    return -1;
+}
+
+int audio_output_write(AudioOutput *out, const void *frames, size_t n) {
+    if (!out->clock_running) {
+        clock_gettime(CLOCK_MONOTONIC, &out->started);
+        out->started_frame = out->frames_written;
+        out->clock_running = 1;
+    }
+    if (out->backend->write(out, frames, n) != 0) {
+        return -1;
+    }
+    out->frames_written += n;
+    return 0;
+}
+
+long audio_output_wait(AudioOutput *out) {
+    if (!out->backend->wait) {
+        return (long)out->period_frames;
+    }
+    return out->backend->wait(out);
+}
+
+int audio_output_status(AudioOutput *out, long *delay, long *avail) {
+    if (!out->backend || !out->backend->status) {
+        return -1;
+    }
+    return out->backend->status(out, delay, avail);
+}
+
+void audio_output_drop(AudioOutput *out) {
+    out->backend->drop(out);
+    out->clock_running = 0;
+}
+
+void audio_output_drain(AudioOutput *out) {
+    out->backend->drain(out);
+    out->clock_running = 0;
+}
+
+void audio_output_close(AudioOutput *out) {
+    if (out->backend) {
+        out->backend->close(out);
+        out->backend = NULL;
+    }
+}
@@ -0,0 +1,132 @@
+#ifndef AUDIO_OUTPUT_H
+#define AUDIO_OUTPUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 音声の出力先
+// 生成した波形の送り先を「出力先の指定文字列」で切り替えられるようにする
+//   alsa[:デバイス名]   ALSAのPCMデバイス (既定は "default")
+//   wav:ファイル名      WAVファイル ("-" なら標準出力)
+//   raw[:ファイル名]    ヘッダなしのPCMデータ (既定は標準出力。aplay などへパイプで渡せる)
+//   null[:realtime]     どこにも出さず、受け取ったフレーム数と時間だけ数える
+//                       (realtime を付けると実際のデバイスと同じ速さで受け取り、間に合わなければアンダーランとして数える)
+// サウンドカードのないマシンでも、alsa 以外を使えばそのまま生成・計測ができる
+//
+// 出力先のバッファの大きさは、開くときに指定した遅延 (latency_us) から決める
+// ALSAではバッファを RING_PERIODS 個のピリオドに分けてデバイスと交渉し、デバイスは非ブロッキングで開く
+// 鳴らす側は audio_output_wait で書き込めるようになるまで待ち (ALSAなら snd_pcm_poll_descriptors をpollする)、
+// 返ってきたフレーム数だけ生成して書き込む。遅延を短くするとCPUの負荷が増え、長くすると減る
+
+#define AUDIO_LATENCY_MIN_US    5000        // 指定できる遅延の範囲 (5ms ~ 100ms)
+#define AUDIO_LATENCY_MAX_US    100000
+#define AUDIO_SAMPLE_RATE_MIN   8000        // 指定できるサンプリングレートの範囲 (8kHz ~ 384kHz)
+#define AUDIO_SAMPLE_RATE_MAX   384000
+
+// サンプルの形式 (どれもリトルエンディアン)
+typedef enum {
+    AUDIO_FORMAT_S16_LE,    // 16bit整数
+    AUDIO_FORMAT_S24_3LE,   // 24bit整数 (3バイト詰め)
+    AUDIO_FORMAT_S32_LE,    // 32bit整数
+    AUDIO_FORMAT_FLOAT_LE,  // 32bit浮動小数点
+} AudioSampleFormat;
+
+struct AudioOutputBackend;
+struct pollfd;
+
+// 開いている出力先
+typedef struct {
+    const struct AudioOutputBackend *backend;
+    AudioSampleFormat format;
+    int channels;
+    int sample_rate;
+    size_t frame_bytes;         // 1フレームのバイト数
+
+    void *pcm;                  // alsa: snd_pcm_t
+    int fd;                     // wav/raw: 書き込み先
+    int seekable;               // wav: 閉じるときにヘッダを書き直せるか (標準出力なら0)
+    int realtime;               // null: デバイスと同じ速さで受け取るか
+    uint64_t frames_written;    // これまでに受け取ったフレーム数
+    int clock_running;          // 止めた後、まだ書き込んでいなければ0
+    struct timespec started;    // 書き込みを始めた時刻 (止めるたびに測り直す)
+    uint64_t started_frame;     // その時点の frames_written
+    uint64_t underruns;         // alsa/null: アンダーランの回数
+    uint64_t recoveries;        // alsa/null: アンダーランなどから回復して書き込みを続けた回数
+
+    unsigned int latency_us;    // バッファの大きさを時間にしたもの (デバイスと決めた値)
+    size_t period_frames;       // ピリオドの大きさ (audio_output_wait はこれだけ空くまで待つ)
+    size_t buffer_frames;       // バッファの大きさ
+    struct pollfd *pollfds;     // alsa: デバイスの空きを待つためのファイル記述子
+    int num_pollfds;
+} AudioOutput;
+
+// 出力先の種類ごとの処理
+typedef struct AudioOutputBackend {
+    const char *name;
+    // target は ':' の後ろ (なければNULL)。戻り値: 成功なら0, 失敗なら-1
+    int (*open)(AudioOutput *out, const char *target);
+    // n フレームを全部書き込む。戻り値: 成功なら0, 失敗なら-1
+    int (*write)(AudioOutput *out, const void *frames, size_t n);
+    // 送ったフレームを捨てて止める / 最後まで出し切る (どちらも後でまた書き込める)
+    void (*drop)(AudioOutput *out);
+    void (*drain)(AudioOutput *out);
+    void (*close)(AudioOutput *out);
+    // まだ鳴っていないフレーム数と書き込めるフレーム数を読む (読めない出力先はNULL)
+    // 戻り値: 成功なら0, 失敗なら-1
+    int (*status)(AudioOutput *out, long *delay, long *avail);
+    // 1ピリオド以上書き込めるようになるまで待ち、書き込めるフレーム数を返す (待つ必要がない出力先はNULL)
+    // 戻り値: 失敗なら-1
+    long (*wait)(AudioOutput *out);
+} AudioOutputBackend;
+
+// 使える出力先の一覧
+size_t audio_output_backend_count(void);
+const AudioOutputBackend *audio_output_backend(size_t i);
+
+// サンプル1つのバイト数
+size_t audio_sample_bytes(AudioSampleFormat format);
+
+// format のサンプル n 個を -1.0 ~ 1.0 の浮動小数点に変換する / 浮動小数点から format に変換する (範囲外は飽和させる)
+void audio_samples_to_float(AudioSampleFormat format, const void *src, float *dst, size_t n);
+void audio_samples_from_float(AudioSampleFormat format, const float *src, void *dst, size_t n);
+
+// spec ("種類[:対象]") の出力先を開く
+// latency_us はバッファの大きさ (AUDIO_LATENCY_MIN_US ~ AUDIO_LATENCY_MAX_US に収める)
+// 0なら PERIOD_FRAMES x RING_PERIODS フレーム。ALSAでは実際にデバイスと決まった値が latency_us などに入る
+// ALSAではレートの変換をplugに任せず、sample_rate に一番近いデバイスのレートで開いて out->sample_rate に入れる
+// (違うレートになったら、呼び出し側がそのレートで生成するか resampler で変換する)
+// 戻り値: 成功なら0, 失敗なら-1
+int audio_output_open(AudioOutput *out, const char *spec, AudioSampleFormat format, int channels, int sample_rate,
+                      unsigned int latency_us);
+
+// 1ピリオド以上書き込めるようになるまで待ち、待たずに書き込めるフレーム数を返す
+// アンダーランはこの中で回復させる (ファイルなど待つ必要のない出力先はすぐに1ピリオド分を返す)
+// 戻り値: 書き込めるフレーム数, 失敗なら-1
+long audio_output_wait(AudioOutput *out);
+
+// n フレームを書き込む (書き込めるまで待つ。途中までしか書けなかった分やアンダーランはこの中でやり直す)
+int audio_output_write(AudioOutput *out, const void *frames, size_t n);
+
+// デバイスの状態を読む (delay: まだ鳴っていないフレーム数, avail: 待たずに書き込めるフレーム数)
+// 戻り値: 成功なら0, 読めない出力先 (ファイルなど) なら-1
+int audio_output_status(AudioOutput *out, long *delay, long *avail);
+
+// 送ったフレームを捨ててすぐに止める
+void audio_output_drop(AudioOutput *out);
+
+// 送ったフレームを最後まで出し切る
+void audio_output_drain(AudioOutput *out);
+
+// 閉じる (WAVファイルはここでヘッダの長さを書き直す)
+void audio_output_close(AudioOutput *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // AUDIO_OUTPUT_H
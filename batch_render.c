@@ -0,0 +1,504 @@
+// 一括書き出し
+// MMLファイルとウェーブテーブルの全ての組み合わせを、再生せずにWAVファイルへ書き出す
+// 曲は1回だけ解析し、ウェーブテーブルも1回だけ読み込んで帯域制限し、全ての書き出しで共有する
+// 書き出しはそれぞれ sound_test -o と同じく休符やイベントの切れ目で区間に分け、全部の区間を
+// ワークスティーリングのスレッドプールで生成する (長い曲の区間も手の空いたスレッドが分担するので、
+// かかる時間は曲の長さの合計ではなくコア数で決まる)
+// ALSAは使わないので、サウンドカードのないマシンでも実行できる
+//
+// 使い方: batch_render [-j スレッド数] [-o 出力ディレクトリ] [-b 音色のディレクトリ] <ファイルかディレクトリ>...
+//   *.mml は曲、*.txt と *.wtx はウェーブテーブルとして扱う。ディレクトリを指定すると、その中のファイルを全部使う
+//   出力ファイルは <出力ディレクトリ>/<曲の名前>_<ウェーブテーブルの名前>.wav
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "bounce.h"
+#include "mml_parser.h"
+#include "osc_kernel.h"
+#include "wavetable.h"
+#include "wavetable_bank.h"
+
+#define SAMPLE_RATE     44100   // サンプリングレート (Hz)
+#define MAX_WORKERS     256     // スレッド数の上限
+#define DEFAULT_OUTPUT_DIR "."
+
+// 読み込んだ曲 (全ての書き出しで共有する)
+typedef struct {
+    char *path;
+    char *name;             // 拡張子を除いたファイル名 (出力ファイル名に使う)
+    MmlSong *song;
+} BatchSong;
+
+// 読み込んだウェーブテーブル (全ての書き出しで共有する)
+typedef struct {
+    char *path;
+    char *name;
+    Wavetable table;
+} BatchWavetable;
+
+// 曲 x ウェーブテーブルの1つの組み合わせの書き出し
+typedef struct {
+    BounceJob *job;
+    char *output;
+    atomic_size_t remaining;    // まだ生成していない区間の数 (0になったら書き出し完了)
+    atomic_int failed;
+} BatchRender;
+
+// 1つの仕事 (どの書き出しのどの区間か)
+typedef struct {
+    uint32_t render;
+    uint32_t segment;
+} BatchTask;
+
+// スレッドごとの仕事の列
+// 自分の仕事は末尾から取り (直前に積んだ曲の続きなのでキャッシュに残っている)、
+// 他のスレッドからは先頭から盗む。1つの仕事は1秒分以上の生成なので、列ごとのロックで十分
+typedef struct {
+    pthread_mutex_t lock;
+    BatchTask *tasks;
+    size_t head;            // 残りの仕事は tasks[head] ~ tasks[tail - 1]
+    size_t tail;
+    size_t capacity;
+    size_t executed;        // このスレッドが生成した区間の数
+    size_t stolen;          // そのうち他のスレッドの列から盗んだ数
+} WorkQueue;
+
+typedef struct {
+    BatchRender *renders;
+    WorkQueue *queues;
+    int num_workers;
+} BatchPool;
+
+typedef struct {
+    BatchPool *pool;
+    int index;
+} BatchWorker;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int has_extension(const char *path, const char *ext) {
+    size_t len = strlen(path);
+    size_t ext_len = strlen(ext);
+    return len > ext_len && strcmp(path + len - ext_len, ext) == 0;
+}
+
+static int is_song_file(const char *path) {
+    return has_extension(path, ".mml");
+}
+
+static int is_wavetable_file(const char *path) {
+    return has_extension(path, ".txt") || has_extension(path, WAVETABLE_BANK_EXTENSION);
+}
+
+// パスから、ディレクトリと拡張子を除いた名前を作る
+static char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    const char *start = slash ? slash + 1 : path;
+    const char *dot = strrchr(start, '.');
+    size_t len = dot && dot != start ? (size_t)(dot - start) : strlen(start);
+    char *name = (char *)malloc(len + 1);
+    if (name) {
+        memcpy(name, start, len);
+        name[len] = '\0';
+    }
+    return name;
+}
+
+// 入力のパスの一覧 (mallocした文字列の配列)
+typedef struct {
+    char **paths;
+    size_t count;
+    size_t capacity;
+} PathList;
+
+static int path_list_add(PathList *list, const char *path) {
+    if (list->count >= list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 16;
+        char **grown = (char **)realloc(list->paths, capacity * sizeof(char *));
+        if (!grown) {
+            return -1;
+        }
+        list->paths = grown;
+        list->capacity = capacity;
+    }
+    if (!(list->paths[list->count] = strdup(path))) {
+        return -1;
+    }
+    list->count++;
+    return 0;
+}
+
+static void path_list_free(PathList *list) {
+    for (size_t i = 0; i < list->count; ++i) {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// ディレクトリの中の曲とウェーブテーブルを名前の順に加える
+static int add_directory(const char *dir, PathList *songs, PathList *wavetables) {
+    DIR *dp = opendir(dir);
+    if (!dp) {
+        fprintf(stderr, "ディレクトリを開けません: %s\n", dir);
+        return -1;
+    }
+    PathList found = {NULL, 0, 0};
+    struct dirent *ent;
+    int err = 0;
+    while (!err && (ent = readdir(dp)) != NULL) {
+        if (is_song_file(ent->d_name) || is_wavetable_file(ent->d_name)) {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+            err = path_list_add(&found, path);
+        }
+    }
+    closedir(dp);
+    if (found.count > 0) {
+        qsort(found.paths, found.count, sizeof(char *), compare_paths);
+    }
+    for (size_t i = 0; !err && i < found.count; ++i) {
+        err = path_list_add(is_song_file(found.paths[i]) ? songs : wavetables, found.paths[i]);
+    }
+    path_list_free(&found);
+    return err;
+}
+
+// 自分の列の末尾から仕事を取る
+static int pop_task(WorkQueue *q, BatchTask *out) {
+    int ok = 0;
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail) {
+        *out = q->tasks[--q->tail];
+        ok = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok;
+}
+
+// 他のスレッドの列の先頭から仕事を盗む
+static int steal_task(WorkQueue *q, BatchTask *out) {
+    int ok = 0;
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail) {
+        *out = q->tasks[q->head++];
+        ok = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok;
+}
+
+static void run_task(BatchPool *pool, BatchTask task, BounceScratch *scratch) {
+    BatchRender *r = &pool->renders[task.render];
+    // 同じ書き出しの区間がすでに失敗していれば、残りは生成しない
+    if (!atomic_load(&r->failed) && bounce_render_segment(r->job, task.segment, scratch) != 0) {
+        atomic_store(&r->failed, 1);
+    }
+    if (atomic_fetch_sub(&r->remaining, 1) == 1) {
+        if (atomic_load(&r->failed)) {
+            fprintf(stderr, "書き出しに失敗しました: %s\n", r->output);
+        } else {
+            printf("書き出し完了: %s\n", r->output);
+        }
+    }
+}
+
+// ワーカースレッド: 自分の列が空になったら、他のスレッドの列から順に盗む
+// 仕事は最初に全部積んでから始めるので、全部の列が空なら終わり
+static void *batch_worker_main(void *arg) {
+    BatchWorker *w = (BatchWorker *)arg;
+    BatchPool *pool = w->pool;
+    WorkQueue *own = &pool->queues[w->index];
+    BounceScratch scratch;
+
+    // 作業領域を用意できなければ何もせずに終わる (自分の列は他のスレッドが盗んで片付ける。
+    // 全部のスレッドが失敗して残った区間は、集計のときに失敗として数える)
+    if (bounce_scratch_init(&scratch) != 0) {
+        fprintf(stderr, "メモリが足りません\n");
+        return NULL;
+    }
+    for (;;) {
+        BatchTask task;
+        if (pop_task(own, &task)) {
+            run_task(pool, task, &scratch);
+            own->executed++;
+            continue;
+        }
+        int found = 0;
+        for (int i = 1; i < pool->num_workers && !found; ++i) {
+            found = steal_task(&pool->queues[(w->index + i) % pool->num_workers], &task);
+        }
+        if (!found) {
+            break;
+        }
+        run_task(pool, task, &scratch);
+        own->executed++;
+        own->stolen++;
+    }
+    bounce_scratch_destroy(&scratch);
+    return NULL;
+}
+
+static void print_usage(const char *program) {
+    fprintf(stderr, "使い方: %s [-j スレッド数] [-o 出力ディレクトリ] [-b 音色のディレクトリ] <ファイルかディレクトリ>...\n", program);
+    fprintf(stderr, "  *.mml は曲、*.txt と *.wtx はウェーブテーブル。全ての組み合わせを <出力ディレクトリ>/<曲>_<ウェーブテーブル>.wav に書き出す\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *output_dir = DEFAULT_OUTPUT_DIR;
+    const char *bank_dir = WAVETABLE_BANK_DIR;
+    int num_workers = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:o:b:")) != -1) {
+        switch (opt) {
+        case 'j':
+            num_workers = atoi(optarg);
+            break;
+        case 'o':
+            output_dir = optarg;
+            break;
+        case 'b':
+            bank_dir = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (num_workers <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_workers = (cores > 0) ? (int)cores : 1;
+    }
+    if (num_workers > MAX_WORKERS) {
+        num_workers = MAX_WORKERS;
+    }
+
+    // --- 入力の一覧を作る ---
+    PathList song_paths = {NULL, 0, 0};
+    PathList wavetable_paths = {NULL, 0, 0};
+    for (int i = optind; i < argc; ++i) {
+        struct stat st;
+        int err = 0;
+        if (stat(argv[i], &st) != 0) {
+            fprintf(stderr, "ファイルが見つかりません: %s\n", argv[i]);
+            err = -1;
+        } else if (S_ISDIR(st.st_mode)) {
+            err = add_directory(argv[i], &song_paths, &wavetable_paths);
+        } else if (is_song_file(argv[i])) {
+            err = path_list_add(&song_paths, argv[i]);
+        } else if (is_wavetable_file(argv[i])) {
+            err = path_list_add(&wavetable_paths, argv[i]);
+        } else {
+            fprintf(stderr, "曲でもウェーブテーブルでもないので無視します: %s\n", argv[i]);
+        }
+        if (err != 0) {
+            return 1;
+        }
+    }
+    if (song_paths.count == 0 || wavetable_paths.count == 0) {
+        fprintf(stderr, "曲とウェーブテーブルが1つ以上必要です (曲 %zu 個, ウェーブテーブル %zu 個)\n",
+                song_paths.count, wavetable_paths.count);
+        return 1;
+    }
+    if (mkdir(output_dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "出力ディレクトリを作れません: %s\n", output_dir);
+        return 1;
+    }
+
+    // --- 曲とウェーブテーブルを1回ずつ読み込む ---
+    double load_start = now_sec();
+    size_t num_songs = song_paths.count;
+    size_t num_wavetables = wavetable_paths.count;
+    BatchSong *songs = (BatchSong *)calloc(num_songs, sizeof(BatchSong));
+    BatchWavetable *wavetables = (BatchWavetable *)calloc(num_wavetables, sizeof(BatchWavetable));
+    if (!songs || !wavetables) {
+        fprintf(stderr, "メモリが足りません\n");
+        return 1;
+    }
+    for (size_t i = 0; i < num_songs; ++i) {
+        songs[i].path = song_paths.paths[i];
+        songs[i].name = base_name(songs[i].path);
+        char *text = read_mml_file(songs[i].path);
+        if (text) {
+            songs[i].song = parse_mml_song(text, SAMPLE_RATE);
+            free(text);
+        }
+        if (!songs[i].song) {
+            fprintf(stderr, "MMLの解析に失敗したので飛ばします: %s\n", songs[i].path);
+        }
+    }
+    size_t loaded_wavetables = 0;
+    for (size_t i = 0; i < num_wavetables; ++i) {
+        int16_t source[TABLE_SIZE];
+        BatchWavetable *wt = &wavetables[loaded_wavetables];
+        if (load_wavetable_from_file(wavetable_paths.paths[i], source) != 0) {
+            fprintf(stderr, "ウェーブテーブルを読み込めないので飛ばします: %s\n", wavetable_paths.paths[i]);
+            continue;
+        }
+        wt->path = wavetable_paths.paths[i];
+        wt->name = base_name(wt->path);
+        wavetable_build(&wt->table, source);
+        loaded_wavetables++;
+    }
+    num_wavetables = loaded_wavetables;
+    WavetableBank bank;
+    wavetable_bank_open(&bank, bank_dir);
+    double load_seconds = now_sec() - load_start;
+
+    // --- 全ての組み合わせを区間に分けて、スレッドごとの列に配る ---
+    size_t num_renders = 0;
+    size_t num_tasks = 0;
+    int failed = 0;
+    BatchRender *renders = (BatchRender *)calloc(num_songs * num_wavetables + 1, sizeof(BatchRender));
+    if (!renders) {
+        fprintf(stderr, "メモリが足りません\n");
+        return 1;
+    }
+    for (size_t s = 0; s < num_songs; ++s) {
+        if (!songs[s].song) {
+            // 解析できなかった曲は、ウェーブテーブルとの組み合わせの数だけ失敗に数える
+            failed += (int)num_wavetables;
+            continue;
+        }
+        for (size_t w = 0; w < num_wavetables; ++w) {
+            BatchRender *r = &renders[num_renders];
+            size_t len = strlen(output_dir) + strlen(songs[s].name) + strlen(wavetables[w].name) + 8;
+            r->output = (char *)malloc(len);
+            if (!r->output) {
+                fprintf(stderr, "メモリが足りません\n");
+                return 1;
+            }
+            snprintf(r->output, len, "%s/%s_%s.wav", output_dir, songs[s].name, wavetables[w].name);
+            r->job = bounce_prepare(songs[s].song, &wavetables[w].table, &bank, SAMPLE_RATE, r->output, num_workers);
+            if (!r->job) {
+                free(r->output);
+                failed++;
+                continue;
+            }
+            atomic_init(&r->remaining, bounce_num_segments(r->job));
+            atomic_init(&r->failed, 0);
+            num_tasks += bounce_num_segments(r->job);
+            num_renders++;
+        }
+    }
+
+    WorkQueue queues[MAX_WORKERS];
+    BatchPool pool = {renders, queues, num_workers};
+    for (int i = 0; i < num_workers; ++i) {
+        pthread_mutex_init(&queues[i].lock, NULL);
+        queues[i].capacity = num_tasks / (size_t)num_workers + 1;
+        queues[i].tasks = (BatchTask *)malloc(queues[i].capacity * sizeof(BatchTask));
+        queues[i].head = 0;
+        queues[i].tail = 0;
+        queues[i].executed = 0;
+        queues[i].stolen = 0;
+        if (!queues[i].tasks) {
+            fprintf(stderr, "メモリが足りません\n");
+            return 1;
+        }
+    }
+    // 区間を順番に配る (同じ曲の区間が全スレッドに散らばるので、曲の長さが違っても偏りにくい)
+    size_t next = 0;
+    for (size_t r = 0; r < num_renders; ++r) {
+        for (size_t k = 0; k < bounce_num_segments(renders[r].job); ++k) {
+            WorkQueue *q = &queues[next++ % (size_t)num_workers];
+            q->tasks[q->tail++] = (BatchTask){(uint32_t)r, (uint32_t)k};
+        }
+    }
+
+    printf("曲 %zu 個 x ウェーブテーブル %zu 個 = %zu 個の書き出しを %zu 区間に分けて、%d スレッドで生成します\n",
+           num_songs, num_wavetables, num_renders, num_tasks, num_workers);
+
+    // --- 生成 (呼び出し元のスレッドもワーカーの1つとして働く) ---
+    osc_kernel_selected();
+    double render_start = now_sec();
+    pthread_t threads[MAX_WORKERS];
+    BatchWorker workers[MAX_WORKERS];
+    int started[MAX_WORKERS] = {0};
+    for (int i = 0; i < num_workers; ++i) {
+        workers[i].pool = &pool;
+        workers[i].index = i;
+        if (i > 0) {
+            started[i] = pthread_create(&threads[i], NULL, batch_worker_main, &workers[i]) == 0;
+        }
+    }
+    // (スレッドを作れなかった分の列も、空くまで他のスレッドが盗んで片付ける)
+    batch_worker_main(&workers[0]);
+    for (int i = 1; i < num_workers; ++i) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    double render_seconds = now_sec() - render_start;
+
+    // --- 集計 ---
+    // 生成されずに区間が残った書き出しも失敗に数える
+    uint64_t total_frames = 0;
+    for (size_t r = 0; r < num_renders; ++r) {
+        if (atomic_load(&renders[r].remaining) > 0) {
+            fprintf(stderr, "書き出しに失敗しました (生成されなかった区間があります): %s\n", renders[r].output);
+            failed++;
+        } else if (atomic_load(&renders[r].failed)) {
+            failed++;
+        } else {
+            total_frames += bounce_total_frames(renders[r].job);
+        }
+    }
+    double audio_seconds = (double)total_frames / SAMPLE_RATE;
+    double megabytes = (double)total_frames * sizeof(int16_t) / (1024.0 * 1024.0);
+    printf("---------------------- 集計 ----------------------\n");
+    printf("読み込み: 曲 %zu 個, ウェーブテーブル %zu 個 (%f 秒)\n", num_songs, num_wavetables, load_seconds);
+    printf("書き出し: %zu 個 (失敗 %d 個), %f 秒分 (%.1f MB) を %f 秒で生成\n",
+           num_songs * num_wavetables, failed, audio_seconds, megabytes, render_seconds);
+    printf("速さ: 実時間の %.1f 倍, %.1f MB/s, 1スレッドあたり実時間の %.1f 倍\n",
+           render_seconds > 0 ? audio_seconds / render_seconds : 0.0,
+           render_seconds > 0 ? megabytes / render_seconds : 0.0,
+           render_seconds > 0 ? audio_seconds / render_seconds / num_workers : 0.0);
+    for (int i = 0; i < num_workers; ++i) {
+        printf("スレッド%d: %zu 区間 (盗んだもの %zu)\n", i, queues[i].executed, queues[i].stolen);
+    }
+
+    // --- 後片付け ---
+    for (int i = 0; i < num_workers; ++i) {
+        pthread_mutex_destroy(&queues[i].lock);
+        free(queues[i].tasks);
+    }
+    for (size_t r = 0; r < num_renders; ++r) {
+        bounce_job_free(renders[r].job);
+        free(renders[r].output);
+    }
+    free(renders);
+    for (size_t i = 0; i < num_songs; ++i) {
+        free_mml_song(songs[i].song);
+        free(songs[i].name);
+    }
+    for (size_t i = 0; i < num_wavetables; ++i) {
+        free(wavetables[i].name);
+    }
+    free(songs);
+    free(wavetables);
+    wavetable_bank_close(&bank);
+    path_list_free(&song_paths);
+    path_list_free(&wavetable_paths);
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,631 @@
+// ベンチマーク
+// 乱数で作ったMMLを使って、MMLの解析と波形生成の速さを測り、結果をJSONで出力する
+// ALSAは使わないので、サウンドカードのないマシンでも実行できる
+// 乱数の種を固定しているので、同じ設定なら毎回同じMMLで測れる (リリース間の比較用)
+// Q15版のカーネルが浮動小数点版と決めた誤差の範囲で一致するかも確かめ、外れたら終了コード2で終わる
+// リサンプラーは品質 x カーネルごとの速さと変換の精度 (正弦波のSN比) を測り、SIMD版がスカラー版と
+// ビット単位で一致しなければ同じく終了コード2で終わる
+// ミキサーは出力の形式 x チャンネル数ごとに特殊化したカーネルの速さを、定位をつける場合とつけない場合で測る
+//
+// 使い方: bench [-s MMLのサイズ(KB)] [-p トラック数] [-n 生成する秒数] [-r 繰り返し回数] [-S 乱数の種] [-o 出力ファイル]
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "mixer.h"
+#include "mml_parser.h"
+#include "osc_kernel.h"
+#include "resampler.h"
+#include "synth_engine.h"
+#include "wavetable.h"
+
+#define SAMPLE_RATE     44100   // サンプリングレート (Hz)
+#define AMPLITUDE       32760   // テーブルの振幅
+
+// 既定の設定
+#define DEFAULT_SIZE_KB     1024    // 生成するMMLの大きさ
+#define DEFAULT_TRACKS      4       // トラック数 (同時に鳴る音の数)
+#define DEFAULT_SECONDS     10      // 発振器1つあたりに生成する秒数
+#define DEFAULT_REPEAT      5       // 繰り返し回数 (一番速かった回を結果とする)
+#define DEFAULT_SEED        2025
+
+// Q15版と浮動小数点版 (スカラー版) の差の上限 (16bitのLSB単位)
+// 補間の丸め (切り捨ての向きの違い) と、減衰を Q30 で掛け続ける誤差の合計がこの範囲に収まる
+#define Q15_MAX_ERROR       4       // 1サンプルの差の最大 (約 -78dBFS)
+#define Q15_MAX_RMS_ERROR   0.75    // 差の二乗平均平方根
+#define Q15_FIRST_NOTE      24      // 確かめる音域 (1オクターブおき)
+#define Q15_LAST_NOTE       108
+
+// リサンプラーの測定条件 (WAVの 44.1kHz を 48kHz のデバイスで鳴らす場合)
+#define RESAMPLE_IN_RATE    44100
+#define RESAMPLE_OUT_RATE   48000
+#define RESAMPLE_CHANNELS   2
+#define RESAMPLE_TONE       1000.0  // SN比を測る正弦波の周波数 (Hz)
+#define RESAMPLE_AMPLITUDE  0.5
+
+// ミキサーの測定で試すチャンネル数 (2より多いと汎用のカーネルになる)
+static const int mix_channels[] = {1, 2, 6};
+
+typedef struct {
+    size_t size_kb;
+    size_t num_tracks;
+    double seconds;
+    int repeat;
+    uint32_t seed;
+    const char *output;
+} BenchConfig;
+
+// 再現性のある乱数 (xorshift32)
+static uint32_t next_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// 合わせて約 size_kb KB になるように、num_tracks トラック分のMMLを作る
+// 音符・休符・オクターブ・音量・タイ・付点をまんべんなく含める
+static char *generate_mml(size_t size_kb, size_t num_tracks, uint32_t seed) {
+    static const char notes[] = "cdefgab";
+    static const int lengths[] = {4, 8, 8, 16, 16, 16};
+    size_t target = size_kb * 1024;
+    size_t per_track = target / num_tracks;
+    char *mml = (char *)malloc(target + num_tracks * 64 + 64);
+    if (!mml) {
+        return NULL;
+    }
+    uint32_t state = seed ? seed : 1;
+    size_t len = 0;
+
+    len += (size_t)sprintf(mml + len, "MML@t140");
+    for (size_t t = 0; t < num_tracks; ++t) {
+        size_t track_start = len;
+        int octave = 4;
+        len += (size_t)sprintf(mml + len, "%so%dl8v%d", t > 0 ? "," : "", octave, 80 + (int)(next_random(&state) % 21));
+        while (len - track_start < per_track) {
+            uint32_t r = next_random(&state) % 100;
+            if (r < 10) {
+                len += (size_t)sprintf(mml + len, "r%d", lengths[next_random(&state) % 6]);
+            } else if (r < 14) {
+                // オクターブを3~5の範囲で上下させる
+                if (octave < 5 && (octave <= 3 || next_random(&state) % 2)) {
+                    mml[len++] = '<';
+                    octave++;
+                } else {
+                    mml[len++] = '>';
+                    octave--;
+                }
+            } else if (r < 16) {
+                len += (size_t)sprintf(mml + len, "v%d", 60 + (int)(next_random(&state) % 41));
+            } else {
+                mml[len++] = notes[next_random(&state) % 7];
+                uint32_t accidental = next_random(&state) % 8;
+                if (accidental == 0) {
+                    mml[len++] = '+';
+                } else if (accidental == 1) {
+                    mml[len++] = '-';
+                }
+                len += (size_t)sprintf(mml + len, "%d", lengths[next_random(&state) % 6]);
+                uint32_t extra = next_random(&state) % 16;
+                if (extra == 0) {
+                    len += (size_t)sprintf(mml + len, "&%d", lengths[next_random(&state) % 6]);
+                } else if (extra == 1) {
+                    mml[len++] = '.';
+                }
+            }
+        }
+    }
+    mml[len++] = ';';
+    mml[len] = '\0';
+    return mml;
+}
+
+// 基音 + 2倍音 + 3倍音 のテーブル (sound_test.c の init_wavetable と同じ波形)
+static void init_bench_wavetable(Wavetable *wt) {
+    int16_t table[TABLE_SIZE];
+    for (int i = 0; i < TABLE_SIZE; ++i) {
+        double angle = 2.0 * M_PI * i / TABLE_SIZE;
+        table[i] = (int16_t)((0.5 * sin(angle) + 0.3 * sin(2 * angle) + 0.2 * sin(3 * angle)) * AMPLITUDE);
+    }
+    wavetable_build(wt, table);
+}
+
+// --- 解析の速さ ---
+typedef struct {
+    size_t bytes;
+    size_t events;
+    double seconds;     // 一番速かった回の時間
+    size_t event_bytes; // 展開したイベント列の大きさ
+    size_t ir_bytes;    // 中間表現 (命令列) の大きさ
+    double compile_seconds; // 中間表現にするだけの時間 (一番速かった回)
+} ParseResult;
+
+static int bench_parse(const char *mml, int repeat, ParseResult *result) {
+    result->bytes = strlen(mml);
+    result->events = 0;
+    result->seconds = 0;
+    result->compile_seconds = 0;
+    for (int i = 0; i < repeat; ++i) {
+        double start = now_sec();
+        MmlSong *song = parse_mml_song(mml, SAMPLE_RATE);
+        double elapsed = now_sec() - start;
+        if (!song) {
+            return -1;
+        }
+        size_t events = 0;
+        for (size_t t = 0; t < song->num_tracks; ++t) {
+            events += song->tracks[t].num_events;
+        }
+        free_mml_song(song);
+        result->events = events;
+        result->event_bytes = events * sizeof(MmlEvent);
+        if (i == 0 || elapsed < result->seconds) {
+            result->seconds = elapsed;
+        }
+
+        start = now_sec();
+        MmlProgram *program = mml_compile(mml, SAMPLE_RATE);
+        elapsed = now_sec() - start;
+        if (!program) {
+            return -1;
+        }
+        result->ir_bytes = mml_program_size(program);
+        free_mml_program(program);
+        if (i == 0 || elapsed < result->compile_seconds) {
+            result->compile_seconds = elapsed;
+        }
+    }
+    return 0;
+}
+
+// --- 発振器カーネルの速さ ---
+// 1つの発振器でA4を鳴らし続けたときの、1秒あたりの生成サンプル数を測る
+static double bench_kernel(const OscKernelInfo *kernel, const Wavetable *wt, int interp, size_t samples, int repeat) {
+    int16_t buffer[PERIOD_FRAMES];
+    double frequency = note_to_freq(69);
+    const int16_t *table = wavetable_level(wt, wavetable_select_level(frequency / SAMPLE_RATE));
+    double best = 0;
+    volatile int16_t sink = 0; // 最適化で生成が消されないように結果を読む
+
+    for (int i = 0; i < repeat; ++i) {
+        OscState s;
+        memset(&s, 0, sizeof(s));
+        osc_set_ramp(&s, 1 << OSC_GAIN_BITS, 0, 0);
+        s.phase_increment = synth_phase_increment(69, SAMPLE_RATE);
+        s.interp = interp;
+        double start = now_sec();
+        for (size_t done = 0; done < samples; done += PERIOD_FRAMES) {
+            size_t n = (samples - done < PERIOD_FRAMES) ? samples - done : PERIOD_FRAMES;
+            kernel->func(&s, table, buffer, n);
+            sink ^= buffer[n - 1];
+        }
+        double elapsed = now_sec() - start;
+        if (i == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    (void)sink;
+    return best;
+}
+
+// --- Q15版の精度 ---
+typedef struct {
+    size_t notes;           // 確かめた音の数 (補間方法ごと)
+    int max_error;          // 1サンプルの差の最大
+    double rms_error;       // 差の二乗平均平方根 (全ての音の平均)
+} Q15Accuracy;
+
+// 音域全体で、同じ状態から始めたスカラー版と Q15 版の出力を比べる
+static void check_q15(const OscKernelInfo *q15, const Wavetable *wt, size_t samples, Q15Accuracy *result) {
+    const OscKernelInfo *reference = osc_kernel_info(0);
+    int16_t expected[PERIOD_FRAMES];
+    int16_t actual[PERIOD_FRAMES];
+    double sum_squares = 0;
+    size_t total = 0;
+
+    result->notes = 0;
+    result->max_error = 0;
+    for (int interp = OSC_INTERP_LINEAR; interp <= OSC_INTERP_CUBIC; ++interp) {
+        for (int note = Q15_FIRST_NOTE; note <= Q15_LAST_NOTE; note += 12) {
+            const int16_t *table = wavetable_level(wt, wavetable_select_level(note_to_freq(note) / SAMPLE_RATE));
+            OscState a, b;
+            memset(&a, 0, sizeof(a));
+            // 音量1.0から0へのフェードアウト (音量のランプの計算も比べる)
+            osc_set_ramp(&a, 1 << OSC_GAIN_BITS, -(int32_t)((1u << OSC_GAIN_BITS) / samples), 0);
+            a.phase_increment = synth_phase_increment(note, SAMPLE_RATE);
+            a.interp = interp;
+            b = a;
+            for (size_t done = 0; done < samples; done += PERIOD_FRAMES) {
+                size_t n = (samples - done < PERIOD_FRAMES) ? samples - done : PERIOD_FRAMES;
+                reference->func(&a, table, expected, n);
+                q15->func(&b, table, actual, n);
+                for (size_t i = 0; i < n; ++i) {
+                    int error = abs(expected[i] - actual[i]);
+                    if (error > result->max_error) {
+                        result->max_error = error;
+                    }
+                    sum_squares += (double)error * error;
+                }
+                total += n;
+            }
+            if (interp == OSC_INTERP_LINEAR) {
+                result->notes++;
+            }
+        }
+    }
+    result->rms_error = total > 0 ? sqrt(sum_squares / (double)total) : 0.0;
+}
+
+// --- 曲全体の生成の速さ ---
+// 解析済みの曲を、再生と同じようにトラックごとのスレッドで生成してミックスする
+static int bench_song(const MmlSong *song, const Wavetable *wt, size_t max_frames, int repeat,
+                      size_t *out_frames, double *out_seconds) {
+    int16_t buffer[PERIOD_FRAMES];
+    *out_seconds = 0;
+    for (int i = 0; i < repeat; ++i) {
+        SongRenderer renderer;
+        if (song_renderer_init(&renderer, song, wt, SAMPLE_RATE) != 0) {
+            return -1;
+        }
+        size_t frames = 0;
+        double start = now_sec();
+        while (frames < max_frames && !song_renderer_finished(&renderer)) {
+            frames += song_render_block(&renderer, buffer, PERIOD_FRAMES);
+        }
+        double elapsed = now_sec() - start;
+        song_renderer_destroy(&renderer);
+        *out_frames = frames;
+        if (i == 0 || elapsed < *out_seconds) {
+            *out_seconds = elapsed;
+        }
+    }
+    return 0;
+}
+
+// --- ミキサーの速さ ---
+// num_inputs 本のトラックのバッファを frames フレーム分ミックスする時間を測る
+static double bench_mix(MixKernel mix, int channels, const int16_t *const *inputs, size_t num_inputs,
+                        size_t frames, int repeat) {
+    static uint8_t buffer[PERIOD_FRAMES * MIXER_MAX_CHANNELS * sizeof(float)];
+    double best = 0;
+    volatile uint8_t sink = 0; // 最適化でミックスが消されないように結果を読む
+
+    for (int i = 0; i < repeat; ++i) {
+        double start = now_sec();
+        for (size_t done = 0; done < frames; done += PERIOD_FRAMES) {
+            size_t n = (frames - done < PERIOD_FRAMES) ? frames - done : PERIOD_FRAMES;
+            mix(buffer, inputs, num_inputs, n, channels);
+            sink ^= buffer[0];
+        }
+        double elapsed = now_sec() - start;
+        if (i == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    (void)sink;
+    return best;
+}
+
+// 定位をつけてミックスする時間を測る (トラックごとに1ブロックに2回定位が変わるとする)
+static double bench_mix_panned(MixPanKernel mix, int channels, const MixPanInput *inputs, size_t num_inputs,
+                               size_t frames, int repeat) {
+    static uint8_t buffer[PERIOD_FRAMES * MIXER_MAX_CHANNELS * sizeof(float)];
+    double best = 0;
+    volatile uint8_t sink = 0;
+
+    for (int i = 0; i < repeat; ++i) {
+        double start = now_sec();
+        for (size_t done = 0; done < frames; done += PERIOD_FRAMES) {
+            size_t n = (frames - done < PERIOD_FRAMES) ? frames - done : PERIOD_FRAMES;
+            mix(buffer, inputs, num_inputs, n, channels);
+            sink ^= buffer[0];
+        }
+        double elapsed = now_sec() - start;
+        if (i == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    (void)sink;
+    return best;
+}
+
+// --- リサンプラーの速さと精度 ---
+typedef struct {
+    double seconds;     // 一番速かった回の時間
+    size_t out_frames;
+    double snr_db;      // 理想の正弦波に対するSN比
+    float max_diff;     // スカラー版の出力との差の最大
+} ResampleResult;
+
+// in の frames フレームと、遅れの分の0を変換して out に書く
+// 戻り値: 出力したフレーム数
+static size_t resample_all(Resampler *rs, const float *in, size_t frames, float *out, size_t out_capacity) {
+    size_t total = frames + resampler_latency(rs);
+    size_t done = 0;
+    size_t made = 0;
+    while (done < total && made < out_capacity) {
+        size_t used = 0;
+        made += resampler_process(rs, in + done * RESAMPLE_CHANNELS, total - done, &used,
+                                  out + made * RESAMPLE_CHANNELS, out_capacity - made);
+        done += used;
+    }
+    return made;
+}
+
+// in (後ろに遅れの分の0を足したもの) を変換する速さを測り、reference (スカラー版の出力) との差を調べる
+// reference が NULL なら out をそのまま基準にする
+static int bench_resample(ResamplerQuality quality, const ResamplerKernelInfo *kernel, const float *in, size_t frames,
+                          float *out, size_t out_capacity, const float *reference, int repeat, ResampleResult *result) {
+    memset(result, 0, sizeof(*result));
+    for (int i = 0; i < repeat; ++i) {
+        Resampler rs;
+        if (resampler_init(&rs, RESAMPLE_CHANNELS, RESAMPLE_IN_RATE, RESAMPLE_OUT_RATE, quality) != 0) {
+            return -1;
+        }
+        resampler_set_kernel(&rs, kernel);
+        double start = now_sec();
+        size_t made = resample_all(&rs, in, frames, out, out_capacity);
+        double elapsed = now_sec() - start;
+        resampler_destroy(&rs);
+        result->out_frames = made;
+        if (i == 0 || elapsed < result->seconds) {
+            result->seconds = elapsed;
+        }
+    }
+
+    // 先頭と末尾のフィルタの立ち上がり・立ち下がりを除いて比べる
+    double signal = 0, noise = 0;
+    size_t edge = RESAMPLE_OUT_RATE / 100;
+    for (size_t i = 0; i < result->out_frames * RESAMPLE_CHANNELS; ++i) {
+        if (reference) {
+            float diff = fabsf(out[i] - reference[i]);
+            if (diff > result->max_diff) {
+                result->max_diff = diff;
+            }
+        }
+        size_t frame = i / RESAMPLE_CHANNELS;
+        if (frame >= edge && frame + edge < result->out_frames) {
+            double ideal = RESAMPLE_AMPLITUDE * sin(2.0 * M_PI * RESAMPLE_TONE * (double)frame / RESAMPLE_OUT_RATE);
+            signal += ideal * ideal;
+            noise += (out[i] - ideal) * (out[i] - ideal);
+        }
+    }
+    result->snr_db = noise > 0 ? 10.0 * log10(signal / noise) : 999.0;
+    return 0;
+}
+
+static double per_sec(double amount, double seconds) {
+    return seconds > 0 ? amount / seconds : 0.0;
+}
+
+static void print_usage(const char *program) {
+    fprintf(stderr, "使い方: %s [-s MMLのサイズ(KB)] [-p トラック数] [-n 生成する秒数] [-r 繰り返し回数] [-S 乱数の種] [-o 出力ファイル]\n", program);
+}
+
+int main(int argc, char *argv[]) {
+    BenchConfig config = {DEFAULT_SIZE_KB, DEFAULT_TRACKS, DEFAULT_SECONDS, DEFAULT_REPEAT, DEFAULT_SEED, NULL};
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:p:n:r:S:o:")) != -1) {
+        switch (opt) {
+        case 's':
+            config.size_kb = (size_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            config.num_tracks = (size_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            config.seconds = atof(optarg);
+            break;
+        case 'r':
+            config.repeat = atoi(optarg);
+            break;
+        case 'S':
+            config.seed = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'o':
+            config.output = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (config.size_kb == 0 || config.num_tracks == 0 || config.num_tracks > MML_MAX_TRACKS
+        || config.seconds <= 0 || config.repeat <= 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    FILE *out = stdout;
+    if (config.output && !(out = fopen(config.output, "w"))) {
+        fprintf(stderr, "出力ファイルを開けません: %s\n", config.output);
+        return 1;
+    }
+
+    static Wavetable wt;
+    init_bench_wavetable(&wt);
+
+    char *mml = generate_mml(config.size_kb, config.num_tracks, config.seed);
+    if (!mml) {
+        fprintf(stderr, "メモリが足りません\n");
+        return 1;
+    }
+    ParseResult parse;
+    if (bench_parse(mml, config.repeat, &parse) != 0) {
+        free(mml);
+        return 1;
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"config\": {\"size_kb\": %zu, \"tracks\": %zu, \"seconds\": %g, \"repeat\": %d, \"seed\": %u, \"sample_rate\": %d},\n",
+            config.size_kb, config.num_tracks, config.seconds, config.repeat, config.seed, SAMPLE_RATE);
+    fprintf(out, "  \"system\": {\"cpus\": %ld, \"selected_kernel\": \"%s\", \"table_size\": %d, \"mip_levels\": %d},\n",
+            sysconf(_SC_NPROCESSORS_ONLN), osc_kernel_selected()->name, TABLE_SIZE, MIP_LEVELS);
+    fprintf(out, "  \"parse\": {\"bytes\": %zu, \"events\": %zu, \"seconds\": %.6f, \"mb_per_sec\": %.3f, \"events_per_sec\": %.1f, \"event_bytes\": %zu, \"ir_bytes\": %zu, \"compile_seconds\": %.6f},\n",
+            parse.bytes, parse.events, parse.seconds,
+            per_sec((double)parse.bytes / (1024.0 * 1024.0), parse.seconds), per_sec((double)parse.events, parse.seconds),
+            parse.event_bytes, parse.ir_bytes, parse.compile_seconds);
+
+    // 各カーネル x 補間方法ごとに測る
+    static const char *interp_names[] = {"linear", "cubic"};
+    size_t samples = (size_t)(config.seconds * SAMPLE_RATE);
+    fprintf(out, "  \"kernels\": [\n");
+    for (size_t k = 0; k < osc_kernel_count(); ++k) {
+        const OscKernelInfo *kernel = osc_kernel_info(k);
+        for (int interp = OSC_INTERP_LINEAR; interp <= OSC_INTERP_CUBIC; ++interp) {
+            double seconds = bench_kernel(kernel, &wt, interp, samples, config.repeat);
+            double rate = per_sec((double)samples, seconds);
+            fprintf(out, "    {\"name\": \"%s\", \"interp\": \"%s\", \"samples\": %zu, \"seconds\": %.6f, \"samples_per_sec\": %.1f, \"realtime_voices\": %.1f}%s\n",
+                    kernel->name, interp_names[interp], samples, seconds, rate, rate / SAMPLE_RATE,
+                    (k + 1 == osc_kernel_count() && interp == OSC_INTERP_CUBIC) ? "" : ",");
+        }
+    }
+    fprintf(out, "  ],\n");
+
+    // Q15版の誤差 (範囲に収まらなければ、結果を出力した後に失敗として終わる)
+    int q15_ok = 1;
+    for (size_t k = 0; k < osc_kernel_count(); ++k) {
+        const OscKernelInfo *kernel = osc_kernel_info(k);
+        if (strcmp(kernel->name, "q15") != 0) {
+            continue;
+        }
+        Q15Accuracy accuracy;
+        check_q15(kernel, &wt, samples, &accuracy);
+        q15_ok = accuracy.max_error <= Q15_MAX_ERROR && accuracy.rms_error <= Q15_MAX_RMS_ERROR;
+        fprintf(out, "  \"q15_accuracy\": {\"reference\": \"%s\", \"notes\": %zu, \"samples_per_note\": %zu, \"max_error\": %d, \"rms_error\": %.4f, \"max_error_bound\": %d, \"rms_error_bound\": %.4f, \"pass\": %s},\n",
+                osc_kernel_info(0)->name, accuracy.notes, samples, accuracy.max_error, accuracy.rms_error,
+                Q15_MAX_ERROR, Q15_MAX_RMS_ERROR, q15_ok ? "true" : "false");
+    }
+
+    // リサンプラー (品質 x カーネルごと。SIMD版はスカラー版と一致しなければ失敗として終わる)
+    size_t resample_frames = (size_t)(config.seconds * RESAMPLE_IN_RATE);
+    size_t resample_capacity = (size_t)((double)resample_frames * RESAMPLE_OUT_RATE / RESAMPLE_IN_RATE) + 256;
+    float *resample_in = (float *)calloc((resample_frames + 256) * RESAMPLE_CHANNELS, sizeof(float));
+    float *resample_out = (float *)malloc(resample_capacity * RESAMPLE_CHANNELS * sizeof(float));
+    float *resample_ref = (float *)malloc(resample_capacity * RESAMPLE_CHANNELS * sizeof(float));
+    if (!resample_in || !resample_out || !resample_ref) {
+        fprintf(stderr, "メモリが足りません\n");
+        free(resample_in);
+        free(resample_out);
+        free(resample_ref);
+        free(mml);
+        return 1;
+    }
+    for (size_t i = 0; i < resample_frames; ++i) {
+        float v = (float)(RESAMPLE_AMPLITUDE * sin(2.0 * M_PI * RESAMPLE_TONE * (double)i / RESAMPLE_IN_RATE));
+        for (int c = 0; c < RESAMPLE_CHANNELS; ++c) {
+            resample_in[i * RESAMPLE_CHANNELS + c] = v;
+        }
+    }
+    int resample_ok = 1;
+    fprintf(out, "  \"resample\": {\"in_rate\": %d, \"out_rate\": %d, \"channels\": %d, \"frames\": %zu, \"selected_kernel\": \"%s\", \"results\": [\n",
+            RESAMPLE_IN_RATE, RESAMPLE_OUT_RATE, RESAMPLE_CHANNELS, resample_frames, resampler_kernel_selected()->name);
+    for (int quality = 0; quality < RESAMPLER_NUM_QUALITIES; ++quality) {
+        for (size_t k = 0; k < resampler_kernel_count(); ++k) {
+            ResampleResult r;
+            float *dest = (k == 0) ? resample_ref : resample_out;
+            if (bench_resample((ResamplerQuality)quality, resampler_kernel_info(k), resample_in, resample_frames,
+                               dest, resample_capacity, k == 0 ? NULL : resample_ref, config.repeat, &r) != 0) {
+                free(resample_in);
+                free(resample_out);
+                free(resample_ref);
+                free(mml);
+                return 1;
+            }
+            if (r.max_diff != 0.0f) {
+                resample_ok = 0;
+            }
+            double rate = per_sec((double)r.out_frames, r.seconds);
+            fprintf(out, "    {\"quality\": \"%s\", \"kernel\": \"%s\", \"out_frames\": %zu, \"seconds\": %.6f, \"frames_per_sec\": %.1f, \"realtime_factor\": %.1f, \"snr_db\": %.1f, \"max_diff_from_scalar\": %g}%s\n",
+                    resampler_quality_name((ResamplerQuality)quality), resampler_kernel_info(k)->name, r.out_frames,
+                    r.seconds, rate, rate / RESAMPLE_OUT_RATE, r.snr_db, (double)r.max_diff,
+                    (quality + 1 == RESAMPLER_NUM_QUALITIES && k + 1 == resampler_kernel_count()) ? "" : ",");
+        }
+    }
+    fprintf(out, "  ], \"pass\": %s},\n", resample_ok ? "true" : "false");
+    free(resample_in);
+    free(resample_out);
+    free(resample_ref);
+
+    // ミキサー (形式 x チャンネル数ごと。トラック数分の乱数のバッファを混ぜる)
+    static const char *format_names[] = {"s16", "s24", "s32", "float"};
+    static int16_t mix_buffers[MML_MAX_TRACKS][PERIOD_FRAMES];
+    const int16_t *mix_inputs[MML_MAX_TRACKS];
+    size_t mix_tracks = config.num_tracks < MML_MAX_TRACKS ? config.num_tracks : MML_MAX_TRACKS;
+    static MixPanSegment pan_segments[MML_MAX_TRACKS][2];
+    MixPanInput pan_inputs[MML_MAX_TRACKS];
+    uint32_t mix_state = config.seed;
+    for (size_t t = 0; t < mix_tracks; ++t) {
+        for (size_t i = 0; i < PERIOD_FRAMES; ++i) {
+            mix_buffers[t][i] = (int16_t)(next_random(&mix_state) >> 16);
+        }
+        mix_inputs[t] = mix_buffers[t];
+        pan_segments[t][0].start = 0;
+        pan_segments[t][1].start = PERIOD_FRAMES / 2;
+        mixer_pan_gains((int)(next_random(&mix_state) % 128), pan_segments[t][0].gains);
+        mixer_pan_gains((int)(next_random(&mix_state) % 128), pan_segments[t][1].gains);
+        pan_inputs[t].samples = mix_buffers[t];
+        pan_inputs[t].segments = pan_segments[t];
+        pan_inputs[t].num_segments = 2;
+    }
+    size_t num_mix_channels = sizeof(mix_channels) / sizeof(mix_channels[0]);
+    fprintf(out, "  \"mix\": {\"tracks\": %zu, \"frames\": %zu, \"results\": [\n", mix_tracks, samples);
+    for (int format = AUDIO_FORMAT_S16_LE; format <= AUDIO_FORMAT_FLOAT_LE; ++format) {
+        for (size_t c = 0; c < num_mix_channels; ++c) {
+            // 定位は2チャンネル以上のときだけ (pan = 1)
+            for (int pan = 0; pan <= (mix_channels[c] >= 2); ++pan) {
+                double seconds = pan
+                    ? bench_mix_panned(mixer_select_panned((AudioSampleFormat)format, mix_channels[c]), mix_channels[c],
+                                       pan_inputs, mix_tracks, samples, config.repeat)
+                    : bench_mix(mixer_select((AudioSampleFormat)format, mix_channels[c]), mix_channels[c],
+                                mix_inputs, mix_tracks, samples, config.repeat);
+                double rate = per_sec((double)samples, seconds);
+                fprintf(out, "    {\"format\": \"%s\", \"channels\": %d, \"pan\": %s, \"seconds\": %.6f, \"frames_per_sec\": %.1f, \"realtime_factor\": %.1f}%s\n",
+                        format_names[format], mix_channels[c], pan ? "true" : "false", seconds, rate, rate / SAMPLE_RATE,
+                        (format == AUDIO_FORMAT_FLOAT_LE && c + 1 == num_mix_channels && pan == 1) ? "" : ",");
+            }
+        }
+    }
+    fprintf(out, "  ]},\n");
+
+    // 曲全体 (解析した曲の先頭から、トラック数 x 秒数分) を生成する速さ
+    MmlSong *song = parse_mml_song(mml, SAMPLE_RATE);
+    size_t frames = 0;
+    double song_seconds = 0;
+    if (!song || bench_song(song, &wt, samples, config.repeat, &frames, &song_seconds) != 0) {
+        free_mml_song(song);
+        free(mml);
+        return 1;
+    }
+    double frame_rate = per_sec((double)frames, song_seconds);
+    fprintf(out, "  \"song_render\": {\"tracks\": %zu, \"frames\": %zu, \"seconds\": %.6f, \"frames_per_sec\": %.1f, \"realtime_factor\": %.1f}\n",
+            song->num_tracks, frames, song_seconds, frame_rate, frame_rate / SAMPLE_RATE);
+    fprintf(out, "}\n");
+
+    free_mml_song(song);
+    free(mml);
+    if (out != stdout) {
+        fclose(out);
+    }
+    if (!q15_ok) {
+        fprintf(stderr, "Q15版の誤差が範囲を超えています\n");
+        return 2;
+    }
+    if (!resample_ok) {
+        fprintf(stderr, "リサンプラーのSIMD版がスカラー版と一致しません\n");
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,425 @@
+#include "bounce.h"
+#include "synth_engine.h"
+#include "mixer.h"
+#include "wav_file.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// 1スレッドあたりの区間数の目安 (区間ごとに長さが違っても、スレッドの仕事量がそろうように細かめに分ける)
+#define SEGMENTS_PER_THREAD 8
+// これより短い区間には分けない (秒)
+#define MIN_SEGMENT_SEC     1
+// まとめてファイルに書き込むフレーム数
+#define WRITE_CHUNK_FRAMES  (PERIOD_FRAMES * 16)
+
+// 1トラック分の時刻とフェーズの一覧
+typedef struct {
+    const MmlEvent *events;
+    size_t num_events;
+    uint64_t *starts;   // i番目のイベントの開始時刻 (サンプル, starts[num_events] はトラックの長さ)
+    uint64_t *phases;   // i番目のイベント開始時のフェーズ
+} TrackTimeline;
+
+// 1曲分の書き出しの状態 (区間を受け持つ全スレッドで共有する)
+struct BounceJob {
+    const Wavetable *wavetable;
+    const WavetableBank *bank;
+    int sample_rate;
+    char *path;
+    size_t num_tracks;
+    TrackTimeline timelines[MML_MAX_TRACKS];
+    uint64_t total_frames;
+
+    uint64_t *splits;           // 区間の境目 (splits[k] ~ splits[k+1] がk番目の区間)
+    size_t num_segments;
+};
+
+// bounce_song_to_wav のワーカーが共有する状態
+typedef struct {
+    BounceJob *job;
+    atomic_size_t next_segment; // 次にどのスレッドかが受け持つ区間
+    atomic_int failed;
+} BounceRun;
+
+// イベントの開始時刻と、そこまでに進むフェーズを先頭から積み上げる
+// 休符ではフェーズが進まないので、ノートの長さ x フェーズ増分の合計になる
+static int build_timeline(TrackTimeline *tl, const MmlTrack *track, int sample_rate) {
+    tl->events = track->events;
+    tl->num_events = track->num_events;
+    tl->starts = (uint64_t *)malloc((track->num_events + 1) * sizeof(uint64_t));
+    tl->phases = (uint64_t *)malloc((track->num_events + 1) * sizeof(uint64_t));
+    if (!tl->starts || !tl->phases) {
+        return -1;
+    }
+    uint64_t time = 0;
+    uint64_t phase = 0;
+    for (size_t i = 0; i < track->num_events; ++i) {
+        const MmlEvent *e = &track->events[i];
+        tl->starts[i] = time;
+        tl->phases[i] = phase;
+        time += e->duration_samples;
+        if (e->note_number > 0) {
+            phase += synth_phase_increment(e->note_number, sample_rate) * e->duration_samples;
+        }
+    }
+    tl->starts[track->num_events] = time;
+    tl->phases[track->num_events] = phase;
+    return 0;
+}
+
+// 時刻 time に鳴っているイベントの番号 (トラックが終わっていれば num_events)
+static size_t find_event(const TrackTimeline *tl, uint64_t time) {
+    if (time >= tl->starts[tl->num_events]) {
+        return tl->num_events;
+    }
+    // starts[i] <= time となる最後の i を二分探索する
+    size_t lo = 0;
+    size_t hi = tl->num_events;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tl->starts[mid] <= time) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// 全トラックが「イベントの切れ目」「休符の途中」「終わった後」のどれかにあれば、そこで区間を分けられる
+static int is_split_point(const BounceJob *job, uint64_t time) {
+    for (size_t t = 0; t < job->num_tracks; ++t) {
+        const TrackTimeline *tl = &job->timelines[t];
+        size_t i = find_event(tl, time);
+        if (i < tl->num_events && tl->starts[i] != time && tl->events[i].note_number > 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// 曲を区間に分ける
+// 均等に分けた時刻をそのまま使えればそれを、使えなければその後の一番近いイベントの切れ目を使う
+// (次の目安の時刻までに見つからなければ、隣の区間とまとめる)
+static int choose_splits(BounceJob *job, uint64_t total_frames, int num_threads) {
+    uint64_t target = (uint64_t)num_threads * SEGMENTS_PER_THREAD;
+    uint64_t max_segments = total_frames / ((uint64_t)job->sample_rate * MIN_SEGMENT_SEC);
+    if (target > max_segments) {
+        target = max_segments;
+    }
+    if (target < 1) {
+        target = 1;
+    }
+
+    // 全トラックのイベントの切れ目を時刻順に並べておく
+    size_t num_candidates = 0;
+    for (size_t t = 0; t < job->num_tracks; ++t) {
+        num_candidates += job->timelines[t].num_events;
+    }
+    uint64_t *candidates = (uint64_t *)malloc((num_candidates + 1) * sizeof(uint64_t));
+    job->splits = (uint64_t *)malloc((target + 1) * sizeof(uint64_t));
+    if (!candidates || !job->splits) {
+        free(candidates);
+        return -1;
+    }
+    num_candidates = 0;
+    for (size_t t = 0; t < job->num_tracks; ++t) {
+        const TrackTimeline *tl = &job->timelines[t];
+        memcpy(candidates + num_candidates, tl->starts, tl->num_events * sizeof(uint64_t));
+        num_candidates += tl->num_events;
+    }
+    qsort(candidates, num_candidates, sizeof(uint64_t), compare_u64);
+
+    size_t count = 0;
+    job->splits[count++] = 0;
+    for (uint64_t k = 1; k < target; ++k) {
+        uint64_t ideal = total_frames * k / target;
+        uint64_t limit = total_frames * (k + 1) / target;
+        if (ideal <= job->splits[count - 1]) {
+            continue;
+        }
+        if (is_split_point(job, ideal)) {
+            job->splits[count++] = ideal;
+            continue;
+        }
+        // ideal 以上の最初の候補から順に探す
+        size_t lo = 0;
+        size_t hi = num_candidates;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (candidates[mid] < ideal) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        for (size_t j = lo; j < num_candidates && candidates[j] < limit; ++j) {
+            if ((j == lo || candidates[j] != candidates[j - 1]) && is_split_point(job, candidates[j])) {
+                job->splits[count++] = candidates[j];
+                break;
+            }
+        }
+    }
+    job->splits[count] = total_frames;
+    job->num_segments = count;
+    free(candidates);
+    return 0;
+}
+
+// 途中まで書けなかった場合も含めて、指定の位置に全部書き込む
+static int pwrite_all(int fd, const void *buf, size_t size, off_t offset) {
+    const uint8_t *p = (const uint8_t *)buf;
+    while (size > 0) {
+        ssize_t n = pwrite(fd, p, size, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        size -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+int bounce_scratch_init(BounceScratch *scratch) {
+    memset(scratch, 0, sizeof(*scratch));
+    scratch->chunk = (int16_t *)malloc(WRITE_CHUNK_FRAMES * sizeof(int16_t));
+    int ok = scratch->chunk != NULL;
+    for (size_t t = 0; t < MML_MAX_TRACKS; ++t) {
+        scratch->track_buffers[t] = (int16_t *)malloc(PERIOD_FRAMES * sizeof(int16_t));
+        ok = ok && scratch->track_buffers[t];
+    }
+    if (!ok) {
+        bounce_scratch_destroy(scratch);
+        return -1;
+    }
+    return 0;
+}
+
+void bounce_scratch_destroy(BounceScratch *scratch) {
+    for (size_t t = 0; t < MML_MAX_TRACKS; ++t) {
+        free(scratch->track_buffers[t]);
+        scratch->track_buffers[t] = NULL;
+    }
+    free(scratch->chunk);
+    scratch->chunk = NULL;
+}
+
+// k番目の区間を生成してファイルに書き込む
+// 波形データはこのマシンのバイト順のまま書く (x86もRaspberry Piもリトルエンディアン)
+// 区間ごとにファイルを開き直すので、たくさんの曲を同時に書き出しても開いたままのファイルは増えない
+int bounce_render_segment(BounceJob *job, size_t k, BounceScratch *scratch) {
+    uint64_t start = job->splits[k];
+    uint64_t end = job->splits[k + 1];
+    SynthRenderer renderers[MML_MAX_TRACKS];
+    MmlEventCursor cursors[MML_MAX_TRACKS];
+    int16_t *chunk = scratch->chunk;
+    int16_t *const *track_buffers = scratch->track_buffers;
+
+    int fd = open(job->path, O_WRONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // 区間の先頭に当たるイベントから、そこまでのフェーズを引き継いで始める
+    for (size_t t = 0; t < job->num_tracks; ++t) {
+        const TrackTimeline *tl = &job->timelines[t];
+        size_t i = find_event(tl, start);
+        uint32_t offset = (i < tl->num_events) ? (uint32_t)(start - tl->starts[i]) : 0;
+        MmlEventSource source = mml_cursor_source(&cursors[t], tl->events + i, tl->num_events - i);
+        synth_renderer_init_at(&renderers[t], source, job->wavetable, job->sample_rate, tl->phases[i], offset);
+        synth_renderer_set_bank(&renderers[t], job->bank);
+    }
+
+    uint64_t pos = start;
+    while (pos < end) {
+        size_t chunk_frames = (end - pos < WRITE_CHUNK_FRAMES) ? (size_t)(end - pos) : WRITE_CHUNK_FRAMES;
+        for (size_t done = 0; done < chunk_frames; done += PERIOD_FRAMES) {
+            size_t frames = (chunk_frames - done < PERIOD_FRAMES) ? chunk_frames - done : PERIOD_FRAMES;
+            for (size_t t = 0; t < job->num_tracks; ++t) {
+                size_t n = synth_render_block(&renderers[t], track_buffers[t], frames);
+                for (size_t i = n; i < frames; ++i) {
+                    track_buffers[t][i] = 0;
+                }
+            }
+            mix_saturate(chunk + done, (const int16_t *const *)track_buffers, job->num_tracks, frames);
+        }
+        if (pwrite_all(fd, chunk, chunk_frames * sizeof(int16_t),
+                       (off_t)(WAV_HEADER_SIZE + pos * sizeof(int16_t))) != 0) {
+            close(fd);
+            return -1;
+        }
+        pos += chunk_frames;
+    }
+    return close(fd);
+}
+
+// ワーカースレッド: 区間がなくなるまで1つずつ受け持って書き出す
+static void *bounce_worker_main(void *arg) {
+    BounceRun *run = (BounceRun *)arg;
+    BounceScratch scratch;
+    int ok = bounce_scratch_init(&scratch) == 0;
+
+    if (!ok) {
+        atomic_store(&run->failed, 1);
+    }
+    while (ok && !atomic_load(&run->failed)) {
+        size_t k = atomic_fetch_add(&run->next_segment, 1);
+        if (k >= run->job->num_segments) {
+            break;
+        }
+        if (bounce_render_segment(run->job, k, &scratch) != 0) {
+            atomic_store(&run->failed, 1);
+        }
+    }
+    if (ok) {
+        bounce_scratch_destroy(&scratch);
+    }
+    return NULL;
+}
+
+BounceJob *bounce_prepare(const MmlSong *song, const Wavetable *wavetable, const WavetableBank *bank, int sample_rate,
+                          const char *path, int num_threads) {
+    BounceJob *job = (BounceJob *)calloc(1, sizeof(BounceJob));
+    if (!job) {
+        fprintf(stderr, "メモリが足りません\n");
+        return NULL;
+    }
+    job->wavetable = wavetable;
+    job->bank = bank;
+    job->sample_rate = sample_rate;
+    job->num_tracks = song->num_tracks;
+    job->path = strdup(path);
+    if (!job->path) {
+        fprintf(stderr, "メモリが足りません\n");
+        goto fail;
+    }
+
+    // 曲の長さは一番長いトラックの長さ
+    for (size_t t = 0; t < job->num_tracks; ++t) {
+        if (build_timeline(&job->timelines[t], &song->tracks[t], sample_rate) != 0) {
+            fprintf(stderr, "メモリが足りません\n");
+            goto fail;
+        }
+        uint64_t length = job->timelines[t].starts[job->timelines[t].num_events];
+        if (length > job->total_frames) {
+            job->total_frames = length;
+        }
+    }
+    if (job->total_frames * sizeof(int16_t) > WAV_MAX_DATA_BYTES) {
+        fprintf(stderr, "曲が長すぎてWAVファイルに書き出せません: %s\n", path);
+        goto fail;
+    }
+    if (num_threads <= 0) {
+        num_threads = 1;
+    }
+    if (choose_splits(job, job->total_frames, num_threads) != 0) {
+        fprintf(stderr, "メモリが足りません\n");
+        goto fail;
+    }
+
+    // ヘッダを書き、ファイルを最終的な大きさにしておく (各スレッドは自分の区間の位置に書くだけ)
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "出力ファイルを開けません: %s\n", path);
+        goto fail;
+    }
+    uint8_t header[WAV_HEADER_SIZE];
+    wav_build_header(header, WAV_FORMAT_PCM, 1, sample_rate, 16, (uint32_t)(job->total_frames * sizeof(int16_t)));
+    int written = pwrite_all(fd, header, sizeof(header), 0) == 0
+                  && ftruncate(fd, (off_t)(WAV_HEADER_SIZE + job->total_frames * sizeof(int16_t))) == 0;
+    if (close(fd) != 0 || !written) {
+        fprintf(stderr, "出力ファイルに書き込めません: %s\n", path);
+        goto fail;
+    }
+    return job;
+
+fail:
+    bounce_job_free(job);
+    return NULL;
+}
+
+size_t bounce_num_segments(const BounceJob *job) {
+    return job->num_segments;
+}
+
+uint64_t bounce_total_frames(const BounceJob *job) {
+    return job->total_frames;
+}
+
+void bounce_job_free(BounceJob *job) {
+    if (!job) {
+        return;
+    }
+    for (size_t t = 0; t < job->num_tracks; ++t) {
+        free(job->timelines[t].starts);
+        free(job->timelines[t].phases);
+    }
+    free(job->splits);
+    free(job->path);
+    free(job);
+}
+
+int bounce_song_to_wav(const MmlSong *song, const Wavetable *wavetable, const WavetableBank *bank, int sample_rate,
+                       const char *path, int num_threads, BounceStats *stats) {
+    if (num_threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = (cores > 0) ? (int)cores : 1;
+    }
+    if (num_threads > MML_MAX_TRACKS * SEGMENTS_PER_THREAD) {
+        num_threads = MML_MAX_TRACKS * SEGMENTS_PER_THREAD;
+    }
+    BounceRun run;
+    run.job = bounce_prepare(song, wavetable, bank, sample_rate, path, num_threads);
+    if (!run.job) {
+        return -1;
+    }
+    atomic_init(&run.next_segment, 0);
+    atomic_init(&run.failed, 0);
+    if ((size_t)num_threads > run.job->num_segments) {
+        num_threads = run.job->num_segments > 0 ? (int)run.job->num_segments : 1;
+    }
+
+    // 使うカーネルをここで決めておく (ワーカーが同時に選ばないように)
+    osc_kernel_selected();
+
+    // 呼び出し元のスレッドもワーカーの1つとして働く
+    pthread_t workers[MML_MAX_TRACKS * SEGMENTS_PER_THREAD];
+    int num_workers = 0;
+    for (int i = 1; i < num_threads; ++i) {
+        if (pthread_create(&workers[num_workers], NULL, bounce_worker_main, &run) == 0) {
+            num_workers++;
+        }
+    }
+    bounce_worker_main(&run);
+    for (int i = 0; i < num_workers; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+
+    int result = 0;
+    if (atomic_load(&run.failed)) {
+        fprintf(stderr, "出力ファイルに書き込めません: %s\n", path);
+        result = -1;
+    } else if (stats) {
+        stats->total_frames = run.job->total_frames;
+        stats->num_segments = run.job->num_segments;
+        stats->num_threads = num_workers + 1;
+    }
+    bounce_job_free(run.job);
+    return result;
+}
@@ -0,0 +1,66 @@
+#ifndef BOUNCE_H
+#define BOUNCE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mml_parser.h"
+#include "wavetable.h"
+#include "wavetable_bank.h"
+
+// オフライン書き出し (バウンス)
+// 再生デバイスを使わずに、曲全体を実時間より速くRIFF/WAVファイルへ書き出す
+//
+// 全トラックが「イベントの切れ目」か「休符の途中」にある時刻では、その先の波形が
+// それまでの振幅に依存しない (フェーズだけはイベントの長さから計算できる)
+// そこで曲をその時刻で独立した区間に分け、区間ごとに別々のスレッドで生成して
+// 出力ファイルの該当位置へ直接書き込む。結果は先頭から順に再生した場合と同じになる
+
+// 書き出しの結果
+typedef struct {
+    uint64_t total_frames;  // 書き出したフレーム数
+    size_t num_segments;    // 分割した区間の数
+    int num_threads;        // 使ったスレッド数
+} BounceStats;
+
+// song を path にモノラル16bitのWAVとして書き出す
+// bank: @X で選ぶ音色バンク (NULLなら全て wavetable で鳴らす)
+// num_threads: 使うスレッド数 (0以下ならCPUのコア数)
+// stats: 結果を受け取る (不要ならNULL)
+// 戻り値: 成功なら0, 失敗なら-1
+int bounce_song_to_wav(const MmlSong *song, const Wavetable *wavetable, const WavetableBank *bank, int sample_rate,
+                       const char *path, int num_threads, BounceStats *stats);
+
+// --- 区間ごとの書き出し (たくさんの曲の区間をまとめて1つのスレッドプールで生成するときに使う) ---
+
+// 書き出しの準備ができた1曲分 (区間ごとに別々のスレッドから bounce_render_segment を呼べる)
+typedef struct BounceJob BounceJob;
+
+// 区間の生成に使う作業用のバッファ (スレッドごとに1つ用意する)
+typedef struct {
+    int16_t *chunk;
+    int16_t *track_buffers[MML_MAX_TRACKS];
+} BounceScratch;
+
+// 曲を区間に分け、path にWAVのヘッダを書いて最終的な大きさにしておく
+// num_threads: 区間の数の目安にするスレッド数
+// song・wavetable・bank は bounce_job_free まで呼び出し側が保持する (複数の書き出しで共有してよい)
+// 戻り値: 失敗時はNULL
+BounceJob *bounce_prepare(const MmlSong *song, const Wavetable *wavetable, const WavetableBank *bank, int sample_rate,
+                          const char *path, int num_threads);
+
+// 区間の数 / 曲全体のフレーム数
+size_t bounce_num_segments(const BounceJob *job);
+uint64_t bounce_total_frames(const BounceJob *job);
+
+// k番目の区間を生成してファイルに書き込む (区間ごとに別々のスレッドから同時に呼んでよい)
+// 戻り値: 成功なら0, 失敗なら-1
+int bounce_render_segment(BounceJob *job, size_t k, BounceScratch *scratch);
+
+void bounce_job_free(BounceJob *job);
+
+// 作業用のバッファを確保する / 解放する
+// 戻り値: 成功なら0, 失敗なら-1
+int bounce_scratch_init(BounceScratch *scratch);
+void bounce_scratch_destroy(BounceScratch *scratch);
+
+#endif // BOUNCE_H
@@ -0,0 +1,130 @@
+#include "envelope.h"
+
+// 減衰率 (解析したときに MmlEnvelope に入れてある) の小数部のビット数
+#define RATE_BITS MML_DECAY_BITS
+
+static void set_ramp(Envelope *e, int stage, int32_t level, int32_t step, uint32_t length) {
+    e->stage = stage;
+    e->level = level;
+    e->step = step;
+    e->ramp_pos = 0;
+    e->ramp_length = length;
+}
+
+// ディケイの次の区間を始める (サステインのレベルに十分近づいていればサステインへ)
+static void begin_decay_segment(Envelope *e, int32_t level) {
+    int64_t diff = (int64_t)level - e->sustain;
+    if (diff < ENVELOPE_SETTLED && diff > -ENVELOPE_SETTLED) {
+        if (e->sustain <= 0) {
+            set_ramp(e, ENVELOPE_DONE, 0, 0, UINT32_MAX);
+        } else {
+            set_ramp(e, ENVELOPE_SUSTAIN, e->sustain, 0, UINT32_MAX);
+        }
+        return;
+    }
+    int32_t target = e->sustain + (int32_t)((diff * e->decay_segment) >> RATE_BITS);
+    set_ramp(e, ENVELOPE_DECAY, level, (int32_t)(((int64_t)target - level) / (int32_t)ENVELOPE_SEGMENT), ENVELOPE_SEGMENT);
+    e->target = target;
+}
+
+static void begin_release(Envelope *e) {
+    int32_t level = envelope_level(e);
+    if (e->release == 0 || level <= 0) {
+        set_ramp(e, ENVELOPE_DONE, 0, 0, UINT32_MAX);
+        return;
+    }
+    set_ramp(e, ENVELOPE_RELEASE, level, -(int32_t)(level / (int32_t)e->release), e->release);
+}
+
+void envelope_start(Envelope *e, int32_t peak, const MmlEnvelope *params, uint32_t duration) {
+    e->pos = 0;
+    e->peak = peak;
+    e->sustain = (int32_t)((int64_t)peak * params->sustain / 100);
+    e->attack = (params->attack < OSC_MAX_RAMP) ? params->attack : OSC_MAX_RAMP;
+    e->release = (params->release < OSC_MAX_RAMP) ? params->release : OSC_MAX_RAMP;
+    e->decay_segment = params->decay_segment;
+
+    if (duration == ENVELOPE_HOLD) {
+        e->release_at = ENVELOPE_HOLD;
+    } else {
+        // リリースがノートの長さに収まるようにする (次のノートと重ならないので、ノートごとに独立して生成できる)
+        if (e->release > duration / 2) {
+            e->release = duration / 2;
+        }
+        uint32_t gate = (uint32_t)((uint64_t)duration * (uint32_t)params->gate / MAX_GATE);
+        e->release_at = (gate < duration - e->release) ? gate : duration - e->release;
+    }
+
+    if (e->attack > 0) {
+        set_ramp(e, ENVELOPE_ATTACK, 0, peak / (int32_t)e->attack, e->attack);
+    } else {
+        begin_decay_segment(e, peak);
+    }
+    if (e->release_at == 0) {
+        begin_release(e);
+    }
+}
+
+void envelope_retrigger(Envelope *e, int32_t peak, const MmlEnvelope *params, uint32_t duration) {
+    int32_t level = envelope_level(e);
+    envelope_start(e, peak, params, duration);
+    if (e->stage != ENVELOPE_ATTACK || level <= 0) {
+        return;
+    }
+    if (level >= peak) {
+        // もう音量を超えているので、アタックを飛ばして今の音量からディケイする
+        begin_decay_segment(e, level);
+        return;
+    }
+    // 残りの差の分だけのアタックにして、傾きは最初から鳴らしたときと同じにする
+    uint32_t attack = (uint32_t)((uint64_t)e->attack * (uint32_t)(peak - level) / (uint32_t)peak);
+    if (attack == 0) {
+        begin_decay_segment(e, peak);
+        return;
+    }
+    set_ramp(e, ENVELOPE_ATTACK, level, (peak - level) / (int32_t)attack, attack);
+}
+
+void envelope_release(Envelope *e) {
+    if (e->stage < ENVELOPE_RELEASE) {
+        begin_release(e);
+    }
+}
+
+size_t envelope_apply(Envelope *e, OscState *osc, size_t max_n) {
+    size_t n = max_n;
+    if (e->ramp_length != UINT32_MAX && e->ramp_length - e->ramp_pos < n) {
+        n = e->ramp_length - e->ramp_pos;
+    }
+    if (e->stage < ENVELOPE_RELEASE && e->release_at - e->pos < n) {
+        n = e->release_at - e->pos;
+    }
+    osc_set_ramp(osc, e->level, e->step, e->ramp_pos);
+    return n;
+}
+
+void envelope_advance(Envelope *e, size_t n) {
+    e->pos += (uint32_t)n;
+    e->ramp_pos += (uint32_t)n;
+    if (e->ramp_length != UINT32_MAX && e->ramp_pos >= e->ramp_length) {
+        if (e->stage == ENVELOPE_ATTACK) {
+            begin_decay_segment(e, e->peak);
+        } else if (e->stage == ENVELOPE_DECAY) {
+            begin_decay_segment(e, e->target);
+        } else if (e->stage == ENVELOPE_RELEASE) {
+            set_ramp(e, ENVELOPE_DONE, 0, 0, UINT32_MAX);
+        }
+    }
+    if (e->stage < ENVELOPE_RELEASE && e->pos >= e->release_at) {
+        begin_release(e);
+    }
+}
+
+int32_t envelope_level(const Envelope *e) {
+    int64_t level = (int64_t)e->level + (int64_t)e->step * e->ramp_pos;
+    return (level > 0) ? (int32_t)level : 0;
+}
+
+int envelope_finished(const Envelope *e) {
+    return e->stage == ENVELOPE_DONE;
+}
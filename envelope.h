@@ -0,0 +1,75 @@
+#ifndef ENVELOPE_H
+#define ENVELOPE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mml_parser.h"
+#include "osc_kernel.h"
+
+// 音量エンベロープ (ADSR)
+// 1サンプルずつ音量を計算するのではなく、区間ごとの直線 (ランプ) を作って発振器に渡す
+// 発振器はランプをSIMDでまとめて掛けるので、エンベロープの計算はブロックあたり数回で済む
+//   アタック:   0から音量まで直線で上がる
+//   ディケイ:   サステインのレベルへ指数的に近づく (ENVELOPE_SEGMENT サンプルごとの直線で近似する)
+//   サステイン: 一定
+//   リリース:   その時点の音量から0まで直線で下がる
+// 鳴り終わった (ENVELOPE_DONE) 音は発振器を動かさずに飛ばせる
+// 計算は全て整数 (音量は小数部 OSC_GAIN_BITS) なので、Q15版でも浮動小数点を使わない
+
+#define ENVELOPE_SEGMENT_BITS MML_DECAY_SEGMENT_BITS
+#define ENVELOPE_SEGMENT (1u << ENVELOPE_SEGMENT_BITS)  // ディケイを直線で近似する区間の長さ
+// サステインのレベルとの差がこれより小さくなったらディケイを終える (16bitの1LSBの1/4程度)
+#define ENVELOPE_SETTLED (1 << (OSC_GAIN_BITS - 17))
+// ノートオフまでリリースしない (ライブ演奏用)
+#define ENVELOPE_HOLD UINT32_MAX
+
+typedef enum {
+    ENVELOPE_ATTACK,
+    ENVELOPE_DECAY,
+    ENVELOPE_SUSTAIN,
+    ENVELOPE_RELEASE,
+    ENVELOPE_DONE,
+} EnvelopeStage;
+
+typedef struct {
+    int stage;              // EnvelopeStage
+    uint32_t pos;           // ノートの先頭からのサンプル数
+    uint32_t release_at;    // リリースを始める位置 (ENVELOPE_HOLD ならノートオフまで)
+    int32_t peak;           // アタックの終わりの音量
+    int32_t sustain;        // サステインのレベル
+    uint32_t attack;        // アタックの長さ
+    uint32_t release;       // リリースの長さ
+    uint32_t decay_segment; // ENVELOPE_SEGMENT サンプルあたりのディケイの減衰率 (小数部30bit)
+
+    // 今のランプ (段階の途中からでも、この3つで音量が決まる)
+    int32_t level;          // ランプの始点の音量
+    int32_t step;           // 1サンプルあたりの変化
+    uint32_t ramp_pos;      // ランプの始点からのサンプル数
+    uint32_t ramp_length;   // ランプの長さ (UINT32_MAX なら終わりなし)
+    int32_t target;         // ランプの終点の音量 (ディケイ中のみ。誤差をためないように終点はこの値にそろえる)
+} Envelope;
+
+// ノートの開始
+// peak: 音量 (小数部 OSC_GAIN_BITS)、duration: ノートの長さ (ENVELOPE_HOLD ならノートオフまで鳴らす)
+// 長さが決まっているノートは、ゲートタイムの位置か、リリースが長さ内に収まる位置の早い方でリリースする
+void envelope_start(Envelope *e, int32_t peak, const MmlEnvelope *params, uint32_t duration);
+
+// 鳴っている途中のノートを新しいノートで始め直す (アタックを0からではなく今の音量から始めて、音量の段差を作らない)
+void envelope_retrigger(Envelope *e, int32_t peak, const MmlEnvelope *params, uint32_t duration);
+
+// ノートオフ (今の音量からリリースを始める)
+void envelope_release(Envelope *e);
+
+// 今のランプを発振器に設定し、そのランプのまま生成してよいサンプル数 (max_n 以下) を返す
+size_t envelope_apply(Envelope *e, OscState *osc, size_t max_n);
+
+// n サンプル生成した分だけ進める (n は直前の envelope_apply の戻り値以下)
+void envelope_advance(Envelope *e, size_t n);
+
+// 今の音量 (小数部 OSC_GAIN_BITS)
+int32_t envelope_level(const Envelope *e);
+
+// 鳴り終わったかどうか
+int envelope_finished(const Envelope *e);
+
+#endif // ENVELOPE_H
@@ -0,0 +1,136 @@
+#include "live_input.h"
+#include "realtime.h"
+#include <alsa/asoundlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+
+#define POLL_TIMEOUT_MS     100     // 終了要求を確かめる間隔
+#define MAX_POLL_FDS        4
+
+// MIDIのコントロールチェンジ番号
+#define CC_ALL_SOUND_OFF    120
+#define CC_ALL_NOTES_OFF    123
+
+static void push_message(LiveInput *in, uint8_t type, uint8_t note, uint8_t velocity) {
+    NoteMessage message = { type, note, velocity };
+    if (!note_queue_push(in->queue, message)) {
+        atomic_fetch_add(&in->dropped, 1);
+    }
+}
+
+// シーケンサのイベントをノートのメッセージに変換して積む
+static void handle_event(LiveInput *in, const snd_seq_event_t *ev) {
+    switch (ev->type) {
+    case SND_SEQ_EVENT_NOTEON:
+        // ベロシティ0のノートオンはノートオフとして扱う
+        if (ev->data.note.velocity == 0) {
+            push_message(in, NOTE_MESSAGE_OFF, ev->data.note.note, 0);
+        } else {
+            push_message(in, NOTE_MESSAGE_ON, ev->data.note.note, ev->data.note.velocity);
+        }
+        break;
+    case SND_SEQ_EVENT_NOTEOFF:
+        push_message(in, NOTE_MESSAGE_OFF, ev->data.note.note, 0);
+        break;
+    case SND_SEQ_EVENT_CONTROLLER:
+        if (ev->data.control.param == CC_ALL_SOUND_OFF || ev->data.control.param == CC_ALL_NOTES_OFF) {
+            push_message(in, NOTE_MESSAGE_ALL_OFF, 0, 0);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// 入力スレッド: イベントが届くまで poll で待ち、届いた分を全部キューに積む
+static void *input_thread_main(void *arg) {
+    LiveInput *in = (LiveInput *)arg;
+    snd_seq_t *seq = (snd_seq_t *)in->seq;
+    struct pollfd fds[MAX_POLL_FDS];
+    int nfds = snd_seq_poll_descriptors(seq, fds, MAX_POLL_FDS, POLLIN);
+
+    while (!atomic_load(&in->quit)) {
+        if (poll(fds, (nfds_t)nfds, POLL_TIMEOUT_MS) <= 0) {
+            continue;
+        }
+        for (;;) {
+            snd_seq_event_t *ev;
+            int err = snd_seq_event_input(seq, &ev);
+            if (err == -EAGAIN) {
+                break;
+            }
+            if (err < 0) {
+                // -ENOSPC: 読み出しが追いつかずにカーネル側のバッファからあふれた
+                fprintf(stderr, "警告: シーケンサの入力エラー: %s\n", snd_strerror(err));
+                break;
+            }
+            handle_event(in, ev);
+        }
+    }
+    return NULL;
+}
+
+int live_input_open(LiveInput *in, NoteQueue *queue, const char *connect_from) {
+    snd_seq_t *seq;
+    int err;
+
+    in->queue = queue;
+    atomic_init(&in->quit, 0);
+    atomic_init(&in->dropped, 0);
+
+    err = snd_seq_open(&seq, "default", SND_SEQ_OPEN_INPUT, SND_SEQ_NONBLOCK);
+    if (err < 0) {
+        fprintf(stderr, "シーケンサを開けません: %s\n", snd_strerror(err));
+        return -1;
+    }
+    snd_seq_set_client_name(seq, LIVE_INPUT_CLIENT_NAME);
+    in->port = snd_seq_create_simple_port(seq, LIVE_INPUT_PORT_NAME,
+                                          SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
+                                          SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+    if (in->port < 0) {
+        fprintf(stderr, "シーケンサのポートを作れません: %s\n", snd_strerror(in->port));
+        snd_seq_close(seq);
+        return -1;
+    }
+    in->client = snd_seq_client_id(seq);
+
+    if (connect_from) {
+        snd_seq_addr_t addr;
+        if (snd_seq_parse_address(seq, &addr, connect_from) < 0
+            || snd_seq_connect_from(seq, in->port, addr.client, addr.port) < 0) {
+            fprintf(stderr, "入力元につなげません: %s\n", connect_from);
+            snd_seq_close(seq);
+            return -1;
+        }
+    }
+    if (snd_seq_poll_descriptors_count(seq, POLLIN) > MAX_POLL_FDS) {
+        fprintf(stderr, "シーケンサのディスクリプタが多すぎます\n");
+        snd_seq_close(seq);
+        return -1;
+    }
+    in->seq = seq;
+
+    // ノートの到着から音声スレッドに渡すまでを遅らせないよう、入力スレッドも優先度を上げる
+    if (realtime_thread_create(&in->thread, input_thread_main, in) != 0) {
+        snd_seq_close(seq);
+        in->seq = NULL;
+        return -1;
+    }
+    printf("MIDI入力ポート: %d:%d\n", in->client, in->port);
+    fflush(stdout);
+    return 0;
+}
+
+void live_input_close(LiveInput *in) {
+    if (!in->seq) {
+        return;
+    }
+    atomic_store(&in->quit, 1);
+    pthread_join(in->thread, NULL);
+    snd_seq_close((snd_seq_t *)in->seq);
+    in->seq = NULL;
+    if (atomic_load(&in->dropped) > 0) {
+        fprintf(stderr, "警告: キューが満杯で %lu 個のノートを捨てました\n", atomic_load(&in->dropped));
+    }
+}
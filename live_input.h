@@ -0,0 +1,34 @@
+#ifndef LIVE_INPUT_H
+#define LIVE_INPUT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "note_queue.h"
+
+// ALSAシーケンサからのノート入力
+// シーケンサに書き込み用のポートを作り、届いたノートオン・ノートオフを NoteQueue に積む
+// 別のポートからつなぐには aconnect を使うか、open のときに接続元を指定する
+//   例: aconnect 20:0 <クライアント番号>:0
+//       aplaymidi -p <クライアント番号>:0 song.mid
+#define LIVE_INPUT_CLIENT_NAME  "synthe-2025"
+#define LIVE_INPUT_PORT_NAME    "synthe-2025 input"
+
+typedef struct {
+    void *seq;                  // snd_seq_t
+    int client;                 // 自分のクライアント番号
+    int port;                   // 自分のポート番号
+    NoteQueue *queue;           // ノートを積む先 (呼び出し側が保持する)
+    pthread_t thread;           // 入力を待つスレッド
+    atomic_int quit;            // 入力スレッドへの終了要求
+    atomic_ulong dropped;       // キューが満杯で捨てたノートの数
+} LiveInput;
+
+// シーケンサのポートを作り、入力スレッドを起動する
+// connect_from が NULL でなければ、そのポート ("クライアント:ポート" または名前) から自動でつなぐ
+// 戻り値: 成功なら0, 失敗なら-1
+int live_input_open(LiveInput *in, NoteQueue *queue, const char *connect_from);
+
+// 入力スレッドを止めてポートを閉じる
+void live_input_close(LiveInput *in);
+
+#endif // LIVE_INPUT_H
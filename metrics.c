@@ -0,0 +1,190 @@
+#include "metrics.h"
+#include <string.h>
+#include <time.h>
+
+static const char *const stage_names[METRICS_NUM_STAGES] = {
+    "parse", "wavetable_load", "render", "write",
+};
+
+uint64_t metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void histogram_reset(MetricsHistogram *h) {
+    memset(h, 0, sizeof(*h));
+    h->min_ns = UINT64_MAX;
+}
+
+int metrics_open(Metrics *m, const char *path, int sample_rate) {
+    memset(m, 0, sizeof(*m));
+    if (strcmp(path, "-") == 0) {
+        m->fp = stderr;
+    } else {
+        m->fp = fopen(path, "a");
+        if (!m->fp) {
+            fprintf(stderr, "計測結果の書き出し先を開けません: %s\n", path);
+            return -1;
+        }
+        m->owns_fp = 1;
+    }
+    m->sample_rate = sample_rate;
+    m->started_ns = metrics_now();
+    m->last_report_ns = m->started_ns;
+    for (int s = 0; s < METRICS_NUM_STAGES; ++s) {
+        histogram_reset(&m->stages[s]);
+    }
+    return 0;
+}
+
+// 1マイクロ秒未満は0番、それ以降は2倍ごとに1つずつ上の区間
+static int bucket_of(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    int b = 0;
+    while (us > 0 && b < METRICS_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+void metrics_record(Metrics *m, MetricsStage stage, uint64_t ns) {
+    if (!m->fp) {
+        return;
+    }
+    MetricsHistogram *h = &m->stages[stage];
+    h->count++;
+    h->sum_ns += ns;
+    if (ns < h->min_ns) {
+        h->min_ns = ns;
+    }
+    if (ns > h->max_ns) {
+        h->max_ns = ns;
+    }
+    h->buckets[bucket_of(ns)]++;
+}
+
+void metrics_record_render(Metrics *m, uint64_t ns, size_t frames) {
+    metrics_record(m, METRICS_RENDER, ns);
+    m->rendered_frames += frames;
+}
+
+void metrics_record_voices(Metrics *m, const uint64_t *voice_ns, size_t num_voices) {
+    if (num_voices > METRICS_MAX_VOICES) {
+        num_voices = METRICS_MAX_VOICES;
+    }
+    m->num_voices = num_voices;
+    memcpy(m->voice_ns, voice_ns, num_voices * sizeof(uint64_t));
+}
+
+void metrics_record_device(Metrics *m, long delay, long avail, uint64_t underruns, uint64_t recoveries) {
+    if (delay >= 0) {
+        if (!m->has_device || delay < m->min_delay) {
+            m->min_delay = delay;
+        }
+        m->has_device = 1;
+        m->delay = delay;
+        m->avail = avail;
+    }
+    m->underruns = underruns;
+    m->recoveries = recoveries;
+}
+
+// 全体の q (0~1) の位置にある値を、その区間の上端で近似する
+static double percentile_us(const MetricsHistogram *h, double q) {
+    uint64_t rank = (uint64_t)(q * (double)h->count + 0.5);
+    uint64_t seen = 0;
+    if (rank < 1) {
+        rank = 1;
+    }
+    for (int b = 0; b < METRICS_BUCKETS; ++b) {
+        seen += h->buckets[b];
+        if (seen >= rank) {
+            double upper = (double)(1ULL << b);
+            double max_us = (double)h->max_ns / 1000.0;
+            return upper < max_us ? upper : max_us;
+        }
+    }
+    return (double)h->max_ns / 1000.0;
+}
+
+static void write_histogram(FILE *fp, const MetricsHistogram *h) {
+    fprintf(fp, "{\"count\":%llu", (unsigned long long)h->count);
+    if (h->count > 0) {
+        fprintf(fp, ",\"mean_us\":%.1f,\"min_us\":%.1f,\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f,\"buckets\":[",
+                (double)h->sum_ns / (double)h->count / 1000.0, (double)h->min_ns / 1000.0,
+                percentile_us(h, 0.50), percentile_us(h, 0.99), (double)h->max_ns / 1000.0);
+        // 後ろの空の区間は省く (i 番目は 2^(i-1) ~ 2^i マイクロ秒)
+        int last = METRICS_BUCKETS - 1;
+        while (last > 0 && h->buckets[last] == 0) {
+            last--;
+        }
+        for (int b = 0; b <= last; ++b) {
+            fprintf(fp, "%s%llu", b > 0 ? "," : "", (unsigned long long)h->buckets[b]);
+        }
+        fputc(']', fp);
+    }
+    fputc('}', fp);
+}
+
+void metrics_report(Metrics *m) {
+    if (!m->fp) {
+        return;
+    }
+    uint64_t now = metrics_now();
+    double interval = (double)(now - m->last_report_ns) / 1e9;
+    double audio_seconds = (double)m->rendered_frames / m->sample_rate;
+    FILE *fp = m->fp;
+
+    fprintf(fp, "{\"time\":%.3f,\"interval\":%.3f", (double)(now - m->started_ns) / 1e9, interval);
+    for (int s = 0; s < METRICS_NUM_STAGES; ++s) {
+        fprintf(fp, ",\"%s\":", stage_names[s]);
+        write_histogram(fp, &m->stages[s]);
+    }
+
+    // 生成にかかった時間の、生成した音の長さに対する割合 (100%を超えると実時間に間に合わない)
+    const MetricsHistogram *render = &m->stages[METRICS_RENDER];
+    fprintf(fp, ",\"rendered_frames\":%llu,\"render_cpu_percent\":%.2f,\"voice_cpu_percent\":[",
+            (unsigned long long)m->rendered_frames,
+            audio_seconds > 0 ? 100.0 * (double)render->sum_ns / 1e9 / audio_seconds : 0.0);
+    for (size_t v = 0; v < m->num_voices; ++v) {
+        uint64_t ns = m->voice_ns[v] - m->reported_voice_ns[v];
+        fprintf(fp, "%s%.2f", v > 0 ? "," : "", audio_seconds > 0 ? 100.0 * (double)ns / 1e9 / audio_seconds : 0.0);
+        m->reported_voice_ns[v] = m->voice_ns[v];
+    }
+    fputc(']', fp);
+
+    if (m->has_device) {
+        fprintf(fp, ",\"delay\":%ld,\"avail\":%ld,\"min_delay\":%ld", m->delay, m->avail, m->min_delay);
+    }
+    fprintf(fp, ",\"underruns\":%llu,\"new_underruns\":%llu,\"recoveries\":%llu}\n",
+            (unsigned long long)m->underruns, (unsigned long long)(m->underruns - m->reported_underruns),
+            (unsigned long long)m->recoveries);
+    fflush(fp);
+
+    for (int s = 0; s < METRICS_NUM_STAGES; ++s) {
+        histogram_reset(&m->stages[s]);
+    }
+    m->rendered_frames = 0;
+    m->has_device = 0;
+    m->reported_underruns = m->underruns;
+    m->last_report_ns = now;
+}
+
+void metrics_maybe_report(Metrics *m) {
+    if (m->fp && metrics_now() - m->last_report_ns >= METRICS_INTERVAL_NS) {
+        metrics_report(m);
+    }
+}
+
+void metrics_close(Metrics *m) {
+    if (!m->fp) {
+        return;
+    }
+    metrics_report(m);
+    if (m->owns_fp) {
+        fclose(m->fp);
+    }
+    m->fp = NULL;
+}
@@ -0,0 +1,93 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// 再生中の計測
+// 段階 (MMLの解析・ウェーブテーブルの読み込み・1ブロックの生成・デバイスへの書き込み) ごとの所要時間のヒストグラムと、
+// デバイスのバッファの状態・アンダーランの回数・トラック (声部) ごとのCPU時間を集め、
+// 一定間隔で1行のJSONにして書き出す (音切れが起きた時刻と負荷を突き合わせるため)
+//
+// 所要時間は 1マイクロ秒未満, 1~2, 2~4, ... マイクロ秒 の2倍ごとの区間で数える
+// 中央値などは区間の上端で近似する (最大値を超える場合は最大値)
+// ヒストグラムは報告のたびに0に戻し、アンダーランなどの回数は通算で書く
+// 書き出しはファイルへの書き込みなので、リアルタイムの再生スレッドからは呼ばない
+
+#define METRICS_BUCKETS         24      // 区間の数 (最後の区間は 2^22 マイクロ秒 = 約4秒以上)
+#define METRICS_MAX_VOICES      16      // CPU時間を数えるトラックの数の上限 (MML_MAX_TRACKS と同じ)
+#define METRICS_INTERVAL_NS     1000000000ULL   // 報告の間隔 (1秒)
+
+typedef enum {
+    METRICS_PARSE,              // MMLの解析 (コンパイル済みデータの読み込みを含む)
+    METRICS_WAVETABLE_LOAD,     // ウェーブテーブル・音色バンクの読み込み
+    METRICS_RENDER,             // 1ブロックの生成
+    METRICS_WRITE,              // 1ブロックのデバイスへの書き込み (デバイスの空きを待つ時間を含む)
+    METRICS_NUM_STAGES,
+} MetricsStage;
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t buckets[METRICS_BUCKETS];
+} MetricsHistogram;
+
+typedef struct {
+    FILE *fp;                   // 書き出し先 (NULLなら計測しない)
+    int owns_fp;                // 閉じるときに fclose するか (標準エラーなら0)
+    int sample_rate;
+    uint64_t started_ns;        // metrics_open した時刻
+    uint64_t last_report_ns;    // 前回報告した時刻
+
+    // 前回の報告からの分
+    MetricsHistogram stages[METRICS_NUM_STAGES];
+    uint64_t rendered_frames;   // 生成したフレーム数
+
+    // トラックごとの生成にかかった時間 (通算。前回の報告時の値との差を書く)
+    size_t num_voices;
+    uint64_t voice_ns[METRICS_MAX_VOICES];
+    uint64_t reported_voice_ns[METRICS_MAX_VOICES];
+
+    // デバイスの状態 (最後に読んだ値と、前回の報告からで一番バッファが減ったときの値)
+    int has_device;
+    long delay;                 // まだ鳴っていないフレーム数 (snd_pcm_delay)
+    long avail;                 // 書き込めるフレーム数 (snd_pcm_avail)
+    long min_delay;
+    uint64_t underruns;         // 通算
+    uint64_t recoveries;
+    uint64_t reported_underruns;
+} Metrics;
+
+// 単調増加の時計の現在時刻 (ナノ秒)
+uint64_t metrics_now(void);
+
+// 計測を始める (path が "-" なら標準エラー、それ以外はファイルに追記する)
+// 戻り値: 成功なら0, ファイルを開けなければ-1
+int metrics_open(Metrics *m, const char *path, int sample_rate);
+
+// 段階 stage に ns ナノ秒かかったことを記録する
+void metrics_record(Metrics *m, MetricsStage stage, uint64_t ns);
+
+// 1ブロック (frames フレーム) の生成に ns ナノ秒かかったことを記録する
+void metrics_record_render(Metrics *m, uint64_t ns, size_t frames);
+
+// トラックごとの生成時間の通算値 (SongRenderer の track_ns) を記録する
+void metrics_record_voices(Metrics *m, const uint64_t *voice_ns, size_t num_voices);
+
+// デバイスの状態とアンダーラン・回復の通算回数を記録する
+// (状態を読めない出力先なら delay/avail に -1 を渡す)
+void metrics_record_device(Metrics *m, long delay, long avail, uint64_t underruns, uint64_t recoveries);
+
+// 前回の報告から METRICS_INTERVAL_NS 経っていれば1行書き出す
+void metrics_maybe_report(Metrics *m);
+
+// 今までの分をすぐに1行書き出す
+void metrics_report(Metrics *m);
+
+// 残りを書き出して閉じる
+void metrics_close(Metrics *m);
+
+#endif // METRICS_H
@@ -0,0 +1,280 @@
+#include "mixer.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#define MIX_HAVE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MIX_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+// 一度に足し合わせるフレーム数 (int32の作業領域をスタックに置ける大きさ)
+#define MIX_CHUNK 256
+
+// 全トラックの start から n フレームを合計して、16bitの範囲に飽和させる
+static inline void mix_chunk(int32_t *acc, const int16_t *const *inputs, size_t num_inputs, size_t start, size_t n) {
+    // トラックごとに連続したメモリを足し込む (コンパイラがベクトル化しやすい形)
+    for (size_t i = 0; i < n; ++i) {
+        acc[i] = 0;
+    }
+    for (size_t t = 0; t < num_inputs; ++t) {
+        const int16_t *in = inputs[t] + start;
+        for (size_t i = 0; i < n; ++i) {
+            acc[i] += in[i];
+        }
+    }
+    // 16bitの範囲に収める
+    for (size_t i = 0; i < n; ++i) {
+        int32_t sum = acc[i];
+        if (sum > INT16_MAX) sum = INT16_MAX;
+        if (sum < INT16_MIN) sum = INT16_MIN;
+        acc[i] = sum;
+    }
+}
+
+// 16bitの範囲の値 v を形式 format のサンプル1つにして dst に書く
+// 戻り値: 次のサンプルの位置
+__attribute__((always_inline))
+static inline uint8_t *store_sample(uint8_t *dst, int32_t v, const AudioSampleFormat format) {
+    switch (format) {
+    case AUDIO_FORMAT_S16_LE: {
+        int16_t s = (int16_t)v;
+        memcpy(dst, &s, 2);
+        return dst + 2;
+    }
+    case AUDIO_FORMAT_S24_3LE:
+        // 16bitの値を上位に置く (下位8bitは0)
+        dst[0] = 0;
+        dst[1] = (uint8_t)v;
+        dst[2] = (uint8_t)(v >> 8);
+        return dst + 3;
+    case AUDIO_FORMAT_S32_LE: {
+        int32_t s = (int32_t)((uint32_t)v << 16);
+        memcpy(dst, &s, 4);
+        return dst + 4;
+    }
+    case AUDIO_FORMAT_FLOAT_LE: {
+        float f = (float)v * (1.0f / 32768.0f);
+        memcpy(dst, &f, 4);
+        return dst + 4;
+    }
+    }
+    return dst;
+}
+
+// --- 形式 x チャンネル数ごとの特殊化 ---
+// 本体は形式とチャンネル数を定数として受け取る always_inline の関数にして、組み合わせごとに展開する
+// (サンプルごとの形式の分岐とチャンネルのループがなくなる)
+__attribute__((always_inline))
+static inline void mix_impl(void *out, const int16_t *const *inputs, size_t num_inputs, size_t frames,
+                            const AudioSampleFormat format, const int channels) {
+    int32_t acc[MIX_CHUNK];
+    uint8_t *dst = (uint8_t *)out;
+
+    for (size_t start = 0; start < frames; start += MIX_CHUNK) {
+        size_t n = frames - start;
+        if (n > MIX_CHUNK) {
+            n = MIX_CHUNK;
+        }
+        mix_chunk(acc, inputs, num_inputs, start, n);
+        for (size_t i = 0; i < n; ++i) {
+            for (int c = 0; c < channels; ++c) {
+                dst = store_sample(dst, acc[i], format);
+            }
+        }
+    }
+}
+
+void mix_saturate(int16_t *out, const int16_t *const *inputs, size_t num_inputs, size_t frames) {
+    mix_impl(out, inputs, num_inputs, frames, AUDIO_FORMAT_S16_LE, 1);
+}
+
+// --- 定位をつけたミックス ---
+
+void mixer_pan_gains(int pan, int16_t gains[2]) {
+    // 0 ~ 64 を左半分, 64 ~ 127 を右半分にして、角度 0 (左) ~ π/2 (右) にする
+    double x = (pan < 64) ? (double)(pan - 64) / 64.0 : (double)(pan - 64) / 63.0;
+    if (x < -1.0) x = -1.0;
+    if (x > 1.0) x = 1.0;
+    double angle = (x + 1.0) * M_PI / 4.0;
+    gains[0] = (int16_t)lround(M_SQRT2 * cos(angle) * (1 << MIXER_PAN_BITS));
+    gains[1] = (int16_t)lround(M_SQRT2 * sin(angle) * (1 << MIXER_PAN_BITS));
+}
+
+// 1トラックの n サンプルに左右の音量を掛けて、左右の作業領域に足し込む
+// (積は32bitに収まり、MIXER_PAN_BITS だけ右シフトしてから足すので、どのカーネルでも同じ値になる)
+static inline void pan_accumulate(int32_t *left, int32_t *right, const int16_t *in, const int16_t gains[2], size_t n) {
+    size_t i = 0;
+#if defined(MIX_HAVE_SSE2)
+    __m128i gl = _mm_set1_epi16(gains[0]);
+    __m128i gr = _mm_set1_epi16(gains[1]);
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+        // 16bit x 16bit の積の下位・上位を並べ直して32bitにする
+        __m128i lo = _mm_mullo_epi16(x, gl);
+        __m128i hi = _mm_mulhi_epi16(x, gl);
+        __m128i l0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), MIXER_PAN_BITS);
+        __m128i l1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), MIXER_PAN_BITS);
+        lo = _mm_mullo_epi16(x, gr);
+        hi = _mm_mulhi_epi16(x, gr);
+        __m128i r0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), MIXER_PAN_BITS);
+        __m128i r1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), MIXER_PAN_BITS);
+        _mm_storeu_si128((__m128i *)(left + i), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(left + i)), l0));
+        _mm_storeu_si128((__m128i *)(left + i + 4), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(left + i + 4)), l1));
+        _mm_storeu_si128((__m128i *)(right + i), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(right + i)), r0));
+        _mm_storeu_si128((__m128i *)(right + i + 4), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(right + i + 4)), r1));
+    }
+#elif defined(MIX_HAVE_NEON)
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t x = vld1q_s16(in + i);
+        int32x4_t l0 = vshrq_n_s32(vmull_n_s16(vget_low_s16(x), gains[0]), MIXER_PAN_BITS);
+        int32x4_t l1 = vshrq_n_s32(vmull_n_s16(vget_high_s16(x), gains[0]), MIXER_PAN_BITS);
+        int32x4_t r0 = vshrq_n_s32(vmull_n_s16(vget_low_s16(x), gains[1]), MIXER_PAN_BITS);
+        int32x4_t r1 = vshrq_n_s32(vmull_n_s16(vget_high_s16(x), gains[1]), MIXER_PAN_BITS);
+        vst1q_s32(left + i, vaddq_s32(vld1q_s32(left + i), l0));
+        vst1q_s32(left + i + 4, vaddq_s32(vld1q_s32(left + i + 4), l1));
+        vst1q_s32(right + i, vaddq_s32(vld1q_s32(right + i), r0));
+        vst1q_s32(right + i + 4, vaddq_s32(vld1q_s32(right + i + 4), r1));
+    }
+#endif
+    for (; i < n; ++i) {
+        left[i] += ((int32_t)in[i] * gains[0]) >> MIXER_PAN_BITS;
+        right[i] += ((int32_t)in[i] * gains[1]) >> MIXER_PAN_BITS;
+    }
+}
+
+static inline int32_t saturate16(int32_t v) {
+    return v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+}
+
+__attribute__((always_inline))
+static inline void pan_impl(void *out, const MixPanInput *inputs, size_t num_inputs, size_t frames,
+                            const AudioSampleFormat format, const int channels) {
+    int32_t left[MIX_CHUNK];
+    int32_t right[MIX_CHUNK];
+    int32_t mono[MIX_CHUNK];
+    uint8_t *dst = (uint8_t *)out;
+
+    for (size_t start = 0; start < frames; start += MIX_CHUNK) {
+        size_t n = frames - start;
+        if (n > MIX_CHUNK) {
+            n = MIX_CHUNK;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            left[i] = 0;
+            right[i] = 0;
+        }
+        // トラックごとに、このチャンクにかかる区間だけ足し込む
+        for (size_t t = 0; t < num_inputs; ++t) {
+            const MixPanInput *in = &inputs[t];
+            for (size_t k = 0; k < in->num_segments; ++k) {
+                size_t begin = in->segments[k].start;
+                size_t end = (k + 1 < in->num_segments) ? in->segments[k + 1].start : frames;
+                if (begin < start) begin = start;
+                if (end > start + n) end = start + n;
+                if (begin < end) {
+                    pan_accumulate(left + (begin - start), right + (begin - start), in->samples + begin,
+                                   in->segments[k].gains, end - begin);
+                }
+            }
+        }
+        // 3チャンネル以上なら、残りのチャンネル用にモノラルのミックスも作る
+        if (channels > 2) {
+            for (size_t i = 0; i < n; ++i) {
+                mono[i] = 0;
+            }
+            for (size_t t = 0; t < num_inputs; ++t) {
+                const int16_t *in = inputs[t].samples + start;
+                for (size_t i = 0; i < n; ++i) {
+                    mono[i] += in[i];
+                }
+            }
+            for (size_t i = 0; i < n; ++i) {
+                mono[i] = saturate16(mono[i]);
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            dst = store_sample(dst, saturate16(left[i]), format);
+            dst = store_sample(dst, saturate16(right[i]), format);
+            for (int c = 2; c < channels; ++c) {
+                dst = store_sample(dst, mono[i], format);
+            }
+        }
+    }
+}
+
+// 形式 format, チャンネル数 channels (0ならループで回す) のカーネルを作る
+#define MIX_KERNEL(name, format, channels) \
+    static void name(void *out, const int16_t *const *inputs, size_t num_inputs, size_t frames, int n) { \
+        mix_impl(out, inputs, num_inputs, frames, format, (channels) ? (channels) : n); \
+    }
+#define PAN_KERNEL(name, format, channels) \
+    static void name(void *out, const MixPanInput *inputs, size_t num_inputs, size_t frames, int n) { \
+        pan_impl(out, inputs, num_inputs, frames, format, (channels) ? (channels) : n); \
+    }
+
+MIX_KERNEL(mix_s16_1, AUDIO_FORMAT_S16_LE, 1)
+MIX_KERNEL(mix_s16_2, AUDIO_FORMAT_S16_LE, 2)
+MIX_KERNEL(mix_s16_n, AUDIO_FORMAT_S16_LE, 0)
+MIX_KERNEL(mix_s24_1, AUDIO_FORMAT_S24_3LE, 1)
+MIX_KERNEL(mix_s24_2, AUDIO_FORMAT_S24_3LE, 2)
+MIX_KERNEL(mix_s24_n, AUDIO_FORMAT_S24_3LE, 0)
+MIX_KERNEL(mix_s32_1, AUDIO_FORMAT_S32_LE, 1)
+MIX_KERNEL(mix_s32_2, AUDIO_FORMAT_S32_LE, 2)
+MIX_KERNEL(mix_s32_n, AUDIO_FORMAT_S32_LE, 0)
+MIX_KERNEL(mix_float_1, AUDIO_FORMAT_FLOAT_LE, 1)
+MIX_KERNEL(mix_float_2, AUDIO_FORMAT_FLOAT_LE, 2)
+MIX_KERNEL(mix_float_n, AUDIO_FORMAT_FLOAT_LE, 0)
+
+PAN_KERNEL(pan_s16_2, AUDIO_FORMAT_S16_LE, 2)
+PAN_KERNEL(pan_s16_n, AUDIO_FORMAT_S16_LE, 0)
+PAN_KERNEL(pan_s24_2, AUDIO_FORMAT_S24_3LE, 2)
+PAN_KERNEL(pan_s24_n, AUDIO_FORMAT_S24_3LE, 0)
+PAN_KERNEL(pan_s32_2, AUDIO_FORMAT_S32_LE, 2)
+PAN_KERNEL(pan_s32_n, AUDIO_FORMAT_S32_LE, 0)
+PAN_KERNEL(pan_float_2, AUDIO_FORMAT_FLOAT_LE, 2)
+PAN_KERNEL(pan_float_n, AUDIO_FORMAT_FLOAT_LE, 0)
+
+// 形式ごとの 1チャンネル, 2チャンネル, それ以外 のカーネル
+static const MixKernel kernels[][3] = {
+    [AUDIO_FORMAT_S16_LE] = {mix_s16_1, mix_s16_2, mix_s16_n},
+    [AUDIO_FORMAT_S24_3LE] = {mix_s24_1, mix_s24_2, mix_s24_n},
+    [AUDIO_FORMAT_S32_LE] = {mix_s32_1, mix_s32_2, mix_s32_n},
+    [AUDIO_FORMAT_FLOAT_LE] = {mix_float_1, mix_float_2, mix_float_n},
+};
+
+// 形式ごとの 2チャンネル, それ以外 の定位をつけるカーネル
+static const MixPanKernel pan_kernels[][2] = {
+    [AUDIO_FORMAT_S16_LE] = {pan_s16_2, pan_s16_n},
+    [AUDIO_FORMAT_S24_3LE] = {pan_s24_2, pan_s24_n},
+    [AUDIO_FORMAT_S32_LE] = {pan_s32_2, pan_s32_n},
+    [AUDIO_FORMAT_FLOAT_LE] = {pan_float_2, pan_float_n},
+};
+
+// 形式ごとのサンプル1つのバイト数
+static const size_t sample_bytes[] = {
+    [AUDIO_FORMAT_S16_LE] = 2,
+    [AUDIO_FORMAT_S24_3LE] = 3,
+    [AUDIO_FORMAT_S32_LE] = 4,
+    [AUDIO_FORMAT_FLOAT_LE] = 4,
+};
+
+MixKernel mixer_select(AudioSampleFormat format, int channels) {
+    if ((size_t)format >= sizeof(kernels) / sizeof(kernels[0]) || channels < 1 || channels > MIXER_MAX_CHANNELS) {
+        return NULL;
+    }
+    return kernels[format][channels <= 2 ? channels - 1 : 2];
+}
+
+MixPanKernel mixer_select_panned(AudioSampleFormat format, int channels) {
+    if ((size_t)format >= sizeof(pan_kernels) / sizeof(pan_kernels[0]) || channels < 2 || channels > MIXER_MAX_CHANNELS) {
+        return NULL;
+    }
+    return pan_kernels[format][channels == 2 ? 0 : 1];
+}
+
+size_t mixer_frame_bytes(AudioSampleFormat format, int channels) {
+    return sample_bytes[format] * (size_t)channels;
+}
@@ -0,0 +1,59 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "audio_output.h"
+
+// ミックスした結果を書き出せるチャンネル数の上限
+#define MIXER_MAX_CHANNELS 8
+
+// 複数トラックのバッファを足し合わせて out に書き込む
+// int32で合計してから16bitの範囲に飽和させるので、音が大きすぎても符号が反転しない
+void mix_saturate(int16_t *out, const int16_t *const *inputs, size_t num_inputs, size_t frames);
+
+// 複数トラックのバッファを足し合わせ、出力の形式で channels チャンネルのインターリーブにして out に書き込む
+// (トラックはモノラルなので、全チャンネルに同じ値を書く。飽和のさせ方は mix_saturate と同じ)
+typedef void (*MixKernel)(void *out, const int16_t *const *inputs, size_t num_inputs, size_t frames, int channels);
+
+// 形式 x チャンネル数ごとに作ってあるカーネルから、合うものを選ぶ
+// 1・2チャンネルは専用のもの、それ以外はチャンネル数をループで回すもの
+// 戻り値: カーネル, 形式かチャンネル数 (1 ~ MIXER_MAX_CHANNELS) が対応していなければNULL
+MixKernel mixer_select(AudioSampleFormat format, int channels);
+
+// --- 定位をつけたミックス (出力が2チャンネル以上のとき) ---
+// トラックごとに、ブロックの中で定位が変わる位置と、そこからの左右の音量 (Q14) を渡す
+// 音量は一定パワーの法則 (左右の2乗の和が一定) で、中央では両方 1.0 (モノラルのミックスと同じ大きさ)、
+// 端では片側が √2 倍になる。掛け算は整数だけなので、SIMD版とスカラー版の結果は同じ
+
+#define MIXER_PAN_BITS      14  // 左右の音量の小数部のビット数
+#define MIXER_PAN_SEGMENTS  32  // 1ブロックの中で定位を変えられる回数の上限 (トラックごと)
+
+// 定位の区間 (start からこの音量で鳴らす)
+typedef struct {
+    uint32_t start;         // ブロックの先頭からのフレーム数
+    int16_t gains[2];       // 左・右の音量 (小数部 MIXER_PAN_BITS)
+} MixPanSegment;
+
+// 定位をつけてミックスするトラック1つ分
+typedef struct {
+    const int16_t *samples;             // モノラルのブロック
+    const MixPanSegment *segments;      // start の順。最初の区間は0から始まる (0個なら無音のトラック)
+    size_t num_segments;
+} MixPanInput;
+
+typedef void (*MixPanKernel)(void *out, const MixPanInput *inputs, size_t num_inputs, size_t frames, int channels);
+
+// 定位 pan (0で左, 64で中央, 127で右) の左右の音量
+void mixer_pan_gains(int pan, int16_t gains[2]);
+
+// 形式 x チャンネル数ごとに作ってある、定位をつけるカーネルから合うものを選ぶ
+// 3チャンネル以上では 0・1番目 (左・右) に定位をつけ、残りのチャンネルにはモノラルのミックスを書く
+// 戻り値: カーネル, 形式が対応していないかチャンネル数が 2 ~ MIXER_MAX_CHANNELS でなければNULL
+MixPanKernel mixer_select_panned(AudioSampleFormat format, int channels);
+
+// mixer_select したカーネルが書き出す1フレームのバイト数
+// (audio_output.c に依存しないように、ミキサーの側でも持っている)
+size_t mixer_frame_bytes(AudioSampleFormat format, int channels);
+
+#endif // MIXER_H
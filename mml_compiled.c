@@ -0,0 +1,251 @@
+#include "mml_compiled.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// 各配列の先頭をそろえる境界
+#define MMLC_ALIGN 8
+
+static size_t align_up(size_t n) {
+    return (n + MMLC_ALIGN - 1) & ~(size_t)(MMLC_ALIGN - 1);
+}
+
+// FNV-1a 64bit ハッシュ
+static uint64_t fnv1a(const uint8_t *data, size_t size) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < size; ++i) {
+        h ^= data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// コンパイル済みの曲から .mmlc の内容をメモリ上に作る
+static void *build_image(const MmlProgram *program, const MmlcHeader *source_info, size_t *out_size) {
+    MmlcHeader header = *source_info;
+    size_t offset = align_up(sizeof(MmlcHeader));
+
+    for (size_t t = 0; t < program->num_tracks; ++t) {
+        MmlcTrack *ct = &header.tracks[t];
+        ct->tempo = program->tracks[t].tempo;
+        ct->num_ops = program->tracks[t].num_ops;
+        ct->ops_offset = offset;
+        offset = align_up(offset + program->tracks[t].num_ops * sizeof(MmlOp));
+    }
+
+    uint8_t *image = (uint8_t *)calloc(1, offset);
+    if (!image) {
+        return NULL;
+    }
+    memcpy(image, &header, sizeof(header));
+    for (size_t t = 0; t < program->num_tracks; ++t) {
+        memcpy(image + header.tracks[t].ops_offset, program->tracks[t].ops, program->tracks[t].num_ops * sizeof(MmlOp));
+    }
+    *out_size = offset;
+    return image;
+}
+
+// ループの命令の対応が、コンパイラが作るものと同じになっているか確認する
+// (壊れたファイルで、カーソルがループの記録の外を読んだり、イベントを出さずに回り続けたりしないように)
+static int ops_are_valid(const MmlOp *ops, uint64_t num_ops) {
+    uint64_t begins[MML_LOOP_DEPTH];
+    int has_event[MML_LOOP_DEPTH];
+    size_t depth = 0;
+    for (uint64_t i = 0; i < num_ops; ++i) {
+        const MmlOp *op = &ops[i];
+        if (op->op > MML_OP_LOOP_END) {
+            return 0;
+        }
+        if (op->op == MML_OP_NOTE || op->op == MML_OP_NOTE_NUMBER || op->op == MML_OP_REST) {
+            for (size_t d = 0; d < depth; ++d) {
+                has_event[d] = 1;
+            }
+        } else if (op->op == MML_OP_LOOP_BEGIN) {
+            if (depth >= MML_LOOP_DEPTH || op->value < 1 || op->value > MML_MAX_LOOP_COUNT) {
+                return 0;
+            }
+            begins[depth] = i;
+            has_event[depth] = 0;
+            depth++;
+        } else if (op->op == MML_OP_LOOP_END) {
+            // 音符も休符もないループは、閉じていなかったもの (1回だけ) しか作らない
+            if (depth == 0 || (uint64_t)op->value != begins[depth - 1]
+                || (!has_event[depth - 1] && ops[begins[depth - 1]].value > 1)) {
+                return 0;
+            }
+            depth--;
+        }
+    }
+    return depth == 0;
+}
+
+// 命令列の位置がファイルの範囲に収まっていて、中身も正しいか確認する
+static int image_is_valid(const void *image, size_t size, int sample_rate) {
+    const MmlcHeader *h = (const MmlcHeader *)image;
+    if (size < sizeof(MmlcHeader) || memcmp(h->magic, MMLC_MAGIC, 4) != 0 || h->version != MMLC_VERSION) {
+        return 0;
+    }
+    if (h->sample_rate != (uint32_t)sample_rate || h->num_tracks == 0 || h->num_tracks > MML_MAX_TRACKS) {
+        return 0;
+    }
+    for (uint32_t t = 0; t < h->num_tracks; ++t) {
+        const MmlcTrack *ct = &h->tracks[t];
+        if (ct->ops_offset % MMLC_ALIGN != 0 || ct->ops_offset > size
+            || ct->num_ops > (size - ct->ops_offset) / sizeof(MmlOp)
+            || !ops_are_valid((const MmlOp *)((const uint8_t *)image + ct->ops_offset), ct->num_ops)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// 読み込んだ内容を CompiledSong に設定し、命令列を MmlProgram として見せる
+static void attach_image(CompiledSong *cs, const void *image, void *map, void *owned, size_t size) {
+    const MmlcHeader *h = (const MmlcHeader *)image;
+    cs->header = h;
+    cs->map = map;
+    cs->owned = owned;
+    cs->size = size;
+    memset(&cs->program, 0, sizeof(cs->program));
+    cs->program.num_tracks = h->num_tracks;
+    cs->program.sample_rate = (int)h->sample_rate;
+    for (uint32_t t = 0; t < h->num_tracks; ++t) {
+        // 命令列はmmapした読み出し専用の領域を指す (カーソルは書き換えない)
+        cs->program.tracks[t].ops = (MmlOp *)((uint8_t *)image + h->tracks[t].ops_offset);
+        cs->program.tracks[t].num_ops = (size_t)h->tracks[t].num_ops;
+        cs->program.tracks[t].tempo = h->tracks[t].tempo;
+    }
+}
+
+// .mmlc をmmapする。元の .mml と一致しなければ -1
+static int map_compiled(CompiledSong *cs, const char *path, const struct stat *src_st, const char *mml_path, int sample_rate) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    const MmlcHeader *h = (const MmlcHeader *)map;
+    int ok = image_is_valid(map, (size_t)st.st_size, sample_rate) && h->source_size == (uint64_t)src_st->st_size;
+    if (ok && (h->source_mtime_sec != (int64_t)src_st->st_mtim.tv_sec || h->source_mtime_nsec != (int64_t)src_st->st_mtim.tv_nsec)) {
+        // 更新時刻だけが違う場合 (コピーやtouch) は、内容のハッシュが同じならそのまま使う
+        char *text = read_mml_file(mml_path);
+        ok = text && fnv1a((const uint8_t *)text, strlen(text)) == h->source_hash;
+        free(text);
+    }
+    if (!ok) {
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+    attach_image(cs, map, map, NULL, (size_t)st.st_size);
+    return 0;
+}
+
+// 書き込み途中のファイルを読まれないように、一時ファイルに書いてから置き換える
+static int write_compiled(const char *path, const void *image, size_t size) {
+    char tmp_path[PATH_MAX + 32];  // path の後ろに ".tmp" とプロセスIDを付ける分
+    int len = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp%d", path, (int)getpid());
+    if (len < 0 || (size_t)len >= sizeof(tmp_path)) {
+        return -1;
+    }
+    FILE *fp = fopen(tmp_path, "wb");
+    if (!fp) {
+        return -1;
+    }
+    size_t written = fwrite(image, 1, size, fp);
+    if (fclose(fp) != 0 || written != size || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+int compiled_song_open(CompiledSong *cs, const char *mml_path, int sample_rate) {
+    char path[PATH_MAX];
+    struct stat src_st;
+
+    memset(cs, 0, sizeof(*cs));
+    if (stat(mml_path, &src_st) != 0) {
+        fprintf(stderr, "MMLファイルを開けません: %s\n", mml_path);
+        return -1;
+    }
+    int len = snprintf(path, sizeof(path), "%s%s", mml_path, MMLC_EXTENSION);
+    if (len < 0 || (size_t)len >= sizeof(path)) {
+        fprintf(stderr, "MMLファイルのパスが長すぎます: %s\n", mml_path);
+        return -1;
+    }
+
+    // 元の .mml と一致する .mmlc があれば、mmapするだけで終わり
+    if (map_compiled(cs, path, &src_st, mml_path, sample_rate) == 0) {
+        return 0;
+    }
+
+    // 無いか古い場合は解析してコンパイルする
+    char *text = read_mml_file(mml_path);
+    if (!text) {
+        return -1;
+    }
+    MmlProgram *program = mml_compile(text, sample_rate);
+    if (!program) {
+        free(text);
+        return -1;
+    }
+    MmlcHeader info;
+    memset(&info, 0, sizeof(info));
+    memcpy(info.magic, MMLC_MAGIC, 4);
+    info.version = MMLC_VERSION;
+    info.source_mtime_sec = (int64_t)src_st.st_mtim.tv_sec;
+    info.source_mtime_nsec = (int64_t)src_st.st_mtim.tv_nsec;
+    info.source_size = (uint64_t)src_st.st_size;
+    info.source_hash = fnv1a((const uint8_t *)text, strlen(text));
+    info.sample_rate = (uint32_t)sample_rate;
+    info.num_tracks = (uint32_t)program->num_tracks;
+    free(text);
+
+    size_t size = 0;
+    void *image = build_image(program, &info, &size);
+    free_mml_program(program);
+    if (!image) {
+        fprintf(stderr, "メモリが足りません\n");
+        return -1;
+    }
+
+    // 保存できれば次回からはmmapで読めるようになる
+    if (write_compiled(path, image, size) == 0 && map_compiled(cs, path, &src_st, mml_path, sample_rate) == 0) {
+        free(image);
+        return 0;
+    }
+    // 保存できない場所 (読み込み専用など) なら、メモリ上のデータをそのまま使う
+    fprintf(stderr, "コンパイル済みデータを保存できません: %s\n", path);
+    attach_image(cs, image, NULL, image, size);
+    return 0;
+}
+
+void compiled_song_close(CompiledSong *cs) {
+    if (cs->map) {
+        munmap(cs->map, cs->size);
+    }
+    free(cs->owned);
+    memset(cs, 0, sizeof(*cs));
+}
+
+size_t compiled_song_num_tracks(const CompiledSong *cs) {
+    return cs->header ? cs->header->num_tracks : 0;
+}
+
+const MmlProgram *compiled_song_program(const CompiledSong *cs) {
+    return &cs->program;
+}
@@ -0,0 +1,66 @@
+#ifndef MML_COMPILED_H
+#define MML_COMPILED_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mml_parser.h"
+
+// コンパイル済みの曲データ (.mmlc)
+// 一度解析したMMLを、.mml と同じ場所にバイナリで保存しておき、次回からはmmapするだけで使う
+// (解析もメモリ確保もしないので、長い曲でも読み込みが一瞬で終わる)
+//
+// 中身はトラックごとの中間表現の命令列 (MmlOp の配列) そのもの
+// ループを展開しないので、ファイルの大きさはMMLの文字数に比例し、曲の長さには比例しない
+// 再生するときは compiled_song_program で MmlProgram として取り出し、mmapした命令列を
+// MmlProgramCursor がその場で実行する (シークの目印もカーソルが実行しながら記録する)
+// ファイルは実行しているマシンのバイト順で書く (キャッシュなので他のマシンへは持っていかない)
+
+#define MMLC_MAGIC      "MMLC"
+#define MMLC_VERSION    7
+#define MMLC_EXTENSION  "c"     // "song.mml" -> "song.mmlc"
+
+// 1トラック分の命令列の位置 (ファイル先頭からのバイト数)
+typedef struct {
+    double tempo;               // トラックの開始テンポ
+    uint64_t num_ops;
+    uint64_t ops_offset;
+} MmlcTrack;
+
+// ファイルの先頭
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    int64_t source_mtime_sec;   // 元の .mml の更新時刻
+    int64_t source_mtime_nsec;
+    uint64_t source_size;       // 元の .mml のサイズ
+    uint64_t source_hash;       // 元の .mml の内容のハッシュ (FNV-1a)
+    uint32_t sample_rate;       // 長さをサンプル数にしたときのサンプリングレート
+    uint32_t num_tracks;
+    MmlcTrack tracks[MML_MAX_TRACKS];
+} MmlcHeader;
+
+// 読み込んだコンパイル済みの曲
+typedef struct {
+    const MmlcHeader *header;
+    void *map;              // mmapした領域 (ファイルに書けなかったときはNULL)
+    void *owned;            // ファイルに書けなかったときにメモリ上に作ったデータ
+    size_t size;
+    MmlProgram program;     // 命令列を MmlProgram として見せたもの (命令列は読み出し専用)
+} CompiledSong;
+
+// mml_path のコンパイル済みデータを開く
+// .mmlc が元の .mml と一致していればmmapするだけ、古い・無い場合は解析して書き直す
+// 戻り値: 成功なら0, 失敗なら-1
+int compiled_song_open(CompiledSong *cs, const char *mml_path, int sample_rate);
+
+// 閉じる (mmapの解除・メモリの解放)
+void compiled_song_close(CompiledSong *cs);
+
+// トラック数
+size_t compiled_song_num_tracks(const CompiledSong *cs);
+
+// 曲の命令列 (mml_program_source や song_renderer_init_program に渡す。free_mml_program はしない)
+// 閉じるまで使える
+const MmlProgram *compiled_song_program(const CompiledSong *cs);
+
+#endif // MML_COMPILED_H
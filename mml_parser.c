@@ -3,6 +3,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 // 1オクターブ内の音名（C, C#, D, D#...）からMIDIノートナンバーへのオフセット
 // C4(60)を基準として、配列のインデックスを引くと、その音のノートナンバーになる
@@ -10,203 +14,913 @@
 const int note_offsets[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
 // ...など、変換に必要なテーブルを定義する
 
-// MML文字列を解析するメイン関数
-MmlEvent* parse_mml(const char *mml_string, int sample_rate, size_t *out_num_events) {
-    MmlEvent *events = NULL;
-    size_t capacity = 10;
-    size_t count = 0;
+static uint32_t ms_to_samples(long ms, int sample_rate) {
+    return (ms > 0) ? (uint32_t)((double)ms * sample_rate / 1000.0) : 0;
+}
 
-    // 初期化とメモリ確保
-    events = (MmlEvent*)malloc(capacity * sizeof(MmlEvent));
-    if (!events) {
-        fprintf(stderr, "メモリが足りません\n");
-        *out_num_events = 0;
-        return NULL;
+// 1サンプルあたりの減衰率を、区間 (2^MML_DECAY_SEGMENT_BITS サンプル) あたりの固定小数点にする
+// (2乗を繰り返すだけなので、整数の計算で済む)
+static uint32_t decay_per_segment(double rate_per_sample) {
+    uint64_t rate = (uint64_t)(rate_per_sample * (1u << MML_DECAY_BITS) + 0.5);
+    for (int i = 0; i < MML_DECAY_SEGMENT_BITS; ++i) {
+        rate = (rate * rate) >> MML_DECAY_BITS;
     }
+    return (uint32_t)rate;
+}
 
-    // 現在の状態を保持する変数
-    int current_octave = 4;
-    int current_length = 4;
-    double current_tempo = DEFAULT_TEMPO; // t120から開始
-    int current_volume = DEFAULT_VOLUME; // デフォルト音量を設定
-    double current_decay_rate = DEFAULT_DECAY_RATE; // デフォルト減衰率を設定
+void mml_default_envelope(MmlEnvelope *envelope, int sample_rate) {
+    envelope->attack = ms_to_samples(DEFAULT_ATTACK_MS, sample_rate);
+    envelope->decay_segment = decay_per_segment(DEFAULT_DECAY_RATE);
+    envelope->sustain = DEFAULT_SUSTAIN;
+    envelope->release = ms_to_samples(DEFAULT_RELEASE_MS, sample_rate);
+    envelope->gate = DEFAULT_GATE;
+}
 
-    // --- 解析ループ ---
-    const char *p = mml_string;
-    const char *next_p;
+int mml_envelope_equal(const MmlEnvelope *a, const MmlEnvelope *b) {
+    return a->attack == b->attack && a->decay_segment == b->decay_segment && a->sustain == b->sustain
+        && a->release == b->release && a->gate == b->gate;
+}
 
-    // MML@ の特殊処理 先頭に "MML@" がある場合はスキップ
-    if (p[0] == 'M' && p[1] == 'M' && p[2] == 'L' && p[3] == '@') {
-        p += 4; // "MML@" の4文字をスキップ
+// @E の1項目を設定する (field: 0~3 = アタック・ディケイ・サステイン・リリース, 値は負にならないようにしてある)
+// ディケイはサステインのレベルとの差が 1/e になるまでの時間 (0ならすぐにサステインになる)
+static void set_envelope_field(MmlEnvelope *envelope, int field, long value, int sample_rate) {
+    if (field == 0) {
+        envelope->attack = ms_to_samples(value, sample_rate);
+    } else if (field == 1) {
+        envelope->decay_segment = decay_per_segment((value > 0) ? exp(-1000.0 / ((double)value * sample_rate)) : 0.0);
+    } else if (field == 2) {
+        envelope->sustain = (value > 100) ? 100 : (int)value;
+    } else {
+        envelope->release = ms_to_samples(value, sample_rate);
     }
+}
 
-    while (*p != '\0') {
-        if (isspace(*p)) {
-            p++;
-            continue; // 空白はスキップ
+// --- コンパイル ---
+
+static int is_event_op(int op) {
+    return op == MML_OP_NOTE || op == MML_OP_NOTE_NUMBER || op == MML_OP_REST;
+}
+
+// 命令を1つ追加する (全部0で埋めてから返す)。メモリが足りなければNULL
+static MmlOp *emit_op(MmlCompiler *c, int op) {
+    if (c->num_ops >= c->capacity) {
+        size_t capacity = c->capacity ? c->capacity * 2 : 16;
+        MmlOp *grown = (MmlOp *)realloc(c->ops, capacity * sizeof(MmlOp));
+        if (!grown) {
+            fprintf(stderr, "メモリ拡張に失敗しました\n");
+            return NULL;
         }
+        c->ops = grown;
+        c->capacity = capacity;
+    }
+    MmlOp *o = &c->ops[c->num_ops++];
+    memset(o, 0, sizeof(*o));
+    o->op = (uint8_t)op;
+    return o;
+}
 
-        // メモリが足りなくなったら拡張
-        if (count >= capacity) {
-            capacity *= 2;
-            events = (MmlEvent*)realloc(events, capacity * sizeof(MmlEvent));
-            if (!events) {
-                fprintf(stderr, "メモリ拡張に失敗しました\n");
-                *out_num_events = count;
-                return NULL;
+// @E アタック,ディケイ,サステイン,リリース を読み、指定された項目ごとに命令にする (省略した値は変えない)
+static const char *compile_envelope(const char *p, MmlCompiler *c) {
+    for (int i = 0; i < 4; ++i) {
+        if (i > 0) {
+            if (*p != ',') {
+                break;
             }
+            p++;
         }
+        char *next_p;
+        long value = strtol(p, &next_p, 10);
+        if (next_p == p) {
+            continue;
+        }
+        p = next_p;
+        MmlOp *o = emit_op(c, MML_OP_ENVELOPE);
+        if (!o) {
+            c->failed = 1;
+            return p;
+        }
+        o->dots = (uint8_t)i;
+        o->value = (value < 0) ? 0 : (value > INT32_MAX) ? INT32_MAX : (int32_t)value;
+    }
+    return p;
+}
 
-        char command = tolower(*p);
-        p++;
-
-        int note_idx = -1;
-        int note_length = current_length;
-        uint32_t current_duration = 0;
+// コマンドを1つ (引数・タイ・付点まで) 命令にする関数
+// *pp: 空白でも ',' でもないコマンドの先頭。解析後は次のコマンドを指す
+// 失敗したら c->failed を立てる
+static void compile_command(const char **pp, MmlCompiler *c) {
+    const char *p = *pp;
+    char *next_p;
+    char command = tolower(*p);
+    p++;
+    MmlOp *o = NULL;
 
-        // --- 制御コマンド (o, l, t) ---
-        if (command == 'o') { // オクターブ oX
-            current_octave = (int)strtol(p, (char **)&next_p, 10);
-            p = next_p;
-            continue;
-        } else if (command == 'l') { // 音長 lX
-            current_length = (int)strtol(p, (char **)&next_p, 10);
-            p = next_p;
-            continue;
-        } else if (command == 't') { // テンポ tX
-            current_tempo = (double)strtol(p, (char **)&next_p, 10);
-            p = next_p;
-            continue;
-        } else if (command == 'v') { // 音量 vX の処理
-            current_volume = (int)strtol(p, (char **)&next_p, 10);
-            p = next_p;
-            continue;
-        } else if (command == '@') { // 音色 @X の処理 (今回は無視)
-            // 音色の数字を読み飛ばす
-            (void)strtol(p, (char **)&next_p, 10);
+    // --- 制御コマンド ---
+    if (command == 'o' || command == 'l' || command == 't' || command == 'v') { // オクターブ・音長・テンポ・音量
+        long value = strtol(p, &next_p, 10);
+        p = next_p;
+        o = emit_op(c, command == 'o' ? MML_OP_OCTAVE : command == 'l' ? MML_OP_LENGTH
+                      : command == 't' ? MML_OP_TEMPO : MML_OP_VOLUME);
+        if (o) {
+            o->value = (int32_t)value;
+        }
+    } else if (command == 'p') { // 定位 pX (0で左, 64で中央, 127で右)
+        long pan = strtol(p, &next_p, 10);
+        if (next_p == p) {
+            *pp = p;
+            return;
+        }
+        p = next_p;
+        if ((o = emit_op(c, MML_OP_PAN)) != NULL) {
+            o->value = (pan < 0) ? 0 : (pan > MML_PAN_MAX) ? MML_PAN_MAX : (int32_t)pan;
+        }
+    } else if (command == '@' && (*p == 'E' || *p == 'e')) { // エンベロープ @Ea,d,s,r
+        *pp = compile_envelope(p + 1, c);
+        return;
+    } else if (command == 'q') { // ゲートタイム qX (音符の長さの X/8 だけ鳴らしてからリリースする)
+        int gate = (int)strtol(p, &next_p, 10);
+        p = next_p;
+        if ((o = emit_op(c, MML_OP_GATE)) != NULL) {
+            o->value = (gate < 1) ? 1 : (gate > MAX_GATE) ? MAX_GATE : gate;
+        }
+    } else if (command == '@') { // 音色 @X の処理 (音色バンクの X 番目のウェーブテーブルで鳴らす)
+        long instrument = strtol(p, &next_p, 10);
+        if (next_p == p) {
+            *pp = p;
+            return;
+        }
+        p = next_p;
+        if ((o = emit_op(c, MML_OP_INSTRUMENT)) != NULL) {
+            o->value = (instrument >= 0 && instrument <= INT32_MAX) ? (int32_t)instrument : MML_DEFAULT_INSTRUMENT;
+        }
+    } else if (command == '<' || command == '>') { // オクターブアップ・ダウン
+        if ((o = emit_op(c, MML_OP_OCTAVE_SHIFT)) != NULL) {
+            o->value = (command == '<') ? 1 : -1;
+        }
+    } else if (command == '[') { // ループの始まり (回数は ] で決まる)
+        if (c->depth >= MML_LOOP_DEPTH) {
+            fprintf(stderr, "ループの入れ子が深すぎます (最大%d)\n", MML_LOOP_DEPTH);
+            c->failed = 1;
+            *pp = p;
+            return;
+        }
+        c->loop_begins[c->depth++] = c->num_ops;
+        o = emit_op(c, MML_OP_LOOP_BEGIN);
+    } else if (command == ']') { // ループの終わり ]n (対応する [ がなければ無視する)
+        long count = MML_DEFAULT_LOOP_COUNT;
+        if (isdigit(*p)) {
+            count = strtol(p, &next_p, 10);
             p = next_p;
-            continue;
-        } else if (command == '<') { // オクターブアップ
-            current_octave++;
-            continue;
-        } else if (command == '>') { // オクターブダウン
-            current_octave--;
-            continue;
         }
-
-        // MMLコマンドごとの解析ロジック
-        if (command >= 'a' && command <= 'g' || command == 'n') {
-            if (command == 'n') {
-                // nXX の処理
-                int n_note = (int)strtol(p, (char **)&next_p, 10);
-                p = next_p;
-                events[count].note_number = n_note;
-            } else {
+        if (c->depth == 0) {
+            *pp = p;
+            return;
+        }
+        size_t begin = c->loop_begins[--c->depth];
+        // 音符も休符もないループは、何回まわしてもイベントが出ずに止まらなくなるので、
+        // [ を消して中身を1回だけ実行する (中の入れ子のループも同じ理由で消えているので、戻り先はずれない)
+        int has_event = 0;
+        for (size_t i = begin + 1; i < c->num_ops; ++i) {
+            has_event |= is_event_op(c->ops[i].op);
+        }
+        if (!has_event) {
+            memmove(c->ops + begin, c->ops + begin + 1, (c->num_ops - begin - 1) * sizeof(MmlOp));
+            c->num_ops--;
+            *pp = p;
+            return;
+        }
+        c->ops[begin].value = (count < 1) ? 1 : (count > MML_MAX_LOOP_COUNT) ? MML_MAX_LOOP_COUNT : (int32_t)count;
+        if ((o = emit_op(c, MML_OP_LOOP_END)) != NULL) {
+            o->value = (int32_t)begin;
+        }
+    } else if ((command >= 'a' && command <= 'g') || command == 'n' || command == 'r') {
+        if (command == 'n') {
+            // nXX の処理 (音長は lX の値)
+            int n_note = (int)strtol(p, &next_p, 10);
+            p = next_p;
+            if ((o = emit_op(c, MML_OP_NOTE_NUMBER)) != NULL) {
+                o->value = n_note;
+            }
+        } else {
+            if (command == 'r') { // 休符
+                o = emit_op(c, MML_OP_REST);
+            } else if ((o = emit_op(c, MML_OP_NOTE)) != NULL) {
                 // 'c'を0、'd'を2、'e'を4、'f'を5、'g'を7、'a'を9、'b'を11とする
-                // ノート名をインデックスに変換
-                if (command == 'c') note_idx = 0;
-                else if (command == 'd') note_idx = 2;
-                else if (command == 'e') note_idx = 4;
-                else if (command == 'f') note_idx = 5;
-                else if (command == 'g') note_idx = 7;
-                else if (command == 'a') note_idx = 9;
-                else if (command == 'b') note_idx = 11;
-
-                // MIDIノートナンバーを計算 (C4=60を基準)
-                if (note_idx != -1) {
-                    events[count].note_number = 60 + (current_octave - 4) * 12 + note_idx;
-                } else {
-                    continue;
-                }
-
+                static const int16_t note_indices[] = {9, 11, 0, 2, 4, 5, 7};
+                o->pitch = note_indices[command - 'a'];
                 if (*p == '+' || *p == '#') {
-                    events[count].note_number += 1; // シャープは半音上げ
+                    o->pitch += 1; // シャープは半音上げ
                     p++;
                 } else if (*p == '-') {
-                    events[count].note_number -= 1; // フラットは半音下げ
+                    o->pitch -= 1; // フラットは半音下げ
                     p++;
                 }
-
-                // 音長の解析
-                const char *p_before_dot = p;
-                if (isdigit(*p_before_dot)) {
-                    note_length = (int)strtol(p_before_dot, (char **)&next_p, 10);
+            }
+            // 音長の解析
+            if (isdigit(*p)) {
+                long length = strtol(p, &next_p, 10);
+                p = next_p;
+                if (o) {
+                    o->value = (int32_t)length;
+                }
+            }
+        }
+        if (o) {
+            // タイ記号(&)の処理 (& の後に数字がない場合は '&' だけを消費)
+            if (*p == '&') {
+                p++;
+                if (isdigit(*p)) {
+                    o->tie = (int32_t)strtol(p, &next_p, 10);
                     p = next_p;
                 }
             }
+            // 付点音符(.)の処理
+            while (*p == '.') {
+                if (o->dots < UINT8_MAX) {
+                    o->dots++;
+                }
+                p++;
+            }
+        }
+    } else {
+        // 未対応のコマンドはスキップ
+        *pp = p;
+        return;
+    }
+    if (!o) {
+        c->failed = 1;
+    }
+    *pp = p;
+}
 
-        } else if (command == 'r') { // 休符の処理
-            events[count].note_number = 0; // 休符はNOTE=0
-            const char *p_before_dot = p;
-            if (isdigit(*p_before_dot)) {
-                note_length = (int)strtol(p_before_dot, (char **)&next_p, 10);
-                p = next_p;
+// 閉じていないループを1回だけ実行するように閉じる
+static void close_loops(MmlCompiler *c) {
+    while (c->depth > 0 && !c->failed) {
+        size_t begin = c->loop_begins[--c->depth];
+        c->ops[begin].value = 1;
+        MmlOp *o = emit_op(c, MML_OP_LOOP_END);
+        if (!o) {
+            c->failed = 1;
+            break;
+        }
+        o->value = (int32_t)begin;
+    }
+}
+
+// 1トラック分 (次の ',' か文字列の終わりまで) を命令列にする関数
+// *pp: 解析開始位置。解析後はトラックの終わり (',' か '\0') を指す
+// *song_tempo: 各トラックの開始テンポ。最初のトラックで最初の音符より前に t があれば更新する
+// 戻り値: 成功なら0, 失敗なら-1
+static int compile_track(const char **pp, double *song_tempo, int is_first_track, MmlProgramTrack *track) {
+    MmlCompiler c;
+    int has_event = 0;
+    memset(&c, 0, sizeof(c));
+
+    track->tempo = *song_tempo; // 曲の開始テンポ (指定がなければt120) から開始
+
+    // --- 解析ループ ---
+    const char *p = *pp;
+    while (*p != '\0' && *p != ',' && !c.failed) { // ',' はトラック区切り
+        if (isspace(*p)) {
+            p++;
+            continue; // 空白はスキップ
+        }
+        size_t first = c.num_ops;
+        compile_command(&p, &c);
+        for (size_t i = first; i < c.num_ops && !c.failed; ++i) {
+            // 最初のトラックの冒頭で指定されたテンポは、他のトラックの開始テンポにもなる
+            if (c.ops[i].op == MML_OP_TEMPO && is_first_track && !has_event) {
+                *song_tempo = (double)c.ops[i].value;
             }
-        } else if (command == ',') { // トラック区切りの処理
-            // トラック区切りは無視
-            continue;
-        } else {
-            // 未対応のコマンドはスキップ
-            continue;
+            has_event |= is_event_op(c.ops[i].op);
         }
+    }
 
-        // 音符の長さから再生時間を計算
-        double sec_per_quarter = 60.0 / current_tempo;
-        double sec_per_note = sec_per_quarter * (4.0 / (double)note_length);
-        current_duration = (uint32_t)(sec_per_note * sample_rate);
-
-        // イベントをリストに追加
-        events[count].duration_samples = current_duration;
-        events[count].volume = current_volume;
-        events[count].decay_rate = current_decay_rate;
-        count++;
-
-        // タイ記号(&)の処理
-        if (*p == '&') {
-            const char *p_after_amp = p + 1;
-            if (isdigit(*p_after_amp)) {
-                p++; // '&' を消費
-                
-                int tied_length = 0;
-                // タイ後の音長数字を読み込む (例: '8')
-                tied_length = (int)strtol(p, (char **)&next_p, 10);
-                p = next_p;
-                
-                // タイで指定された音長 (例: 8分音符) の長さを計算し、イベントに加算
-                double sec_per_quarter_tied = 60.0 / current_tempo;
-                double sec_per_note_tied = sec_per_quarter_tied * (4.0 / (double)tied_length);
-                uint32_t tied_duration = (uint32_t)(sec_per_note_tied * sample_rate);
-                
-                // 最後に作成したイベントにタイの長さを加算
-                events[count - 1].duration_samples += tied_duration;
+    close_loops(&c);
+    if (c.failed) {
+        free(c.ops);
+        return -1;
+    }
+
+    // 最後にメモリを整理する (命令が0個でもNULLにならないよう最低1個分は残す)
+    MmlOp *shrunk = (MmlOp *)realloc(c.ops, (c.num_ops > 0 ? c.num_ops : 1) * sizeof(MmlOp));
+    if (shrunk) {
+        c.ops = shrunk;
+    } else if (!c.ops) {
+        fprintf(stderr, "メモリが足りません\n");
+        return -1;
+    }
+    track->ops = c.ops;
+    track->num_ops = c.num_ops;
+    *pp = p;
+    return 0;
+}
+
+MmlProgram* mml_compile(const char *mml_string, int sample_rate) {
+    MmlProgram *program = (MmlProgram*)calloc(1, sizeof(MmlProgram));
+    if (!program) {
+        fprintf(stderr, "メモリが足りません\n");
+        return NULL;
+    }
+    program->sample_rate = sample_rate;
+
+    const char *p = mml_string;
+    double song_tempo = DEFAULT_TEMPO;
+
+    // MML@ の特殊処理 先頭に "MML@" がある場合はスキップ
+    if (p[0] == 'M' && p[1] == 'M' && p[2] == 'L' && p[3] == '@') {
+        p += 4; // "MML@" の4文字をスキップ
+    }
+
+    for (;;) {
+        if (program->num_tracks >= MML_MAX_TRACKS) {
+            fprintf(stderr, "トラック数が多すぎます (最大%d)。残りは無視します\n", MML_MAX_TRACKS);
+            break;
+        }
+        MmlProgramTrack *track = &program->tracks[program->num_tracks];
+        if (compile_track(&p, &song_tempo, program->num_tracks == 0, track) != 0) {
+            free_mml_program(program);
+            return NULL;
+        }
+        program->num_tracks++;
+
+        if (*p != ',') {
+            break;
+        }
+        p++; // ',' を消費して次のトラックへ
+    }
+
+    return program;
+}
+
+size_t mml_program_size(const MmlProgram *program) {
+    size_t size = sizeof(MmlProgram);
+    for (size_t t = 0; t < program->num_tracks; ++t) {
+        size += program->tracks[t].num_ops * sizeof(MmlOp);
+    }
+    return size;
+}
+
+// --- 実行 ---
+
+// 音符・休符の命令から、今の状態でイベントを作る
+static void make_event(const MmlProgramCursor *c, const MmlOp *op, MmlEvent *out) {
+    int note_length = c->length;
+
+    if (op->op == MML_OP_NOTE_NUMBER) {
+        out->note_number = op->value;
+    } else {
+        // MIDIノートナンバーを計算 (C4=60を基準, 休符はNOTE=0)
+        out->note_number = (op->op == MML_OP_NOTE) ? 60 + (c->octave - 4) * 12 + op->pitch : 0;
+        if (op->value != 0) {
+            note_length = op->value;
+        }
+    }
+
+    // 音符の長さから再生時間を計算
+    double sec_per_quarter = 60.0 / c->tempo;
+    double sec_per_note = sec_per_quarter * (4.0 / (double)note_length);
+    out->duration_samples = (uint32_t)(sec_per_note * c->sample_rate);
+    out->volume = c->volume;
+    out->instrument = c->instrument;
+    out->pan = c->pan;
+    out->envelope = c->envelope;
+
+    // タイで指定された音長 (例: 8分音符) の長さを加算
+    if (op->tie != 0) {
+        double sec_per_note_tied = sec_per_quarter * (4.0 / (double)op->tie);
+        out->duration_samples += (uint32_t)(sec_per_note_tied * c->sample_rate);
+    }
+    // 付点音符は、元の音符の長さの 1/2, 1/4, 1/8... を加算
+    double ext_factor = 0.5;
+    for (int i = 0; i < op->dots; ++i) {
+        out->duration_samples += (uint32_t)(sec_per_note * ext_factor * c->sample_rate);
+        ext_factor /= 2.0;
+    }
+}
+
+// 今の状態を、次の目印として記録する (メモリが足りなければ記録をやめる)
+static void save_checkpoint(MmlProgramCursor *c) {
+    if (c->num_checkpoints >= c->checkpoint_capacity) {
+        size_t capacity = c->checkpoint_capacity ? c->checkpoint_capacity * 2 : 16;
+        MmlProgramCheckpoint *grown = (MmlProgramCheckpoint *)realloc(c->checkpoints, capacity * sizeof(MmlProgramCheckpoint));
+        if (!grown) {
+            c->recording = 0;
+            return;
+        }
+        c->checkpoints = grown;
+        c->checkpoint_capacity = capacity;
+    }
+    MmlProgramCheckpoint *cp = &c->checkpoints[c->num_checkpoints++];
+    cp->pc = c->pc;
+    cp->octave = c->octave;
+    cp->length = c->length;
+    cp->tempo = c->tempo;
+    cp->volume = c->volume;
+    cp->instrument = c->instrument;
+    cp->pan = c->pan;
+    cp->envelope = c->envelope;
+    cp->depth = c->depth;
+    memcpy(cp->loops, c->loops, c->depth * sizeof(MmlLoopState));
+}
+
+// k 番目の目印の状態に戻す
+static void restore_checkpoint(MmlProgramCursor *c, size_t k) {
+    const MmlProgramCheckpoint *cp = &c->checkpoints[k];
+    c->pc = cp->pc;
+    c->index = k * MML_SEEK_INTERVAL;
+    c->octave = cp->octave;
+    c->length = cp->length;
+    c->tempo = cp->tempo;
+    c->volume = cp->volume;
+    c->instrument = cp->instrument;
+    c->pan = cp->pan;
+    c->envelope = cp->envelope;
+    c->depth = cp->depth;
+    memcpy(c->loops, cp->loops, cp->depth * sizeof(MmlLoopState));
+}
+
+// 次の音符か休符まで命令を実行する
+static int program_next(void *ctx, MmlEvent *out) {
+    MmlProgramCursor *c = (MmlProgramCursor *)ctx;
+
+    // まだ目印のない所まで来たら記録する
+    if (c->recording && c->index == c->num_checkpoints * MML_SEEK_INTERVAL) {
+        save_checkpoint(c);
+    }
+    while (c->pc < c->num_ops) {
+        const MmlOp *op = &c->ops[c->pc++];
+        switch (op->op) {
+        case MML_OP_NOTE:
+        case MML_OP_NOTE_NUMBER:
+        case MML_OP_REST:
+            make_event(c, op, out);
+            c->index++;
+            return 1;
+        case MML_OP_OCTAVE:
+            c->octave = op->value;
+            break;
+        case MML_OP_OCTAVE_SHIFT:
+            c->octave += op->value;
+            break;
+        case MML_OP_LENGTH:
+            c->length = op->value;
+            break;
+        case MML_OP_TEMPO:
+            c->tempo = (double)op->value;
+            break;
+        case MML_OP_VOLUME:
+            c->volume = op->value;
+            break;
+        case MML_OP_INSTRUMENT:
+            c->instrument = op->value;
+            break;
+        case MML_OP_ENVELOPE:
+            set_envelope_field(&c->envelope, op->dots, op->value, c->sample_rate);
+            break;
+        case MML_OP_GATE:
+            c->envelope.gate = op->value;
+            break;
+        case MML_OP_PAN:
+            c->pan = op->value;
+            break;
+        case MML_OP_LOOP_BEGIN:
+            // コンパイル時に入れ子の深さを確かめてある
+            c->loops[c->depth].begin = c->pc - 1;
+            c->loops[c->depth].remaining = op->value;
+            c->depth++;
+            break;
+        case MML_OP_LOOP_END:
+            if (--c->loops[c->depth - 1].remaining > 0) {
+                c->pc = c->loops[c->depth - 1].begin + 1;
             } else {
-                p++; // & の後に数字がない場合は '&' だけを消費
+                c->depth--;
             }
+            break;
+        }
+    }
+    return 0;
+}
+
+// 状態を初期値にして、命令列の先頭に戻す
+static void program_rewind(MmlProgramCursor *c) {
+    c->pc = 0;
+    c->index = 0;
+    c->octave = 4;
+    c->length = 4;
+    c->tempo = c->start_tempo;
+    c->volume = DEFAULT_VOLUME;
+    c->instrument = MML_DEFAULT_INSTRUMENT;
+    c->pan = MML_PAN_CENTER;
+    mml_default_envelope(&c->envelope, c->sample_rate);
+    c->depth = 0;
+}
+
+// index 番目のイベントの直前まで進める (index 以前で最後の目印から実行し直す)
+static int program_seek(void *ctx, size_t index) {
+    MmlProgramCursor *c = (MmlProgramCursor *)ctx;
+    MmlEvent skipped;
+
+    c->recording = 1;
+    if (c->num_checkpoints > 0) {
+        size_t k = index / MML_SEEK_INTERVAL;
+        restore_checkpoint(c, (k < c->num_checkpoints) ? k : c->num_checkpoints - 1);
+    } else {
+        program_rewind(c);
+    }
+    while (c->index < index) {
+        if (!program_next(c, &skipped)) {
+            return -1;
         }
+    }
+    return 0;
+}
+
+MmlEventSource mml_program_source(MmlProgramCursor *cursor, const MmlProgram *program, size_t track) {
+    cursor->ops = program->tracks[track].ops;
+    cursor->num_ops = program->tracks[track].num_ops;
+    cursor->sample_rate = program->sample_rate;
+    cursor->start_tempo = program->tracks[track].tempo;
+    cursor->checkpoints = NULL;
+    cursor->num_checkpoints = 0;
+    cursor->checkpoint_capacity = 0;
+    cursor->recording = 0;
+    program_rewind(cursor);
+
+    MmlEventSource source = {program_next, program_seek, cursor};
+    return source;
+}
+
+void mml_program_cursor_free(MmlProgramCursor *cursor) {
+    free(cursor->checkpoints);
+    cursor->checkpoints = NULL;
+    cursor->num_checkpoints = 0;
+    cursor->checkpoint_capacity = 0;
+    cursor->recording = 0;
+}
+
+// --- ストリーム ---
+
+void mml_stream_init(MmlStream *stream, int sample_rate) {
+    memset(stream, 0, sizeof(*stream));
+    stream->fd = -1;
+    stream->cursor.sample_rate = sample_rate;
+    stream->cursor.start_tempo = DEFAULT_TEMPO;
+    program_rewind(&stream->cursor);
+}
+
+int mml_stream_open(MmlStream *stream, const char *path, int sample_rate) {
+    mml_stream_init(stream, sample_rate);
+    if (strcmp(path, "-") == 0) {
+        stream->fd = STDIN_FILENO;
+        return 0;
+    }
+    stream->fd = open(path, O_RDONLY);
+    if (stream->fd < 0) {
+        fprintf(stderr, "MMLファイルを開けません: %s\n", path);
+        return -1;
+    }
+    stream->owns_fd = 1;
+    return 0;
+}
+
+// text[i] で区切れるか (続きが届いても、その前のコマンドの意味が変わらないか)
+// 数字・+#-・&・.・@E の , は前のコマンドの引数かもしれないので、そこでは区切らない
+static int is_command_start(const char *text, size_t i) {
+    char ch = text[i];
+    if (isdigit((unsigned char)ch) || strchr("+#-&.,", ch) != NULL) {
+        return 0;
+    }
+    return !((ch == 'E' || ch == 'e') && i > 0 && text[i - 1] == '@');
+}
+
+// text のうち、区切れる所まで (final なら全部) を命令にする
+static void stream_compile(MmlStream *s, int final) {
+    MmlCompiler *c = &s->compiler;
+
+    // 先頭の "MML@" は4文字そろってから確かめて読み飛ばす
+    if (!s->started) {
+        if (s->text_len < 4 && !final) {
+            return;
+        }
+        if (s->text_len >= 4 && memcmp(s->text, "MML@", 4) == 0) {
+            memmove(s->text, s->text + 4, s->text_len - 4);
+            s->text_len -= 4;
+        }
+        s->started = 1;
+    }
 
-        // 付点音符(.)の処理
-        // sec_per_note は元の音符の長さ（例：c4 なら 0.5秒）
-        double ext_factor = 0.5; // 延長倍率の初期値 (付点用)
-        while (*p == '.') {
-            // 付点音符は、元の音符の長さの 1/2, 1/4, 1/8... を加算
-            // (sec_per_note) の 1/2^N を加算
-            events[count - 1].duration_samples += (uint32_t)(sec_per_note * ext_factor * sample_rate);
-            ext_factor /= 2.0; // 次の付点はさらに半分
+    size_t end = s->text_len;
+    if (!final && end > 0) {
+        do {
+            end--;
+        } while (end > 0 && !is_command_start(s->text, end));
+        // 1つのコマンドが読み込みの単位より長い (数字が続くなど) ときは、切れた所までで命令にする
+        if (end == 0 && s->text_len >= MML_STREAM_TEXT_BYTES) {
+            end = s->text_len;
+        }
+    }
+
+    char saved = s->text[end];
+    s->text[end] = '\0';
+    const char *p = s->text;
+    while (*p != '\0' && !c->failed) {
+        if (*p == ',') {
+            fprintf(stderr, "少しずつ読むときは最初のトラックだけを再生します。残りのトラックは無視します\n");
+            s->input_done = 1;
+            break;
+        }
+        if (isspace((unsigned char)*p)) {
             p++;
+            continue;
+        }
+        compile_command(&p, c);
+    }
+    s->text[end] = saved;
+
+    if (final || s->input_done) {
+        close_loops(c);
+        s->input_done = 1;
+        s->text_len = 0;
+        return;
+    }
+    size_t used = (size_t)(p - s->text);
+    memmove(s->text, s->text + used, s->text_len - used);
+    s->text_len -= used;
+}
+
+// text の後ろに n バイト届いたので、区切れる所までを命令にする
+static void stream_received(MmlStream *s, size_t n) {
+    // 途中の '\0' で文字列が終わらないように、空白として扱う
+    for (size_t i = s->text_len; i < s->text_len + n; ++i) {
+        if (s->text[i] == '\0') {
+            s->text[i] = ' ';
+        }
+    }
+    s->text_len += n;
+    s->bytes_read += n;
+    stream_compile(s, 0);
+}
+
+int mml_stream_feed(MmlStream *stream, const char *data, size_t len) {
+    while (len > 0 && !stream->input_done && !stream->compiler.failed) {
+        size_t n = MML_STREAM_TEXT_BYTES - stream->text_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(stream->text + stream->text_len, data, n);
+        stream_received(stream, n);
+        data += n;
+        len -= n;
+    }
+    return stream->compiler.failed ? -1 : 0;
+}
+
+void mml_stream_finish(MmlStream *stream) {
+    if (!stream->input_done) {
+        stream_compile(stream, 1);
+    }
+}
+
+int mml_stream_finished(const MmlStream *stream) {
+    return (stream->input_done || stream->compiler.failed) && stream->cursor.pc >= stream->compiler.num_ops;
+}
+
+// 読み込み元から、空いている分だけ読む (届くまで待つ)
+static void stream_read(MmlStream *s) {
+    ssize_t n;
+    do {
+        n = read(s->fd, s->text + s->text_len, MML_STREAM_TEXT_BYTES - s->text_len);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        perror("MMLの読み込み");
+    }
+    if (n <= 0) {
+        mml_stream_finish(s);
+        return;
+    }
+    stream_received(s, (size_t)n);
+}
+
+// 実行し終えた命令を捨てて前に詰める (ループの中なら、戻る先が要るので捨てない)
+static void stream_discard(MmlStream *s) {
+    MmlCompiler *c = &s->compiler;
+    size_t done = s->cursor.pc;
+    if (done == 0 || s->cursor.depth > 0) {
+        return;
+    }
+    memmove(c->ops, c->ops + done, (c->num_ops - done) * sizeof(MmlOp));
+    c->num_ops -= done;
+    for (size_t i = 0; i < c->num_ops; ++i) {
+        if (c->ops[i].op == MML_OP_LOOP_END) {
+            c->ops[i].value -= (int32_t)done;
+        }
+    }
+    for (size_t d = 0; d < c->depth; ++d) {
+        c->loop_begins[d] -= done;
+    }
+    s->cursor.pc = 0;
+}
+
+// 命令が尽きたら捨てて、読み込み元から続きを読んで命令にする
+static int stream_next(void *ctx, MmlEvent *out) {
+    MmlStream *s = (MmlStream *)ctx;
+    MmlCompiler *c = &s->compiler;
+
+    for (;;) {
+        // 閉じていないループの中身は、] が来て回数が決まるまで実行しない
+        s->cursor.ops = c->ops;
+        s->cursor.num_ops = (c->depth > 0) ? c->loop_begins[0] : c->num_ops;
+        if (program_next(&s->cursor, out)) {
+            return 1;
+        }
+        stream_discard(s);
+        if (s->input_done || c->failed || s->fd < 0) {
+            return 0;
         }
+        stream_read(s);
     }
+}
+
+MmlEventSource mml_stream_source(MmlStream *stream) {
+    MmlEventSource source = {stream_next, NULL, stream};
+    return source;
+}
+
+void mml_stream_close(MmlStream *stream) {
+    free(stream->compiler.ops);
+    if (stream->owns_fd) {
+        close(stream->fd);
+    }
+    memset(stream, 0, sizeof(*stream));
+    stream->fd = -1;
+}
+
+// 1トラック分の命令列を実行して、ループを展開したイベント列を作る
+static MmlEvent* expand_track(const MmlProgram *program, size_t track, size_t *out_num_events) {
+    MmlProgramCursor cursor;
+    MmlEventSource source = mml_program_source(&cursor, program, track);
+    size_t capacity = 10;
+    size_t count = 0;
 
-    // 最後にメモリを整理する
-    events = (MmlEvent*)realloc(events, count * sizeof(MmlEvent));
+    MmlEvent *events = (MmlEvent*)malloc(capacity * sizeof(MmlEvent));
+    if (!events) {
+        fprintf(stderr, "メモリが足りません\n");
+        *out_num_events = 0;
+        return NULL;
+    }
+    for (;;) {
+        // メモリが足りなくなったら拡張
+        if (count >= capacity) {
+            capacity *= 2;
+            MmlEvent *grown = (MmlEvent*)realloc(events, capacity * sizeof(MmlEvent));
+            if (!grown) {
+                fprintf(stderr, "メモリ拡張に失敗しました\n");
+                free(events);
+                *out_num_events = 0;
+                return NULL;
+            }
+            events = grown;
+        }
+        if (!source.next(source.ctx, &events[count])) {
+            break;
+        }
+        // ループの入れ子で展開後が大きくなりすぎた曲は、メモリを使い切る前に止める
+        if (++count > MML_MAX_EVENTS) {
+            fprintf(stderr, "トラック%zuのイベントが多すぎます (ループを展開すると最大%d個まで)\n", track + 1, MML_MAX_EVENTS);
+            free(events);
+            *out_num_events = 0;
+            return NULL;
+        }
+    }
+
+    // 最後にメモリを整理する (イベントが0個でもNULLにならないよう最低1個分は残す)
+    MmlEvent *shrunk = (MmlEvent*)realloc(events, (count > 0 ? count : 1) * sizeof(MmlEvent));
+    if (shrunk) {
+        events = shrunk;
+    }
     *out_num_events = count;
+    return events;
+}
 
-    printf("MML解析完了イベント数: %zu\n", count);
+// MML文字列を解析するメイン関数 (',' で区切られたトラックごとにイベント列を作る)
+MmlSong* parse_mml_song(const char *mml_string, int sample_rate) {
+    MmlProgram *program = mml_compile(mml_string, sample_rate);
+    if (!program) {
+        return NULL;
+    }
+    MmlSong *song = (MmlSong*)calloc(1, sizeof(MmlSong));
+    if (!song) {
+        fprintf(stderr, "メモリが足りません\n");
+        free_mml_program(program);
+        return NULL;
+    }
+
+    for (size_t t = 0; t < program->num_tracks; ++t) {
+        MmlTrack *track = &song->tracks[t];
+        track->events = expand_track(program, t, &track->num_events);
+        if (!track->events) {
+            free_mml_program(program);
+            free_mml_song(song);
+            return NULL;
+        }
+        song->num_tracks++;
+    }
+    free_mml_program(program);
+    return song;
+}
+
+// 1トラックだけのMMLを解析する関数 (複数トラックの場合は最初のトラックだけを返す)
+MmlEvent* parse_mml(const char *mml_string, int sample_rate, size_t *out_num_events) {
+    MmlSong *song = parse_mml_song(mml_string, sample_rate);
+    if (!song) {
+        *out_num_events = 0;
+        return NULL;
+    }
+    // 最初のトラックの所有権を呼び出し側へ移す
+    MmlEvent *events = song->tracks[0].events;
+    *out_num_events = song->tracks[0].num_events;
+    song->tracks[0].events = NULL;
+    free_mml_song(song);
     return events;
 }
 
+static int cursor_next(void *ctx, MmlEvent *out) {
+    MmlEventCursor *cursor = (MmlEventCursor *)ctx;
+    if (cursor->index >= cursor->num_events) {
+        return 0;
+    }
+    *out = cursor->events[cursor->index++];
+    return 1;
+}
+
+static int cursor_seek(void *ctx, size_t index) {
+    MmlEventCursor *cursor = (MmlEventCursor *)ctx;
+    if (index > cursor->num_events) {
+        return -1;
+    }
+    cursor->index = index;
+    return 0;
+}
+
+MmlEventSource mml_cursor_source(MmlEventCursor *cursor, const MmlEvent *events, size_t num_events) {
+    cursor->events = events;
+    cursor->num_events = num_events;
+    cursor->index = 0;
+    MmlEventSource source = {cursor_next, cursor_seek, cursor};
+    return source;
+}
+
+// MMLファイルの内容を文字列として読み込む関数
+char* read_mml_file(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "MMLファイルを開けません: %s\n", path);
+        return NULL;
+    }
+    // ファイルサイズを取得
+    fseek(fp, 0, SEEK_END);
+    long file_size = ftell(fp);
+    rewind(fp);
+
+    // MML文字列を格納するバッファを確保
+    char *mml_string = (char *)malloc(file_size + 1);
+    if (!mml_string) {
+        fprintf(stderr, "メモリが足りません\n");
+        fclose(fp);
+        return NULL;
+    }
+
+    // ファイル内容を読み込む
+    size_t read_size = fread(mml_string, 1, file_size, fp);
+    mml_string[read_size] = '\0'; // NULL終端
+    fclose(fp);
+    return mml_string;
+}
+
 // メモリ解放関数
 void free_mml_events(MmlEvent *events) {
     if (events) {
         free(events);
     }
+}
+
+void free_mml_song(MmlSong *song) {
+    if (!song) {
+        return;
+    }
+    for (size_t i = 0; i < song->num_tracks; ++i) {
+        free_mml_events(song->tracks[i].events);
+    }
+    free(song);
+}
+
+void free_mml_program(MmlProgram *program) {
+    if (!program) {
+        return;
+    }
+    for (size_t i = 0; i < program->num_tracks; ++i) {
+        free(program->tracks[i].ops);
+    }
+    free(program);
 }
\ No newline at end of file
@@ -4,25 +4,273 @@
 #include <stdint.h>
 #include <stddef.h>
 
+// 音量エンベロープ (ADSR) の設定
+// MMLの @E アタック,ディケイ,サステイン,リリース (ミリ秒, ミリ秒, %, ミリ秒) と qX (ゲートタイム) で変わる
+// 長さは解析したときのサンプリングレートでサンプル数にしておく
+// ディケイの減衰率も解析したときに整数にしておくので、ノートを始めるときに浮動小数点を使わない
+#define MML_DECAY_BITS          30  // 減衰率の小数部のビット数
+#define MML_DECAY_SEGMENT_BITS  6   // 減衰率を持つ区間の長さ (2^n サンプル。エンベロープはこの区間ごとの直線で近似する)
+typedef struct {
+    uint32_t attack;        // 0から音量まで上がる長さ (サンプル数)
+    uint32_t decay_segment; // ディケイ中の 2^MML_DECAY_SEGMENT_BITS サンプルあたりの減衰率 (小数部 MML_DECAY_BITS)
+    int sustain;            // サステインのレベル (音量に対する %, 0 ~ 100。0なら減衰しきって止まる)
+    uint32_t release;       // ノートオフから0まで下がる長さ (サンプル数)
+    int gate;               // 音符の長さのうちノートオンしている割合 (1 ~ 8, 8分率)
+} MmlEnvelope;
+
 // MML演奏イベントの構造体
 typedef struct {
     int note_number;
     uint32_t duration_samples;
     int volume;
-    double decay_rate;
+    int instrument;         // 音色番号 (@X。MML_DEFAULT_INSTRUMENT なら読み込んだ・編集中のウェーブテーブル)
+    int pan;                // 定位 (pX。0 = 左, MML_PAN_CENTER = 中央, MML_PAN_MAX = 右)
+    MmlEnvelope envelope;
 } MmlEvent;
 
+// シークの目印を置く間隔 (イベント数)
+// 目印から目的の位置までは、最大でこの数だけイベントを読み進める
+#define MML_SEEK_INTERVAL 64
+
+// イベントを1つずつ取り出すための読み出し口
+// 解析済みの配列・コンパイル済みの曲データなど、元の形式に関係なくレンダラーから同じように読める
+typedef struct {
+    // 次のイベントを *out に書き込む。戻り値: 取り出せたら1, もうなければ0
+    int (*next)(void *ctx, MmlEvent *out);
+    // index 番目のイベントから読み出すように位置を変える (NULLなら位置を変えられない読み出し口)
+    // 戻り値: 成功なら0, 範囲外なら-1
+    int (*seek)(void *ctx, size_t index);
+    void *ctx;
+} MmlEventSource;
+
+// MmlEventの配列を先頭から順に読み出すカーソル
+typedef struct {
+    const MmlEvent *events;
+    size_t num_events;
+    size_t index;
+} MmlEventCursor;
+
+// 1トラック分のイベント列
+typedef struct {
+    MmlEvent *events;
+    size_t num_events;
+} MmlTrack;
+
+// 曲全体 (MML@ の ',' で区切られたトラックの集まり)
+#define MML_MAX_TRACKS 16
+typedef struct {
+    MmlTrack tracks[MML_MAX_TRACKS];
+    size_t num_tracks;
+} MmlSong;
+
+// --- 中間表現 (バイトコード) ---
+// MMLを、音符・状態の変更・ループの命令の列にしたもの
+// [ ... ]n のループを展開しないので、大きさはMMLの文字数に比例し、曲の長さには比例しない
+// MmlProgramCursor が命令列をその場で実行しながら、イベントを1つずつ取り出す
+// (オクターブ・テンポなどの状態も実行しながら変えるので、ループの中で < や t を使ってもよい)
+#define MML_LOOP_DEPTH          16  // ループの入れ子の上限
+#define MML_DEFAULT_LOOP_COUNT  2   // ] の後に回数がないときの繰り返し回数
+#define MML_MAX_LOOP_COUNT      255 // ]n の回数の上限 (大きい値はここまでに丸める)
+#define MML_MAX_EVENTS          (1 << 21) // ループを展開したイベント列の、1トラックあたりの上限
+
+typedef enum {
+    MML_OP_NOTE,            // 音符 a~g (pitch: c からの半音数, value: 音長)
+    MML_OP_NOTE_NUMBER,     // nX (value: ノートナンバー。音長は lX の値)
+    MML_OP_REST,            // 休符 r (value: 音長)
+    MML_OP_OCTAVE,          // oX
+    MML_OP_OCTAVE_SHIFT,    // < と > (value: +1 / -1)
+    MML_OP_LENGTH,          // lX
+    MML_OP_TEMPO,           // tX
+    MML_OP_VOLUME,          // vX
+    MML_OP_INSTRUMENT,      // @X (value: 音色番号。範囲外は MML_DEFAULT_INSTRUMENT にしておく)
+    MML_OP_ENVELOPE,        // @E の1項目 (field: 0~3 = アタック・ディケイ・サステイン・リリース)
+    MML_OP_GATE,            // qX
+    MML_OP_PAN,             // pX (value: 0 ~ MML_PAN_MAX に収めておく)
+    MML_OP_LOOP_BEGIN,      // [ (value: 繰り返し回数)
+    MML_OP_LOOP_END,        // ]n (value: 対応する MML_OP_LOOP_BEGIN の位置)
+} MmlOpCode;
+
+// 命令1つ (12バイト)
+typedef struct {
+    uint8_t op;             // MmlOpCode
+    uint8_t dots;           // 付点の数 (音符・休符) / @E の項目 (MML_OP_ENVELOPE)
+    int16_t pitch;          // c からの半音数 (シャープ・フラットを含む)
+    int32_t value;          // 音長 (音符・休符。0なら lX の値) / 各命令の値
+    int32_t tie;            // & でつなぐ音長 (0ならなし)
+} MmlOp;
+
+// 1トラック分の命令列
+typedef struct {
+    MmlOp *ops;
+    size_t num_ops;
+    double tempo;           // トラックの開始テンポ
+} MmlProgramTrack;
+
+typedef struct {
+    MmlProgramTrack tracks[MML_MAX_TRACKS];
+    size_t num_tracks;
+    int sample_rate;        // 長さをサンプル数にするときのサンプリングレート
+} MmlProgram;
+
+// 実行中のループ
+typedef struct {
+    size_t begin;           // MML_OP_LOOP_BEGIN の位置
+    int32_t remaining;      // 残りの回数
+} MmlLoopState;
+
+// 実行カーソルの目印 (k 番目は k * MML_SEEK_INTERVAL 番目のイベントを取り出す直前の状態)
+// ここから実行を続ければ、先頭から実行し直したのと同じイベントが出る
+typedef struct {
+    size_t pc;
+    int octave;
+    int length;
+    double tempo;
+    int volume;
+    int instrument;
+    int pan;
+    MmlEnvelope envelope;
+    size_t depth;
+    MmlLoopState loops[MML_LOOP_DEPTH];
+} MmlProgramCheckpoint;
+
+// 命令列を実行してイベントを取り出すカーソル (命令列のほかは、この構造体だけで実行できる)
+typedef struct {
+    const MmlOp *ops;
+    size_t num_ops;
+    int sample_rate;
+    double start_tempo;
+
+    size_t pc;              // 次に実行する命令
+    size_t index;           // 次に取り出すイベントの番号
+    int octave;
+    int length;
+    double tempo;
+    int volume;
+    int instrument;
+    int pan;
+    MmlEnvelope envelope;
+    size_t depth;           // 実行中のループの数
+    MmlLoopState loops[MML_LOOP_DEPTH];
+
+    // シークの目印 (初めて seek されてから、実行しながら MML_SEEK_INTERVAL イベントごとに記録する)
+    MmlProgramCheckpoint *checkpoints;
+    size_t num_checkpoints;
+    size_t checkpoint_capacity;
+    int recording;          // 目印を記録するか (先頭から読むだけの使い方ではメモリを使わない)
+} MmlProgramCursor;
+
+// 命令列を作っている途中の状態 (MMLを先頭から順に命令にしていく)
+typedef struct {
+    MmlOp *ops;
+    size_t num_ops;
+    size_t capacity;
+    size_t loop_begins[MML_LOOP_DEPTH]; // まだ ] が来ていない [ の位置
+    size_t depth;
+    int failed;             // メモリが足りないなどで続けられない
+} MmlCompiler;
+
+// --- 少しずつ届くMMLの解析 (ストリーム) ---
+// 標準入力・FIFO・ファイルから少しずつ読み、届いた分だけ命令にしながら実行してイベントを取り出す
+// 曲全体を読み込むのを待たずに、最初の音符を読んだところで再生を始められる
+// オクターブ・音長・テンポ・音量などの状態と、閉じていないループはチャンクの間で持ち越す
+// 実行し終えた命令は捨てるので、メモリは読み込みの単位と実行中のループの中身の分だけで済む
+// (閉じていないループの中身は、] が来て回数が決まるまで実行しない)
+// 1トラックだけを読む。',' で区切った2つ目以降のトラックは、後ろまで読まないと始められないので無視する
+#define MML_STREAM_TEXT_BYTES   4096    // 読み込みの単位 (まだ命令にしていない文字を含む)
+
+typedef struct {
+    int fd;                 // 読み込み元 (-1なら mml_stream_feed で渡す)
+    int owns_fd;
+    char text[MML_STREAM_TEXT_BYTES + 1]; // まだ命令にしていない文字 (コマンドの途中で切れた分と、読んだばかりの分)
+    size_t text_len;
+    int started;            // 先頭の "MML@" を確かめたか
+    int input_done;         // 入力の終わり (EOFか最初のトラックの終わり) まで命令にしたか
+    size_t bytes_read;      // 今までに受け取ったバイト数
+    MmlCompiler compiler;
+    MmlProgramCursor cursor;
+} MmlStream;
+
 // テンポの初期値 (BPM)
 #define DEFAULT_TEMPO 120
 #define DEFAULT_VOLUME 100
+#define MML_DEFAULT_INSTRUMENT -1   // @X を指定していないときの音色
+#define MML_PAN_CENTER 64           // pX を指定していないときの定位 (中央)
+#define MML_PAN_MAX 127
 #define DEFAULT_DECAY_RATE 0.99995 // 1サンプルあたりの音量減少率（例）
+#define DEFAULT_ATTACK_MS 2         // 音の出だしでプチッといわない程度の長さ
+#define DEFAULT_SUSTAIN 0
+#define DEFAULT_RELEASE_MS 5        // 音の切れ目でプチッといわない程度の長さ
+#define DEFAULT_GATE 8
+#define MAX_GATE 8
+
+// エンベロープの初期値 (@E も q も指定していないときの値)
+void mml_default_envelope(MmlEnvelope *envelope, int sample_rate);
+
+// 2つのエンベロープの設定が同じかどうか
+int mml_envelope_equal(const MmlEnvelope *a, const MmlEnvelope *b);
+
+// MML文字列を解析して、トラックごとのMmlEventのリストを生成する関数
+// 中間表現にコンパイルしてから、ループを展開しながら実行して作る
+// 戻り値: MmlSong (使い終わったらfree_mml_songで解放する), 失敗時はNULL
+MmlSong* parse_mml_song(const char *mml_string, int sample_rate);
+
+// MML文字列を中間表現にコンパイルする
+// 戻り値: MmlProgram (使い終わったらfree_mml_programで解放する), 失敗時はNULL
+MmlProgram* mml_compile(const char *mml_string, int sample_rate);
+
+// 命令列の大きさ (バイト数)
+size_t mml_program_size(const MmlProgram *program);
+
+// トラック track の命令列を先頭から実行するカーソルを初期化し、その読み出し口を返す
+// 読み出し口の seek は、実行しながら記録した目印から読み進めるので、最大 MML_SEEK_INTERVAL イベント分で済む
+// (まだ実行していない所へは、記録してある最後の目印から読み進める)
+MmlEventSource mml_program_source(MmlProgramCursor *cursor, const MmlProgram *program, size_t track);
+
+// カーソルが記録した目印を解放する
+void mml_program_cursor_free(MmlProgramCursor *cursor);
+
+// mml_stream_feed でMMLを渡すストリームを初期化する
+void mml_stream_init(MmlStream *stream, int sample_rate);
+
+// path ("-" なら標準入力) から必要になった分だけ読むストリームを開く
+// 戻り値: 成功なら0, 開けなければ-1
+int mml_stream_open(MmlStream *stream, const char *path, int sample_rate);
+
+// MMLの続き (len バイト) を渡す。コマンドの途中で切れていてもよい
+// 渡した分は命令になって残るので、渡したらイベントを取り出してから次を渡す
+// 戻り値: 成功なら0, メモリが足りなければ-1
+int mml_stream_feed(MmlStream *stream, const char *data, size_t len);
+
+// MMLの終わりを知らせる (残りの文字を命令にし、閉じていないループを閉じる)
+void mml_stream_finish(MmlStream *stream);
+
+// 入力の終わりまで命令にして、全部実行し終えたかどうか
+int mml_stream_finished(const MmlStream *stream);
+
+// ストリームの読み出し口を返す (位置は変えられない)
+// 読み込み元があれば、命令が尽きるたびにそこから読む (届くまで待つ)
+// mml_stream_feed で渡す場合は、渡した分を実行し終えると0を返す (mml_stream_finished で終わりかどうか分かる)
+MmlEventSource mml_stream_source(MmlStream *stream);
+
+// 命令を解放し、開いた読み込み元を閉じる
+void mml_stream_close(MmlStream *stream);
 
 // MML文字列を解析して、MmlEventのリストを生成する関数
+// 複数トラックのMMLでは最初のトラックだけを返す
 // 戻り値: MmlEventの配列
 // *out_num_events: 生成されたイベントの個数を格納するポインタ
 MmlEvent* parse_mml(const char *mml_string, int sample_rate, size_t *out_num_events);
 
+// MMLファイルの内容を読み込み、NULL終端した文字列として返す関数
+// 戻り値: mallocで確保した文字列 (使い終わったらfreeする), 失敗時はNULL
+char* read_mml_file(const char *path);
+
+// 配列を読み出すカーソルを初期化し、その読み出し口を返す
+MmlEventSource mml_cursor_source(MmlEventCursor *cursor, const MmlEvent *events, size_t num_events);
+
 // メモリ解放関数(mallocで確保した分をfreeする)
 void free_mml_events(MmlEvent *events);
+void free_mml_song(MmlSong *song);
+void free_mml_program(MmlProgram *program);
 
 #endif // MML_PARSER_H
\ No newline at end of file
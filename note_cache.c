@@ -0,0 +1,174 @@
+#include "note_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+static size_t entry_bytes(const NoteCacheEntry *e) {
+    return (size_t)e->key.duration * sizeof(int16_t);
+}
+
+void note_cache_init(NoteCache *cache, size_t budget) {
+    memset(cache, 0, sizeof(*cache));
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->budget = budget;
+}
+
+void note_cache_destroy(NoteCache *cache) {
+    NoteCacheEntry *e = cache->lru_head;
+    while (e) {
+        NoteCacheEntry *next = e->lru_next;
+        free(e->samples);
+        free(e);
+        e = next;
+    }
+    pthread_mutex_destroy(&cache->lock);
+    memset(cache, 0, sizeof(*cache));
+}
+
+int note_cache_accepts(const NoteCache *cache, uint32_t duration) {
+    return duration > 0 && (size_t)duration * sizeof(int16_t) <= cache->budget / 4;
+}
+
+// FNV-1a 64bit ハッシュ
+uint64_t note_cache_hash(const NoteCacheKey *key) {
+    const uint8_t *p = (const uint8_t *)key;
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < sizeof(*key); ++i) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// --- LRUの並び (lock を持った状態で呼ぶ) ---
+
+static void lru_unlink(NoteCache *cache, NoteCacheEntry *e) {
+    if (e->lru_prev) {
+        e->lru_prev->lru_next = e->lru_next;
+    } else {
+        cache->lru_head = e->lru_next;
+    }
+    if (e->lru_next) {
+        e->lru_next->lru_prev = e->lru_prev;
+    } else {
+        cache->lru_tail = e->lru_prev;
+    }
+    e->lru_prev = NULL;
+    e->lru_next = NULL;
+}
+
+static void lru_push_front(NoteCache *cache, NoteCacheEntry *e) {
+    e->lru_prev = NULL;
+    e->lru_next = cache->lru_head;
+    if (cache->lru_head) {
+        cache->lru_head->lru_prev = e;
+    } else {
+        cache->lru_tail = e;
+    }
+    cache->lru_head = e;
+}
+
+static NoteCacheEntry *find(NoteCache *cache, const NoteCacheKey *key, uint64_t hash) {
+    for (NoteCacheEntry *e = cache->buckets[hash & (NOTE_CACHE_BUCKETS - 1)]; e; e = e->bucket_next) {
+        if (e->hash == hash && memcmp(&e->key, key, sizeof(*key)) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+// 表から外す (参照されていなければ解放する)
+static void evict(NoteCache *cache, NoteCacheEntry *e) {
+    NoteCacheEntry **link = &cache->buckets[e->hash & (NOTE_CACHE_BUCKETS - 1)];
+    while (*link != e) {
+        link = &(*link)->bucket_next;
+    }
+    *link = e->bucket_next;
+    lru_unlink(cache, e);
+    cache->used -= entry_bytes(e);
+    cache->evictions++;
+    e->listed = 0;
+    if (e->refs == 0) {
+        free(e->samples);
+        free(e);
+    }
+}
+
+// bytes を入れられるように、使っていないものを古い順に追い出す
+// 戻り値: 入れられるなら1
+static int make_room(NoteCache *cache, size_t bytes) {
+    NoteCacheEntry *e = cache->lru_tail;
+    while (cache->used + bytes > cache->budget && e) {
+        NoteCacheEntry *newer = e->lru_prev;
+        if (e->refs == 0) {
+            evict(cache, e);
+        }
+        e = newer;
+    }
+    return cache->used + bytes <= cache->budget;
+}
+
+const NoteCacheEntry *note_cache_acquire(NoteCache *cache, const NoteCacheKey *key) {
+    uint64_t hash = note_cache_hash(key);
+
+    pthread_mutex_lock(&cache->lock);
+    NoteCacheEntry *e = find(cache, key, hash);
+    if (e) {
+        e->refs++;
+        lru_unlink(cache, e);
+        lru_push_front(cache, e);
+        cache->hits++;
+    } else {
+        cache->misses++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return e;
+}
+
+const NoteCacheEntry *note_cache_insert(NoteCache *cache, const NoteCacheKey *key, int16_t *samples) {
+    uint64_t hash = note_cache_hash(key);
+
+    pthread_mutex_lock(&cache->lock);
+    // 別のトラックが同じノートを先に入れていれば、そちらを使う
+    NoteCacheEntry *e = find(cache, key, hash);
+    if (e) {
+        e->refs++;
+        lru_unlink(cache, e);
+        lru_push_front(cache, e);
+        pthread_mutex_unlock(&cache->lock);
+        free(samples);
+        return e;
+    }
+    e = (NoteCacheEntry *)calloc(1, sizeof(NoteCacheEntry));
+    if (!e) {
+        pthread_mutex_unlock(&cache->lock);
+        free(samples);
+        return NULL;
+    }
+    e->key = *key;
+    e->hash = hash;
+    e->samples = samples;
+    e->refs = 1;
+    if (make_room(cache, entry_bytes(e))) {
+        NoteCacheEntry **bucket = &cache->buckets[hash & (NOTE_CACHE_BUCKETS - 1)];
+        e->bucket_next = *bucket;
+        *bucket = e;
+        lru_push_front(cache, e);
+        cache->used += entry_bytes(e);
+        e->listed = 1;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return e;
+}
+
+void note_cache_release(NoteCache *cache, const NoteCacheEntry *entry) {
+    NoteCacheEntry *e = (NoteCacheEntry *)entry;
+
+    pthread_mutex_lock(&cache->lock);
+    e->refs--;
+    int discard = (e->refs == 0 && !e->listed);
+    pthread_mutex_unlock(&cache->lock);
+    if (discard) {
+        free(e->samples);
+        free(e);
+    }
+}
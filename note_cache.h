@@ -0,0 +1,82 @@
+#ifndef NOTE_CACHE_H
+#define NOTE_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "mml_parser.h"
+
+// 生成済みのノートのキャッシュ (LRU)
+// 同じウェーブテーブル・音の高さ・長さ・音量・エンベロープのノートは、開始時のフェーズが同じなら同じ波形になる
+// フェーズを元のテーブルの1点 (1/TABLE_SIZE 周期) 単位に丸めて鍵に含め、繰り返しのフレーズは memcpy で済ませる
+// 丸めたフェーズから鳴らすのはヒットでもミスでも同じなので、キャッシュを使うときの出力は履歴によらず一定になる
+// (使わないときとは、ノートの頭のフェーズが1/TABLE_SIZE 周期未満ずれる分だけ違う)
+//
+// トラックのワーカースレッドから同時に使えるように、表はミューテックスで守る
+// 使用中のノート (参照数が1以上) は追い出さない
+// ミスしたノートの生成でメモリを確保するので、リアルタイムの再生スレッドでは使わない
+
+#define NOTE_CACHE_BUCKETS 1024     // ハッシュ表の大きさ (2のべき乗)
+
+// キャッシュの鍵 (memcmpで比べるので、作るときは全体を0で埋めてから設定する)
+typedef struct {
+    uint64_t table_hash;        // 使う帯域制限済みテーブル1段分の内容のハッシュ
+    uint64_t phase_increment;
+    uint32_t duration;          // ノートの長さ (サンプル数)
+    uint32_t start_phase;       // 開始時のフェーズ (元のテーブルの点の番号に丸めたもの)
+    int32_t peak;               // 音量 (小数部 OSC_GAIN_BITS)
+    int32_t interp;
+    MmlEnvelope envelope;
+} NoteCacheKey;
+
+typedef struct NoteCacheEntry {
+    NoteCacheKey key;
+    uint64_t hash;
+    int16_t *samples;           // ノート全体の波形 (key.duration サンプル)
+    int refs;                   // 使用中のレンダラーの数
+    int listed;                 // 表に入っているか (予算に入らなかったものは使い終わったら捨てる)
+    struct NoteCacheEntry *bucket_next;
+    struct NoteCacheEntry *lru_prev;   // 新しい方
+    struct NoteCacheEntry *lru_next;   // 古い方
+} NoteCacheEntry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    NoteCacheEntry *buckets[NOTE_CACHE_BUCKETS];
+    NoteCacheEntry *lru_head;   // 一番最近使ったもの
+    NoteCacheEntry *lru_tail;   // 一番長く使っていないもの (ここから追い出す)
+    size_t budget;              // 波形に使ってよいバイト数
+    size_t used;                // 表に入っている波形のバイト数
+
+    // 統計
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} NoteCache;
+
+// budget バイトまで波形を覚えるキャッシュを初期化する
+void note_cache_init(NoteCache *cache, size_t budget);
+
+// 全部の波形を解放する (使用中のものが残っていないこと)
+void note_cache_destroy(NoteCache *cache);
+
+// キャッシュに入れる価値のある長さか (予算の1/4を超えるノートは入れない)
+int note_cache_accepts(const NoteCache *cache, uint32_t duration);
+
+// 鍵のハッシュ値
+uint64_t note_cache_hash(const NoteCacheKey *key);
+
+// 鍵に一致するノートを探す。見つかれば参照数を増やして返す (使い終わったら note_cache_release)
+// 見つからなければミスとして数えてNULLを返す
+const NoteCacheEntry *note_cache_acquire(NoteCache *cache, const NoteCacheKey *key);
+
+// 生成したノート (mallocした samples, 所有権を移す) を入れて、参照数1で返す
+// 同じ鍵が先に入っていればそちらを返して samples は解放する
+// 予算に収まらない場合 (使用中のものばかりのとき) は表に入れず、使い終わったときに捨てる
+// 戻り値: メモリが足りなければNULL (samples は解放する)
+const NoteCacheEntry *note_cache_insert(NoteCache *cache, const NoteCacheKey *key, int16_t *samples);
+
+// 使い終わったノートを返す
+void note_cache_release(NoteCache *cache, const NoteCacheEntry *entry);
+
+#endif // NOTE_CACHE_H
@@ -0,0 +1,29 @@
+#include "note_queue.h"
+
+void note_queue_init(NoteQueue *q) {
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+}
+
+int note_queue_push(NoteQueue *q, NoteMessage message) {
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (tail - head >= NOTE_QUEUE_SIZE) {
+        return 0;
+    }
+    q->items[tail & (NOTE_QUEUE_SIZE - 1)] = message;
+    // 中身を書いてから位置を進める (読み出し側は位置を見てから中身を読む)
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+int note_queue_pop(NoteQueue *q, NoteMessage *out) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    if (head == tail) {
+        return 0;
+    }
+    *out = q->items[head & (NOTE_QUEUE_SIZE - 1)];
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return 1;
+}
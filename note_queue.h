@@ -0,0 +1,42 @@
+#ifndef NOTE_QUEUE_H
+#define NOTE_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+// MIDI入力スレッドから音声スレッドへノートを渡すキュー
+// 書き込み側と読み出し側がそれぞれ1スレッドだけ (SPSC) なので、ロックなしで受け渡せる
+// 容量は固定で、満杯のときは書き込み側が捨てる (音声スレッドを待たせない)
+
+#define NOTE_QUEUE_SIZE 256     // 2のべき乗
+#define NOTE_QUEUE_CACHE_LINE 64
+
+typedef enum {
+    NOTE_MESSAGE_ON,        // ノートオン (note, velocity)
+    NOTE_MESSAGE_OFF,       // ノートオフ (note)
+    NOTE_MESSAGE_ALL_OFF,   // 全ての音を止める (All Notes Off / All Sound Off)
+} NoteMessageType;
+
+typedef struct {
+    uint8_t type;           // NoteMessageType
+    uint8_t note;           // MIDIノートナンバー
+    uint8_t velocity;       // 1 ~ 127
+} NoteMessage;
+
+typedef struct {
+    NoteMessage items[NOTE_QUEUE_SIZE];
+    // 書き込み側と読み出し側が別々に更新するので、同じキャッシュラインに載せない
+    _Alignas(NOTE_QUEUE_CACHE_LINE) atomic_size_t head;  // 次に読む位置 (読み出し側だけが書く)
+    _Alignas(NOTE_QUEUE_CACHE_LINE) atomic_size_t tail;  // 次に書く位置 (書き込み側だけが書く)
+} NoteQueue;
+
+void note_queue_init(NoteQueue *q);
+
+// 1つ積む (書き込み側から呼ぶ)。戻り値: 積めたら1, 満杯なら0
+int note_queue_push(NoteQueue *q, NoteMessage message);
+
+// 1つ取り出す (読み出し側から呼ぶ)。戻り値: 取り出せたら1, 空なら0
+int note_queue_pop(NoteQueue *q, NoteMessage *out);
+
+#endif // NOTE_QUEUE_H
@@ -0,0 +1,436 @@
+// ビット単位で一致させるため、a + b * c を融合積和(FMA)にまとめさせない
+#pragma GCC optimize("fp-contract=off")
+
+#include "osc_kernel.h"
+#include "wavetable.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+// SYNTH_FIXED_POINT のビルドでは浮動小数点のSIMD版を含めない
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(SYNTH_FIXED_POINT)
+#define OSC_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && !defined(SYNTH_FIXED_POINT)
+#define OSC_HAVE_NEON 1
+#include <arm_neon.h>
+#if defined(__arm__)
+// 32bit ARM (armhf) ではNEONの有無を実行時に確認する
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+// フェーズ (TABLE_SIZE で1周期) から細かいテーブルの位置への変換
+// TABLE_SIZE=32, MIP_TABLE_SIZE=256 なら、フェーズを 29bit 右シフトした値が細かいテーブルの位置になる
+#define INDEX_SHIFT (FRACTIONAL_BITS - (MIP_TABLE_BITS - TABLE_BITS))
+#define INDEX_MASK  (MIP_TABLE_SIZE - 1)
+#define FRAC_BITS   16  // 補間に使う小数部のビット数
+#define FRAC_SCALE  (1.0f / (1 << FRAC_BITS))
+#define Q15_BITS    15  // Q15版の補間位置と音量の小数部のビット数
+
+#define GAIN_SCALE  (1.0f / (1 << OSC_GAIN_BITS))
+
+void osc_set_ramp(OscState *s, int32_t gain, int32_t gain_step, uint32_t pos) {
+    s->gain = gain;
+    s->gain_step = gain_step;
+    s->gain_pos = pos;
+}
+
+// --- 全カーネル共通の処理 ---
+// テーブルの読み出しはスカラーで行い、補間と音量の計算をSIMDでまとめて行う
+// SIMD版もスカラー版も下の interp_* と同じ順番で演算するので、結果はビット単位で一致する
+
+// 1グループ分のテーブルの値と補間位置
+typedef struct {
+    float p0[OSC_LANES];    // 1つ前の点 (3次補間のみ)
+    float p1[OSC_LANES];    // 現在の点
+    float p2[OSC_LANES];    // 次の点
+    float p3[OSC_LANES];    // 2つ先の点 (3次補間のみ)
+    float frac[OSC_LANES];  // 点と点の間の位置 (0.0 ~ 1.0)
+} OscGroup;
+
+// 線形補間
+static inline float interp_linear(float p1, float p2, float t) {
+    return p1 + (p2 - p1) * t;
+}
+
+// 3次補間 (Catmull-Rom)
+static inline float interp_cubic(float p0, float p1, float p2, float p3, float t) {
+    float c1 = 0.5f * (p2 - p0);
+    float c2 = p0 - 2.5f * p1 + 2.0f * p2 - 0.5f * p3;
+    float c3 = 0.5f * (p3 - p0) + 1.5f * (p1 - p2);
+    return ((c3 * t + c2) * t + c1) * t + p1;
+}
+
+// float を int16 に変換 (0方向への切り捨て + 飽和, SIMDの変換命令と同じ結果になる)
+static inline int16_t to_int16(float v) {
+    // int32に収まらない値はSIMD命令と同じく飽和させる
+    if (v >= 32768.0f) return INT16_MAX;
+    if (v <= -32769.0f) return INT16_MIN;
+    int32_t t = (int32_t)v;
+    if (t > INT16_MAX) t = INT16_MAX;
+    if (t < INT16_MIN) t = INT16_MIN;
+    return (int16_t)t;
+}
+
+// ランプ内の位置 pos の音量 (どのカーネルもこの順番で計算する)
+static inline float ramp_gain(float gain, float step, float pos) {
+    return (gain + step * pos) * GAIN_SCALE;
+}
+
+// 現在のフェーズのテーブル位置と補間位置
+static inline const int16_t *table_point(const int16_t *table, uint64_t phase, float *frac) {
+    *frac = (float)((uint32_t)(phase >> (INDEX_SHIFT - FRAC_BITS)) & ((1u << FRAC_BITS) - 1)) * FRAC_SCALE;
+    return &table[(uint32_t)(phase >> INDEX_SHIFT) & INDEX_MASK];
+}
+
+// --- 補間方法ごとの特殊化 ---
+// 各カーネルの本体は、補間方法 cubic を定数として受け取る always_inline の関数にして、
+// カーネルの入口で補間方法ごとに呼び分ける (ブロックの先頭で1回だけ分岐し、ループの中では分岐しない)
+// テーブルの大きさ (TABLE_BITS, MIP_TABLE_BITS) もコンパイル時の定数なので、位置の計算はシフトとマスクだけになる
+#define OSC_SPECIALIZE __attribute__((always_inline)) static inline
+
+// 補間方法ごとに本体 impl を呼び分ける
+#define OSC_DISPATCH_INTERP(impl, s, table, out, n) \
+    do { \
+        if ((s)->interp == OSC_INTERP_CUBIC) { \
+            impl(s, table, out, n, 1); \
+        } else { \
+            impl(s, table, out, n, 0); \
+        } \
+    } while (0)
+
+// 1サンプルずつ生成する (スカラー版と、SIMD版の端数の処理に使う)
+OSC_SPECIALIZE void render_scalar_samples(OscState *s, const int16_t *table, int16_t *out, size_t n, const int cubic) {
+    float gain0 = (float)s->gain;
+    float step = (float)s->gain_step;
+    for (size_t j = 0; j < n; ++j) {
+        float t;
+        const int16_t *p = table_point(table, s->phase, &t);
+        float v;
+        if (cubic) {
+            v = interp_cubic(p[-1], p[0], p[1], p[2], t);
+        } else {
+            v = interp_linear(p[0], p[1], t);
+        }
+        out[j] = to_int16(v * ramp_gain(gain0, step, (float)s->gain_pos));
+        s->phase += s->phase_increment;
+        s->gain_pos++;
+    }
+}
+
+#if defined(OSC_HAVE_X86) || defined(OSC_HAVE_NEON)
+// グループ内の位置 (ランプ内の位置に足してレーンごとの位置にする)
+static const float lane_offsets[OSC_LANES] = {0, 1, 2, 3, 4, 5, 6, 7};
+#endif
+
+// 1グループ分のテーブル値を読み出してフェーズを進める
+OSC_SPECIALIZE void gather_group(OscState *s, const int16_t *table, OscGroup *g, const int cubic) {
+    uint64_t phase = s->phase;
+    for (int j = 0; j < OSC_LANES; ++j) {
+        const int16_t *p = table_point(table, phase, &g->frac[j]);
+        g->p1[j] = p[0];
+        g->p2[j] = p[1];
+        if (cubic) {
+            g->p0[j] = p[-1];
+            g->p3[j] = p[2];
+        }
+        phase += s->phase_increment;
+    }
+    s->phase = phase;
+}
+
+// 1グループ分を処理し終えたときの状態更新
+static inline void advance_group(OscState *s) {
+    s->gain_pos += OSC_LANES;
+}
+
+// --- スカラー版 (どのCPUでも動く基準実装) ---
+static void osc_kernel_scalar(OscState *s, const int16_t *table, int16_t *out, size_t n) {
+    OSC_DISPATCH_INTERP(render_scalar_samples, s, table, out, n);
+}
+
+// --- Q15版 (整数演算だけで生成する。FPUのない・遅いCPU向け) ---
+// 補間位置は Q15、音量はランプの値の上位を Q15 として掛ける
+// 補間した値は小数部14bitを残しておき、最後に音量を掛けてから0方向に切り捨てる (浮動小数点版と同じ丸め)
+#define Q15_INTERP_BITS 14  // 補間した値に残す小数部のビット数
+
+OSC_SPECIALIZE int32_t q15_interp(const int16_t *table, uint64_t phase, const int cubic) {
+    const int16_t *p = &table[(uint32_t)(phase >> INDEX_SHIFT) & INDEX_MASK];
+    int32_t t = (int32_t)((uint32_t)(phase >> (INDEX_SHIFT - Q15_BITS)) & ((1u << Q15_BITS) - 1));
+    if (cubic) {
+        // Catmull-Rom の係数を2倍して整数にしたもの (途中の値は32bitに収まらないので64bitで計算する)
+        int64_t c1 = p[1] - p[-1];
+        int64_t c2 = 2 * p[-1] - 5 * p[0] + 4 * p[1] - p[2];
+        int64_t c3 = (p[2] - p[-1]) + 3 * (p[0] - p[1]);
+        int64_t v = ((c3 * t) >> Q15_BITS) + c2;
+        v = ((v * t) >> Q15_BITS) + c1;
+        v = v * t;  // 係数が2倍なので、ここで小数部は Q15_BITS + 1 ビット
+        return p[0] * (1 << Q15_INTERP_BITS) + (int32_t)(v >> (Q15_BITS + 1 - Q15_INTERP_BITS));
+    }
+    // 差は17bit、t を14bitにすれば積は31bitに収まる
+    return p[0] * (1 << Q15_INTERP_BITS) + (p[1] - p[0]) * (t >> (Q15_BITS - Q15_INTERP_BITS));
+}
+
+OSC_SPECIALIZE void render_q15(OscState *s, const int16_t *table, int16_t *out, size_t n, const int cubic) {
+    uint64_t phase = s->phase;
+    int64_t gain = (int64_t)s->gain + (int64_t)s->gain_step * s->gain_pos;
+    const int shift = Q15_INTERP_BITS + Q15_BITS;
+
+    for (size_t j = 0; j < n; ++j) {
+        int32_t v = q15_interp(table, phase, cubic);
+        int64_t product = (int64_t)v * (int32_t)(gain >> (OSC_GAIN_BITS - Q15_BITS));
+        int64_t y = (product >= 0) ? (product >> shift) : -((-product) >> shift);
+        if (y > INT16_MAX) y = INT16_MAX;
+        if (y < INT16_MIN) y = INT16_MIN;
+        out[j] = (int16_t)y;
+        phase += s->phase_increment;
+        gain += s->gain_step;
+    }
+    s->phase = phase;
+    s->gain_pos += (uint32_t)n;
+}
+
+static void osc_kernel_q15(OscState *s, const int16_t *table, int16_t *out, size_t n) {
+    OSC_DISPATCH_INTERP(render_q15, s, table, out, n);
+}
+
+#ifdef OSC_HAVE_X86
+// --- SSE2版 (4レーン x 2) ---
+__attribute__((target("sse2")))
+static inline __m128 sse2_interp(const OscGroup *g, int k, int cubic) {
+    __m128 p1 = _mm_loadu_ps(&g->p1[k]);
+    __m128 p2 = _mm_loadu_ps(&g->p2[k]);
+    __m128 t = _mm_loadu_ps(&g->frac[k]);
+    if (!cubic) {
+        return _mm_add_ps(p1, _mm_mul_ps(_mm_sub_ps(p2, p1), t));
+    }
+    __m128 p0 = _mm_loadu_ps(&g->p0[k]);
+    __m128 p3 = _mm_loadu_ps(&g->p3[k]);
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128 c1 = _mm_mul_ps(half, _mm_sub_ps(p2, p0));
+    __m128 c2 = _mm_sub_ps(_mm_add_ps(_mm_sub_ps(p0, _mm_mul_ps(_mm_set1_ps(2.5f), p1)), _mm_mul_ps(_mm_set1_ps(2.0f), p2)), _mm_mul_ps(half, p3));
+    __m128 c3 = _mm_add_ps(_mm_mul_ps(half, _mm_sub_ps(p3, p0)), _mm_mul_ps(_mm_set1_ps(1.5f), _mm_sub_ps(p1, p2)));
+    __m128 v = _mm_add_ps(_mm_mul_ps(c3, t), c2);
+    v = _mm_add_ps(_mm_mul_ps(v, t), c1);
+    return _mm_add_ps(_mm_mul_ps(v, t), p1);
+}
+
+__attribute__((target("sse2")))
+static inline __m128 sse2_gain(__m128 gain, __m128 step, __m128 pos) {
+    return _mm_mul_ps(_mm_add_ps(gain, _mm_mul_ps(step, pos)), _mm_set1_ps(GAIN_SCALE));
+}
+
+__attribute__((target("sse2")))
+OSC_SPECIALIZE void render_sse2(OscState *s, const int16_t *table, int16_t *out, size_t n, const int cubic) {
+    size_t done = 0;
+    const __m128 gain = _mm_set1_ps((float)s->gain);
+    const __m128 step = _mm_set1_ps((float)s->gain_step);
+    const __m128 lanes0 = _mm_loadu_ps(&lane_offsets[0]);
+    const __m128 lanes1 = _mm_loadu_ps(&lane_offsets[4]);
+    OscGroup g;
+
+    for (; n - done >= OSC_LANES; done += OSC_LANES) {
+        gather_group(s, table, &g, cubic);
+        __m128 pos = _mm_set1_ps((float)s->gain_pos);
+        __m128 v0 = _mm_mul_ps(sse2_interp(&g, 0, cubic), sse2_gain(gain, step, _mm_add_ps(pos, lanes0)));
+        __m128 v1 = _mm_mul_ps(sse2_interp(&g, 4, cubic), sse2_gain(gain, step, _mm_add_ps(pos, lanes1)));
+        __m128i packed = _mm_packs_epi32(_mm_cvttps_epi32(v0), _mm_cvttps_epi32(v1));
+        _mm_storeu_si128((__m128i *)&out[done], packed);
+        advance_group(s);
+    }
+    render_scalar_samples(s, table, out + done, n - done, cubic);
+}
+
+__attribute__((target("sse2")))
+static void osc_kernel_sse2(OscState *s, const int16_t *table, int16_t *out, size_t n) {
+    OSC_DISPATCH_INTERP(render_sse2, s, table, out, n);
+}
+
+// --- AVX2版 (8レーン) ---
+__attribute__((target("avx2")))
+static inline __m256 avx2_interp(const OscGroup *g, int cubic) {
+    __m256 p1 = _mm256_loadu_ps(g->p1);
+    __m256 p2 = _mm256_loadu_ps(g->p2);
+    __m256 t = _mm256_loadu_ps(g->frac);
+    if (!cubic) {
+        return _mm256_add_ps(p1, _mm256_mul_ps(_mm256_sub_ps(p2, p1), t));
+    }
+    __m256 p0 = _mm256_loadu_ps(g->p0);
+    __m256 p3 = _mm256_loadu_ps(g->p3);
+    __m256 half = _mm256_set1_ps(0.5f);
+    __m256 c1 = _mm256_mul_ps(half, _mm256_sub_ps(p2, p0));
+    __m256 c2 = _mm256_sub_ps(_mm256_add_ps(_mm256_sub_ps(p0, _mm256_mul_ps(_mm256_set1_ps(2.5f), p1)), _mm256_mul_ps(_mm256_set1_ps(2.0f), p2)), _mm256_mul_ps(half, p3));
+    __m256 c3 = _mm256_add_ps(_mm256_mul_ps(half, _mm256_sub_ps(p3, p0)), _mm256_mul_ps(_mm256_set1_ps(1.5f), _mm256_sub_ps(p1, p2)));
+    __m256 v = _mm256_add_ps(_mm256_mul_ps(c3, t), c2);
+    v = _mm256_add_ps(_mm256_mul_ps(v, t), c1);
+    return _mm256_add_ps(_mm256_mul_ps(v, t), p1);
+}
+
+__attribute__((target("avx2")))
+OSC_SPECIALIZE void render_avx2(OscState *s, const int16_t *table, int16_t *out, size_t n, const int cubic) {
+    size_t done = 0;
+    const __m256 gain = _mm256_set1_ps((float)s->gain);
+    const __m256 step = _mm256_set1_ps((float)s->gain_step);
+    const __m256 lanes = _mm256_loadu_ps(lane_offsets);
+    const __m256 scale = _mm256_set1_ps(GAIN_SCALE);
+    OscGroup g;
+
+    for (; n - done >= OSC_LANES; done += OSC_LANES) {
+        gather_group(s, table, &g, cubic);
+        __m256 pos = _mm256_add_ps(_mm256_set1_ps((float)s->gain_pos), lanes);
+        __m256 v = _mm256_mul_ps(avx2_interp(&g, cubic), _mm256_mul_ps(_mm256_add_ps(gain, _mm256_mul_ps(step, pos)), scale));
+        __m256i t = _mm256_cvttps_epi32(v);
+        __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(t), _mm256_extracti128_si256(t, 1));
+        _mm_storeu_si128((__m128i *)&out[done], packed);
+        advance_group(s);
+    }
+    render_scalar_samples(s, table, out + done, n - done, cubic);
+}
+
+__attribute__((target("avx2")))
+static void osc_kernel_avx2(OscState *s, const int16_t *table, int16_t *out, size_t n) {
+    OSC_DISPATCH_INTERP(render_avx2, s, table, out, n);
+}
+#endif // OSC_HAVE_X86
+
+#ifdef OSC_HAVE_NEON
+// --- NEON版 (4レーン x 2) ---
+// armhf でこの版を使うには -mfpu=neon-vfpv4 を付けてビルドする
+static inline float32x4_t neon_interp(const OscGroup *g, int k, int cubic) {
+    float32x4_t p1 = vld1q_f32(&g->p1[k]);
+    float32x4_t p2 = vld1q_f32(&g->p2[k]);
+    float32x4_t t = vld1q_f32(&g->frac[k]);
+    if (!cubic) {
+        return vaddq_f32(p1, vmulq_f32(vsubq_f32(p2, p1), t));
+    }
+    float32x4_t p0 = vld1q_f32(&g->p0[k]);
+    float32x4_t p3 = vld1q_f32(&g->p3[k]);
+    float32x4_t half = vdupq_n_f32(0.5f);
+    float32x4_t c1 = vmulq_f32(half, vsubq_f32(p2, p0));
+    float32x4_t c2 = vsubq_f32(vaddq_f32(vsubq_f32(p0, vmulq_f32(vdupq_n_f32(2.5f), p1)), vmulq_f32(vdupq_n_f32(2.0f), p2)), vmulq_f32(half, p3));
+    float32x4_t c3 = vaddq_f32(vmulq_f32(half, vsubq_f32(p3, p0)), vmulq_f32(vdupq_n_f32(1.5f), vsubq_f32(p1, p2)));
+    float32x4_t v = vaddq_f32(vmulq_f32(c3, t), c2);
+    v = vaddq_f32(vmulq_f32(v, t), c1);
+    return vaddq_f32(vmulq_f32(v, t), p1);
+}
+
+// vmlaq_f32 は融合積和になる場合があるので、掛け算と足し算を分けて書く
+static inline float32x4_t neon_gain(float32x4_t gain, float32x4_t step, float32x4_t pos) {
+    return vmulq_f32(vaddq_f32(gain, vmulq_f32(step, pos)), vdupq_n_f32(GAIN_SCALE));
+}
+
+OSC_SPECIALIZE void render_neon(OscState *s, const int16_t *table, int16_t *out, size_t n, const int cubic) {
+    size_t done = 0;
+    const float32x4_t gain = vdupq_n_f32((float)s->gain);
+    const float32x4_t step = vdupq_n_f32((float)s->gain_step);
+    const float32x4_t lanes0 = vld1q_f32(&lane_offsets[0]);
+    const float32x4_t lanes1 = vld1q_f32(&lane_offsets[4]);
+    OscGroup g;
+
+    for (; n - done >= OSC_LANES; done += OSC_LANES) {
+        gather_group(s, table, &g, cubic);
+        float32x4_t pos = vdupq_n_f32((float)s->gain_pos);
+        float32x4_t v0 = vmulq_f32(neon_interp(&g, 0, cubic), neon_gain(gain, step, vaddq_f32(pos, lanes0)));
+        float32x4_t v1 = vmulq_f32(neon_interp(&g, 4, cubic), neon_gain(gain, step, vaddq_f32(pos, lanes1)));
+        int16x4_t o0 = vqmovn_s32(vcvtq_s32_f32(v0));
+        int16x4_t o1 = vqmovn_s32(vcvtq_s32_f32(v1));
+        vst1q_s16(&out[done], vcombine_s16(o0, o1));
+        advance_group(s);
+    }
+    render_scalar_samples(s, table, out + done, n - done, cubic);
+}
+
+static void osc_kernel_neon(OscState *s, const int16_t *table, int16_t *out, size_t n) {
+    OSC_DISPATCH_INTERP(render_neon, s, table, out, n);
+}
+#endif // OSC_HAVE_NEON
+// --- 実行時のカーネル選択 ---
+
+// 速い順に並べた全カーネル (このビルドに含まれるもの)
+static const OscKernelInfo all_kernels[] = {
+    {"scalar", osc_kernel_scalar},
+    {"q15", osc_kernel_q15},
+#ifdef OSC_HAVE_X86
+    {"sse2", osc_kernel_sse2},
+    {"avx2", osc_kernel_avx2},
+#endif
+#ifdef OSC_HAVE_NEON
+    {"neon", osc_kernel_neon},
+#endif
+};
+#define NUM_ALL_KERNELS (sizeof(all_kernels) / sizeof(all_kernels[0]))
+
+// CPUがそのカーネルの命令に対応しているか
+static int kernel_supported(const OscKernelInfo *k) {
+#ifdef OSC_HAVE_X86
+    if (k->func == osc_kernel_sse2) return __builtin_cpu_supports("sse2");
+    if (k->func == osc_kernel_avx2) return __builtin_cpu_supports("avx2");
+#endif
+#if defined(OSC_HAVE_NEON) && defined(__arm__)
+    if (k->func == osc_kernel_neon) return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#endif
+    (void)k;
+    return 1;
+}
+
+static const OscKernelInfo *supported_kernels[NUM_ALL_KERNELS];
+static size_t num_supported_kernels;
+static _Atomic(const OscKernelInfo *) selected_kernel;
+
+static void detect_kernels(void) {
+    if (num_supported_kernels > 0) {
+        return;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < NUM_ALL_KERNELS; ++i) {
+        if (kernel_supported(&all_kernels[i])) {
+            supported_kernels[count++] = &all_kernels[i];
+        }
+    }
+    num_supported_kernels = count;
+}
+
+size_t osc_kernel_count(void) {
+    detect_kernels();
+    return num_supported_kernels;
+}
+
+const OscKernelInfo *osc_kernel_info(size_t i) {
+    detect_kernels();
+    return (i < num_supported_kernels) ? supported_kernels[i] : NULL;
+}
+
+const OscKernelInfo *osc_kernel_selected(void) {
+    const OscKernelInfo *k = atomic_load(&selected_kernel);
+    if (k) {
+        return k;
+    }
+    detect_kernels();
+#ifdef SYNTH_FIXED_POINT
+    k = &all_kernels[1];
+#else
+    // 基本は一番後ろ (一番速い) の浮動小数点版 (q15 は出力が少し違うので、指定されたときだけ使う)
+    k = supported_kernels[num_supported_kernels - 1];
+    if (k->func == osc_kernel_q15) {
+        k = supported_kernels[0];
+    }
+#endif
+    const char *name = getenv("SYNTH_OSC_KERNEL");
+    if (name) {
+        for (size_t i = 0; i < num_supported_kernels; ++i) {
+            if (strcmp(supported_kernels[i]->name, name) == 0) {
+                k = supported_kernels[i];
+            }
+        }
+    }
+    atomic_store(&selected_kernel, k);
+    return k;
+}
+
+void osc_render(OscState *s, const int16_t *table, int16_t *out, size_t n) {
+    osc_kernel_selected()->func(s, table, out, n);
+}
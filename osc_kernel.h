@@ -0,0 +1,64 @@
+#ifndef OSC_KERNEL_H
+#define OSC_KERNEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 一度に処理するサンプル数 (SIMDのレーン数)
+#define OSC_LANES 8
+
+// テーブルの補間方法
+#define OSC_INTERP_LINEAR 0     // 線形補間 (2点)
+#define OSC_INTERP_CUBIC  1     // 3次補間 (Catmull-Rom, 4点)
+
+// ウェーブテーブル発振器の状態
+// 音量は「ランプの始点 gain + 1サンプルあたりの変化 gain_step x ランプ内の位置」の直線で与える
+// (エンベロープが区間ごとにランプを作って設定する。envelope.h を参照)
+// 各サンプルの音量はランプ内の位置だけから計算するので、サンプル間の依存がなく、
+// SIMDでもスカラーでも、どこでブロックを区切っても同じ計算順序になり、ビット単位で同じ出力になる
+// (-ffast-math を付けると計算順序が変わって一致しなくなるので付けないこと)
+//
+// FPUの遅いCPU向けに、整数演算だけで生成する Q15 版のカーネル ("q15") もある
+// ランプも補間・音量・飽和も全て整数で計算する
+// (浮動小数点版とは一致しないが、誤差は bench の q15_accuracy で確かめている)
+// -DSYNTH_FIXED_POINT を付けてビルドすると、SIMD版を含めず q15 を使う
+typedef struct {
+    uint64_t phase;                 // フェーズアキュムレータ (固定小数点, 小数部 FRACTIONAL_BITS)
+    uint64_t phase_increment;       // 1サンプルあたりのフェーズ増分
+    int32_t gain;                   // ランプの始点の音量 (小数部 OSC_GAIN_BITS)
+    int32_t gain_step;              // 1サンプルあたりの音量の変化 (小数部 OSC_GAIN_BITS)
+    uint32_t gain_pos;              // 次に生成するサンプルのランプ内の位置
+    int interp;                     // 補間方法 (OSC_INTERP_*)
+} OscState;
+
+// 音量の小数部のビット数 (1.0 = 1 << OSC_GAIN_BITS, 8.0 未満まで表せる)
+#define OSC_GAIN_BITS 28
+// ランプの長さの上限 (浮動小数点版で位置を誤差なく表せる範囲)
+#define OSC_MAX_RAMP (1u << 24)
+
+// Nサンプルをまとめて生成するカーネル
+// table は帯域制限したコピー1段分 (MIP_TABLE_SIZE個, 前後にガード点あり)、out に n サンプルを書き込む
+typedef void (*OscKernel)(OscState *s, const int16_t *table, int16_t *out, size_t n);
+
+// カーネルの名前と実体
+typedef struct {
+    const char *name;
+    OscKernel func;
+} OscKernelInfo;
+
+// 音量のランプを設定する (pos はランプの始点から数えた、次に生成するサンプルの位置)
+// ランプは OSC_MAX_RAMP サンプルまでしか使えない (長い区間はエンベロープが分けて設定する)
+void osc_set_ramp(OscState *s, int32_t gain, int32_t gain_step, uint32_t pos);
+
+// このCPUで使えるカーネルの一覧 (0番は常に浮動小数点のスカラー版。Q15版との比較の基準にもなる)
+size_t osc_kernel_count(void);
+const OscKernelInfo *osc_kernel_info(size_t i);
+
+// 実行時に選ばれたカーネル (使える中で一番速い浮動小数点版。SYNTH_FIXED_POINT なら q15)
+// 環境変数 SYNTH_OSC_KERNEL にカーネル名を指定すると、それを優先する
+const OscKernelInfo *osc_kernel_selected(void);
+
+// 選ばれたカーネルで n サンプル生成する
+void osc_render(OscState *s, const int16_t *table, int16_t *out, size_t n);
+
+#endif // OSC_KERNEL_H
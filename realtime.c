@@ -0,0 +1,42 @@
+#include "realtime.h"
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+int realtime_lock_memory(void) {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        perror("警告: メモリをロックできません (mlockall)");
+        return -1;
+    }
+    return 0;
+}
+
+int realtime_thread_create(pthread_t *thread, void *(*start)(void *), void *arg) {
+    pthread_attr_t attr;
+    struct sched_param param;
+    int err;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = REALTIME_PRIORITY;
+    pthread_attr_setschedparam(&attr, &param);
+    err = pthread_create(thread, &attr, start, arg);
+    pthread_attr_destroy(&attr);
+    if (err == 0) {
+        return 0;
+    }
+
+    // 権限がない (EPERM) などの場合は通常の優先度で動かす
+    fprintf(stderr, "警告: リアルタイム優先度のスレッドを作れません: %s\n", strerror(err));
+    return pthread_create(thread, NULL, start, arg) == 0 ? 0 : -1;
+}
+
+void realtime_prefault_stack(void) {
+    volatile unsigned char stack[REALTIME_STACK_SIZE];
+    for (size_t i = 0; i < sizeof(stack); i += 4096) {
+        stack[i] = 0;
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <pthread.h>
+
+// 音声スレッドをリアルタイム優先度で動かすための設定
+// 音声スレッドは他の処理に邪魔されないよう SCHED_FIFO で動かし、
+// ページフォールトで止まらないようにメモリをロックしておく
+// (権限がない環境では警告を出して通常の優先度で動かす)
+
+#define REALTIME_PRIORITY   70      // SCHED_FIFO の優先度 (1 ~ 99)
+#define REALTIME_STACK_SIZE (256 * 1024) // 先に触っておくスタックの大きさ
+
+// プロセスのメモリ (これから確保・mmapする分も含む) をロックする
+// 戻り値: 成功なら0, 失敗なら-1
+int realtime_lock_memory(void);
+
+// SCHED_FIFO のスレッドを作る。優先度を上げられなければ通常のスレッドとして作る
+// このスレッドから作ったスレッドも同じ優先度を引き継ぐ
+// 戻り値: 成功なら0, 失敗なら-1
+int realtime_thread_create(pthread_t *thread, void *(*start)(void *), void *arg);
+
+// スタックを先に触って、実行中にページフォールトが起きないようにする (スレッドの先頭で呼ぶ)
+void realtime_prefault_stack(void);
+
+#endif // REALTIME_H
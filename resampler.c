@@ -0,0 +1,348 @@
+// ビット単位で一致させるため、a + b * c を融合積和(FMA)にまとめさせない
+#pragma GCC optimize("fp-contract=off")
+
+#include "resampler.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RESAMPLER_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define RESAMPLER_HAVE_NEON 1
+#include <arm_neon.h>
+#if defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+#define DOT_LANES 8     // 内積を分けて足す数 (タップ数はこの倍数にする)
+
+// 品質ごとのフィルタの形
+typedef struct {
+    const char *name;
+    size_t taps;
+    double beta;        // Kaiser 窓の形 (大きいほど阻止域の減衰が大きく、遷移帯域が広い)
+    double rolloff;     // 遮断周波数 (低い方のナイキスト周波数に対する割合)
+} ResamplerTier;
+
+static const ResamplerTier tiers[RESAMPLER_NUM_QUALITIES] = {
+    {"fast", 8, 5.0, 0.85},
+    {"medium", 32, 8.0, 0.92},
+    {"best", 64, 10.0, 0.95},
+};
+
+const char *resampler_quality_name(ResamplerQuality quality) {
+    return tiers[quality].name;
+}
+
+ResamplerQuality resampler_quality_default(void) {
+    const char *name = getenv("SYNTH_RESAMPLE_QUALITY");
+    if (name) {
+        for (int q = 0; q < RESAMPLER_NUM_QUALITIES; ++q) {
+            if (strcmp(tiers[q].name, name) == 0) {
+                return (ResamplerQuality)q;
+            }
+        }
+    }
+    return RESAMPLER_MEDIUM;
+}
+
+// --- 内積のカーネル ---
+// どの版も DOT_LANES 個の部分和に分けて足し、最後に同じ順番でまとめるので、結果はビット単位で一致する
+// (部分和 s[0..7] を (s[i] + s[i+4]) -> (t[i] + t[i+2]) -> (u[0] + u[1]) の順に足す)
+
+static float dot_scalar(const float *h, const float *x, size_t taps) {
+    float s[DOT_LANES] = {0};
+    for (size_t i = 0; i < taps; i += DOT_LANES) {
+        for (int k = 0; k < DOT_LANES; ++k) {
+            s[k] = s[k] + h[i + k] * x[i + k];
+        }
+    }
+    float t[4];
+    for (int k = 0; k < 4; ++k) {
+        t[k] = s[k] + s[k + 4];
+    }
+    return (t[0] + t[2]) + (t[1] + t[3]);
+}
+
+#ifdef RESAMPLER_HAVE_X86
+// 4つの部分和 t をまとめる
+__attribute__((target("sse2")))
+static inline float sse2_reduce(__m128 t) {
+    __m128 u = _mm_add_ps(t, _mm_movehl_ps(t, t));              // t0+t2, t1+t3
+    return _mm_cvtss_f32(_mm_add_ss(u, _mm_shuffle_ps(u, u, 1)));
+}
+
+__attribute__((target("sse2")))
+static float dot_sse2(const float *h, const float *x, size_t taps) {
+    __m128 s0 = _mm_setzero_ps();
+    __m128 s1 = _mm_setzero_ps();
+    for (size_t i = 0; i < taps; i += DOT_LANES) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(h + i), _mm_loadu_ps(x + i)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(h + i + 4), _mm_loadu_ps(x + i + 4)));
+    }
+    return sse2_reduce(_mm_add_ps(s0, s1));
+}
+
+__attribute__((target("avx2")))
+static float dot_avx2(const float *h, const float *x, size_t taps) {
+    __m256 s = _mm256_setzero_ps();
+    for (size_t i = 0; i < taps; i += DOT_LANES) {
+        s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_loadu_ps(h + i), _mm256_loadu_ps(x + i)));
+    }
+    __m128 t = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    __m128 u = _mm_add_ps(t, _mm_movehl_ps(t, t));
+    return _mm_cvtss_f32(_mm_add_ss(u, _mm_shuffle_ps(u, u, 1)));
+}
+#endif // RESAMPLER_HAVE_X86
+
+#ifdef RESAMPLER_HAVE_NEON
+// vmlaq_f32 は融合積和になる場合があるので、掛け算と足し算を分けて書く
+static float dot_neon(const float *h, const float *x, size_t taps) {
+    float32x4_t s0 = vdupq_n_f32(0.0f);
+    float32x4_t s1 = vdupq_n_f32(0.0f);
+    for (size_t i = 0; i < taps; i += DOT_LANES) {
+        s0 = vaddq_f32(s0, vmulq_f32(vld1q_f32(h + i), vld1q_f32(x + i)));
+        s1 = vaddq_f32(s1, vmulq_f32(vld1q_f32(h + i + 4), vld1q_f32(x + i + 4)));
+    }
+    float t[4];
+    vst1q_f32(t, vaddq_f32(s0, s1));
+    return (t[0] + t[2]) + (t[1] + t[3]);
+}
+#endif // RESAMPLER_HAVE_NEON
+
+// --- 実行時のカーネル選択 ---
+
+// 速い順に並べた全カーネル (このビルドに含まれるもの)
+static const ResamplerKernelInfo all_kernels[] = {
+    {"scalar", dot_scalar},
+#ifdef RESAMPLER_HAVE_X86
+    {"sse2", dot_sse2},
+    {"avx2", dot_avx2},
+#endif
+#ifdef RESAMPLER_HAVE_NEON
+    {"neon", dot_neon},
+#endif
+};
+#define NUM_ALL_KERNELS (sizeof(all_kernels) / sizeof(all_kernels[0]))
+
+static int kernel_supported(const ResamplerKernelInfo *k) {
+#ifdef RESAMPLER_HAVE_X86
+    if (k->func == dot_sse2) return __builtin_cpu_supports("sse2");
+    if (k->func == dot_avx2) return __builtin_cpu_supports("avx2");
+#endif
+#if defined(RESAMPLER_HAVE_NEON) && defined(__arm__)
+    if (k->func == dot_neon) return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#endif
+    (void)k;
+    return 1;
+}
+
+static const ResamplerKernelInfo *supported_kernels[NUM_ALL_KERNELS];
+static size_t num_supported_kernels;
+static _Atomic(const ResamplerKernelInfo *) selected_kernel;
+
+static void detect_kernels(void) {
+    if (num_supported_kernels > 0) {
+        return;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < NUM_ALL_KERNELS; ++i) {
+        if (kernel_supported(&all_kernels[i])) {
+            supported_kernels[count++] = &all_kernels[i];
+        }
+    }
+    num_supported_kernels = count;
+}
+
+size_t resampler_kernel_count(void) {
+    detect_kernels();
+    return num_supported_kernels;
+}
+
+const ResamplerKernelInfo *resampler_kernel_info(size_t i) {
+    detect_kernels();
+    return (i < num_supported_kernels) ? supported_kernels[i] : NULL;
+}
+
+const ResamplerKernelInfo *resampler_kernel_selected(void) {
+    const ResamplerKernelInfo *k = atomic_load(&selected_kernel);
+    if (k) {
+        return k;
+    }
+    detect_kernels();
+    k = supported_kernels[num_supported_kernels - 1];
+    const char *name = getenv("SYNTH_RESAMPLE_KERNEL");
+    if (name) {
+        for (size_t i = 0; i < num_supported_kernels; ++i) {
+            if (strcmp(supported_kernels[i]->name, name) == 0) {
+                k = supported_kernels[i];
+            }
+        }
+    }
+    atomic_store(&selected_kernel, k);
+    return k;
+}
+
+// --- フィルタの設計 ---
+
+static uint32_t gcd(uint32_t a, uint32_t b) {
+    while (b != 0) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// 第1種変形ベッセル関数 I0 (級数展開)
+static double bessel_i0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50; ++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+// フェーズ p (入力の点と点の間の p/num_phases の位置) 用の係数を作る
+// k 番目の係数は、出力の位置から見て (k - taps/2 + 1 - p/num_phases) サンプル離れた入力に掛ける
+static void design_phase(float *h, size_t taps, uint32_t p, uint32_t num_phases, double cutoff, double beta) {
+    double half = (double)(taps / 2);
+    double offset = (double)p / num_phases;
+    double sum = 0.0;
+    double coeffs[64];
+    for (size_t k = 0; k < taps; ++k) {
+        double d = (double)k - half + 1.0 - offset;
+        double sinc = (d == 0.0) ? 1.0 : sin(M_PI * cutoff * d) / (M_PI * cutoff * d);
+        double r = d / half;
+        double window = (r <= -1.0 || r >= 1.0) ? 0.0 : bessel_i0(beta * sqrt(1.0 - r * r)) / bessel_i0(beta);
+        coeffs[k] = cutoff * sinc * window;
+        sum += coeffs[k];
+    }
+    // 直流の利得を1にそろえる (フェーズごとに音量が揺れないように)
+    for (size_t k = 0; k < taps; ++k) {
+        h[k] = (float)(coeffs[k] / sum);
+    }
+}
+
+int resampler_init(Resampler *rs, int channels, int in_rate, int out_rate, ResamplerQuality quality) {
+    memset(rs, 0, sizeof(*rs));
+    if (channels < 1 || channels > RESAMPLER_MAX_CHANNELS || in_rate <= 0 || out_rate <= 0
+        || quality < 0 || quality >= RESAMPLER_NUM_QUALITIES) {
+        return -1;
+    }
+    const ResamplerTier *tier = &tiers[quality];
+    uint32_t g = gcd((uint32_t)in_rate, (uint32_t)out_rate);
+    rs->channels = channels;
+    rs->in_rate = in_rate;
+    rs->out_rate = out_rate;
+    rs->up = (uint32_t)out_rate / g;
+    rs->down = (uint32_t)in_rate / g;
+    rs->num_phases = rs->up < RESAMPLER_MAX_PHASES ? rs->up : RESAMPLER_MAX_PHASES;
+    rs->taps = tier->taps;
+    rs->dot = resampler_kernel_selected()->func;
+
+    // 下げるときは出力のナイキスト周波数より上を落とす
+    double cutoff = tier->rolloff * (out_rate < in_rate ? (double)out_rate / in_rate : 1.0);
+    rs->filters = (float *)malloc((size_t)rs->num_phases * rs->taps * sizeof(float));
+    rs->buffer = (float *)calloc((size_t)channels * RESAMPLER_BUFFER_FRAMES, sizeof(float));
+    if (!rs->filters || !rs->buffer) {
+        resampler_destroy(rs);
+        return -1;
+    }
+    for (uint32_t p = 0; p < rs->num_phases; ++p) {
+        design_phase(rs->filters + (size_t)p * rs->taps, rs->taps, p, rs->num_phases, cutoff, tier->beta);
+    }
+
+    // 先頭の入力より前は0 (最初の出力は最初の入力と同じ時刻)
+    rs->fill = rs->taps / 2 - 1;
+    rs->pos = rs->taps / 2 - 1;
+    rs->frac = 0;
+    return 0;
+}
+
+void resampler_set_kernel(Resampler *rs, const ResamplerKernelInfo *kernel) {
+    rs->dot = kernel->func;
+}
+
+size_t resampler_latency(const Resampler *rs) {
+    return rs->taps / 2;
+}
+
+size_t resampler_process(Resampler *rs, const float *in, size_t in_frames, size_t *in_used,
+                         float *out, size_t out_frames) {
+    size_t half = rs->taps / 2;
+    size_t channels = (size_t)rs->channels;
+    size_t used = 0;
+    size_t produced = 0;
+
+    for (;;) {
+        // 後ろに half 点そろっている位置の分だけ出力する
+        while (produced < out_frames && rs->pos + half < rs->fill) {
+            uint32_t phase = (rs->num_phases == rs->up)
+                ? rs->frac : (uint32_t)((uint64_t)rs->frac * rs->num_phases / rs->up);
+            const float *h = rs->filters + (size_t)phase * rs->taps;
+            for (size_t c = 0; c < channels; ++c) {
+                const float *x = rs->buffer + c * RESAMPLER_BUFFER_FRAMES + rs->pos + 1 - half;
+                out[produced * channels + c] = rs->dot(h, x, rs->taps);
+            }
+            produced++;
+            rs->frac += rs->down;
+            rs->pos += rs->frac / rs->up;
+            rs->frac %= rs->up;
+        }
+        if (produced == out_frames || used == in_frames) {
+            break;
+        }
+
+        // もう使わない古い入力を捨てて前に詰める
+        size_t drop = rs->pos + 1 - half;
+        if (drop > rs->fill) {
+            drop = rs->fill;
+        }
+        if (drop > 0) {
+            for (size_t c = 0; c < channels; ++c) {
+                float *buf = rs->buffer + c * RESAMPLER_BUFFER_FRAMES;
+                memmove(buf, buf + drop, (rs->fill - drop) * sizeof(float));
+            }
+            rs->fill -= drop;
+            rs->pos -= drop;
+        }
+
+        // 入力をチャンネルごとに分けて後ろに足す
+        size_t n = in_frames - used;
+        if (n > RESAMPLER_BUFFER_FRAMES - rs->fill) {
+            n = RESAMPLER_BUFFER_FRAMES - rs->fill;
+        }
+        for (size_t c = 0; c < channels; ++c) {
+            float *buf = rs->buffer + c * RESAMPLER_BUFFER_FRAMES + rs->fill;
+            const float *src = in + used * channels + c;
+            for (size_t i = 0; i < n; ++i) {
+                buf[i] = src[i * channels];
+            }
+        }
+        rs->fill += n;
+        used += n;
+    }
+    *in_used = used;
+    return produced;
+}
+
+void resampler_destroy(Resampler *rs) {
+    free(rs->filters);
+    free(rs->buffer);
+    rs->filters = NULL;
+    rs->buffer = NULL;
+}
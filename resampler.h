@@ -0,0 +1,97 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// サンプリングレートの変換 (窓付きsincのポリフェーズフィルタ)
+// WAVファイルのレートとデバイスのレートが違うときに、ALSAのplugに任せずに自分で変換する
+//
+// 変換比を既約分数 out_rate/in_rate = up/down にして、出力1サンプルごとに入力上の位置を
+// 「整数部 + up分のいくつ」で正確に進める。フィルタは位置の端数ごと (フェーズごと) に前もって計算しておき、
+// 1サンプルの計算は係数と入力の内積だけにする (内積はSIMDのカーネルで計算する)
+// up が RESAMPLER_MAX_PHASES を超える比 (44100 -> 47999 など) では、端数を RESAMPLER_MAX_PHASES 段に丸める
+//
+// 窓は Kaiser 窓。遮断周波数は低い方のレートのナイキスト周波数に、品質ごとの割合を掛けたもの
+// 入力の先頭は0が続いていたものとして扱い、出力の先頭は入力の先頭と同じ時刻になる
+// 最後の入力の分を出し切るには、resampler_latency フレームの0を入力する
+
+#define RESAMPLER_MAX_CHANNELS  8
+#define RESAMPLER_MAX_PHASES    1024    // フェーズの数の上限
+#define RESAMPLER_BUFFER_FRAMES 2048    // 内部に溜める入力のフレーム数 (チャンネルごと)
+
+// 品質 (タップ数が多いほど通過帯域が広く、折り返しが小さいが、重い)
+typedef enum {
+    RESAMPLER_FAST,     // 8タップ (Raspberry Pi などで軽く鳴らす用)
+    RESAMPLER_MEDIUM,   // 32タップ
+    RESAMPLER_BEST,     // 64タップ
+    RESAMPLER_NUM_QUALITIES,
+} ResamplerQuality;
+
+// 係数 h と入力 x の taps 個 (8の倍数) の内積
+typedef float (*ResamplerDot)(const float *h, const float *x, size_t taps);
+
+// カーネルの名前と実体
+typedef struct {
+    const char *name;
+    ResamplerDot func;
+} ResamplerKernelInfo;
+
+typedef struct {
+    int channels;
+    int in_rate;
+    int out_rate;
+    uint32_t up;                // 変換比 out_rate/in_rate の分子
+    uint32_t down;              // 分母
+    uint32_t num_phases;
+    size_t taps;
+    float *filters;             // num_phases x taps の係数
+    float *buffer;              // channels x RESAMPLER_BUFFER_FRAMES の入力 (チャンネルごとに並べる)
+    size_t fill;                // buffer に入っているフレーム数
+    size_t pos;                 // 次の出力の位置の整数部 (buffer の中の番号)
+    uint32_t frac;              // 次の出力の位置の端数 (up分の frac)
+    ResamplerDot dot;
+} Resampler;
+
+// 品質の名前 ("fast" / "medium" / "best")
+const char *resampler_quality_name(ResamplerQuality quality);
+
+// 環境変数 SYNTH_RESAMPLE_QUALITY で指定された品質 (指定がなければ RESAMPLER_MEDIUM)
+ResamplerQuality resampler_quality_default(void);
+
+// このCPUで使えるカーネルの一覧 (0番は常にスカラー版)
+size_t resampler_kernel_count(void);
+const ResamplerKernelInfo *resampler_kernel_info(size_t i);
+
+// 実行時に選ばれたカーネル (使える中で一番速いもの)
+// 環境変数 SYNTH_RESAMPLE_KERNEL にカーネル名を指定すると、それを優先する
+const ResamplerKernelInfo *resampler_kernel_selected(void);
+
+// in_rate から out_rate へ変換するリサンプラーを作る
+// 戻り値: 成功なら0, チャンネル数やレートが正しくないか、メモリが足りなければ-1
+int resampler_init(Resampler *rs, int channels, int in_rate, int out_rate, ResamplerQuality quality);
+
+// 内積に使うカーネルを差し替える (ベンチマーク用)
+void resampler_set_kernel(Resampler *rs, const ResamplerKernelInfo *kernel);
+
+// 入力の遅れ (このフレーム数だけ0を入力すると、それまでの入力の分が全部出力される)
+size_t resampler_latency(const Resampler *rs);
+
+// インターリーブした in_frames フレームを入力し、作れるだけ (最大 out_frames フレーム) out に出力する
+// 出力がいっぱいになると入力を全部は使わないので、使ったフレーム数を *in_used に返す
+// 戻り値: 出力したフレーム数
+size_t resampler_process(Resampler *rs, const float *in, size_t in_frames, size_t *in_used,
+                         float *out, size_t out_frames);
+
+// 係数とバッファを解放する
+void resampler_destroy(Resampler *rs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RESAMPLER_H
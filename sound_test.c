@@ -1,9 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <math.h>
-#include <alsa/asoundlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "audio_output.h"
+#include "bounce.h"
+#include "metrics.h"
 #include "mml_parser.h"
+#include "mml_compiled.h"
+#include "synth_engine.h"
+#include "wavetable.h"
+#include "wavetable_bank.h"
 
 // 音声再生の基本パラメータ
 #define DURATION_SEC    1.0     // 再生時間（秒）
@@ -11,20 +21,17 @@
 #define CHANNELS        1       // チャンネル数 (1: モノラル, 2: ステレオ)
 #define TONE_FREQ       440.0   // 音の周波数 (Hz) - 440Hzは「ラ」(A4)の音
 #define AMPLITUDE       32760   // 振幅 (16bitの最大値に近い値)
-#define TABLE_SIZE        32    // ウェーブテーブルのサイズ（2のべき乗が一般的）
-#define INC_AMPLITUDE   4096    // 増分用振幅
-#define FILE_TABLE_SIZE   32    // ファイルから読み込むウェーブテーブルのサイズ
 
 // グローバル変数としてウェーブテーブルを定義
 // GUIから変更する場合、この配列を書き換える
 float wavetable_f[TABLE_SIZE];
 
-// --- 固定小数点演算のための設定 ---
-// フェーズアキュムレータの小数部として使うビット数
-#define FRACTIONAL_BITS 32
-
 // グローバルなウェーブテーブル (整数型)
 int16_t wavetable[TABLE_SIZE];
+// 再生に使う帯域制限済みのウェーブテーブル (wavetable から作る)
+Wavetable bandlimited_wavetable;
+// MMLの @X で選ぶ音色バンク
+WavetableBank instrument_bank;
 
 // ウェーブテーブルを初期化する関数
 void init_wavetable_f() {
@@ -52,36 +59,7 @@ void init_wavetable() {
     }
 }
 
-// テキストファイルから波形数値列を読み込む関数
-int load_wavetable_from_file(const char *filename) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        fprintf(stderr, "ファイルを開けません: %s\n", filename);
-        return -1;
-    }
-    for (int i = 0; i < FILE_TABLE_SIZE; ++i) {
-        if (fscanf(fp, "%d", &wavetable[i]) != 1) {
-            fprintf(stderr, "ウェーブテーブルの読み込みに失敗しました。\n");
-            fclose(fp);
-            return -1;
-        }
-        wavetable[i] *= INC_AMPLITUDE; // 振幅を増加
-    }
-    // FILE_TABLE_SIZEからTABLE_SIZEに適応するようコピー
-    for (int i = FILE_TABLE_SIZE; i < TABLE_SIZE; ++i) {
-        wavetable[i] = wavetable[i % FILE_TABLE_SIZE];
-        printf("[%d]: %d\n", i, wavetable[i]);
-    }
-    fclose(fp);
-    return 0;
-}
-
-// MIDIノートナンバーを周波数に変換するヘルパー関数
-double note_to_freq(int note) {
-    return 440.0 * pow(2.0, (note - 69.0) / 12.0);
-}
-
-void debug_play_note(snd_pcm_t *handle, snd_pcm_hw_params_t *params, int err) {
+void debug_play_note(AudioOutput *output) {
     printf("\n--- 過去のテストコード実行（デバッグ用） ---\n");
     // --- 音声データの生成と再生 ---
     int duration_sec = 3; // 3秒間再生
@@ -134,11 +112,11 @@ void debug_play_note(snd_pcm_t *handle, snd_pcm_hw_params_t *params, int err) {
     }
     
     printf("「ドレミ」を再生します...\n");
-    snd_pcm_writei(handle, buffer, buffer_size);
+    audio_output_write(output, buffer, buffer_size);
     
     // クリーンアップ
-    snd_pcm_drain(handle);
-    snd_pcm_close(handle);
+    audio_output_drain(output);
+    audio_output_close(output);
     free(buffer);
 
     // --- ここからが波形データの生成 ---
@@ -176,175 +154,408 @@ void debug_play_note(snd_pcm_t *handle, snd_pcm_hw_params_t *params, int err) {
     printf("-------------------------------------------\n");
 }
 
-int main(int argc, char *argv[]) {
-    // ALSA関連の変数を宣言
-    snd_pcm_t *handle;
-    snd_pcm_hw_params_t *params;
-    int err;
-    
-    // ウェーブテーブルを初期化
-    //init_wavetable();
-    // 絶対パス "/wavetables/..." は root 参照になってしまうので相対パスに変更
-    load_wavetable_from_file("wavetables/preset1.txt");
-    
-    // PCMデバイスを再生用に開く。 "default" は標準の出力デバイスを意味する
-    if ((err = snd_pcm_open(&handle, "default", SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
-        fprintf(stderr, "PCMデバイスを開けません: %s\n", snd_strerror(err));
+// MMLファイルを解析し、再生せずにWAVファイルへ書き出す (サウンドカードのないマシンでも使える)
+static int bounce_to_file(const char *mml_input, const char *output_file, int num_threads, int sample_rate) {
+    char *mml_text = read_mml_file(mml_input);
+    if (!mml_text) {
+        return 1;
+    }
+    MmlSong *song = parse_mml_song(mml_text, sample_rate);
+    free(mml_text);
+    if (!song) {
+        fprintf(stderr, "MMLの解析に失敗しました。\n");
         return 1;
     }
 
-    // ハードウェアパラメータ構造体を確保
-    snd_pcm_hw_params_alloca(&params);
-    // デバイスの現在のパラメータを取得
-    snd_pcm_hw_params_any(handle, params);
+    printf("WAVファイルに書き出し中...: %s\n", output_file);
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    BounceStats stats;
+    int err = bounce_song_to_wav(song, &bandlimited_wavetable, &instrument_bank, sample_rate, output_file, num_threads, &stats);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free_mml_song(song);
+    if (err != 0) {
+        return 1;
+    }
 
-    // パラメータを設定
-    snd_pcm_hw_params_set_access(handle, params, SND_PCM_ACCESS_RW_INTERLEAVED); // アクセスタイプ: インターリーブ
-    snd_pcm_hw_params_set_format(handle, params, SND_PCM_FORMAT_S16_LE);      // フォーマット: 16bit, リトルエンディアン
-    snd_pcm_hw_params_set_channels(handle, params, CHANNELS);                 // チャンネル数
-    snd_pcm_hw_params_set_rate_near(handle, params, (unsigned int[]){SAMPLE_RATE}, 0); // サンプリングレート
+    double elapsed = (double)(end.tv_sec - begin.tv_sec) + (double)(end.tv_nsec - begin.tv_nsec) / 1e9;
+    double song_sec = (double)stats.total_frames / sample_rate;
+    printf("書き出し完了: %f 秒分を %f 秒で生成 (%zu 区間, %d スレッド, 実時間の %.1f 倍)\n",
+           song_sec, elapsed, stats.num_segments, stats.num_threads, elapsed > 0 ? song_sec / elapsed : 0.0);
+    return 0;
+}
 
-    // 設定したパラメータをデバイスに書き込む
-    if ((err = snd_pcm_hw_params(handle, params)) < 0) {
-        fprintf(stderr, "ハードウェアパラメータを設定できません: %s\n", snd_strerror(err));
-        return 1;
+// -F の形式名を AudioSampleFormat にする
+// 戻り値: 成功なら0, 知らない名前なら-1
+static int parse_sample_format(const char *name, AudioSampleFormat *format) {
+    if (strcmp(name, "s16") == 0) {
+        *format = AUDIO_FORMAT_S16_LE;
+    } else if (strcmp(name, "s24") == 0) {
+        *format = AUDIO_FORMAT_S24_3LE;
+    } else if (strcmp(name, "s32") == 0) {
+        *format = AUDIO_FORMAT_S32_LE;
+    } else if (strcmp(name, "float") == 0) {
+        *format = AUDIO_FORMAT_FLOAT_LE;
+    } else {
+        return -1;
     }
+    return 0;
+}
+
+static void print_usage(const char *program) {
+    fprintf(stderr, "使い方: %s [-d 出力先] [-o 出力WAVファイル名] [-j スレッド数] [-b 音色のディレクトリ] [-s 開始秒] [-e 終了秒] [-l] [-c キャッシュMB] [-i] [-m 計測結果の出力先] [-L 遅延ms] [-r サンプリングレート] [-F サンプル形式] [-C チャンネル数] [-S] <wavetableファイル名> <mmlファイル名>\n", program);
+    fprintf(stderr, "  -d 出力先: alsa[:デバイス名] / wav:ファイル名 / raw[:ファイル名] / null[:realtime] (既定は alsa)\n");
+    fprintf(stderr, "  -o を指定すると再生せずにWAVファイルへ書き出す (全コアで並列に生成する)\n");
+    fprintf(stderr, "  -b MMLの @X で使う *.wtx を置いたディレクトリ (既定は %s)\n", WAVETABLE_BANK_DIR);
+    fprintf(stderr, "  -s / -e 再生する区間 (曲の先頭からの秒数。既定は曲の最初から最後まで)\n");
+    fprintf(stderr, "  -l 区間 (指定がなければ曲全体) を止めるまで繰り返し再生する\n");
+    fprintf(stderr, "  -c 生成したノートを覚えておくメモリの量 (MB)。同じノートの繰り返しはコピーで済ませる\n");
+    fprintf(stderr, "  -S MMLを少しずつ読みながら再生する (最初のトラックだけ。mmlファイル名が \"-\" (標準入力) かFIFOなら指定しなくてもそうする)\n");
+    fprintf(stderr, "  -i .mmlc を使わず、MMLをその場で中間表現にコンパイルして再生する\n");
+    fprintf(stderr, "  -L 出力先のバッファの長さ (%d ~ %d ms)。短いほど反応が速く、長いほどCPUの負荷が減る\n",
+            AUDIO_LATENCY_MIN_US / 1000, AUDIO_LATENCY_MAX_US / 1000);
+    fprintf(stderr, "  -r 生成するサンプリングレート (%d ~ %d Hz, 既定は %d Hz)。ALSAではデバイスが対応している一番近いレートで生成する\n",
+            AUDIO_SAMPLE_RATE_MIN, AUDIO_SAMPLE_RATE_MAX, SAMPLE_RATE);
+    fprintf(stderr, "  -F 出力先に送るサンプルの形式: s16 / s24 / s32 / float (既定は s16)\n");
+    fprintf(stderr, "  -C 出力先のチャンネル数 (1 ~ %d, 既定は %d)。2以上ではMMLの pX で左右に振り分ける\n", MIXER_MAX_CHANNELS, CHANNELS);
+    fprintf(stderr, "  -m 再生中の計測結果を1秒ごとに1行のJSONで書き出す (\"-\" なら標準エラー、それ以外はファイルに追記)\n");
+}
+
+int main(int argc, char *argv[]) {
+    // 出力先 (既定はALSAの "default" デバイス)
+    AudioOutput output;
+    const char *output_spec = "alsa";
+    const char *output_file = NULL;
+    const char *bank_dir = WAVETABLE_BANK_DIR;
+    int num_threads = 0;
+    double start_sec = 0.0;
+    double end_sec = 0.0;
+    int loop = 0;
+    size_t cache_mb = 0;
+    int use_program = 0;
+    int use_stream = 0;
+    const char *metrics_path = NULL;
+    Metrics metrics;
+    unsigned int latency_us = 0;
+    int sample_rate = SAMPLE_RATE;
+    AudioSampleFormat sample_format = AUDIO_FORMAT_S16_LE;
+    int channels = CHANNELS;
+    int opt;
 
     // コマンドライン引数の処理
-    if (argc < 3) {
-        fprintf(stderr, "使い方: %s <wavetableファイル名> <mmlファイル名>\n", argv[0]);
+    while ((opt = getopt(argc, argv, "d:o:j:b:s:e:lc:im:L:r:F:C:S")) != -1) {
+        switch (opt) {
+        case 'd':
+            output_spec = optarg;
+            break;
+        case 'o':
+            output_file = optarg;
+            break;
+        case 'j':
+            num_threads = atoi(optarg);
+            break;
+        case 'b':
+            bank_dir = optarg;
+            break;
+        case 's':
+            start_sec = atof(optarg);
+            break;
+        case 'e':
+            end_sec = atof(optarg);
+            break;
+        case 'l':
+            loop = 1;
+            break;
+        case 'c':
+            cache_mb = (size_t)atoi(optarg);
+            break;
+        case 'i':
+            use_program = 1;
+            break;
+        case 'S':
+            use_stream = 1;
+            break;
+        case 'm':
+            metrics_path = optarg;
+            break;
+        case 'L':
+            latency_us = (unsigned int)(atof(optarg) * 1000);
+            break;
+        case 'r':
+            sample_rate = atoi(optarg);
+            if (sample_rate < AUDIO_SAMPLE_RATE_MIN || sample_rate > AUDIO_SAMPLE_RATE_MAX) {
+                fprintf(stderr, "サンプリングレートは %d ~ %d Hz で指定してください: %s\n", AUDIO_SAMPLE_RATE_MIN, AUDIO_SAMPLE_RATE_MAX, optarg);
+                return 1;
+            }
+            break;
+        case 'F':
+            if (parse_sample_format(optarg, &sample_format) != 0) {
+                fprintf(stderr, "サンプルの形式が正しくありません: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'C':
+            channels = atoi(optarg);
+            if (channels < 1 || channels > MIXER_MAX_CHANNELS) {
+                fprintf(stderr, "チャンネル数は 1 ~ %d で指定してください: %s\n", MIXER_MAX_CHANNELS, optarg);
+                return 1;
+            }
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind < 2) {
+        print_usage(argv[0]);
+        if (output_file) {
+            return 1;
+        }
         // デバッグ用に過去のテストコードを実行
-        debug_play_note(handle, params, err);
+        // 絶対パス "/wavetables/..." は root 参照になってしまうので相対パスに変更
+        load_wavetable_from_file("wavetables/preset1.txt", wavetable);
+        if (audio_output_open(&output, output_spec, AUDIO_FORMAT_S16_LE, CHANNELS, sample_rate, latency_us) != 0) {
+            return 1;
+        }
+        debug_play_note(&output);
         return 1;
     }
-    const char *wavetable_file = argv[1];
-    const char *mml_input = argv[2];
-
-    // --- wavetableテキストの読み込み ---
-    if (load_wavetable_from_file(wavetable_file) != 0) {
-        fprintf(stderr, "ウェーブテーブルの読み込みに失敗しました: %s\n", wavetable_file);
+    const char *wavetable_file = argv[optind];
+    const char *mml_input = argv[optind + 1];
+    // 標準入力やFIFOは終わりが来るまで待たずに、届いた分から再生する
+    struct stat mml_stat;
+    if (strcmp(mml_input, "-") == 0 || (stat(mml_input, &mml_stat) == 0 && S_ISFIFO(mml_stat.st_mode))) {
+        use_stream = 1;
+    }
+    if (use_stream && !output_file && (start_sec > 0 || end_sec > 0 || loop)) {
+        fprintf(stderr, "MMLを少しずつ読むときは、再生区間や繰り返しは指定できません\n");
         return 1;
     }
-    printf("ウェーブテーブルをファイルから読み込みました: %s\n", wavetable_file);
-
-    // --- MMLファイルの解析とイベントリストの取得 ---
 
-    // --- MMLファイルを読み込む ---
-    FILE *fp = fopen(mml_input, "rb");
-    if (!fp) {
-        fprintf(stderr, "MMLファイルを開けません: %s\n", mml_input);
+    // ここから先の失敗は、どれも cleanup で開いたものを閉じてから終わる
+    // (閉じる関数はどれも、開いていない・ゼロのままのものを渡しても何もしない)
+    int status = 1;
+    CompiledSong song;
+    MmlProgram *program = NULL;
+    MmlStream stream;
+    SongRenderer renderer;
+    NoteCache note_cache;
+    int has_renderer = 0;
+    int has_cache = 0;
+    memset(&output, 0, sizeof(output));
+    memset(&metrics, 0, sizeof(metrics));
+    memset(&song, 0, sizeof(song));
+    memset(&stream, 0, sizeof(stream));
+    stream.fd = -1;
+
+    // 出力先を先に開く (標準出力に波形を出す場合、これ以降のメッセージは標準エラーへ回る)
+    // 書き出しモードなら出力先は開かない
+    if (!output_file && audio_output_open(&output, output_spec, sample_format, channels, sample_rate, latency_us) != 0) {
         return 1;
     }
-    // ファイルサイズを取得
-    fseek(fp, 0, SEEK_END);
-    long file_size = ftell(fp);
-    rewind(fp);
+    // デバイスのレートが違えば、フェーズ増分や長さをそのレートで計算し直して生成する (変換はしない)
+    if (!output_file && output.sample_rate != sample_rate) {
+        printf("デバイスのサンプリングレート %d Hz で生成します\n", output.sample_rate);
+        sample_rate = output.sample_rate;
+    }
+    // 計測は再生するときだけ (指定がなければ何も記録しない)
+    if (!output_file && metrics_path && metrics_open(&metrics, metrics_path, sample_rate) != 0) {
+        goto cleanup;
+    }
 
-    // MML文字列を格納するバッファを確保
-    char *mml_string = (char *)malloc(file_size + 1);
-    if (!mml_string) {
-        fprintf(stderr, "メモリが足りません\n");
-        fclose(fp);
-        return 1;
+    // --- wavetableテキストの読み込み ---
+    uint64_t stage_begin = metrics_now();
+    if (load_wavetable_from_file(wavetable_file, wavetable) != 0) {
+        fprintf(stderr, "ウェーブテーブルの読み込みに失敗しました: %s\n", wavetable_file);
+        goto cleanup;
     }
+    printf("ウェーブテーブルをファイルから読み込みました: %s\n", wavetable_file);
+    // オクターブごとの帯域制限したコピーを作る (再生中はテーブルを引くだけで済む)
+    wavetable_build(&bandlimited_wavetable, wavetable);
 
-    // ファイル内容を読み込む
-    size_t read_size = fread(mml_string, 1, file_size, fp);
-    mml_string[read_size] = '\0'; // NULL終端
-    fclose(fp);
+    // --- 音色バンクの読み込み (なくても @X を使っていない曲は鳴らせる) ---
+    if (wavetable_bank_open(&instrument_bank, bank_dir) == 0) {
+        for (size_t i = 0; i < wavetable_bank_count(&instrument_bank); ++i) {
+            printf("音色 @%zu: %s\n", i, wavetable_bank_name(&instrument_bank, (int)i));
+        }
+    }
+    metrics_record(&metrics, METRICS_WAVETABLE_LOAD, metrics_now() - stage_begin);
 
-    // --- MML解析と音声データの生成 ---
-    MmlEvent *events = NULL;
-    size_t num_events = 0;
+    if (output_file) {
+        status = bounce_to_file(mml_input, output_file, num_threads, sample_rate);
+        goto cleanup;
+    }
 
-    printf("MMLを解析中...: %s\n", mml_input);
-    // MML文字列を解析してイベントリストを取得
-    events = parse_mml(mml_string, SAMPLE_RATE, &num_events);
-    free(mml_string); // 解析後はMML文字列のメモリを解放
-    if (!events) {
-        fprintf(stderr, "MMLの解析に失敗しました。\n");
-        return 1;
+    // --- MMLファイルの解析 ---
+    // コンパイル済みデータ (.mmlc, 中間表現の命令列) が最新ならmmapするだけ、なければ解析して作る
+    // -i なら .mmlc を使わずに、メモリ上で中間表現にコンパイルする
+    // どちらもループを展開せず、命令列を実行しながら生成するので、メモリは曲の長さに比例しない
+    // 少しずつ読む場合は、ここでは開くだけで、生成しながら必要な分を読んで解析する
+    printf("MMLを読み込み中...: %s\n", mml_input);
+    size_t num_tracks;
+    stage_begin = metrics_now();
+    if (use_stream) {
+        if (mml_stream_open(&stream, mml_input, sample_rate) != 0) {
+            goto cleanup;
+        }
+        num_tracks = 1;
+        printf("MMLを少しずつ読みながら再生します (最初の音符を読んだところで始めます)\n");
+    } else if (use_program) {
+        char *mml_text = read_mml_file(mml_input);
+        program = mml_text ? mml_compile(mml_text, sample_rate) : NULL;
+        free(mml_text);
+        if (!program) {
+            fprintf(stderr, "MMLの解析に失敗しました。\n");
+            goto cleanup;
+        }
+        num_tracks = program->num_tracks;
+        printf("中間表現: %zu バイト\n", mml_program_size(program));
+    } else {
+        if (compiled_song_open(&song, mml_input, sample_rate) != 0) {
+            fprintf(stderr, "MMLの解析に失敗しました。\n");
+            goto cleanup;
+        }
+        num_tracks = compiled_song_num_tracks(&song);
+        printf("中間表現: %zu バイト (.mmlc)\n", mml_program_size(compiled_song_program(&song)));
     }
+    const MmlProgram *song_program = program ? program : compiled_song_program(&song);
+    metrics_record(&metrics, METRICS_PARSE, metrics_now() - stage_begin);
 
-    // 総再生時間を計算
+    // 解析結果を一覧表示し、総再生時間 (一番長いトラックの長さ) を計算
     long total_samples = 0;
-    for (size_t i = 0; i < num_events; ++i) {
-        total_samples += events[i].duration_samples;
-    }
-    printf("総再生時間: %ld サンプル (%f 秒)\n", total_samples, (double)total_samples / SAMPLE_RATE);
-
-    // 解析結果を一覧表示
-    printf("--- 解析イベント詳細 ---\n");
-    for (size_t i = 0; i < num_events; ++i) {
-        double duration_sec = (double)events[i].duration_samples / SAMPLE_RATE;
-        // とりあえず数値で確認
-        if (events[i].note_number > 0) {
-            printf("イベント%zu: NOTE=%d (周波数=%f Hz), 長さ=%u サンプル (%f 秒)\n", i, events[i].note_number, note_to_freq(events[i].note_number), events[i].duration_samples, duration_sec
-            );
-        } else {
-            printf("イベント%zu: REST, 長さ=%u サンプル (%f 秒)\n", i, events[i].duration_samples, duration_sec);
+    size_t total_events = 0;
+    if (!use_stream) {
+        printf("--- 解析イベント詳細 ---\n");
+    }
+    for (size_t t = 0; t < num_tracks && !use_stream; ++t) {
+        MmlProgramCursor program_cursor;
+        MmlEventSource source = mml_program_source(&program_cursor, song_program, t);
+        MmlEvent event;
+        long track_samples = 0;
+        printf("トラック%zu:\n", t);
+        for (size_t i = 0; source.next(source.ctx, &event); ++i) {
+            double duration_sec = (double)event.duration_samples / sample_rate;
+            // とりあえず数値で確認
+            if (event.note_number > 0) {
+                printf("イベント%zu: NOTE=%d (周波数=%f Hz), 長さ=%u サンプル (%f 秒)\n", i, event.note_number, note_to_freq(event.note_number), event.duration_samples, duration_sec
+                );
+            } else {
+                printf("イベント%zu: REST, 長さ=%u サンプル (%f 秒)\n", i, event.duration_samples, duration_sec);
+            }
+            track_samples += event.duration_samples;
+            total_events++;
         }
+        mml_program_cursor_free(&program_cursor);
+        if (track_samples > total_samples) {
+            total_samples = track_samples;
+        }
+    }
+    if (!use_stream) {
+        printf("----------------------\n");
+        printf("トラック数: %zu, イベント数: %zu\n", num_tracks, total_events);
+        printf("総再生時間: %ld サンプル (%f 秒)\n", total_samples, (double)total_samples / sample_rate);
     }
-    printf("----------------------\n");
 
-    // 再生用バッファを確保
-    int16_t *buffer = (int16_t *)malloc(total_samples * sizeof(int16_t));
-    if (!buffer) {
-        fprintf(stderr, "再生バッファの確保に失敗しました。\n");
-        free_mml_events(events);
-        return 1;
+    // --- MMLイベントを少しずつ波形にしながら再生するループ ---
+    // 曲全体を一度に生成せず、1ピリオドずつ生成してデバイスのリングバッファへ送る
+    // (曲の長さに関係なく、必要なメモリと再生開始までの時間は一定)
+    // 複数トラックの場合は、トラックごとのスレッドで並列に生成してからミックスする
+    // (出力の形式とチャンネル数が一番大きいときの分を取っておく)
+    uint8_t period_buffer[PERIOD_FRAMES * MIXER_MAX_CHANNELS * sizeof(float)];
+    MmlEventSource stream_source = mml_stream_source(&stream);
+    int err = use_stream ? song_renderer_init_sources(&renderer, &stream_source, 1, &bandlimited_wavetable, sample_rate)
+                         : song_renderer_init_program(&renderer, song_program, &bandlimited_wavetable, sample_rate);
+    if (err != 0) {
+        goto cleanup;
+    }
+    has_renderer = 1;
+    song_renderer_set_output(&renderer, sample_format, channels);
+    song_renderer_set_bank(&renderer, &instrument_bank);
+    // 繰り返しの多い曲では、同じノートを生成し直さずにキャッシュからコピーする
+    if (cache_mb > 0) {
+        note_cache_init(&note_cache, cache_mb << 20);
+        song_renderer_set_cache(&renderer, &note_cache);
+        has_cache = 1;
     }
 
-    // --- MMLイベントを使った波形生成ループ ---
-    uint64_t phase = 0;
-    long current_sample_index = 0;
-
-    // MMLイベントを順に処理するループ
-    for (size_t i = 0; i < num_events; ++i) {
-        MmlEvent *event = &events[i];
-        // ノートナンバーから周波数を計算
-        double frequency = 0.0;
-        uint64_t phase_increment = 0;
-
-        if (event->note_number > 0) {
-            frequency = note_to_freq(event->note_number);
-            // 固定小数点のフェーズ増分を計算 (イベント開始時に一度だけ計算)
-            phase_increment = (uint64_t)(((double)TABLE_SIZE * frequency / SAMPLE_RATE) * (1LL << FRACTIONAL_BITS));
-        }
-        double volume_scale = (double)(event->volume) / DEFAULT_VOLUME; // 音量スケール (0.0 ~ 1.0)
-        double current_amplitude = volume_scale; // 現在の振幅
-
-        for (uint32_t j = 0; j < event->duration_samples; ++j) {
-            
-            // 音を鳴らす or 休符（ゼロ埋め）
-            if (event->note_number > 0) {
-                // 音を鳴らす処理
-                uint32_t index = (uint32_t)(phase >> FRACTIONAL_BITS);
-                buffer[current_sample_index] = (int16_t)(wavetable[index % TABLE_SIZE] * current_amplitude);
-                current_amplitude *= event->decay_rate; // 1サンプルごとに音量を減衰
-
-                // フェーズを更新
-                phase += phase_increment;
-            } else {
-                // 休符処理 (音をゼロにする)
-                buffer[current_sample_index] = 0;
-            }
-            
-            current_sample_index++;
-            if (current_sample_index >= total_samples) break; // バッファオーバーフロー対策
+    // 区間の指定があれば、目次を使ってその位置へ飛ぶ (先頭から生成し直したりはしない)
+    if (start_sec > 0 || end_sec > 0 || loop) {
+        uint64_t start = (uint64_t)((start_sec > 0 ? start_sec : 0) * sample_rate);
+        uint64_t end = (uint64_t)((end_sec > 0 ? end_sec : 0) * sample_rate);
+        if (song_renderer_set_region(&renderer, start, end, loop) != 0) {
+            fprintf(stderr, "再生区間が正しくありません: %f 秒 ~ %f 秒\n", start_sec, end_sec);
+            goto cleanup;
         }
-        if (current_sample_index >= total_samples) break;
+        printf("再生区間: %f 秒 ~ %f 秒%s\n", (double)renderer.region_start / sample_rate,
+               (double)renderer.region_end / sample_rate, loop ? " (繰り返し)" : "");
     }
 
+    printf("出力先のバッファ: %zu フレーム (%.1f ms), ピリオド: %zu フレーム\n",
+           output.buffer_frames, output.latency_us / 1000.0, output.period_frames);
     printf("再生を開始します...\n");
-    snd_pcm_writei(handle, buffer, total_samples);
+    // 出力先が1ピリオド以上空くまで待ち、空いた分だけ生成して書き込む
+    int playing = 1;
+    while (playing && !song_renderer_finished(&renderer)) {
+        long avail = audio_output_wait(&output);
+        if (avail < 0) {
+            break;
+        }
+        while (avail > 0) {
+            size_t n = (size_t)avail < PERIOD_FRAMES ? (size_t)avail : PERIOD_FRAMES;
+            uint64_t render_begin = metrics_now();
+            size_t frames = song_render_block(&renderer, period_buffer, n);
+            uint64_t write_begin = metrics_now();
+            metrics_record_render(&metrics, write_begin - render_begin, frames);
+            if (frames == 0) {
+                break;
+            }
+            if (audio_output_write(&output, period_buffer, frames) != 0) {
+                playing = 0;
+                break;
+            }
+            avail -= (long)frames;
+            if (metrics.fp) {
+                long delay = -1, device_avail = -1;
+                metrics_record(&metrics, METRICS_WRITE, metrics_now() - write_begin);
+                audio_output_status(&output, &delay, &device_avail);
+                metrics_record_device(&metrics, delay, device_avail, output.underruns, output.recoveries);
+                metrics_record_voices(&metrics, renderer.track_ns, renderer.num_tracks);
+                metrics_maybe_report(&metrics);
+            }
+        }
+    }
 
-    // クリーンアップ
-    snd_pcm_drain(handle);
-    snd_pcm_close(handle); // PCMデバイスを閉じる
-    free(buffer);
-    free_mml_events(events); // 解析結果のメモリも解放
-    printf("クリーンアップ完了\n");
+    audio_output_drain(&output);
+    if (has_cache) {
+        uint64_t lookups = note_cache.hits + note_cache.misses;
+        printf("ノートのキャッシュ: ヒット %llu / ミス %llu (ヒット率 %.1f%%), 追い出し %llu, 使用 %zu / %zu KB\n",
+               (unsigned long long)note_cache.hits, (unsigned long long)note_cache.misses,
+               lookups > 0 ? 100.0 * note_cache.hits / lookups : 0.0, (unsigned long long)note_cache.evictions,
+               note_cache.used >> 10, note_cache.budget >> 10);
+    }
+    if (use_stream) {
+        printf("MMLを %zu バイト読みました\n", stream.bytes_read);
+    }
+    status = 0;
+
+    // クリーンアップ (途中で失敗した場合もここへ来る)
+cleanup:
+    metrics_close(&metrics);
+    audio_output_close(&output); // 出力先を閉じる
+    if (has_renderer) {
+        song_renderer_destroy(&renderer);
+    }
+    if (has_cache) {
+        note_cache_destroy(&note_cache);
+    }
+    free_mml_program(program);
+    compiled_song_close(&song); // 曲データのmmapも解除
+    mml_stream_close(&stream);
+    wavetable_bank_close(&instrument_bank);
+    if (status == 0) {
+        printf("クリーンアップ完了\n");
+    }
 
-    return 0;
+    return status;
 }
@@ -2,7 +2,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <math.h>
-#include <alsa/asoundlib.h>
+#include "audio_output.h"
 
 // 音声再生の基本パラメータ
 #define DURATION_SEC    1.0     // 再生時間（秒）
@@ -11,32 +11,11 @@
 #define TONE_FREQ       440.0   // 音の周波数 (Hz) - 440Hzは「ラ」(A4)の音
 #define AMPLITUDE       32760   // 振幅 (16bitの最大値に近い値)
 
-int main() {
-    // ALSA関連の変数を宣言
-    snd_pcm_t *handle;
-    snd_pcm_hw_params_t *params;
-    int err;
-    
-    // PCMデバイスを再生用に開く。 "default" は標準の出力デバイスを意味する
-    if ((err = snd_pcm_open(&handle, "default", SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
-        fprintf(stderr, "PCMデバイスを開けません: %s\n", snd_strerror(err));
-        return 1;
-    }
-
-    // ハードウェアパラメータ構造体を確保
-    snd_pcm_hw_params_alloca(&params);
-    // デバイスの現在のパラメータを取得
-    snd_pcm_hw_params_any(handle, params);
-
-    // パラメータを設定
-    snd_pcm_hw_params_set_access(handle, params, SND_PCM_ACCESS_RW_INTERLEAVED); // アクセスタイプ: インターリーブ
-    snd_pcm_hw_params_set_format(handle, params, SND_PCM_FORMAT_S16_LE);      // フォーマット: 16bit, リトルエンディアン
-    snd_pcm_hw_params_set_channels(handle, params, CHANNELS);                 // チャンネル数
-    snd_pcm_hw_params_set_rate_near(handle, params, (unsigned int[]){SAMPLE_RATE}, 0); // サンプリングレート
-
-    // 設定したパラメータをデバイスに書き込む
-    if ((err = snd_pcm_hw_params(handle, params)) < 0) {
-        fprintf(stderr, "ハードウェアパラメータを設定できません: %s\n", snd_strerror(err));
+int main(int argc, char *argv[]) {
+    // 出力先を開く (引数で指定しなければALSAの "default" デバイス)
+    AudioOutput output;
+    const char *output_spec = (argc > 1) ? argv[1] : "alsa";
+    if (audio_output_open(&output, output_spec, AUDIO_FORMAT_S16_LE, CHANNELS, SAMPLE_RATE, 0) != 0) {
         return 1;
     }
 
@@ -56,22 +35,17 @@ int main() {
 
     // --- ここで波形データを再生 ---
     printf("再生を開始します...\n");
-    err = snd_pcm_writei(handle, buffer, buffer_size);
-    printf("err = %d\n", err);
-    int play = snd_pcm_start(handle);
-    if (err < 0) {
-        // バッファが一杯なら回復を試みる
-        printf("playing sound...");
-        snd_pcm_recover(handle, err, 0);
-        err = snd_pcm_writei(handle, buffer, buffer_size);
+    // アンダーランからの回復は audio_output_write の中で行う
+    if (audio_output_write(&output, buffer, buffer_size) != 0) {
+        fprintf(stderr, "再生に失敗しました\n");
     }
 
     // 全てのフレームが再生されるのを待つ
-    snd_pcm_drain(handle);
+    audio_output_drain(&output);
     printf("再生が完了しました。\n");
 
-    // PCMデバイスを閉じる
-    snd_pcm_close(handle);
+    // 出力先を閉じる
+    audio_output_close(&output);
 
     return 0;
 }
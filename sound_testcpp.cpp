@@ -1,50 +1,145 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // (1)
-#include <alsa/asoundlib.h>
+#include "audio_output.h"
+#include "wav_file.h"
+#include "resampler.h"
 
 #define	BUFFER_SAMPLES	588
+// 出力先のバッファの長さ (マイクロ秒)
+#define	LATENCY_US	50000
+// 先読みを頼む範囲と、再生し終えたページを手放す単位 (バイト)
+#define	WINDOW_BYTES	(4 * 1024 * 1024)
+// レートを変換するときに一度に作る出力のフレーム数
+#define	RESAMPLE_FRAMES	1024
+
+// ファイル上の値はリトルエンディアンで、4バイト境界にそろっているとは限らない
+static uint16_t read_u16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t read_u32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// 浮動小数点にした frames フレームをデバイスのレートに変換して書き込む
+static int resample_write(Resampler *rs, AudioOutput *output, AudioSampleFormat format, const float *in, size_t frames,
+						  float *out, uint8_t *out_bytes)
+{
+	while(frames > 0){
+		size_t used = 0;
+		size_t made = resampler_process(rs, in, frames, &used, out, RESAMPLE_FRAMES);
+		audio_samples_from_float(format, out, out_bytes, made * rs->channels);
+		if(made > 0 && audio_output_write(output, out_bytes, made) != 0){
+			return -1;
+		}
+		in += used * rs->channels;
+		frames -= used;
+	}
+	return 0;
+}
 
 int main(int argc, char *argv[])
 {
 	if(argc == 1){
-		printf("Usage: %s <wav> [dev]\n", argv[0]);
+		printf("Usage: %s <wav> [output] [latency_ms]\n", argv[0]);
+		printf("  output: alsa[:dev] (default), wav:file, raw[:file], null[:realtime]\n");
 		return -1;
 	}
 
-	// WAVファイルをオープン
-	FILE *fp = fopen(argv[1], "rb");
-	if(fp == NULL){
+	// WAVファイルをオープンし、ファイル全体をメモリにマップする
+	// (読み込み用のバッファにコピーせず、マップしたページをそのままALSAに渡す)
+	int fd = open(argv[1], O_RDONLY);
+	if(fd < 0){
 		printf("Can't open wav: %s\n", argv[1]);
 		return -1;
 	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size < 12){
+		printf("WAV file format error.\n");
+		close(fd);
+		return -1;
+	}
+	size_t file_size = (size_t)st.st_size;
+	const uint8_t *file = (const uint8_t *)mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(file == MAP_FAILED){
+		printf("Can't mmap wav: %s\n", argv[1]);
+		return -1;
+	}
+	// 先頭から順に読むことをカーネルに伝えておく (先読みが大きくなる)
+	madvise((void *)file, file_size, MADV_SEQUENTIAL);
+
+	const uint8_t *data = NULL;
+	size_t data_len = 0;
+	uint16_t formatTag = 0, channels = 0, blockAlign = 0, bitsPerSample = 0;
+	uint32_t samplesPerSec = 0, avgBytesPerSec = 0;
+	int has_fmt = 0;
+	size_t pos = 12;
 
-	// WAVファイルからパラメータのチャンクを読み取る
-	char cid[5] = "CHID";
-	uint32_t clen;
+	int status = 0;
+	AudioOutput output;
+	int opened = 0;
+	const char *spec = "alsa";
+	unsigned int latency_us = LATENCY_US;
+	AudioSampleFormat format = AUDIO_FORMAT_S16_LE;
+	size_t frames_total = 0;
+	size_t frames_done = 0;
+	size_t released = 0;
+	size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+	Resampler resampler;
+	int resampling = 0;
+	float *in_float = NULL;
+	float *out_float = NULL;
+	uint8_t *out_bytes = NULL;
 
 	printf("---- WAV FILE ----\n");
-	fread(cid, 4, 1, fp); printf("'%s'", cid);		// 'RIFF'
-	fread(&clen, sizeof(clen), 1, fp);
-	printf(", len = %d\n", clen);
-
-	fread(cid, 4, 1, fp); printf("'%s'\n", cid);	// 'WAVE'
-	fread(cid, 4, 1, fp); printf("'%s'", cid);		// 'fmt '
-	fread(&clen, sizeof(clen), 1, fp);
-	printf(", len = %d\n", clen);
-
-	uint8_t *cbuf = new uint8_t[clen];
-	fread(cbuf, clen, 1, fp);
-
-	uint16_t formatTag		= *(uint16_t *)&cbuf[0];
-	uint16_t channels 		= *(uint16_t *)&cbuf[2];
-	uint32_t samplesPerSec	= *(uint32_t *)&cbuf[4];
-	uint32_t avgBytesPerSec	= *(uint32_t *)&cbuf[8];
-	uint16_t blockAlign 	= *(uint16_t *)&cbuf[12];
-	uint16_t bitsPerSample	= *(uint16_t *)&cbuf[14];
-	delete[] cbuf;
-	
+	printf("'%.4s', len = %u\n", (const char *)file, read_u32(file + 4));	// 'RIFF'
+	printf("'%.4s'\n", (const char *)file + 8);								// 'WAVE'
+	if(memcmp(file, "RIFF", 4) != 0 || memcmp(file + 8, "WAVE", 4) != 0){
+		printf("WAV file format error.\n");
+		status = -1;
+		goto End;
+	}
+
+	// チャンクを順にたどって 'fmt ' と 'data' を探す
+	// ('LIST' などの別のチャンクが間に入っていたり、'data' が 'fmt ' より前にあっても読める)
+	while(pos + 8 <= file_size && (!has_fmt || data == NULL)){
+		const uint8_t *chunk = file + pos;
+		uint32_t clen = read_u32(chunk + 4);
+		size_t body = pos + 8;
+		size_t avail = file_size - body;
+		printf("'%.4s', len = %u\n", (const char *)chunk, clen);
+
+		if(memcmp(chunk, "fmt ", 4) == 0 && clen >= 16 && clen <= avail){
+			formatTag		= read_u16(file + body + 0);
+			channels		= read_u16(file + body + 2);
+			samplesPerSec	= read_u32(file + body + 4);
+			avgBytesPerSec	= read_u32(file + body + 8);
+			blockAlign		= read_u16(file + body + 12);
+			bitsPerSample	= read_u16(file + body + 14);
+			// WAV_FORMAT_EXTENSIBLE は実際の形式がサブフォーマットGUIDの先頭に入っている
+			if(formatTag == WAV_FORMAT_EXTENSIBLE && clen >= 26){
+				formatTag = read_u16(file + body + 24);
+			}
+			has_fmt = 1;
+		}else if(memcmp(chunk, "data", 4) == 0){
+			data = file + body;
+			// 録音途中で止まったファイルなどは長さが実際より大きいので、ファイルの範囲に収める
+			data_len = (clen < avail) ? clen : avail;
+		}
+		// チャンクは2バイト境界にそろえて並んでいる
+		pos = body + clen + (clen & 1);
+	}
+
 	printf("  formatTag = %d\n", formatTag);
 	printf("  channels = %d\n", channels);
 	printf("  samplesPerSec = %d\n", samplesPerSec);
@@ -52,72 +147,133 @@ int main(int argc, char *argv[])
 	printf("  blockAlign = %d\n", blockAlign);
 	printf("  bitsPerSample = %d\n", bitsPerSample);
 
-	fread(cid, 4, 1, fp); printf("'%s'", cid);		// 'data'
-	fread(&clen, sizeof(clen), 1, fp);
-	printf(", len = %d\n", clen);
-
-	if(strcmp(cid, "data") != 0){
+	if(!has_fmt || data == NULL || blockAlign == 0 || channels == 0){
 		printf("WAV file format error.\n");
-		fclose(fp);
-		return -1;
+		status = -1;
+		goto End;
 	}
-	int data_len = clen;
 
-	// 音楽データの読み取り用バッファの領域を確保する
-	uint8_t *buffer = new uint8_t[blockAlign * BUFFER_SAMPLES];
+	// (3)
+	if((formatTag == WAV_FORMAT_PCM) && (bitsPerSample == 16)){
+		format = AUDIO_FORMAT_S16_LE;
+	}else if((formatTag == WAV_FORMAT_PCM) && (bitsPerSample == 24) && (blockAlign == 3 * channels)){
+		format = AUDIO_FORMAT_S24_3LE;
+	}else if((formatTag == WAV_FORMAT_PCM) && (bitsPerSample == 32)){
+		format = AUDIO_FORMAT_S32_LE;
+	}else if((formatTag == WAV_FORMAT_IEEE_FLOAT) && (bitsPerSample == 32)){
+		format = AUDIO_FORMAT_FLOAT_LE;
+	}else{
+		printf("Unsupported WAV format: tag = %d, bits = %d\n", formatTag, bitsPerSample);
+		status = -1;
+		goto End;
+	}
+	// マップしたデータをそのまま渡すので、フレームの詰め方が出力先と同じでなければならない
+	if(blockAlign != audio_sample_bytes(format) * channels){
+		printf("Unsupported WAV format: blockAlign = %d\n", blockAlign);
+		status = -1;
+		goto End;
+	}
 
 	// (2)
-	snd_pcm_t *hndl = NULL;
-	snd_output_t *output = NULL;
-	const char *dev = "default";
 	if(argc > 2){
-		dev = argv[2];
+		spec = argv[2];
 	}
-
-	int soft_resample = 1;
-	unsigned int latency = 50000;
-
-	// (3)
-	snd_pcm_format_t format = SND_PCM_FORMAT_S16_LE;
-	if((bitsPerSample == 24) && (blockAlign == 6)){
-		format = SND_PCM_FORMAT_S24_3LE;
+	if(argc > 3){
+		latency_us = (unsigned int)(atof(argv[3]) * 1000);
 	}
 
 	// (4)
-	int ret = snd_pcm_open(&hndl, dev, SND_PCM_STREAM_PLAYBACK, 0);
-	if(ret != 0){
-		printf("snd_pcm_open: error %d\n", ret);
+	if(audio_output_open(&output, spec, format, channels, samplesPerSec, latency_us) != 0){
+		printf("Can't open output: %s\n", spec);
+		status = -1;
 		goto End;
 	}
+	opened = 1;
 
 	// (5)
-	ret = snd_pcm_set_params(hndl, format, SND_PCM_ACCESS_RW_INTERLEAVED, channels, samplesPerSec, soft_resample, latency);
-	if(ret != 0){
-		printf("snd_pcm_set_params: error %d\n", ret);
-		goto End;
+	// デバイスがWAVのレートで開けなかったときは、plugに任せずにここで変換する
+	if(output.sample_rate != (int)samplesPerSec){
+		ResamplerQuality quality = resampler_quality_default();
+		if(resampler_init(&resampler, channels, (int)samplesPerSec, output.sample_rate, quality) != 0){
+			printf("Can't resample %u Hz to %d Hz\n", samplesPerSec, output.sample_rate);
+			status = -1;
+			goto End;
+		}
+		resampling = 1;
+		in_float = (float *)malloc(sizeof(float) * BUFFER_SAMPLES * channels);
+		out_float = (float *)malloc(sizeof(float) * RESAMPLE_FRAMES * channels);
+		out_bytes = (uint8_t *)malloc(audio_sample_bytes(format) * RESAMPLE_FRAMES * channels);
+		if(in_float == NULL || out_float == NULL || out_bytes == NULL){
+			printf("Out of memory\n");
+			status = -1;
+			goto End;
+		}
+		printf("Resampling %u Hz -> %d Hz (%s, %s)\n", samplesPerSec, output.sample_rate,
+			   resampler_quality_name(quality), resampler_kernel_selected()->name);
 	}
 
-	// (6)
-	snd_output_stdio_attach(&output, stdout, 0);
-	printf("---- PCM DUMP ----\n");
-	snd_pcm_dump(hndl, output);
+	// マップしたページを直接出力先に渡す (ALSAなら snd_pcm_writei)
+	// 最初のページが読まれた時点で再生が始まり、ファイル全体を読み込むのを待たない
+	frames_total = data_len / blockAlign;
+	released = (size_t)(data - file) & ~(page_size - 1);
+	madvise((void *)(file + released), (file_size - released < WINDOW_BYTES) ? file_size - released : WINDOW_BYTES, MADV_WILLNEED);
+	while(frames_done < frames_total){
+		size_t frames = frames_total - frames_done;
+		if(frames > BUFFER_SAMPLES){
+			frames = BUFFER_SAMPLES;
+		}
+		// (7)
+		// アンダーランからの回復は audio_output_write の中で行う
+		const uint8_t *src = data + frames_done * blockAlign;
+		int err;
+		if(resampling){
+			audio_samples_to_float(format, src, in_float, frames * channels);
+			err = resample_write(&resampler, &output, format, in_float, frames, out_float, out_bytes);
+		}else{
+			err = audio_output_write(&output, (const void *)src, frames);
+		}
+		if(err != 0){
+			printf("write error\n");
+			status = -1;
+			break;
+		}
+		frames_done += frames;
 
-	for(int n = 0; n < data_len; n += (blockAlign * BUFFER_SAMPLES)){
-		// 音楽データの読み取り
-		ret = fread(buffer, blockAlign, BUFFER_SAMPLES, fp);
-		if(ret > 0){
-			// (7)
-			snd_pcm_writei(hndl, (const void *)buffer, ret);
+		// 出力先に渡し終えたページは手放して、常駐メモリが増え続けないようにする
+		// (手放したページは必要になればファイルから読み直されるだけ)
+		size_t consumed = (size_t)(data - file) + frames_done * blockAlign;
+		if(consumed - released >= WINDOW_BYTES){
+			size_t end = consumed & ~(page_size - 1);
+			madvise((void *)(file + released), end - released, MADV_DONTNEED);
+			released = end;
+			// 次の範囲の先読みを頼んでおく
+			size_t ahead = file_size - end;
+			madvise((void *)(file + end), (ahead < WINDOW_BYTES) ? ahead : WINDOW_BYTES, MADV_WILLNEED);
+		}
+	}
+	// 変換の遅れの分だけ無音を入れて、最後のサンプルまで出し切る
+	if(resampling && frames_done == frames_total){
+		size_t rest = resampler_latency(&resampler);
+		memset(in_float, 0, sizeof(float) * BUFFER_SAMPLES * channels);
+		while(rest > 0){
+			size_t frames = (rest > BUFFER_SAMPLES) ? BUFFER_SAMPLES : rest;
+			if(resample_write(&resampler, &output, format, in_float, frames, out_float, out_bytes) != 0){
+				break;
+			}
+			rest -= frames;
 		}
 	}
 	// (8)
-	snd_pcm_drain(hndl);
+	audio_output_drain(&output);
 
 End:
 	// (9)
-	if(hndl != NULL) snd_pcm_close(hndl);
-	if(fp != NULL) fclose(fp);
-	if(buffer != NULL) delete[] buffer;
+	if(opened) audio_output_close(&output);
+	if(resampling) resampler_destroy(&resampler);
+	free(in_float);
+	free(out_float);
+	free(out_bytes);
+	munmap((void *)file, file_size);
 
-	return 0;
+	return status;
 }
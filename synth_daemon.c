@@ -0,0 +1,393 @@
+// 常駐型のシンセエンジン
+// 一度だけビルドして起動しておき、UIからUnixドメインソケット経由でコマンドを受け取る
+// PCMデバイス・ウェーブテーブル・解析済みMMLを保持したままにするので、
+// Playを押すたびにコンパイルやデバイスのオープンをやり直す必要がない
+//
+// プロトコル (1行1コマンド, 応答は "OK" または "ERR <理由>")
+//   WAVETABLE <ファイルパス>  ウェーブテーブルを読み込む (再生中ならそのまま次のブロックから切り替わる)
+//   WAVEDATA <値 x 32>        エディタで編集中の波形を直接送る (ファイルと同じ -8 ~ 7 の値, 再生は止めない)
+//   MML <ファイルパス>        MMLファイルを読み込んで解析する (@X の音色バンク wavetables/*.wtx もここで読み直す)
+//   PLAY [開始秒 [終了秒]]    先頭 (または開始秒) から再生する (再生中ならやり直す)
+//   LOOP [開始秒 [終了秒]]    区間 (指定がなければ曲全体) を STOP まで繰り返し再生する
+//   LIVE [接続元]             ALSAシーケンサからのノート入力で演奏する (STOP まで続く)
+//                             接続元 ("クライアント:ポート") を指定すると、そこから自動でつなぐ
+//                             応答は "OK <作ったポートのクライアント:ポート>"
+//   STOP                      再生を止める
+//   QUIT                      エンジンを終了する
+//
+// 起動: synth_daemon [ソケットのパス] [出力先 (alsa / wav:ファイル名 / raw / null など)] [遅延ms (5 ~ 100)]
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "audio_output.h"
+#include "live_input.h"
+#include "mml_parser.h"
+#include "mml_compiled.h"
+#include "note_queue.h"
+#include "realtime.h"
+#include "synth_engine.h"
+#include "voice_pool.h"
+#include "wavetable.h"
+#include "wavetable_bank.h"
+
+#define SAMPLE_RATE     44100   // サンプリングレート (Hz)
+#define CHANNELS        1       // チャンネル数 (1: モノラル, 2: ステレオ)
+#define DEFAULT_SOCKET_PATH "/tmp/synthe-2025.sock"
+#define COMMAND_MAX     1024    // 1コマンドの最大長
+
+// エンジンが保持する状態
+typedef struct {
+    AudioOutput output;             // 開きっぱなしにする出力先 (通常はALSAのPCMデバイス)
+    WavetableSwap wavetables;       // 読み込み済みのウェーブテーブル (帯域制限済み, 再生中に差し替えられる)
+    CompiledSong song;              // 読み込み済みの曲 (中間表現の命令列をmmapしたもの。ループは展開しない)
+    int has_song;
+    double region_start;            // 次の再生の区間 (秒, 終わりが0なら曲の最後まで)
+    double region_end;
+    int loop;
+    WavetableBank bank;             // MMLの @X で選ぶ音色 (音色バンクをmmapしたもの)
+
+    int live;                       // 曲ではなくMIDI入力で演奏しているか
+    NoteQueue notes;                // MIDI入力スレッドから再生スレッドへ渡すノート
+    LiveInput input;                // ALSAシーケンサの入力ポート (演奏中だけ開く)
+
+    SongRenderer renderer;          // 再生中の曲のレンダラー (再生スレッドを起動する前に、コマンドのスレッドで作る)
+    int has_renderer;
+
+    pthread_t play_thread;          // 再生スレッド
+    int playing;                    // 再生スレッドが動いているか
+    atomic_int stop_requested;      // 再生スレッドへの停止要求
+    int quit;                       // QUITを受け取ったか
+} SynthDaemon;
+
+// 再生スレッド: 停止要求が来るか曲が終わるまで1ピリオドずつ生成して書き込む
+// 出力先とレンダラーは、動いている間はこのスレッドだけが触る
+// リアルタイム優先度で動かすので、ロックもメモリ確保も待ち合わせもしない
+// (レンダラーと区間の目次は start_playback が作っておく。ワーカーは使わず、全トラックをこのスレッドで生成する)
+static void *play_thread_main(void *arg) {
+    SynthDaemon *d = (SynthDaemon *)arg;
+    SongRenderer *renderer = &d->renderer;
+    realtime_prefault_stack();
+    int16_t period_buffer[PERIOD_FRAMES * CHANNELS];
+
+    // 出力先が1ピリオド以上空くまで待ち、空いた分だけ生成して書き込む
+    while (!song_renderer_finished(renderer) && !atomic_load(&d->stop_requested)) {
+        long avail = audio_output_wait(&d->output);
+        if (avail < 0) {
+            atomic_store(&d->stop_requested, 1);
+            break;
+        }
+        while (avail > 0 && !song_renderer_finished(renderer) && !atomic_load(&d->stop_requested)) {
+            size_t n = (size_t)avail < PERIOD_FRAMES ? (size_t)avail : PERIOD_FRAMES;
+            // ブロックの先頭で最新のウェーブテーブルに切り替える (エディタでの編集がすぐ聞こえる)
+            song_renderer_set_wavetable(renderer, wavetable_swap_acquire(&d->wavetables));
+            size_t frames = song_render_block(renderer, period_buffer, n);
+            wavetable_swap_release(&d->wavetables);
+            if (audio_output_write(&d->output, period_buffer, frames) != 0) {
+                atomic_store(&d->stop_requested, 1);
+                break;
+            }
+            avail -= (long)frames;
+        }
+    }
+
+    // どちらの場合も、出力先は次の再生のために準備状態へ戻る
+    if (atomic_load(&d->stop_requested)) {
+        audio_output_drop(&d->output); // 残っているフレームを捨てて即座に止める
+    } else {
+        audio_output_drain(&d->output); // 最後まで鳴らし切る
+    }
+    return NULL;
+}
+
+// ライブ演奏の再生スレッド: 停止要求が来るまで、届いたノートを反映しながら出力先のピリオドずつ生成する
+// キューはピリオドの先頭で空にするので、ノートが届いてから生成されるまでの遅れは最大1ピリオド
+// (出力先の遅延を短くするほど、ピリオドも短くなって反応が速くなる)
+// ノートオンはプールの中からボイスを選ぶだけで、ループの中ではメモリを確保しない
+static void *live_thread_main(void *arg) {
+    SynthDaemon *d = (SynthDaemon *)arg;
+    realtime_prefault_stack();
+    int16_t period_buffer[PERIOD_FRAMES * CHANNELS];
+    VoicePool pool;
+    const Wavetable *wavetable = wavetable_swap_acquire(&d->wavetables);
+    int err = voice_pool_init(&pool, wavetable, d->output.sample_rate);
+    wavetable_swap_release(&d->wavetables);
+    if (err != 0) {
+        return NULL;
+    }
+
+    size_t period = d->output.period_frames < PERIOD_FRAMES ? d->output.period_frames : PERIOD_FRAMES;
+    while (!atomic_load(&d->stop_requested)) {
+        if (audio_output_wait(&d->output) < 0) {
+            break;
+        }
+        NoteMessage message;
+        while (note_queue_pop(&d->notes, &message)) {
+            if (message.type == NOTE_MESSAGE_ON) {
+                voice_pool_note_on(&pool, message.note, message.velocity);
+            } else if (message.type == NOTE_MESSAGE_OFF) {
+                voice_pool_note_off(&pool, message.note);
+            } else {
+                voice_pool_all_off(&pool);
+            }
+        }
+        voice_pool_set_wavetable(&pool, wavetable_swap_acquire(&d->wavetables));
+        voice_pool_render(&pool, period_buffer, period);
+        wavetable_swap_release(&d->wavetables);
+        if (audio_output_write(&d->output, period_buffer, period) != 0) {
+            break;
+        }
+    }
+
+    audio_output_drop(&d->output);
+    voice_pool_destroy(&pool);
+    return NULL;
+}
+
+// 再生中なら止めて、再生スレッドの終了を待つ
+static void stop_playback(SynthDaemon *d) {
+    if (!d->playing) {
+        return;
+    }
+    atomic_store(&d->stop_requested, 1);
+    pthread_join(d->play_thread, NULL);
+    d->playing = 0;
+    if (d->has_renderer) {
+        song_renderer_destroy(&d->renderer);
+        d->has_renderer = 0;
+    }
+    if (d->live) {
+        live_input_close(&d->input);
+        d->live = 0;
+    }
+}
+
+// 区間 (引数の "開始秒 終了秒") を指定して再生を始める
+static int start_playback(SynthDaemon *d, const char *region, int loop) {
+    stop_playback(d);
+    if (!d->has_song) {
+        return -1;
+    }
+    d->region_start = 0.0;
+    d->region_end = 0.0;
+    d->loop = loop;
+    if (region) {
+        sscanf(region, "%lf %lf", &d->region_start, &d->region_end);
+    }
+
+    // メモリの確保や目次作りは、再生スレッドを起動する前にここで済ませる
+    // (区間を指定したときは、目次を作りながらカーソルがシークの目印を全部記録するので、
+    //  ループで先頭に戻るときもメモリを確保しない)
+    const Wavetable *wavetable = wavetable_swap_acquire(&d->wavetables);
+    int err = song_renderer_init_program(&d->renderer, compiled_song_program(&d->song), wavetable, d->output.sample_rate);
+    wavetable_swap_release(&d->wavetables);
+    if (err != 0) {
+        return -1;
+    }
+    song_renderer_stop_workers(&d->renderer);
+    song_renderer_set_bank(&d->renderer, &d->bank);
+    if ((d->region_start > 0 || d->region_end > 0 || d->loop)
+        && song_renderer_set_region(&d->renderer, (uint64_t)(d->region_start * d->output.sample_rate),
+                                    (uint64_t)(d->region_end * d->output.sample_rate), d->loop) != 0) {
+        fprintf(stderr, "再生区間が正しくありません: %f 秒 ~ %f 秒\n", d->region_start, d->region_end);
+        song_renderer_destroy(&d->renderer);
+        return -1;
+    }
+    d->has_renderer = 1;
+
+    atomic_store(&d->stop_requested, 0);
+    if (realtime_thread_create(&d->play_thread, play_thread_main, d) != 0) {
+        song_renderer_destroy(&d->renderer);
+        d->has_renderer = 0;
+        return -1;
+    }
+    d->playing = 1;
+    return 0;
+}
+
+// MIDI入力ポートを開いてライブ演奏を始める
+static int start_live(SynthDaemon *d, const char *connect_from) {
+    stop_playback(d);
+    note_queue_init(&d->notes);
+    if (live_input_open(&d->input, &d->notes, connect_from) != 0) {
+        return -1;
+    }
+    atomic_store(&d->stop_requested, 0);
+    if (realtime_thread_create(&d->play_thread, live_thread_main, d) != 0) {
+        live_input_close(&d->input);
+        return -1;
+    }
+    d->live = 1;
+    d->playing = 1;
+    return 0;
+}
+
+// 1行分のコマンドを処理し、応答を reply に書き込む
+static void handle_command(SynthDaemon *d, char *line, char *reply, size_t reply_size) {
+    char *arg = strchr(line, ' ');
+    if (arg) {
+        *arg++ = '\0';
+    }
+
+    if (strcmp(line, "WAVETABLE") == 0 && arg) {
+        // 再生中なら、使われていない方のバッファに作ってから切り替える
+        int16_t loaded[TABLE_SIZE];
+        if (load_wavetable_from_file(arg, loaded) != 0) {
+            snprintf(reply, reply_size, "ERR ウェーブテーブルを読み込めません: %s\n", arg);
+            return;
+        }
+        wavetable_swap_publish(&d->wavetables, loaded);
+        snprintf(reply, reply_size, "OK\n");
+    } else if (strcmp(line, "WAVEDATA") == 0 && arg) {
+        int16_t loaded[TABLE_SIZE];
+        if (parse_wavetable_values(arg, loaded) != 0) {
+            snprintf(reply, reply_size, "ERR 波形の値が足りません\n");
+            return;
+        }
+        wavetable_swap_publish(&d->wavetables, loaded);
+        snprintf(reply, reply_size, "OK\n");
+    } else if (strcmp(line, "MML") == 0 && arg) {
+        CompiledSong song;
+        if (compiled_song_open(&song, arg, d->output.sample_rate) != 0) {
+            snprintf(reply, reply_size, "ERR MMLを読み込めません: %s\n", arg);
+            return;
+        }
+        stop_playback(d);
+        if (d->has_song) {
+            compiled_song_close(&d->song);
+        }
+        d->song = song;
+        d->has_song = 1;
+        // 再生が止まっている間に、編集・追加された *.wtx を音色バンクに反映する
+        wavetable_bank_close(&d->bank);
+        wavetable_bank_open(&d->bank, WAVETABLE_BANK_DIR);
+        snprintf(reply, reply_size, "OK\n");
+    } else if (strcmp(line, "PLAY") == 0 || strcmp(line, "LOOP") == 0) {
+        if (start_playback(d, arg, strcmp(line, "LOOP") == 0) != 0) {
+            snprintf(reply, reply_size, "ERR 再生できません (MMLが読み込まれていないか、区間が正しくありません)\n");
+            return;
+        }
+        snprintf(reply, reply_size, "OK\n");
+    } else if (strcmp(line, "LIVE") == 0) {
+        if (start_live(d, arg) != 0) {
+            snprintf(reply, reply_size, "ERR MIDI入力を開けません\n");
+            return;
+        }
+        snprintf(reply, reply_size, "OK %d:%d\n", d->input.client, d->input.port);
+    } else if (strcmp(line, "STOP") == 0) {
+        stop_playback(d);
+        snprintf(reply, reply_size, "OK\n");
+    } else if (strcmp(line, "QUIT") == 0) {
+        stop_playback(d);
+        d->quit = 1;
+        snprintf(reply, reply_size, "OK\n");
+    } else {
+        snprintf(reply, reply_size, "ERR 不明なコマンドです: %s\n", line);
+    }
+}
+
+// 1クライアント分の接続を処理する (改行区切りのコマンドを順に実行)
+static void serve_client(SynthDaemon *d, int client) {
+    char buf[COMMAND_MAX];
+    size_t len = 0;
+
+    while (!d->quit) {
+        ssize_t n = read(client, buf + len, sizeof(buf) - 1 - len);
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t)n;
+        buf[len] = '\0';
+
+        char *line = buf;
+        char *newline;
+        while ((newline = strchr(line, '\n')) != NULL) {
+            *newline = '\0';
+            if (newline > line && newline[-1] == '\r') {
+                newline[-1] = '\0';
+            }
+            if (*line != '\0') {
+                char reply[COMMAND_MAX + 64];
+                handle_command(d, line, reply, sizeof(reply));
+                if (write(client, reply, strlen(reply)) < 0) {
+                    return;
+                }
+            }
+            line = newline + 1;
+        }
+        // 改行が来ていない残りを先頭に詰める
+        len = strlen(line);
+        memmove(buf, line, len + 1);
+        if (len == sizeof(buf) - 1) {
+            // 1行が長すぎる場合は捨てる
+            len = 0;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *socket_path = (argc > 1) ? argv[1] : DEFAULT_SOCKET_PATH;
+    const char *output_spec = (argc > 2) ? argv[2] : "alsa";
+    // 出力先のバッファの長さ (ミリ秒。省略すると PERIOD_FRAMES x RING_PERIODS フレーム)
+    unsigned int latency_us = (argc > 3) ? (unsigned int)(atof(argv[3]) * 1000) : 0;
+    static SynthDaemon d;
+    static const int16_t silence[TABLE_SIZE];
+    memset(&d, 0, sizeof(d));
+    wavetable_swap_init(&d.wavetables, silence);
+
+    // クライアントが途中で切断してもエンジンごと落ちないようにする
+    signal(SIGPIPE, SIG_IGN);
+    // 再生中にページフォールトで音が途切れないよう、メモリをロックしておく
+    realtime_lock_memory();
+
+    if (audio_output_open(&d.output, output_spec, AUDIO_FORMAT_S16_LE, CHANNELS, SAMPLE_RATE, latency_us) != 0) {
+        return 1;
+    }
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0) {
+        perror("socket");
+        return 1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    unlink(socket_path); // 前回の残りを削除
+    if (bind(server, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(server, 4) < 0) {
+        perror("bind/listen");
+        close(server);
+        return 1;
+    }
+    // デバイスが SAMPLE_RATE に対応していなければ、開いたときのレートでそのまま生成する
+    printf("シンセエンジンを起動しました: %s (%d Hz, 出力の遅延 %.1f ms, ピリオド %zu フレーム)\n", socket_path,
+           d.output.sample_rate, d.output.latency_us / 1000.0, d.output.period_frames);
+    fflush(stdout);
+
+    while (!d.quit) {
+        int client = accept(server, NULL, NULL);
+        if (client < 0) {
+            continue;
+        }
+        serve_client(&d, client);
+        close(client);
+    }
+
+    // クリーンアップ
+    stop_playback(&d);
+    close(server);
+    unlink(socket_path);
+    audio_output_close(&d.output);
+    if (d.has_song) {
+        compiled_song_close(&d.song);
+    }
+    wavetable_bank_close(&d.bank);
+    printf("シンセエンジンを終了しました\n");
+    return 0;
+}
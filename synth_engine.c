@@ -0,0 +1,714 @@
+#include "synth_engine.h"
+#include "mixer.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// MIDIノートナンバーを周波数に変換するヘルパー関数
+double note_to_freq(int note) {
+    return 440.0 * pow(2.0, (note - 69.0) / 12.0);
+}
+
+uint64_t synth_phase_increment(int note, int sample_rate) {
+    double frequency = note_to_freq(note);
+    // doubleで一度計算してからuint64_tにキャストすることで精度を保つ
+    return (uint64_t)(((double)TABLE_SIZE * frequency / sample_rate) * (1LL << FRACTIONAL_BITS));
+}
+
+// 作った表を覚えておく数 (使うサンプリングレートはせいぜい1つか2つ)
+#define NOTE_TABLE_SLOTS 4
+
+static SynthNoteTable note_tables[NOTE_TABLE_SLOTS];
+static size_t num_note_tables;
+static pthread_mutex_t note_tables_lock = PTHREAD_MUTEX_INITIALIZER;
+
+const SynthNoteTable *synth_note_table(int sample_rate) {
+    pthread_mutex_lock(&note_tables_lock);
+    SynthNoteTable *table = NULL;
+    for (size_t i = 0; i < num_note_tables; ++i) {
+        if (note_tables[i].sample_rate == sample_rate) {
+            table = &note_tables[i];
+        }
+    }
+    if (!table) {
+        // いっぱいなら一番古いものを作り直す (そのレートのレンダラーが残っていない前提)
+        table = &note_tables[num_note_tables % NOTE_TABLE_SLOTS];
+        if (num_note_tables < NOTE_TABLE_SLOTS) {
+            num_note_tables++;
+        }
+        table->sample_rate = sample_rate;
+        for (int note = 0; note < SYNTH_NOTE_COUNT; ++note) {
+            table->phase_increments[note] = synth_phase_increment(note, sample_rate);
+            table->levels[note] = wavetable_select_level(note_to_freq(note) / sample_rate);
+        }
+    }
+    pthread_mutex_unlock(&note_tables_lock);
+    return table;
+}
+
+// ノートの1サンプルあたりのフェーズ増分 (休符は0。表にない音は計算する)
+static uint64_t note_phase_increment(const SynthNoteTable *notes, int note) {
+    if (note <= 0) {
+        return 0;
+    }
+    return (note < SYNTH_NOTE_COUNT) ? notes->phase_increments[note] : synth_phase_increment(note, notes->sample_rate);
+}
+
+// 現在のノートで使う帯域制限済みのテーブル
+static const int16_t *current_table(const SynthRenderer *r) {
+    return wavetable_level(r->instrument ? r->instrument : r->wavetable, r->level);
+}
+
+// 現在のノートで使うテーブルの内容のハッシュ (編集中の波形が変われば別のノートになる)
+static uint64_t current_table_hash(const SynthRenderer *r) {
+    return wavetable_level_hash(r->instrument ? r->instrument : r->wavetable, r->level);
+}
+
+// 発振器とエンベロープで n サンプル生成する
+// エンベロープのランプが続く区間ごとにカーネルを呼び、鳴り終わった後は無音にしてフェーズだけ進める
+static void render_voice(OscState *osc, Envelope *envelope, const int16_t *table, int16_t *out, size_t n) {
+    while (n > 0 && !envelope_finished(envelope)) {
+        size_t m = envelope_apply(envelope, osc, n);
+        osc_render(osc, table, out, m);
+        envelope_advance(envelope, m);
+        out += m;
+        n -= m;
+    }
+    if (n > 0) {
+        // 区切って生成したときとフェーズが一致するよう、鳴らした場合と同じだけ進めておく
+        osc->phase += osc->phase_increment * n;
+        memset(out, 0, n * sizeof(int16_t));
+    }
+}
+
+// ノート全体をキャッシュから取り出す (なければ生成して入れる)
+// ヒットでもミスでも、丸めたフェーズから生成した同じ波形を鳴らす
+static void begin_cached_note(SynthRenderer *r) {
+    const MmlEvent *event = &r->current;
+    const int16_t *table = current_table(r);
+    NoteCacheKey key;
+
+    memset(&key, 0, sizeof(key));
+    key.table_hash = current_table_hash(r);
+    key.phase_increment = r->osc.phase_increment;
+    key.duration = event->duration_samples;
+    key.start_phase = (uint32_t)(r->osc.phase >> FRACTIONAL_BITS) & (TABLE_SIZE - 1);
+    key.peak = r->envelope.peak;
+    key.interp = r->interp;
+    // 構造体の隙間を0のまま比べられるように、項目ごとに写す
+    key.envelope.attack = event->envelope.attack;
+    key.envelope.decay_segment = event->envelope.decay_segment;
+    key.envelope.sustain = event->envelope.sustain;
+    key.envelope.release = event->envelope.release;
+    key.envelope.gate = event->envelope.gate;
+
+    r->cached = note_cache_acquire(r->cache, &key);
+    if (!r->cached) {
+        int16_t *samples = (int16_t *)malloc(key.duration * sizeof(int16_t));
+        if (!samples) {
+            return;     // 確保できなければキャッシュを使わずに鳴らす
+        }
+        OscState osc = r->osc;
+        Envelope envelope = r->envelope;
+        osc.phase = (uint64_t)key.start_phase << FRACTIONAL_BITS;
+        render_voice(&osc, &envelope, table, samples, key.duration);
+        r->cached = note_cache_insert(r->cache, &key, samples);
+        if (!r->cached) {
+            return;
+        }
+    }
+    // 波形は出来ているので、フェーズはノートの終わりまで進めておく
+    r->osc.phase += r->osc.phase_increment * key.duration;
+}
+
+// キャッシュから鳴らしていたノートを返す
+static void release_cached_note(SynthRenderer *r) {
+    if (r->cached) {
+        note_cache_release(r->cache, r->cached);
+        r->cached = NULL;
+    }
+}
+
+// 現在のイベントの開始準備 (フェーズ増分とエンベロープをイベント開始時に一度だけ計算)
+static void begin_event(SynthRenderer *r) {
+    const MmlEvent *event = &r->current;
+    int note = event->note_number;
+
+    uint64_t phase_increment = note_phase_increment(r->notes, note);
+
+    r->event_pos = 0;
+    if (note > 0 && note < SYNTH_NOTE_COUNT) {
+        // 固定小数点のフェーズ増分と、音の高さで折り返さない帯域制限済みのテーブルを表から引く
+        r->level = r->notes->levels[note];
+    } else if (note > 0) {
+        r->level = wavetable_select_level(note_to_freq(note) / r->sample_rate);
+    }
+    if (note > 0) {
+        // 音量スケール (DEFAULT_VOLUME で1.0) を小数部 OSC_GAIN_BITS にする
+        int64_t peak = ((int64_t)(event->volume > 0 ? event->volume : 0) << OSC_GAIN_BITS) / DEFAULT_VOLUME;
+        envelope_start(&r->envelope, peak > INT32_MAX ? INT32_MAX : (int32_t)peak, &event->envelope,
+                       event->duration_samples);
+    }
+    r->osc.phase_increment = phase_increment;
+    r->osc.interp = r->interp;
+    // 音色の切り替えはバンク内のテーブルを指し直すだけ
+    r->instrument = wavetable_bank_get(r->bank, event->instrument);
+    if (note > 0 && r->cache && note_cache_accepts(r->cache, event->duration_samples)) {
+        begin_cached_note(r);
+    }
+}
+
+// 次のイベントを取り出して開始する (なければ has_current を0にする)
+static void next_event(SynthRenderer *r) {
+    release_cached_note(r);
+    r->has_current = r->source.next(r->source.ctx, &r->current);
+    if (r->has_current) {
+        begin_event(r);
+    }
+}
+
+// 現在のイベントを offset サンプル目まで飛ばす
+// 鳴らした場合と同じだけフェーズを進め、エンベロープもランプの区切りごとに進めるので、続きは通して生成した場合と一致する
+static void skip_into_event(SynthRenderer *r, uint32_t offset) {
+    r->event_pos = offset;
+    if (r->current.note_number <= 0 || r->cached) {
+        return;
+    }
+    r->osc.phase += r->osc.phase_increment * offset;
+    while (offset > 0 && !envelope_finished(&r->envelope)) {
+        size_t m = envelope_apply(&r->envelope, &r->osc, offset);
+        envelope_advance(&r->envelope, m);
+        offset -= (uint32_t)m;
+    }
+}
+
+void synth_renderer_init(SynthRenderer *r, MmlEventSource source, const Wavetable *wavetable, int sample_rate) {
+    synth_renderer_init_at(r, source, wavetable, sample_rate, 0, 0);
+}
+
+void synth_renderer_init_at(SynthRenderer *r, MmlEventSource source, const Wavetable *wavetable, int sample_rate,
+                            uint64_t phase, uint32_t offset) {
+    const char *interp = getenv("SYNTH_INTERP");
+
+    r->source = source;
+    r->wavetable = wavetable;
+    r->bank = NULL;
+    r->instrument = NULL;
+    r->sample_rate = sample_rate;
+    r->interp = (interp && strcmp(interp, "cubic") == 0) ? OSC_INTERP_CUBIC : OSC_INTERP_LINEAR;
+    r->notes = synth_note_table(sample_rate);
+    r->cache = NULL;
+    r->cached = NULL;
+    r->level = 0;
+    r->pan_segments = NULL;
+    r->num_pan_segments = 0;
+    r->segment_pan = MML_PAN_CENTER;
+    r->osc.phase = phase;
+    // 使うカーネルをここで決めておく (再生スレッドで初めて選ばないように)
+    osc_kernel_selected();
+    next_event(r);
+    if (r->has_current) {
+        skip_into_event(r, offset);
+    }
+}
+
+void synth_renderer_set_bank(SynthRenderer *r, const WavetableBank *bank) {
+    r->bank = bank;
+    if (r->has_current) {
+        r->instrument = wavetable_bank_get(bank, r->current.instrument);
+    }
+}
+
+void synth_renderer_set_cache(SynthRenderer *r, NoteCache *cache) {
+    release_cached_note(r);
+    r->cache = cache;
+    // まだ鳴らし始めていなければ、最初のノートからキャッシュを使う
+    if (r->has_current && r->event_pos == 0) {
+        begin_event(r);
+    }
+}
+
+int synth_time_index_build(SynthTimeIndex *index, MmlEventSource source, int sample_rate) {
+    const SynthNoteTable *notes = synth_note_table(sample_rate);
+    size_t capacity = 16;
+    uint64_t start = 0;
+    uint64_t phase = 0;
+    MmlEvent event;
+
+    memset(index, 0, sizeof(*index));
+    if (!source.seek || source.seek(source.ctx, 0) != 0) {
+        return -1;
+    }
+    index->checkpoints = (SynthCheckpoint *)malloc(capacity * sizeof(SynthCheckpoint));
+    for (size_t i = 0; index->checkpoints; ++i) {
+        if (i % MML_SEEK_INTERVAL == 0) {
+            if (index->num_checkpoints >= capacity) {
+                capacity *= 2;
+                SynthCheckpoint *grown = (SynthCheckpoint *)realloc(index->checkpoints, capacity * sizeof(SynthCheckpoint));
+                if (!grown) {
+                    synth_time_index_free(index);
+                    break;
+                }
+                index->checkpoints = grown;
+            }
+            index->checkpoints[index->num_checkpoints].start = start;
+            index->checkpoints[index->num_checkpoints].phase = phase;
+            index->num_checkpoints++;
+        }
+        if (!source.next(source.ctx, &event)) {
+            index->length = start;
+            return 0;
+        }
+        // render_note は鳴り終わった後もフェーズを進めるので、ノートの長さ分そのまま足せばよい
+        start += event.duration_samples;
+        phase += note_phase_increment(notes, event.note_number) * event.duration_samples;
+    }
+    fprintf(stderr, "目次の確保に失敗しました\n");
+    return -1;
+}
+
+void synth_time_index_free(SynthTimeIndex *index) {
+    free(index->checkpoints);
+    memset(index, 0, sizeof(*index));
+}
+
+int synth_renderer_seek(SynthRenderer *r, const SynthTimeIndex *index, uint64_t time) {
+    if (!r->source.seek || index->num_checkpoints == 0) {
+        return -1;
+    }
+    // time より前で最後の目印を探す
+    size_t lo = 0;
+    size_t hi = index->num_checkpoints;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->checkpoints[mid].start <= time) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    if (r->source.seek(r->source.ctx, lo * MML_SEEK_INTERVAL) != 0) {
+        return -1;
+    }
+    release_cached_note(r);
+    uint64_t start = index->checkpoints[lo].start;
+    uint64_t phase = index->checkpoints[lo].phase;
+
+    // 目印から time を含むイベントまで読み進める
+    while ((r->has_current = r->source.next(r->source.ctx, &r->current)) != 0) {
+        uint32_t duration = r->current.duration_samples;
+        if (time < start + duration) {
+            r->osc.phase = phase;
+            begin_event(r);
+            skip_into_event(r, (uint32_t)(time - start));
+            return 0;
+        }
+        start += duration;
+        phase += note_phase_increment(r->notes, r->current.note_number) * duration;
+    }
+    // 曲の最後より後ろなら生成し終えた状態にする
+    return 0;
+}
+
+int synth_renderer_finished(const SynthRenderer *r) {
+    return !r->has_current;
+}
+
+// ノートを n サンプル生成する (キャッシュから鳴らしている場合はコピーするだけ)
+static void render_note(SynthRenderer *r, int16_t *out, size_t n) {
+    if (r->cached) {
+        memcpy(out, r->cached->samples + r->event_pos, n * sizeof(int16_t));
+        return;
+    }
+    render_voice(&r->osc, &r->envelope, current_table(r), out, n);
+}
+
+// ブロックの offset フレーム目から定位 pan で鳴らすことを記録する
+static void record_pan(SynthRenderer *r, size_t offset, int pan) {
+    size_t n = r->num_pan_segments;
+    if (n > 0 && r->segment_pan == pan) {
+        return;
+    }
+    if (n > 0 && r->pan_segments[n - 1].start == offset) {
+        n--;    // 長さ0のイベントの分は上書きする
+    } else if (n >= MIXER_PAN_SEGMENTS) {
+        return;
+    }
+    r->pan_segments[n].start = (uint32_t)offset;
+    mixer_pan_gains(pan, r->pan_segments[n].gains);
+    r->num_pan_segments = n + 1;
+    r->segment_pan = pan;
+}
+
+size_t synth_render_block(SynthRenderer *r, int16_t *out, size_t frames) {
+    size_t written = 0;
+
+    while (written < frames && !synth_renderer_finished(r)) {
+        const MmlEvent *event = &r->current;
+        if (r->pan_segments) {
+            record_pan(r, written, event->pan);
+        }
+
+        // このイベントの残りサンプル数と、ブロックの残りフレーム数の小さい方だけ生成する
+        uint32_t remain = event->duration_samples - r->event_pos;
+        size_t n = frames - written;
+        if (n > remain) {
+            n = remain;
+        }
+
+        if (event->note_number > 0) {
+            // 音を鳴らす処理 (SIMDカーネルでまとめて生成)
+            render_note(r, out + written, n);
+        } else {
+            // 休符処理 (音をゼロにする)
+            for (size_t j = 0; j < n; ++j) {
+                out[written + j] = 0;
+            }
+        }
+
+        written += n;
+        r->event_pos += (uint32_t)n;
+
+        // イベントの最後まで生成したら次のイベントへ
+        if (r->event_pos >= event->duration_samples) {
+            next_event(r);
+        }
+    }
+    return written;
+}
+
+// --- 複数トラックの並列生成 ---
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// 1トラック分を生成し、かかった時間をそのトラックに足す
+static size_t render_track_timed(SongRenderer *sr, size_t track, int16_t *out, size_t frames) {
+    uint64_t begin = now_ns();
+    size_t n = synth_render_block(&sr->tracks[track], out, frames);
+    sr->track_ns[track] += now_ns() - begin;
+    return n;
+}
+
+// 1トラック分を1ブロック生成し、足りない部分は無音で埋める
+static void render_track_block(SongRenderer *sr, size_t track) {
+    int16_t *buf = sr->track_buffers[track];
+    sr->tracks[track].num_pan_segments = 0;
+    size_t n = render_track_timed(sr, track, buf, sr->block_frames);
+    for (size_t i = n; i < sr->block_frames; ++i) {
+        buf[i] = 0;
+    }
+    sr->track_frames[track] = n;
+}
+
+// ワーカースレッド: 開始の合図ごとに担当トラックを1ブロック生成する
+static void *track_worker_main(void *arg) {
+    SongTrackWorker *w = (SongTrackWorker *)arg;
+    SongRenderer *sr = w->sr;
+
+    // 全員を作り終えるまで待つ (途中で作れなかったときは、何もせずに終わる)
+    // quit は見ない (作り終えた直後に止められても、バリアまでは必ず来る)
+    pthread_mutex_lock(&sr->start_lock);
+    int started = sr->threaded;
+    pthread_mutex_unlock(&sr->start_lock);
+    if (!started) {
+        return NULL;
+    }
+    for (;;) {
+        pthread_barrier_wait(&sr->block_start);
+        if (sr->quit) {
+            break;
+        }
+        render_track_block(sr, w->track);
+        pthread_barrier_wait(&sr->block_done);
+    }
+    return NULL;
+}
+
+int song_renderer_init(SongRenderer *sr, const MmlSong *song, const Wavetable *wavetable, int sample_rate) {
+    MmlEventSource sources[MML_MAX_TRACKS];
+    for (size_t t = 0; t < song->num_tracks; ++t) {
+        sources[t] = mml_cursor_source(&sr->cursors[t], song->tracks[t].events, song->tracks[t].num_events);
+    }
+    return song_renderer_init_sources(sr, sources, song->num_tracks, wavetable, sample_rate);
+}
+
+int song_renderer_init_program(SongRenderer *sr, const MmlProgram *program, const Wavetable *wavetable, int sample_rate) {
+    MmlEventSource sources[MML_MAX_TRACKS];
+    for (size_t t = 0; t < program->num_tracks; ++t) {
+        sources[t] = mml_program_source(&sr->programs[t], program, t);
+    }
+    if (song_renderer_init_sources(sr, sources, program->num_tracks, wavetable, sample_rate) != 0) {
+        return -1;
+    }
+    sr->num_programs = program->num_tracks;
+    return 0;
+}
+
+int song_renderer_init_sources(SongRenderer *sr, const MmlEventSource *sources, size_t num_tracks,
+                               const Wavetable *wavetable, int sample_rate) {
+    sr->num_tracks = num_tracks;
+    sr->num_programs = 0;
+    sr->block_frames = 0;
+    sr->quit = 0;
+    memset(sr->indexes, 0, sizeof(sr->indexes));
+    memset(sr->track_ns, 0, sizeof(sr->track_ns));
+    sr->position = 0;
+    sr->region_start = 0;
+    sr->region_end = 0;
+    sr->loop = 0;
+
+    for (size_t t = 0; t < sr->num_tracks; ++t) {
+        synth_renderer_init(&sr->tracks[t], sources[t], wavetable, sample_rate);
+        sr->track_buffers[t] = (int16_t *)malloc(PERIOD_FRAMES * sizeof(int16_t));
+        if (!sr->track_buffers[t]) {
+            fprintf(stderr, "トラックバッファの確保に失敗しました\n");
+            for (size_t i = 0; i < t; ++i) {
+                free(sr->track_buffers[i]);
+            }
+            sr->num_tracks = 0;
+            return -1;
+        }
+    }
+    song_renderer_set_output(sr, AUDIO_FORMAT_S16_LE, 1);
+
+    // 1トラックだけならスレッドは不要
+    sr->threaded = 0;
+    if (sr->num_tracks <= 1) {
+        return 0;
+    }
+    if (pthread_barrier_init(&sr->block_start, NULL, (unsigned)sr->num_tracks) != 0) {
+        goto single_thread;
+    }
+    if (pthread_barrier_init(&sr->block_done, NULL, (unsigned)sr->num_tracks) != 0) {
+        pthread_barrier_destroy(&sr->block_start);
+        goto single_thread;
+    }
+    if (pthread_mutex_init(&sr->start_lock, NULL) != 0) {
+        pthread_barrier_destroy(&sr->block_start);
+        pthread_barrier_destroy(&sr->block_done);
+        goto single_thread;
+    }
+
+    pthread_mutex_lock(&sr->start_lock);
+    size_t started = 1;
+    for (; started < sr->num_tracks; ++started) {
+        sr->worker_args[started].sr = sr;
+        sr->worker_args[started].track = started;
+        if (pthread_create(&sr->workers[started], NULL, track_worker_main, &sr->worker_args[started]) != 0) {
+            break;
+        }
+    }
+    if (started < sr->num_tracks) {
+        // 作れた分も threaded が0のままなのを見て、バリアを待たずに終わる
+        pthread_mutex_unlock(&sr->start_lock);
+        for (size_t t = 1; t < started; ++t) {
+            pthread_join(sr->workers[t], NULL);
+        }
+        pthread_mutex_destroy(&sr->start_lock);
+        pthread_barrier_destroy(&sr->block_start);
+        pthread_barrier_destroy(&sr->block_done);
+        goto single_thread;
+    }
+    sr->threaded = 1;
+    pthread_mutex_unlock(&sr->start_lock);
+    return 0;
+
+single_thread:
+    fprintf(stderr, "ワーカースレッドを作れませんでした。全トラックを1つのスレッドで生成します\n");
+    return 0;
+}
+
+int song_renderer_set_output(SongRenderer *sr, AudioSampleFormat format, int channels) {
+    MixKernel mix = mixer_select(format, channels);
+    if (!mix) {
+        return -1;
+    }
+    sr->format = format;
+    sr->channels = channels;
+    sr->frame_bytes = mixer_frame_bytes(format, channels);
+    sr->mix = mix;
+    sr->mix_panned = mixer_select_panned(format, channels);
+    // ステレオ以上なら、各トラックに定位の変わり目を記録させる
+    for (size_t t = 0; t < sr->num_tracks; ++t) {
+        sr->tracks[t].pan_segments = sr->mix_panned ? sr->pan_segments[t] : NULL;
+        sr->tracks[t].num_pan_segments = 0;
+        sr->pan_inputs[t].samples = sr->track_buffers[t];
+        sr->pan_inputs[t].segments = sr->pan_segments[t];
+    }
+    return 0;
+}
+
+int song_renderer_finished(const SongRenderer *sr) {
+    if (sr->loop) {
+        return 0;
+    }
+    if (sr->region_end > 0 && sr->position >= sr->region_end) {
+        return 1;
+    }
+    for (size_t t = 0; t < sr->num_tracks; ++t) {
+        if (!synth_renderer_finished(&sr->tracks[t])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void song_renderer_set_wavetable(SongRenderer *sr, const Wavetable *wavetable) {
+    for (size_t t = 0; t < sr->num_tracks; ++t) {
+        sr->tracks[t].wavetable = wavetable;
+    }
+}
+
+void song_renderer_set_bank(SongRenderer *sr, const WavetableBank *bank) {
+    for (size_t t = 0; t < sr->num_tracks; ++t) {
+        synth_renderer_set_bank(&sr->tracks[t], bank);
+    }
+}
+
+void song_renderer_set_cache(SongRenderer *sr, NoteCache *cache) {
+    for (size_t t = 0; t < sr->num_tracks; ++t) {
+        synth_renderer_set_cache(&sr->tracks[t], cache);
+    }
+}
+
+int song_renderer_seek(SongRenderer *sr, uint64_t time) {
+    for (size_t t = 0; t < sr->num_tracks; ++t) {
+        SynthRenderer *r = &sr->tracks[t];
+        if (!sr->indexes[t].checkpoints
+            && synth_time_index_build(&sr->indexes[t], r->source, r->sample_rate) != 0) {
+            return -1;
+        }
+        if (synth_renderer_seek(r, &sr->indexes[t], time) != 0) {
+            return -1;
+        }
+    }
+    sr->position = time;
+    return 0;
+}
+
+int song_renderer_set_region(SongRenderer *sr, uint64_t start, uint64_t end, int loop) {
+    if (song_renderer_seek(sr, start) != 0) {
+        return -1;
+    }
+    // 曲の最後より後ろは無音なので、区間は一番長いトラックの終わりまでにする
+    uint64_t length = 0;
+    for (size_t t = 0; t < sr->num_tracks; ++t) {
+        if (sr->indexes[t].length > length) {
+            length = sr->indexes[t].length;
+        }
+    }
+    if (end == 0 || end > length) {
+        end = length;
+    }
+    if (start >= end) {
+        return -1;
+    }
+    sr->region_start = start;
+    sr->region_end = end;
+    sr->loop = loop;
+    return 0;
+}
+
+// 全トラックを frames フレーム分生成してミックスする (区間の扱いは呼び出し側)
+static size_t render_song_block(SongRenderer *sr, void *out, size_t frames) {
+    // 1トラックだけで16bitモノラルならミックスせずに直接書き込む
+    if (sr->num_tracks == 1 && sr->format == AUDIO_FORMAT_S16_LE && sr->channels == 1) {
+        return render_track_timed(sr, 0, (int16_t *)out, frames);
+    }
+
+    sr->block_frames = frames;
+
+    // ワーカーに開始を知らせ、自分はトラック0を担当する (ワーカーがいなければ全トラックを順に生成する)
+    if (sr->threaded) {
+        pthread_barrier_wait(&sr->block_start);
+        render_track_block(sr, 0);
+        pthread_barrier_wait(&sr->block_done);
+    } else {
+        for (size_t t = 0; t < sr->num_tracks; ++t) {
+            render_track_block(sr, t);
+        }
+    }
+
+    // 一番長く鳴っていたトラックの長さが、このブロックの長さになる
+    size_t block = 0;
+    for (size_t t = 0; t < sr->num_tracks; ++t) {
+        if (sr->track_frames[t] > block) {
+            block = sr->track_frames[t];
+        }
+    }
+    if (sr->mix_panned) {
+        for (size_t t = 0; t < sr->num_tracks; ++t) {
+            sr->pan_inputs[t].num_segments = sr->tracks[t].num_pan_segments;
+        }
+        sr->mix_panned(out, sr->pan_inputs, sr->num_tracks, block, sr->channels);
+    } else {
+        sr->mix(out, (const int16_t *const *)sr->track_buffers, sr->num_tracks, block, sr->channels);
+    }
+    return block;
+}
+
+size_t song_render_block(SongRenderer *sr, void *out, size_t frames) {
+    size_t written = 0;
+
+    if (frames > PERIOD_FRAMES) {
+        frames = PERIOD_FRAMES;
+    }
+    if (sr->num_tracks == 0 || song_renderer_finished(sr)) {
+        return 0;
+    }
+    while (written < frames) {
+        size_t n = frames - written;
+        if (sr->region_end > 0) {
+            // 区間の終わりに来たら、ループなら先頭に戻ってブロックの残りを埋める
+            if (sr->position >= sr->region_end && (!sr->loop || song_renderer_seek(sr, sr->region_start) != 0)) {
+                break;
+            }
+            if (n > sr->region_end - sr->position) {
+                n = (size_t)(sr->region_end - sr->position);
+            }
+        }
+        size_t m = render_song_block(sr, (uint8_t *)out + written * sr->frame_bytes, n);
+        sr->position += m;
+        written += m;
+        if (m < n) {
+            break;  // 曲の最後
+        }
+    }
+    return written;
+}
+
+void song_renderer_stop_workers(SongRenderer *sr) {
+    if (!sr->threaded) {
+        return;
+    }
+    sr->quit = 1;
+    pthread_barrier_wait(&sr->block_start);
+    for (size_t t = 1; t < sr->num_tracks; ++t) {
+        pthread_join(sr->workers[t], NULL);
+    }
+    pthread_barrier_destroy(&sr->block_start);
+    pthread_barrier_destroy(&sr->block_done);
+    pthread_mutex_destroy(&sr->start_lock);
+    sr->threaded = 0;
+    sr->quit = 0;
+}
+
+void song_renderer_destroy(SongRenderer *sr) {
+    song_renderer_stop_workers(sr);
+    for (size_t t = 0; t < sr->num_tracks; ++t) {
+        free(sr->track_buffers[t]);
+        synth_time_index_free(&sr->indexes[t]);
+        release_cached_note(&sr->tracks[t]);
+    }
+    for (size_t t = 0; t < sr->num_programs; ++t) {
+        mml_program_cursor_free(&sr->programs[t]);
+    }
+    sr->num_programs = 0;
+    sr->num_tracks = 0;
+}
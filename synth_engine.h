@@ -0,0 +1,217 @@
+#ifndef SYNTH_ENGINE_H
+#define SYNTH_ENGINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "envelope.h"
+#include "mixer.h"
+#include "mml_parser.h"
+#include "note_cache.h"
+#include "osc_kernel.h"
+#include "wavetable.h"
+#include "wavetable_bank.h"
+#include <pthread.h>
+
+// --- ストリーミング再生の設定 ---
+// 1回の描画で生成するフレーム数 (ALSAのピリオドサイズ)
+#define PERIOD_FRAMES   1024
+// リングバッファ(ALSAのバッファ)が保持するピリオド数
+#define RING_PERIODS    4
+
+// ノートナンバーごとに、イベントの開始時に必要な値を前もって計算した表
+// (イベントごとに pow や浮動小数点の割り算をしないで済むように、サンプリングレートごとに一度だけ作る)
+#define SYNTH_NOTE_COUNT 128
+typedef struct {
+    int sample_rate;
+    uint64_t phase_increments[SYNTH_NOTE_COUNT];    // synth_phase_increment の値
+    int levels[SYNTH_NOTE_COUNT];                   // 帯域制限済みのテーブルの段
+} SynthNoteTable;
+
+// イベントを先頭から順に取り出して、少しずつ波形を生成するための状態
+// 曲の長さに関係なく、この構造体と1ピリオド分のバッファだけで再生できる
+typedef struct {
+    MmlEventSource source;      // イベントの読み出し口
+    MmlEvent current;           // 現在再生中のイベント
+    int has_current;            // current が有効か (0なら全て生成し終えた)
+    const Wavetable *wavetable; // 使用するウェーブテーブル (音色を指定していないイベント用)
+    const WavetableBank *bank;  // @X で選ぶ音色バンク (NULLなら全て wavetable で鳴らす)
+    const Wavetable *instrument; // 現在のイベントの音色 (NULLなら wavetable)
+    int sample_rate;            // サンプリングレート
+    int interp;                 // 補間方法 (OSC_INTERP_*)
+    const SynthNoteTable *notes; // sample_rate 用のノートの表
+    NoteCache *cache;           // 生成済みのノートのキャッシュ (NULLなら毎回生成する)
+    const NoteCacheEntry *cached; // 現在のノートをキャッシュから鳴らしている場合はその波形
+
+    uint32_t event_pos;         // 現在のイベント内で生成済みのサンプル数
+    OscState osc;               // 発振器の状態 (フェーズ・振幅)
+    Envelope envelope;          // 現在のノートの音量エンベロープ
+    int level;                  // 現在の音の高さに合わせて選んだ帯域制限済みのテーブルの段
+
+    // 定位の記録 (ステレオで鳴らすときだけ。ブロックの中で定位が変わる位置を pan_segments に書く)
+    MixPanSegment *pan_segments; // 書き込み先 (MIXER_PAN_SEGMENTS 個。NULLなら記録しない)
+    size_t num_pan_segments;    // 今のブロックで書いた数 (ブロックの前に呼び出し側が0にする)
+    int segment_pan;            // 最後に書いた区間の定位
+} SynthRenderer;
+
+// シーク用の目次 (1トラック分)
+// MML_SEEK_INTERVAL イベントごとに、そのイベントの開始位置と発振器のフェーズを覚えておく
+// 音量はエンベロープがイベントごとに最初からやり直すので、イベントの先頭からの位置だけで決まる
+typedef struct {
+    uint64_t start;     // イベントの開始位置 (曲の先頭からのサンプル数)
+    uint64_t phase;     // イベントの開始時のフェーズ
+} SynthCheckpoint;
+
+typedef struct {
+    SynthCheckpoint *checkpoints;   // k 番目は k * MML_SEEK_INTERVAL 番目のイベント
+    size_t num_checkpoints;
+    uint64_t length;                // トラックの長さ (サンプル数)
+} SynthTimeIndex;
+
+// MIDIノートナンバーを周波数に変換するヘルパー関数
+double note_to_freq(int note);
+
+// ノートを鳴らすときの1サンプルあたりのフェーズ増分 (固定小数点, 小数部 FRACTIONAL_BITS)
+uint64_t synth_phase_increment(int note, int sample_rate);
+
+// sample_rate 用のノートの表 (初めて使うサンプリングレートならここで作る。どのスレッドから呼んでもよい)
+const SynthNoteTable *synth_note_table(int sample_rate);
+
+// レンダラーを初期化する (イベントの元データとウェーブテーブルは呼び出し側が保持する)
+// 補間方法は環境変数 SYNTH_INTERP (linear / cubic) で選べる。指定がなければ線形補間
+void synth_renderer_init(SynthRenderer *r, MmlEventSource source, const Wavetable *wavetable, int sample_rate);
+
+// 曲の途中から生成を始める場合の初期化 (オフライン書き出しで区間ごとに分けて生成するときに使う)
+// source の最初のイベントを、フェーズ phase から、イベント内の offset サンプル目から始める
+// ノートの途中から始める場合は、エンベロープを offset サンプル分だけ進めておく
+void synth_renderer_init_at(SynthRenderer *r, MmlEventSource source, const Wavetable *wavetable, int sample_rate,
+                            uint64_t phase, uint32_t offset);
+
+// @X で選ぶ音色バンクを設定する (初期化の直後に呼ぶ。バンクは呼び出し側が保持する)
+// バンクにない音色番号のイベントは wavetable で鳴らす
+void synth_renderer_set_bank(SynthRenderer *r, const WavetableBank *bank);
+
+// source (先頭に戻せるもの) を最後まで読んで目次を作る。読み終わった source の位置は元に戻さない
+// 戻り値: 成功なら0, 失敗なら-1
+int synth_time_index_build(SynthTimeIndex *index, MmlEventSource source, int sample_rate);
+
+// 目次を解放する
+void synth_time_index_free(SynthTimeIndex *index);
+
+// 曲の先頭から time サンプル目に移動する (index はこのレンダラーの source から作ったもの)
+// 目次を二分探索して目印まで戻り、そこから最大 MML_SEEK_INTERVAL イベント読み進める
+// 戻り値: 成功なら0, source が位置を変えられなければ-1
+int synth_renderer_seek(SynthRenderer *r, const SynthTimeIndex *index, uint64_t time);
+
+// ノートのキャッシュを設定する (初期化と音色バンクの設定の後に呼ぶ。キャッシュは呼び出し側が保持する)
+// 予算に収まる長さのノートは、ノートの頭で全体を生成してキャッシュに入れ、同じノートはそこからコピーする
+void synth_renderer_set_cache(SynthRenderer *r, NoteCache *cache);
+
+// 最大 frames フレーム分の波形を out に書き込む
+// pan_segments が設定されていれば、イベントの定位が変わる位置も記録する
+// (1ブロックで MIXER_PAN_SEGMENTS 回を超えて変わった分は、ブロックの残りを直前の定位のまま鳴らす)
+// 戻り値: 実際に書き込んだフレーム数 (曲の最後ではframesより少なくなる)
+size_t synth_render_block(SynthRenderer *r, int16_t *out, size_t frames);
+
+// 全てのイベントを生成し終えたかどうか
+int synth_renderer_finished(const SynthRenderer *r);
+
+struct SongRenderer;
+
+// ワーカースレッドに渡す引数 (どのレンダラーのどのトラックを担当するか)
+typedef struct {
+    struct SongRenderer *sr;
+    size_t track;
+} SongTrackWorker;
+
+// 複数トラックの曲を、トラックごとのワーカースレッドで並列に生成してミックスするための状態
+// 1ブロックごとに全トラックが自分のバッファへ生成し、揃ったところでミキサーが合計する
+// (ワーカーがこの構造体を指しているので、初期化後にコピー・移動しないこと)
+typedef struct SongRenderer {
+    size_t num_tracks;
+    SynthRenderer tracks[MML_MAX_TRACKS];       // トラックごとのレンダラー
+    MmlEventCursor cursors[MML_MAX_TRACKS];     // 解析済みの曲から作ったときの配列カーソル
+    MmlProgramCursor programs[MML_MAX_TRACKS];  // 中間表現から作ったときの実行カーソル
+    size_t num_programs;                        // programs のうち使っている数 (目印を解放する分)
+    size_t track_frames[MML_MAX_TRACKS];        // 今回のブロックで各トラックが生成したフレーム数
+    int16_t *track_buffers[MML_MAX_TRACKS];     // トラックごとのブロックバッファ (PERIOD_FRAMES)
+    uint64_t track_ns[MML_MAX_TRACKS];          // トラックごとの生成にかかった時間の通算 (ナノ秒, 計測用)
+
+    // 出力の形式 (song_renderer_set_output で変える。初期値は16bitモノラル)
+    AudioSampleFormat format;
+    int channels;
+    size_t frame_bytes;                         // 1フレームのバイト数
+    MixKernel mix;                              // 形式 x チャンネル数に合わせて選んだミキサー
+    MixPanKernel mix_panned;                    // 2チャンネル以上のときの、定位をつけるミキサー (モノラルならNULL)
+    MixPanSegment pan_segments[MML_MAX_TRACKS][MIXER_PAN_SEGMENTS]; // トラックごとの今回のブロックの定位
+    MixPanInput pan_inputs[MML_MAX_TRACKS];
+
+    // ワーカースレッド (トラック0は呼び出し元のスレッドが担当する)
+    pthread_t workers[MML_MAX_TRACKS];
+    SongTrackWorker worker_args[MML_MAX_TRACKS];
+    pthread_barrier_t block_start;              // ブロック生成開始の合図
+    pthread_barrier_t block_done;               // 全トラックの生成完了の合図
+    pthread_mutex_t start_lock;                 // 全ワーカーを作り終えるまでワーカーを待たせる
+    int threaded;                               // ワーカーが動いているか (0なら全トラックを呼び出し元で生成する)
+    size_t block_frames;                        // 今回のブロックのフレーム数
+    int quit;                                   // ワーカーへの終了要求
+
+    // シークと区間再生
+    SynthTimeIndex indexes[MML_MAX_TRACKS];     // トラックごとの目次 (初めてシークしたときに作る)
+    uint64_t position;                          // 次に生成する位置 (曲の先頭からのサンプル数)
+    uint64_t region_start;                      // 再生区間の先頭
+    uint64_t region_end;                        // 再生区間の終わり (0なら曲の最後まで)
+    int loop;                                   // 区間の終わりで先頭に戻るか
+} SongRenderer;
+
+// 曲のレンダラーを初期化し、トラック数-1個のワーカースレッドを起動する
+// 戻り値: 成功なら0, 失敗なら-1
+int song_renderer_init(SongRenderer *sr, const MmlSong *song, const Wavetable *wavetable, int sample_rate);
+
+// 中間表現の命令列を実行しながら生成する曲のレンダラーを初期化する
+// ループを展開しないので、曲が長くてもメモリは命令列の分だけで済む (program は呼び出し側が保持する)
+int song_renderer_init_program(SongRenderer *sr, const MmlProgram *program, const Wavetable *wavetable, int sample_rate);
+
+// トラックごとのイベントの読み出し口から曲のレンダラーを初期化する
+int song_renderer_init_sources(SongRenderer *sr, const MmlEventSource *sources, size_t num_tracks,
+                               const Wavetable *wavetable, int sample_rate);
+
+// 出力の形式とチャンネル数を設定する (初期化の直後に呼ぶ)
+// 2チャンネル以上ではトラックごとの定位 (pX) で左右に振り分け、3チャンネル目からはモノラルのミックスを書く
+// 戻り値: 成功なら0, 対応していない組み合わせなら-1
+int song_renderer_set_output(SongRenderer *sr, AudioSampleFormat format, int channels);
+
+// 全トラックを最大 frames フレーム分生成し、ミックスして out に書き込む
+// out は song_renderer_set_output で設定した形式のインターリーブ (初期値なら int16_t のモノラル)
+// 戻り値: 実際に書き込んだフレーム数 (一番長いトラックが終わると0になる)
+size_t song_render_block(SongRenderer *sr, void *out, size_t frames);
+
+// 全トラックを生成し終えたかどうか (ループ再生中は終わらない)
+int song_renderer_finished(const SongRenderer *sr);
+
+// 全トラックを曲の先頭から time サンプル目に移動する (ブロックの合間に呼ぶ)
+// 初めて呼んだときだけ目次を作るために曲を一度読む。それ以降は曲の長さに関係なくすぐに終わる
+// 戻り値: 成功なら0, 位置を変えられない読み出し口があれば-1
+int song_renderer_seek(SongRenderer *sr, uint64_t time);
+
+// 再生区間 [start, end) を設定して start に移動する (end が0なら曲の最後まで)
+// loop が0なら end で終わり、1なら end に来るたびに start に戻って繰り返す
+// 戻り値: 成功なら0, 区間が空か位置を変えられなければ-1
+int song_renderer_set_region(SongRenderer *sr, uint64_t start, uint64_t end, int loop);
+
+// 次のブロックから使うウェーブテーブルを差し替える (ブロックの合間に呼ぶ。音は途切れない)
+void song_renderer_set_wavetable(SongRenderer *sr, const Wavetable *wavetable);
+
+// 全トラックに音色バンクを設定する (初期化の直後に呼ぶ)
+void song_renderer_set_bank(SongRenderer *sr, const WavetableBank *bank);
+
+// 全トラックで1つのノートのキャッシュを共有する (set_bank の後に呼ぶ。リアルタイムの再生では使わない)
+void song_renderer_set_cache(SongRenderer *sr, NoteCache *cache);
+
+// ワーカースレッドを止めて、以後は全トラックを song_render_block の呼び出し元で順に生成する
+// ワーカーとの待ち合わせ (バリア) がなくなるので、リアルタイムのスレッドで生成するときは使う前に呼ぶ
+void song_renderer_stop_workers(SongRenderer *sr);
+
+// ワーカースレッドを止めてバッファを解放する
+void song_renderer_destroy(SongRenderer *sr);
+
+#endif // SYNTH_ENGINE_H
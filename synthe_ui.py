@@ -1,8 +1,18 @@
 import os
+import platform
+import socket
+import subprocess
+import time
 import tkinter as tk
 import tkinter.filedialog
 from tkinter import ttk
 
+# --- シンセエンジン(常駐プロセス)の設定 ---
+ENGINE_SOCKET = "/tmp/synthe-2025.sock"
+ENGINE_BINARY = "synth_daemon"
+ENGINE_SOURCES = ["synth_daemon.c", "mml_parser.c", "synth_engine.c", "osc_kernel.c", "envelope.c", "note_cache.c", "mixer.c", "wavetable.c", "wavetable_bank.c", "mml_compiled.c", "audio_output.c", "wav_file.c", "realtime.c", "note_queue.c", "voice_pool.c", "live_input.c"]
+
+
 class AmplitudeEditorApp:
     """
     Tkinterを使用して振幅を編集・表示するアプリケーションクラス。
@@ -30,6 +40,8 @@ class AmplitudeEditorApp:
         # --- インスタンス変数として状態を管理 ---
         self.pos = 0
         self.amp = [0] * self.WAVE_LENGTH
+        # エディタで波形を編集・読み込みしたか (したら再生時にファイルではなく編集中の波形を使う)
+        self.wave_edited = False
 
         # --- UIウィジェットの作成 ---
         # 説明ラベル
@@ -206,6 +218,7 @@ class AmplitudeEditorApp:
         if self.amp[self.pos] < self.AMP_MAX:
             self.amp[self.pos] += 1
             self.draw_amplitudes()
+            self.publish_wavetable()
         else:
             print("click_button_u: これより振幅を上げられません")
         #print(f"pos = {self.pos}, amp[{self.pos}] = {self.amp[self.pos]}")
@@ -217,6 +230,7 @@ class AmplitudeEditorApp:
         if self.amp[self.pos] > self.AMP_MIN:
             self.amp[self.pos] -= 1
             self.draw_amplitudes()
+            self.publish_wavetable()
         else:
             print("click_button_d: これより振幅を下げられません")
         #print(f"pos = {self.pos}, amp[{self.pos}] = {self.amp[self.pos]}")
@@ -269,10 +283,98 @@ class AmplitudeEditorApp:
         print(f"選択された曲: {selected_song}")
         
         # ここで選択された曲に基づいて再生処理を実行する
-        wav_path = f"./wavetables/{self.selected_wav}.txt"
-        mml_path = f"./mmls/{selected_song}.mml"
-        cmd = f'gcc -o hoge sound_test.c mml_parser.c -lm -lasound && ./hoge "{wav_path}" "{mml_path}" &'
-        os.system(cmd)
+        # 常駐しているシンセエンジンにコマンドを送るだけなので、コンパイルや起動は待たない
+        wav_path = os.path.join(self.get_curdir(), "wavetables", f"{self.selected_wav}.txt")
+        mml_path = os.path.join(self.get_curdir(), "mmls", f"{selected_song}.mml")
+        if self.wave_edited:
+            wave_command = "WAVEDATA " + " ".join(str(int(v)) for v in self.amp)
+        else:
+            wave_command = f"WAVETABLE {wav_path}"
+        self.send_engine_commands([wave_command, f"MML {mml_path}", "PLAY"])
+
+    def publish_wavetable(self):
+        """
+        編集中の波形をシンセエンジンに送る。再生中なら止めずに次のブロックから切り替わる。
+        エンジンが起動していなければ何もしない (次の再生時に送られる)。
+        """
+        self.wave_edited = True
+        try:
+            with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+                sock.connect(ENGINE_SOCKET)
+                sock.sendall(("WAVEDATA " + " ".join(str(int(v)) for v in self.amp) + "\n").encode("utf-8"))
+                sock.recv(64)
+        except OSError:
+            pass
+
+    def build_engine(self):
+        """
+        シンセエンジンをビルドする。ソースが実行ファイルより新しい場合だけコンパイルする。
+        """
+        curdir = self.get_curdir()
+        binary = os.path.join(curdir, ENGINE_BINARY)
+        sources = [os.path.join(curdir, f) for f in os.listdir(curdir) if f.endswith(('.c', '.h'))]
+        if os.path.exists(binary) and all(os.path.getmtime(f) <= os.path.getmtime(binary) for f in sources):
+            return True
+        print("シンセエンジンをビルドしています...")
+        cflags = ["-O2"]
+        if platform.machine().startswith("armv7"):
+            # Raspberry Pi (armhf) ではNEON版の発振器カーネルを有効にする
+            cflags += ["-mfpu=neon-vfpv4"]
+        cmd = ["gcc"] + cflags + ["-o", binary] + [os.path.join(curdir, f) for f in ENGINE_SOURCES] + ["-lm", "-lasound", "-lpthread"]
+        return subprocess.call(cmd) == 0
+
+    def start_engine(self):
+        """
+        シンセエンジンが起動していなければ、ビルドしてバックグラウンドで起動する。
+        """
+        if not self.build_engine():
+            print("start_engine: シンセエンジンのビルドに失敗しました")
+            return False
+        subprocess.Popen([os.path.join(self.get_curdir(), ENGINE_BINARY), ENGINE_SOCKET], cwd=self.get_curdir())
+        # ソケットが作られるまで少し待つ
+        for _ in range(50):
+            if os.path.exists(ENGINE_SOCKET):
+                return True
+            time.sleep(0.05)
+        return False
+
+    def send_engine_commands(self, commands):
+        """
+        シンセエンジンにコマンドを順に送り、応答を表示する。
+        """
+        for retry in range(2):
+            try:
+                with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+                    sock.connect(ENGINE_SOCKET)
+                    reader = sock.makefile("r", encoding="utf-8")
+                    for command in commands:
+                        sock.sendall((command + "\n").encode("utf-8"))
+                        reply = reader.readline().strip()
+                        if reply != "OK":
+                            print(f"send_engine_commands: {command} -> {reply}")
+                return True
+            except OSError:
+                # まだ起動していなければ起動してからやり直す
+                if retry == 0 and not self.start_engine():
+                    break
+        print("send_engine_commands: シンセエンジンに接続できません")
+        return False
+
+    def quit_engine(self):
+        """
+        シンセエンジンが起動していれば終了させる。
+        """
+        try:
+            with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+                sock.connect(ENGINE_SOCKET)
+                sock.sendall(b"QUIT\n")
+                sock.recv(64)
+        except OSError:
+            pass
+
+    def on_close(self):
+        self.quit_engine()
+        self.master.destroy()
         
     def load_preset(self, event=None):
         """
@@ -313,6 +415,7 @@ class AmplitudeEditorApp:
                     self.amp = vals
                     break
             self.draw_amplitudes()
+            self.publish_wavetable()
             # ensure pointer in range
             if self.pos >= len(self.amp):
                 self.pos = 0
@@ -391,5 +494,6 @@ if __name__ == "__main__":
     # ウィンドウの作成とアプリケーションの実行
     root = tk.Tk()
     app = AmplitudeEditorApp(root)
+    root.protocol("WM_DELETE_WINDOW", app.on_close)
     root.mainloop()
 
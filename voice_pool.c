@@ -0,0 +1,163 @@
+#include "voice_pool.h"
+#include "mixer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int voice_pool_init(VoicePool *pool, const Wavetable *wavetable, int sample_rate) {
+    const char *interp = getenv("SYNTH_INTERP");
+
+    memset(pool->voices, 0, sizeof(pool->voices));
+    pool->wavetable = wavetable;
+    pool->sample_rate = sample_rate;
+    pool->notes = synth_note_table(sample_rate);
+    pool->interp = (interp && strcmp(interp, "cubic") == 0) ? OSC_INTERP_CUBIC : OSC_INTERP_LINEAR;
+    // MMLの既定のエンベロープで、リリースだけ長めにする
+    mml_default_envelope(&pool->envelope, sample_rate);
+    pool->envelope.release = (uint32_t)((uint64_t)sample_rate * VOICE_RELEASE_MS / 1000);
+    pool->serial = 0;
+    for (int i = 0; i < VOICE_POOL_SIZE; ++i) {
+        pool->buffers[i] = (int16_t *)malloc(PERIOD_FRAMES * sizeof(int16_t));
+        if (!pool->buffers[i]) {
+            fprintf(stderr, "ボイスバッファの確保に失敗しました\n");
+            for (int j = 0; j < i; ++j) {
+                free(pool->buffers[j]);
+                pool->buffers[j] = NULL;
+            }
+            return -1;
+        }
+    }
+    // 使うカーネルをここで決めておく (音声スレッドで初めて選ばないように)
+    osc_kernel_selected();
+    return 0;
+}
+
+// ノートオンで使うボイスを選ぶ
+static Voice *choose_voice(VoicePool *pool, int note) {
+    Voice *quietest_released = NULL;
+    Voice *oldest = NULL;
+
+    for (int i = 0; i < VOICE_POOL_SIZE; ++i) {
+        Voice *v = &pool->voices[i];
+        // 同じ音が鳴っていれば、そのボイスで鳴らし直す (フェーズがつながるのでプチッといわない)
+        if (v->active && v->note == note) {
+            return v;
+        }
+    }
+    for (int i = 0; i < VOICE_POOL_SIZE; ++i) {
+        Voice *v = &pool->voices[i];
+        if (!v->active) {
+            return v;
+        }
+        if (v->released && (!quietest_released || envelope_level(&v->envelope) < envelope_level(&quietest_released->envelope))) {
+            quietest_released = v;
+        }
+        if (!oldest || v->started < oldest->started) {
+            oldest = v;
+        }
+    }
+    return quietest_released ? quietest_released : oldest;
+}
+
+void voice_pool_note_on(VoicePool *pool, int note, int velocity) {
+    Voice *v = choose_voice(pool, note);
+
+    int retrigger = v->active;
+    if (!v->active) {
+        // 空いていたボイスは前の音のフェーズを引き継がない
+        v->osc.phase = 0;
+    }
+    v->active = 1;
+    v->released = 0;
+    v->note = note;
+    v->started = pool->serial++;
+    v->level = pool->notes->levels[note & (SYNTH_NOTE_COUNT - 1)];
+    v->osc.phase_increment = pool->notes->phase_increments[note & (SYNTH_NOTE_COUNT - 1)];
+    v->osc.interp = pool->interp;
+    // ベロシティ127で音量1.0 (小数部 OSC_GAIN_BITS)。ノートオフまでリリースしない
+    // 鳴っていたボイスを使い回すときは、今の音量からアタックして段差 (クリック) を作らない
+    int32_t peak = (int32_t)(((int64_t)(velocity & 0x7f) << OSC_GAIN_BITS) / 127);
+    if (retrigger) {
+        envelope_retrigger(&v->envelope, peak, &pool->envelope, ENVELOPE_HOLD);
+    } else {
+        envelope_start(&v->envelope, peak, &pool->envelope, ENVELOPE_HOLD);
+    }
+}
+
+// ボイスをノートオフ後のリリースに切り替える (今の音量から続けて小さくする)
+static void release_voice(Voice *v) {
+    v->released = 1;
+    envelope_release(&v->envelope);
+}
+
+void voice_pool_note_off(VoicePool *pool, int note) {
+    for (int i = 0; i < VOICE_POOL_SIZE; ++i) {
+        Voice *v = &pool->voices[i];
+        if (v->active && !v->released && v->note == note) {
+            release_voice(v);
+        }
+    }
+}
+
+void voice_pool_all_off(VoicePool *pool) {
+    for (int i = 0; i < VOICE_POOL_SIZE; ++i) {
+        Voice *v = &pool->voices[i];
+        if (v->active && !v->released) {
+            release_voice(v);
+        }
+    }
+}
+
+void voice_pool_set_wavetable(VoicePool *pool, const Wavetable *wavetable) {
+    pool->wavetable = wavetable;
+}
+
+void voice_pool_render(VoicePool *pool, int16_t *out, size_t frames) {
+    const int16_t *inputs[VOICE_POOL_SIZE];
+    size_t num_inputs = 0;
+
+    if (frames > PERIOD_FRAMES) {
+        frames = PERIOD_FRAMES;
+    }
+    for (int i = 0; i < VOICE_POOL_SIZE; ++i) {
+        Voice *v = &pool->voices[i];
+        if (!v->active) {
+            continue;
+        }
+        // エンベロープが鳴り終わったら空きに戻す (押したままの音もサステインが0なら減衰しきって止まる)
+        if (envelope_finished(&v->envelope)) {
+            v->active = 0;
+            continue;
+        }
+        const int16_t *table = wavetable_level(pool->wavetable, v->level);
+        int16_t *buf = pool->buffers[i];
+        size_t done = 0;
+        while (done < frames && !envelope_finished(&v->envelope)) {
+            size_t n = envelope_apply(&v->envelope, &v->osc, frames - done);
+            osc_render(&v->osc, table, buf + done, n);
+            envelope_advance(&v->envelope, n);
+            done += n;
+        }
+        memset(buf + done, 0, (frames - done) * sizeof(int16_t));
+        inputs[num_inputs++] = buf;
+    }
+    // 鳴っているボイスがなければ mix_saturate は無音を書き込む
+    mix_saturate(out, inputs, num_inputs, frames);
+}
+
+size_t voice_pool_active(const VoicePool *pool) {
+    size_t n = 0;
+    for (int i = 0; i < VOICE_POOL_SIZE; ++i) {
+        if (pool->voices[i].active) {
+            ++n;
+        }
+    }
+    return n;
+}
+
+void voice_pool_destroy(VoicePool *pool) {
+    for (int i = 0; i < VOICE_POOL_SIZE; ++i) {
+        free(pool->buffers[i]);
+        pool->buffers[i] = NULL;
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef VOICE_POOL_H
+#define VOICE_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "envelope.h"
+#include "osc_kernel.h"
+#include "synth_engine.h"
+#include "wavetable.h"
+
+// ライブ演奏用の発音 (ボイス) の集まり
+// ボイスと生成用のバッファは最初に全部確保しておき、ノートオンでは空いているボイスを選ぶだけにする
+// 空きがなければ、ノートオフ済みで一番小さい音のボイス、それもなければ一番古いボイスを奪う
+
+#define VOICE_POOL_SIZE         16          // 同時に鳴らせる音の数
+#define VOICE_RELEASE_MS        100         // ノートオフ後に消えるまでの時間
+
+typedef struct {
+    int active;             // 鳴っているか
+    int released;           // ノートオフ済みか
+    int note;               // MIDIノートナンバー
+    uint64_t started;       // ノートオンの通し番号 (小さいほど古い)
+    int level;              // 音の高さに合わせて選んだ帯域制限済みのテーブルの段
+    OscState osc;           // 発振器の状態
+    Envelope envelope;      // 音量エンベロープ (リリースし終わったら空きに戻す)
+} Voice;
+
+typedef struct {
+    Voice voices[VOICE_POOL_SIZE];
+    int16_t *buffers[VOICE_POOL_SIZE];  // ボイスごとのブロックバッファ (PERIOD_FRAMES)
+    const Wavetable *wavetable;         // 使用するウェーブテーブル
+    int sample_rate;
+    const SynthNoteTable *notes;        // sample_rate 用のノートの表
+    int interp;                         // 補間方法 (OSC_INTERP_*)
+    MmlEnvelope envelope;               // ノートオンで使うエンベロープ
+    uint64_t serial;                    // 次のノートオンの通し番号
+} VoicePool;
+
+// ボイスとバッファを確保する (補間方法は SynthRenderer と同じく環境変数 SYNTH_INTERP で選ぶ)
+// 戻り値: 成功なら0, 失敗なら-1
+int voice_pool_init(VoicePool *pool, const Wavetable *wavetable, int sample_rate);
+
+// ノートオン / ノートオフ / 全部止める (どれもメモリを確保しない)
+void voice_pool_note_on(VoicePool *pool, int note, int velocity);
+void voice_pool_note_off(VoicePool *pool, int note);
+void voice_pool_all_off(VoicePool *pool);
+
+// 次のブロックから使うウェーブテーブルを差し替える (ブロックの合間に呼ぶ)
+void voice_pool_set_wavetable(VoicePool *pool, const Wavetable *wavetable);
+
+// 鳴っているボイスを frames フレーム分 (PERIOD_FRAMES以下) 生成してミックスし、out に書き込む
+void voice_pool_render(VoicePool *pool, int16_t *out, size_t frames);
+
+// 鳴っているボイスの数
+size_t voice_pool_active(const VoicePool *pool);
+
+void voice_pool_destroy(VoicePool *pool);
+
+#endif // VOICE_POOL_H
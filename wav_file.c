@@ -0,0 +1,34 @@
+#include "wav_file.h"
+#include <string.h>
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+void wav_build_header(uint8_t *out, int format_tag, int channels, int sample_rate, int bits_per_sample, uint32_t data_bytes) {
+    uint16_t block_align = (uint16_t)(channels * bits_per_sample / 8);
+
+    memcpy(out, "RIFF", 4);
+    put_u32(out + 4, WAV_HEADER_SIZE - 8 + data_bytes);
+    memcpy(out + 8, "WAVE", 4);
+
+    memcpy(out + 12, "fmt ", 4);
+    put_u32(out + 16, 16);                                  // fmt チャンクの長さ
+    put_u16(out + 20, (uint16_t)format_tag);                // 形式 (WAV_FORMAT_*)
+    put_u16(out + 22, (uint16_t)channels);
+    put_u32(out + 24, (uint32_t)sample_rate);
+    put_u32(out + 28, (uint32_t)sample_rate * block_align); // 1秒あたりのバイト数
+    put_u16(out + 32, block_align);
+    put_u16(out + 34, (uint16_t)bits_per_sample);
+
+    memcpy(out + 36, "data", 4);
+    put_u32(out + 40, data_bytes);
+}
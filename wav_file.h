@@ -0,0 +1,32 @@
+#ifndef WAV_FILE_H
+#define WAV_FILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// RIFF/WAVファイルのヘッダ (sound_testcpp.cpp が読むのと同じ並び)
+//   'RIFF' <全体の長さ-8> 'WAVE'
+//   'fmt ' 16 <形式=1(PCM)> <チャンネル数> <サンプリングレート> <1秒あたりのバイト数> <ブロックサイズ> <ビット数>
+//   'data' <波形データのバイト数> <波形データ...>
+#define WAV_HEADER_SIZE 44
+
+// fmt チャンクの形式
+#define WAV_FORMAT_PCM          1       // 整数のPCM
+#define WAV_FORMAT_IEEE_FLOAT   3       // 浮動小数点のPCM
+#define WAV_FORMAT_EXTENSIBLE   0xFFFE  // 実際の形式はサブフォーマットGUIDの先頭に入っている
+
+// data チャンクに書ける最大のバイト数 (長さが32bitなので約4GB)
+#define WAV_MAX_DATA_BYTES (0xFFFFFFFFu - (WAV_HEADER_SIZE - 8))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ヘッダを out (WAV_HEADER_SIZE バイト) に書き込む (値はリトルエンディアン)
+void wav_build_header(uint8_t *out, int format_tag, int channels, int sample_rate, int bits_per_sample, uint32_t data_bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WAV_FILE_H
@@ -0,0 +1,196 @@
+#include "wavetable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <complex.h>
+
+// FILE_TABLE_SIZE 個の値を1周期として、TABLE_SIZE 個に引き伸ばして table に書く
+// (-DTABLE_BITS で大きいテーブルにしても、ファイルの波形は1周期のまま。各点の値をそのまま伸ばす)
+static void stretch_to_table(const int16_t *loaded, int16_t *table) {
+    for (int i = 0; i < TABLE_SIZE; ++i) {
+        table[i] = loaded[(long)i * FILE_TABLE_SIZE / TABLE_SIZE];
+    }
+}
+
+// テキストファイルから波形数値列を読み込む関数
+int load_wavetable_from_file(const char *filename, int16_t *table) {
+    FILE *fp = fopen(filename, "r");
+    if (!fp) {
+        fprintf(stderr, "ファイルを開けません: %s\n", filename);
+        return -1;
+    }
+    // 途中で失敗しても元のテーブルを壊さないように、一旦ローカルに読み込む
+    int16_t loaded[FILE_TABLE_SIZE];
+    for (int i = 0; i < FILE_TABLE_SIZE; ++i) {
+        int value;
+        if (fscanf(fp, "%d", &value) != 1) {
+            fprintf(stderr, "ウェーブテーブルの読み込みに失敗しました。\n");
+            fclose(fp);
+            return -1;
+        }
+        loaded[i] = (int16_t)(value * INC_AMPLITUDE); // 振幅を増加
+    }
+    fclose(fp);
+
+    // FILE_TABLE_SIZEからTABLE_SIZEに適応するよう引き伸ばす
+    stretch_to_table(loaded, table);
+    return 0;
+}
+
+int parse_wavetable_values(const char *text, int16_t *table) {
+    int16_t loaded[FILE_TABLE_SIZE];
+    const char *p = text;
+    for (int i = 0; i < FILE_TABLE_SIZE; ++i) {
+        char *end;
+        long value = strtol(p, &end, 10);
+        if (end == p) {
+            fprintf(stderr, "ウェーブテーブルの読み込みに失敗しました。\n");
+            return -1;
+        }
+        loaded[i] = (int16_t)(value * INC_AMPLITUDE); // 振幅を増加
+        p = end;
+    }
+    stretch_to_table(loaded, table);
+    return 0;
+}
+
+// 基数2のFFT (n は2のべき乗, inverse なら逆変換。正規化はしない)
+static void fft(double complex *x, int n, int inverse) {
+    // ビット反転の並べ替え
+    for (int i = 1, j = 0; i < n; ++i) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            double complex t = x[i];
+            x[i] = x[j];
+            x[j] = t;
+        }
+    }
+    // バタフライ演算
+    for (int len = 2; len <= n; len <<= 1) {
+        double angle = 2.0 * M_PI / len * (inverse ? 1.0 : -1.0);
+        double complex w_len = cos(angle) + I * sin(angle);
+        for (int i = 0; i < n; i += len) {
+            double complex w = 1.0;
+            for (int k = 0; k < len / 2; ++k) {
+                double complex u = x[i + k];
+                double complex v = x[i + k + len / 2] * w;
+                x[i + k] = u + v;
+                x[i + k + len / 2] = u - v;
+                w *= w_len;
+            }
+        }
+    }
+}
+
+// テーブル1段分の内容のハッシュ (FNV-1a 64bit)
+static uint64_t level_hash(const int16_t *table) {
+    const uint8_t *p = (const uint8_t *)table;
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < MIP_TABLE_SIZE * sizeof(int16_t); ++i) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+void wavetable_build(Wavetable *wt, const int16_t *source) {
+    double complex spectrum[TABLE_SIZE];
+    double complex work[MIP_TABLE_SIZE];
+
+    for (int i = 0; i < TABLE_SIZE; ++i) {
+        wt->source[i] = source[i];
+        spectrum[i] = source[i];
+    }
+    fft(spectrum, TABLE_SIZE, 0);
+
+    for (int level = 0; level < MIP_LEVELS; ++level) {
+        int max_harmonic = MIP_MAX_HARMONIC >> level;
+
+        // 上限までの倍音だけを、細かいテーブル用のスペクトルに置き直す
+        for (int k = 0; k < MIP_TABLE_SIZE; ++k) {
+            work[k] = 0.0;
+        }
+        work[0] = spectrum[0]; // 直流成分はそのまま残す
+        for (int k = 1; k <= max_harmonic && k < TABLE_SIZE / 2; ++k) {
+            work[k] = spectrum[k];
+            work[MIP_TABLE_SIZE - k] = spectrum[TABLE_SIZE - k];
+        }
+        if (max_harmonic >= TABLE_SIZE / 2) {
+            // 元のテーブルのナイキスト成分は正負の周波数に半分ずつ分ける
+            work[TABLE_SIZE / 2] = spectrum[TABLE_SIZE / 2] * 0.5;
+            work[MIP_TABLE_SIZE - TABLE_SIZE / 2] = spectrum[TABLE_SIZE / 2] * 0.5;
+        }
+        fft(work, MIP_TABLE_SIZE, 1);
+
+        // 実部を16bitに戻して格納 (ギブス現象で元より少し大きくなる分は飽和させる)
+        int16_t *table = wt->levels[level] + MIP_GUARD_BEFORE;
+        for (int i = 0; i < MIP_TABLE_SIZE; ++i) {
+            double v = round(creal(work[i]) / TABLE_SIZE);
+            if (v > INT16_MAX) v = INT16_MAX;
+            if (v < INT16_MIN) v = INT16_MIN;
+            table[i] = (int16_t)v;
+        }
+        // 補間で範囲外を読まなくて済むように、前後に折り返した点を置く
+        for (int i = 1; i <= MIP_GUARD_BEFORE; ++i) {
+            table[-i] = table[MIP_TABLE_SIZE - i];
+        }
+        for (int i = 0; i < MIP_GUARD_AFTER; ++i) {
+            table[MIP_TABLE_SIZE + i] = table[i];
+        }
+        wt->hashes[level] = level_hash(table);
+    }
+}
+
+const int16_t *wavetable_level(const Wavetable *wt, int level) {
+    return wt->levels[level] + MIP_GUARD_BEFORE;
+}
+
+uint64_t wavetable_level_hash(const Wavetable *wt, int level) {
+    return wt->hashes[level];
+}
+
+int wavetable_select_level(double cycles_per_sample) {
+    // 最大の倍音がナイキスト周波数 (0.5周期/サンプル) を超えない一番細かいレベル
+    for (int level = 0; level < MIP_LEVELS; ++level) {
+        if ((MIP_MAX_HARMONIC >> level) * cycles_per_sample <= 0.5) {
+            return level;
+        }
+    }
+    return MIP_LEVELS - 1;
+}
+
+void wavetable_swap_init(WavetableSwap *swap, const int16_t *source) {
+    wavetable_build(&swap->tables[0], source);
+    atomic_init(&swap->published, 0);
+    atomic_init(&swap->reading, -1);
+}
+
+void wavetable_swap_publish(WavetableSwap *swap, const int16_t *source) {
+    int next = 1 - atomic_load(&swap->published);
+    // 音声スレッドがまだ前のブロックでこちらを読んでいたら、手放すまで待つ
+    while (atomic_load(&swap->reading) == next) {
+        nanosleep(&(struct timespec){0, 1000000}, NULL);
+    }
+    wavetable_build(&swap->tables[next], source);
+    atomic_store(&swap->published, next);
+}
+
+const Wavetable *wavetable_swap_acquire(WavetableSwap *swap) {
+    int current;
+    // 読む番号を知らせた後で、その間に公開し直されていないか確かめる
+    // (公開し直されていたら、書き込み側がもう片方を書き換え始めているかもしれないので取り直す)
+    do {
+        current = atomic_load(&swap->published);
+        atomic_store(&swap->reading, current);
+    } while (atomic_load(&swap->published) != current);
+    return &swap->tables[current];
+}
+
+void wavetable_swap_release(WavetableSwap *swap) {
+    atomic_store(&swap->reading, -1);
+}
@@ -0,0 +1,94 @@
+#ifndef WAVETABLE_H
+#define WAVETABLE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// テーブルの大きさはビルド時に -DTABLE_BITS=n (5 ~ 12, 32 ~ 4096点) で変えられる
+// 発振器のカーネルは大きさを定数として使うので、どの大きさでも位置の計算はシフトとマスクだけになる
+#ifndef TABLE_BITS
+#define TABLE_BITS         5    // ウェーブテーブルのサイズのビット数
+#endif
+#define TABLE_SIZE        (1 << TABLE_BITS) // ウェーブテーブルのサイズ (2のべき乗)
+#define INC_AMPLITUDE   4096    // 増分用振幅
+#ifndef FILE_TABLE_SIZE
+#define FILE_TABLE_SIZE   32    // ファイルから読み込むウェーブテーブルのサイズ (TABLE_SIZE に引き伸ばす)
+#endif
+
+#if TABLE_BITS < 5 || TABLE_BITS > 12
+#error "TABLE_BITS は 5 ~ 12 で指定してください"
+#endif
+#if FILE_TABLE_SIZE < 1 || FILE_TABLE_SIZE > TABLE_SIZE
+#error "FILE_TABLE_SIZE は 1 ~ TABLE_SIZE で指定してください"
+#endif
+
+// --- 固定小数点演算のための設定 ---
+// フェーズアキュムレータの小数部として使うビット数
+// フェーズの整数部は TABLE_SIZE を1周期とする位置を表す
+#define FRACTIONAL_BITS 32
+
+// --- 帯域制限したウェーブテーブル (ミップマップ) の設定 ---
+// 読み込んだ波形から、1オクターブごとに倍音を半分ずつ減らしたコピーを作っておく
+// 高い音ほど倍音の少ないコピーを使うので、折り返しノイズが出ない
+// 各コピーは補間するので元の8倍の細かさにする (大きいテーブルでは8192点まで)
+#if TABLE_BITS + 3 <= 13
+#define MIP_TABLE_BITS    (TABLE_BITS + 3)          // 各コピーのサイズのビット数
+#else
+#define MIP_TABLE_BITS    13
+#endif
+#define MIP_TABLE_SIZE    (1 << MIP_TABLE_BITS)     // 各コピーのサイズ
+#define MIP_MAX_HARMONIC  (TABLE_SIZE / 2)          // 元の波形が持てる最大の倍音
+#define MIP_LEVELS        TABLE_BITS                // 倍音の上限を半分ずつにした段階 (32点なら 16, 8, 4, 2, 1 の5段階)
+#define MIP_GUARD_BEFORE  1                         // 補間用に先頭の前に置く点の数
+#define MIP_GUARD_AFTER   2                         // 補間用に末尾の後ろに置く点の数
+
+// 読み込み済みのウェーブテーブル (元の波形と、帯域制限したコピー)
+typedef struct {
+    int16_t source[TABLE_SIZE];
+    int16_t levels[MIP_LEVELS][MIP_GUARD_BEFORE + MIP_TABLE_SIZE + MIP_GUARD_AFTER];
+    uint64_t hashes[MIP_LEVELS];    // 各コピーの内容のハッシュ (作ったときに一度だけ計算する。ノートのキャッシュのキー)
+} Wavetable;
+
+// テキストファイルから波形数値列を読み込み、table (TABLE_SIZE個) に格納する関数
+// 戻り値: 成功なら0, 失敗なら-1 (失敗時はtableを書き換えない)
+int load_wavetable_from_file(const char *filename, int16_t *table);
+
+// 空白区切りの波形数値列 (ファイルと同じ形式) を読み取り、table (TABLE_SIZE個) に格納する関数
+// 戻り値: 成功なら0, 失敗なら-1 (失敗時はtableを書き換えない)
+int parse_wavetable_values(const char *text, int16_t *table);
+
+// 元の波形 (TABLE_SIZE個) から帯域制限したコピーを作る (読み込み時に一度だけ呼ぶ)
+// FFTで倍音に分解し、レベルごとに上限より上の倍音を捨ててから逆FFTする
+void wavetable_build(Wavetable *wt, const int16_t *source);
+
+// レベル level のコピーの先頭 (前後にガード点があるので [-1] から [MIP_TABLE_SIZE+1] まで読める)
+const int16_t *wavetable_level(const Wavetable *wt, int level);
+
+// レベル level のコピーの内容のハッシュ (同じ波形なら同じ値。編集中の波形が変われば変わる)
+uint64_t wavetable_level_hash(const Wavetable *wt, int level);
+
+// 1サンプルあたりの周期数 (周波数 / サンプリングレート) から、折り返さないレベルを選ぶ
+int wavetable_select_level(double cycles_per_sample);
+
+// --- 再生を止めずにウェーブテーブルを差し替えるためのダブルバッファ ---
+// 書き込み側 (コマンドを受けるスレッド, 1つだけ) は使われていない方に新しいテーブルを作ってから公開し、
+// 読み出し側 (音声スレッド) はブロックの先頭で最新の方を取り、ブロックの最後に手放す
+// 読み出し側はロックも待ちもしない。書き込み側は、読み出し中のバッファを書き換えないように
+// 最大1ブロック分だけ待つことがある
+typedef struct {
+    Wavetable tables[2];
+    atomic_int published;   // 最新のテーブルの番号
+    atomic_int reading;     // 音声スレッドが読んでいるテーブルの番号 (-1: 読んでいない)
+} WavetableSwap;
+
+// 元の波形 source で初期化する
+void wavetable_swap_init(WavetableSwap *swap, const int16_t *source);
+
+// 新しい波形を公開する (次に acquire したブロックから使われる)
+void wavetable_swap_publish(WavetableSwap *swap, const int16_t *source);
+
+// 最新のテーブルを取る / 手放す (音声スレッドから呼ぶ)
+const Wavetable *wavetable_swap_acquire(WavetableSwap *swap);
+void wavetable_swap_release(WavetableSwap *swap);
+
+#endif // WAVETABLE_H
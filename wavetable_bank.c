@@ -0,0 +1,277 @@
+#include "wavetable_bank.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// 元の *.wtx の情報 (これが変わっていなければ bank.wtb を作り直さない)
+typedef struct {
+    char file[WAVETABLE_BANK_NAME_MAX + sizeof(WAVETABLE_BANK_EXTENSION)];
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} BankSource;
+
+static size_t align_up(size_t n) {
+    return (n + WAVETABLE_BANK_ALIGN - 1) & ~(size_t)(WAVETABLE_BANK_ALIGN - 1);
+}
+
+// FNV-1a 64bit ハッシュ (h に続けて data を混ぜる)
+static uint64_t fnv1a(uint64_t h, const void *data, size_t size) {
+    const uint8_t *p = (const uint8_t *)data;
+    for (size_t i = 0; i < size; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// UIの一覧 (Pythonの sorted) と同じく、ファイル名のバイト列の順に並べる
+static int compare_sources(const void *a, const void *b) {
+    return strcmp(((const BankSource *)a)->file, ((const BankSource *)b)->file);
+}
+
+// dir の *.wtx をファイル名の順に一覧にする
+// 戻り値: mallocした配列 (使い終わったらfreeする), 失敗時はNULL
+static BankSource *list_sources(const char *dir, size_t *out_count) {
+    DIR *dp = opendir(dir);
+    if (!dp) {
+        fprintf(stderr, "音色のディレクトリを開けません: %s\n", dir);
+        return NULL;
+    }
+    size_t capacity = 16;
+    size_t count = 0;
+    BankSource *sources = (BankSource *)malloc(capacity * sizeof(BankSource));
+    size_t ext_len = strlen(WAVETABLE_BANK_EXTENSION);
+    struct dirent *ent;
+
+    while (sources && (ent = readdir(dp)) != NULL) {
+        size_t len = strlen(ent->d_name);
+        if (len <= ext_len || strcmp(ent->d_name + len - ext_len, WAVETABLE_BANK_EXTENSION) != 0) {
+            continue;
+        }
+        if (len - ext_len >= WAVETABLE_BANK_NAME_MAX) {
+            fprintf(stderr, "音色の名前が長すぎるので読み飛ばします: %s\n", ent->d_name);
+            continue;
+        }
+        char path[4096];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (count >= capacity) {
+            capacity *= 2;
+            BankSource *grown = (BankSource *)realloc(sources, capacity * sizeof(BankSource));
+            if (!grown) {
+                free(sources);
+                sources = NULL;
+                break;
+            }
+            sources = grown;
+        }
+        memcpy(sources[count].file, ent->d_name, len + 1);
+        sources[count].size = (uint64_t)st.st_size;
+        sources[count].mtime_sec = (int64_t)st.st_mtim.tv_sec;
+        sources[count].mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+        count++;
+    }
+    closedir(dp);
+    if (!sources) {
+        fprintf(stderr, "メモリが足りません\n");
+        return NULL;
+    }
+
+    qsort(sources, count, sizeof(BankSource), compare_sources);
+    if (count > WAVETABLE_BANK_MAX) {
+        fprintf(stderr, "音色が多すぎます (最大%d)。残りは無視します\n", WAVETABLE_BANK_MAX);
+        count = WAVETABLE_BANK_MAX;
+    }
+    *out_count = count;
+    return sources;
+}
+
+static uint64_t hash_sources(const BankSource *sources, size_t count) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < count; ++i) {
+        h = fnv1a(h, sources[i].file, strlen(sources[i].file) + 1);
+        h = fnv1a(h, &sources[i].size, sizeof(sources[i].size));
+        h = fnv1a(h, &sources[i].mtime_sec, sizeof(sources[i].mtime_sec));
+        h = fnv1a(h, &sources[i].mtime_nsec, sizeof(sources[i].mtime_nsec));
+    }
+    return h;
+}
+
+// *.wtx を全部読み込んで帯域制限したテーブルを作り、bank.wtb の内容をメモリ上に作る
+// (テーブルを境界にそろえるので、領域の先頭も WAVETABLE_BANK_ALIGN にそろえて確保する)
+static void *build_image(const char *dir, const BankSource *sources, size_t count, uint64_t hash, size_t *out_size) {
+    size_t stride = align_up(sizeof(Wavetable));
+    size_t tables_offset = align_up(sizeof(WavetableBankHeader));
+    size_t size = tables_offset + count * stride;
+    void *image;
+
+    if (posix_memalign(&image, WAVETABLE_BANK_ALIGN, size) != 0) {
+        return NULL;
+    }
+    memset(image, 0, size);
+    WavetableBankHeader *header = (WavetableBankHeader *)image;
+    memcpy(header->magic, WAVETABLE_BANK_MAGIC, 4);
+    header->version = WAVETABLE_BANK_VERSION;
+    header->source_hash = hash;
+    header->table_size = (uint32_t)sizeof(Wavetable);
+    header->table_stride = (uint32_t)stride;
+    header->num_tables = (uint32_t)count;
+    header->tables_offset = tables_offset;
+
+    size_t ext_len = strlen(WAVETABLE_BANK_EXTENSION);
+    for (size_t i = 0; i < count; ++i) {
+        char path[4096];
+        int16_t source[TABLE_SIZE];
+        snprintf(path, sizeof(path), "%s/%s", dir, sources[i].file);
+        if (load_wavetable_from_file(path, source) != 0) {
+            // 1つ壊れていても他の音色は使えるように、その音色だけ無音にする
+            fprintf(stderr, "音色を読み込めないので無音にします: %s\n", path);
+            memset(source, 0, sizeof(source));
+        }
+        size_t name_len = strlen(sources[i].file) - ext_len;
+        memcpy(header->names[i], sources[i].file, name_len);
+        header->names[i][name_len] = '\0';
+        wavetable_build((Wavetable *)((uint8_t *)image + tables_offset + i * stride), source);
+    }
+    *out_size = size;
+    return image;
+}
+
+// テーブルの位置がファイルの範囲に収まっているか確認する
+static int image_is_valid(const void *image, size_t size) {
+    const WavetableBankHeader *h = (const WavetableBankHeader *)image;
+    if (size < sizeof(WavetableBankHeader) || memcmp(h->magic, WAVETABLE_BANK_MAGIC, 4) != 0
+        || h->version != WAVETABLE_BANK_VERSION || h->table_size != sizeof(Wavetable)) {
+        return 0;
+    }
+    if (h->table_stride < h->table_size || h->table_stride % WAVETABLE_BANK_ALIGN != 0
+        || h->tables_offset % WAVETABLE_BANK_ALIGN != 0 || h->num_tables > WAVETABLE_BANK_MAX) {
+        return 0;
+    }
+    return h->tables_offset + (uint64_t)h->num_tables * h->table_stride <= size;
+}
+
+// 読み込んだ内容から音色番号ごとのテーブルの一覧を作る
+static void attach_image(WavetableBank *bank, const void *image, size_t size) {
+    const WavetableBankHeader *h = (const WavetableBankHeader *)image;
+    bank->header = h;
+    bank->size = size;
+    for (uint32_t i = 0; i < h->num_tables; ++i) {
+        bank->tables[i] = (const Wavetable *)((const uint8_t *)image + h->tables_offset + (size_t)i * h->table_stride);
+    }
+}
+
+// bank.wtb をmmapする。*.wtx と一致しなければ -1
+static int map_bank(WavetableBank *bank, const char *path, uint64_t hash) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    if (!image_is_valid(map, (size_t)st.st_size) || ((const WavetableBankHeader *)map)->source_hash != hash) {
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+    bank->map = map;
+    attach_image(bank, map, (size_t)st.st_size);
+    return 0;
+}
+
+// 書き込み途中のファイルを読まれないように、一時ファイルに書いてから置き換える
+static int write_bank(const char *path, const void *image, size_t size) {
+    char tmp_path[4096 + 32];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp%d", path, (int)getpid());
+    FILE *fp = fopen(tmp_path, "wb");
+    if (!fp) {
+        return -1;
+    }
+    size_t written = fwrite(image, 1, size, fp);
+    if (fclose(fp) != 0 || written != size || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+int wavetable_bank_open(WavetableBank *bank, const char *dir) {
+    char path[4096];
+    size_t count = 0;
+
+    memset(bank, 0, sizeof(*bank));
+    BankSource *sources = list_sources(dir, &count);
+    if (!sources) {
+        return -1;
+    }
+    uint64_t hash = hash_sources(sources, count);
+    snprintf(path, sizeof(path), "%s/%s", dir, WAVETABLE_BANK_FILE);
+
+    // *.wtx と一致する bank.wtb があれば、mmapするだけで終わり
+    if (map_bank(bank, path, hash) == 0) {
+        free(sources);
+        return 0;
+    }
+
+    // 無いか古い場合は作り直す
+    size_t size = 0;
+    void *image = build_image(dir, sources, count, hash, &size);
+    free(sources);
+    if (!image) {
+        fprintf(stderr, "メモリが足りません\n");
+        return -1;
+    }
+
+    // 保存できれば次回からはmmapで読めるようになる
+    if (write_bank(path, image, size) == 0 && map_bank(bank, path, hash) == 0) {
+        free(image);
+        return 0;
+    }
+    // 保存できない場所 (読み込み専用など) なら、メモリ上のデータをそのまま使う
+    fprintf(stderr, "音色バンクを保存できません: %s\n", path);
+    bank->owned = image;
+    attach_image(bank, image, size);
+    return 0;
+}
+
+void wavetable_bank_close(WavetableBank *bank) {
+    if (bank->map) {
+        munmap(bank->map, bank->size);
+    }
+    free(bank->owned);
+    memset(bank, 0, sizeof(*bank));
+}
+
+size_t wavetable_bank_count(const WavetableBank *bank) {
+    return bank->header ? bank->header->num_tables : 0;
+}
+
+const char *wavetable_bank_name(const WavetableBank *bank, int instrument) {
+    if (!wavetable_bank_get(bank, instrument)) {
+        return NULL;
+    }
+    return bank->header->names[instrument];
+}
+
+const Wavetable *wavetable_bank_get(const WavetableBank *bank, int instrument) {
+    if (!bank || instrument < 0 || instrument >= WAVETABLE_BANK_MAX) {
+        return NULL;
+    }
+    return bank->tables[instrument];
+}
@@ -0,0 +1,64 @@
+#ifndef WAVETABLE_BANK_H
+#define WAVETABLE_BANK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "wavetable.h"
+
+// 音色バンク (MMLの @X で切り替えるウェーブテーブルの集まり)
+// ディレクトリ内の *.wtx を全部読み込み、帯域制限済みのテーブルにしてから1つのバイナリ (bank.wtb) にまとめて保存する
+// 次回からは bank.wtb をmmapするだけなので、起動時にファイルを読み直したりFFTをやり直したりしない
+// 曲の途中で音色を変えても、テーブルを指すポインタが変わるだけでファイルの読み込みは起きない
+//
+// 音色番号は *.wtx のファイル名の順 (UIの一覧と同じ並び) で、先頭が @0
+// テーブルはキャッシュラインの境界にそろえて隙間なく並べる (ファイルは実行しているマシンのバイト順で書く)
+
+#define WAVETABLE_BANK_DIR          "wavetables"
+#define WAVETABLE_BANK_FILE         "bank.wtb"
+#define WAVETABLE_BANK_EXTENSION    ".wtx"
+#define WAVETABLE_BANK_MAGIC        "WTBK"
+#define WAVETABLE_BANK_VERSION      1
+#define WAVETABLE_BANK_MAX          128     // 音色の数の上限 (@0 ~ @127)
+#define WAVETABLE_BANK_NAME_MAX     64      // 音色の名前 (拡張子を除いたファイル名) の最大長
+#define WAVETABLE_BANK_ALIGN        64      // テーブルの先頭をそろえる境界 (キャッシュラインの大きさ)
+
+// ファイルの先頭
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t source_hash;       // 元の *.wtx の名前・サイズ・更新時刻のハッシュ (FNV-1a)
+    uint32_t table_size;        // sizeof(Wavetable) (テーブルの形が変わったら作り直す)
+    uint32_t table_stride;      // テーブルの間隔 (WAVETABLE_BANK_ALIGN の倍数)
+    uint32_t num_tables;
+    uint32_t reserved;
+    uint64_t tables_offset;     // 最初のテーブルの位置 (ファイル先頭からのバイト数)
+    char names[WAVETABLE_BANK_MAX][WAVETABLE_BANK_NAME_MAX];
+} WavetableBankHeader;
+
+// 読み込んだ音色バンク (全部0なら空のバンク)
+typedef struct {
+    const WavetableBankHeader *header;
+    const Wavetable *tables[WAVETABLE_BANK_MAX];    // 音色番号ごとのテーブル (ないものはNULL)
+    void *map;              // mmapした領域 (ファイルに書けなかったときはNULL)
+    void *owned;            // ファイルに書けなかったときにメモリ上に作ったデータ
+    size_t size;
+} WavetableBank;
+
+// dir の音色バンクを開く
+// bank.wtb が *.wtx と一致していればmmapするだけ、古い・無い場合は作り直して保存する
+// 戻り値: 成功なら0, 失敗なら-1 (失敗しても bank は空のバンクとして使える)
+int wavetable_bank_open(WavetableBank *bank, const char *dir);
+
+// 閉じる (mmapの解除・メモリの解放。閉じた後は空のバンクになる)
+void wavetable_bank_close(WavetableBank *bank);
+
+// 音色の数
+size_t wavetable_bank_count(const WavetableBank *bank);
+
+// 音色の名前 (ない場合はNULL)
+const char *wavetable_bank_name(const WavetableBank *bank, int instrument);
+
+// 音色番号のテーブル (bank がNULLか、その番号の音色がない場合はNULL)
+const Wavetable *wavetable_bank_get(const WavetableBank *bank, int instrument);
+
+#endif // WAVETABLE_BANK_H